@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include "aggregate.h"
+#include "serialAlloc.h"
+#include "serialSimd.h"
+
+
+static uint32_t sampleSize(agg_sample_t type)
+{
+    return type == AGG_SAMPLE_INT16 ? 2 : 4;
+}
+
+
+uint32_t aggregateRecordSize(uint32_t channels)
+{
+    return (uint32_t)(offsetof(agg_record_t, channels) + channels * sizeof(agg_channel_t));
+}
+
+
+static void resetWindow(aggregate_t *agg)
+{
+    agg->frames = 0;
+
+    for (uint32_t c = 0; c < agg->config.channels; c++)
+    {
+        agg->sum[c] = 0;
+        agg->sumSquares[c] = 0;
+        agg->min[c] = INFINITY;
+        agg->max[c] = -INFINITY;
+    }
+
+    memset(agg->histogram, 0, (size_t)agg->config.channels * AGG_HISTOGRAM_BINS * sizeof(uint32_t));
+}
+
+
+serial_port_err_t aggregateInit(aggregate_t *agg, const agg_config_t *config)
+{
+    memset(agg, 0, sizeof(*agg));
+
+    if (config->channels == 0 || config->channels > AGG_MAX_CHANNELS || config->window == 0 ||
+        config->percentileCount > AGG_MAX_PERCENTILES || !(config->histogramMax > config->histogramMin))
+        return SERIAL_ERR_UNKNOWN;
+
+    agg->config = *config;
+    if (agg->config.scale == 0)
+        agg->config.scale = 1;
+
+    agg->scratch = serialAlloc((size_t)config->channels * config->window * sizeof(float));
+    agg->histogram = serialAlloc((size_t)config->channels * AGG_HISTOGRAM_BINS * sizeof(uint32_t));
+    if (agg->scratch == NULL || agg->histogram == NULL)
+    {
+        aggregateFree(agg);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    resetWindow(agg);
+    return SERIAL_ERR_OK;
+}
+
+
+void aggregateFree(aggregate_t *agg)
+{
+    serialFree(agg->scratch, (size_t)agg->config.channels * agg->config.window * sizeof(float));
+    serialFree(agg->histogram, (size_t)agg->config.channels * AGG_HISTOGRAM_BINS * sizeof(uint32_t));
+    agg->scratch = NULL;
+    agg->histogram = NULL;
+}
+
+
+/* de-interleaves frames into one float array per channel, applying scale and offset */
+static void convertFrames(const aggregate_t *agg, const uint8_t *data, uint32_t frames)
+{
+    const agg_config_t *config = &agg->config;
+    uint32_t channels = config->channels;
+    uint32_t stride = config->window;
+    float *out = agg->scratch;
+    uint32_t i = 0;
+
+#ifdef SERIAL_SSE2
+    /* single channel streams convert straight from the record, 8 or 4 samples per step */
+    if (channels == 1)
+    {
+        const __m128 scale = _mm_set1_ps(config->scale);
+        const __m128 offset = _mm_set1_ps(config->offset);
+
+        if (config->sampleType == AGG_SAMPLE_INT16)
+        {
+            for (; i + 8 <= frames; i += 8)
+            {
+                __m128i raw = _mm_loadu_si128((const __m128i*)(data + 2 * i));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16);
+
+                _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale), offset));
+                _mm_storeu_ps(out + i + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale), offset));
+            }
+        }
+        else
+        {
+            for (; i + 4 <= frames; i += 4)
+            {
+                __m128i raw = _mm_loadu_si128((const __m128i*)(data + 4 * i));
+                __m128 value = config->sampleType == AGG_SAMPLE_INT32 ? _mm_cvtepi32_ps(raw) : _mm_castsi128_ps(raw);
+
+                _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(value, scale), offset));
+            }
+        }
+    }
+#endif
+
+    for (; i < frames; i++)
+    {
+        for (uint32_t c = 0; c < channels; c++)
+        {
+            const uint8_t *p = data + ((size_t)i * channels + c) * sampleSize(config->sampleType);
+            float value;
+
+            if (config->sampleType == AGG_SAMPLE_INT16)
+            {
+                int16_t raw;
+                memcpy(&raw, p, 2);
+                value = raw;
+            }
+            else if (config->sampleType == AGG_SAMPLE_INT32)
+            {
+                int32_t raw;
+                memcpy(&raw, p, 4);
+                value = (float)raw;
+            }
+            else
+                memcpy(&value, p, 4);
+
+            out[c * stride + i] = value * config->scale + config->offset;
+        }
+    }
+}
+
+
+/* min, max, sum and sum of squares of one channel's piece, four lanes at a time */
+static void reduce(aggregate_t *agg, uint32_t channel, const float *x, uint32_t n)
+{
+    float mn = agg->min[channel];
+    float mx = agg->max[channel];
+    float sum = 0;
+    float sumSquares = 0;
+    uint32_t i = 0;
+
+#ifdef SERIAL_SSE2
+    if (n >= 4)
+    {
+        __m128 vmin = _mm_set1_ps(mn);
+        __m128 vmax = _mm_set1_ps(mx);
+        __m128 vsum = _mm_setzero_ps();
+        __m128 vsq = _mm_setzero_ps();
+        float lanes[4];
+
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(x + i);
+            vmin = _mm_min_ps(vmin, v);
+            vmax = _mm_max_ps(vmax, v);
+            vsum = _mm_add_ps(vsum, v);
+            vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+        }
+
+        _mm_storeu_ps(lanes, vmin);
+        for (int k = 0; k < 4; k++)
+            mn = lanes[k] < mn ? lanes[k] : mn;
+        _mm_storeu_ps(lanes, vmax);
+        for (int k = 0; k < 4; k++)
+            mx = lanes[k] > mx ? lanes[k] : mx;
+        _mm_storeu_ps(lanes, vsum);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        _mm_storeu_ps(lanes, vsq);
+        sumSquares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        mn = x[i] < mn ? x[i] : mn;
+        mx = x[i] > mx ? x[i] : mx;
+        sum += x[i];
+        sumSquares += x[i] * x[i];
+    }
+
+    /* pieces are at most one window long, across pieces the sums are kept in double */
+    agg->min[channel] = mn;
+    agg->max[channel] = mx;
+    agg->sum[channel] += sum;
+    agg->sumSquares[channel] += sumSquares;
+}
+
+
+static void addToHistogram(aggregate_t *agg, uint32_t channel, const float *x, uint32_t n)
+{
+    uint32_t *bins = agg->histogram + (size_t)channel * AGG_HISTOGRAM_BINS;
+    float low = agg->config.histogramMin;
+    float perBin = AGG_HISTOGRAM_BINS / (agg->config.histogramMax - low);
+    uint32_t i = 0;
+
+#ifdef SERIAL_SSE2
+    const __m128 vlow = _mm_set1_ps(low);
+    const __m128 vper = _mm_set1_ps(perBin);
+    const __m128 vtop = _mm_set1_ps(AGG_HISTOGRAM_BINS - 1);
+    int32_t index[4];
+
+    /* bin indices four at a time, clamped into the sketch range; the increments stay scalar */
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 position = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), vlow), vper);
+        position = _mm_min_ps(_mm_max_ps(position, _mm_setzero_ps()), vtop);
+
+        _mm_storeu_si128((__m128i*)index, _mm_cvttps_epi32(position));
+        bins[index[0]]++;
+        bins[index[1]]++;
+        bins[index[2]]++;
+        bins[index[3]]++;
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        float position = (x[i] - low) * perBin;
+
+        /* clamped before the conversion as in the SSE path, NaN fails the first test and lands in bin 0 too */
+        if (!(position > 0))
+            position = 0;
+        else if (position > AGG_HISTOGRAM_BINS - 1)
+            position = AGG_HISTOGRAM_BINS - 1;
+
+        bins[(uint32_t)position]++;
+    }
+}
+
+
+static float percentile(const aggregate_t *agg, uint32_t channel, float p)
+{
+    const uint32_t *bins = agg->histogram + (size_t)channel * AGG_HISTOGRAM_BINS;
+    float low = agg->config.histogramMin;
+    float width = (agg->config.histogramMax - low) / AGG_HISTOGRAM_BINS;
+    double target = (double)p / 100.0 * agg->frames;
+    uint64_t below = 0;
+    float value = agg->max[channel];
+
+    for (uint32_t b = 0; b < AGG_HISTOGRAM_BINS; b++)
+    {
+        if (bins[b] > 0 && below + bins[b] >= target)
+        {
+            /* samples are assumed to be spread evenly inside their bin */
+            double fraction = (target - (double)below) / bins[b];
+            value = low + (float)((b + fraction) * width);
+            break;
+        }
+        below += bins[b];
+    }
+
+    /* the sketch is coarse, the true extremes are exact */
+    if (value < agg->min[channel])
+        value = agg->min[channel];
+    if (value > agg->max[channel])
+        value = agg->max[channel];
+
+    return value;
+}
+
+
+static void emitWindow(aggregate_t *agg, agg_emit_t emit, void *context)
+{
+    agg_record_t record;
+    uint32_t channels = agg->config.channels;
+
+    record.window = agg->window++;
+    record.frames = agg->frames;
+    record.channelCount = channels;
+
+    for (uint32_t c = 0; c < channels; c++)
+    {
+        agg_channel_t *out = &record.channels[c];
+
+        out->mean = (float)(agg->sum[c] / agg->frames);
+        out->min = agg->min[c];
+        out->max = agg->max[c];
+        out->rms = (float)sqrt(agg->sumSquares[c] / agg->frames);
+
+        for (uint32_t k = 0; k < agg->config.percentileCount; k++)
+            out->percentiles[k] = percentile(agg, c, agg->config.percentiles[k]);
+        for (uint32_t k = agg->config.percentileCount; k < AGG_MAX_PERCENTILES; k++)
+            out->percentiles[k] = 0;
+    }
+
+    agg->recordsOut++;
+    if (emit != NULL)
+        emit(&record, aggregateRecordSize(channels), context);
+
+    resetWindow(agg);
+}
+
+
+uint32_t aggregateFeed(aggregate_t *agg, const uint8_t *data, size_t len, agg_emit_t emit, void *context)
+{
+    const agg_config_t *config = &agg->config;
+    uint32_t frameSize = config->channels * sampleSize(config->sampleType);
+    uint32_t emitted = 0;
+
+    if (len < config->headerBytes)
+    {
+        agg->partialFrames++;
+        return 0;
+    }
+
+    data += config->headerBytes;
+    len -= config->headerBytes;
+
+    size_t frames = len / frameSize;
+    if (len % frameSize != 0)
+        agg->partialFrames++;
+
+    while (frames > 0)
+    {
+        /* a piece never crosses a window boundary, so it always fits the scratch arrays */
+        uint32_t piece = config->window - agg->frames;
+        if (piece > frames)
+            piece = (uint32_t)frames;
+
+        convertFrames(agg, data, piece);
+
+        for (uint32_t c = 0; c < config->channels; c++)
+        {
+            const float *x = agg->scratch + (size_t)c * config->window;
+            reduce(agg, c, x, piece);
+            addToHistogram(agg, c, x, piece);
+        }
+
+        agg->frames += piece;
+        agg->framesIn += piece;
+        frames -= piece;
+        data += (size_t)piece * frameSize;
+
+        if (agg->frames == config->window)
+        {
+            emitWindow(agg, emit, context);
+            emitted++;
+        }
+    }
+
+    return emitted;
+}
+
+
+static void emitToPipeline(const agg_record_t *record, uint32_t size, void *context)
+{
+    pipelineEmit((pipeline_stage_t*)context, (const uint8_t*)record, size);
+}
+
+
+void aggregateStage(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    aggregateFeed((aggregate_t*)context, data, len, emitToPipeline, stage);
+}
@@ -0,0 +1,178 @@
+/**
+ * @file aggregate.h
+ * @brief Windowed decimation of high rate sample streams.
+ *
+ * Framed records carrying interleaved multi-channel samples (16 or 32 bit fixed point, or float)
+ * are reduced per channel over fixed windows of samples to mean, min, max, RMS and percentiles,
+ * and only one aggregated record per window is emitted. Samples are de-interleaved into float
+ * arrays and reduced four at a time with SSE; percentiles come from a fixed-bin histogram sketch
+ * with interpolation inside the bin, so memory and time per window do not depend on its length.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+#include "serialPort.h"
+#include "pipeline.h"
+
+/**
+ * @defgroup agg_functions Aggregation
+ * @ingroup functions
+ * @brief Windowed statistics over sample streams.
+ */
+
+#define AGG_MAX_CHANNELS        16
+#define AGG_MAX_PERCENTILES     4
+#define AGG_HISTOGRAM_BINS      256     /**< Resolution of the percentile sketch. */
+
+/**
+ * @enum agg_sample_t
+ * @brief Encoding of one sample, little endian.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    AGG_SAMPLE_INT16,       /**< Signed 16 bit fixed point. */
+    AGG_SAMPLE_INT32,       /**< Signed 32 bit fixed point. */
+    AGG_SAMPLE_FLOAT32,     /**< IEEE 754 single precision. */
+} agg_sample_t;
+
+/**
+ * @struct agg_config_t
+ * @brief Layout of the incoming records and the statistics to produce.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    agg_sample_t sampleType;    /**< Encoding of each sample. */
+    uint32_t channels;          /**< Interleaved channels per frame, 1 - AGG_MAX_CHANNELS. */
+    uint32_t headerBytes;       /**< Bytes skipped at the start of every record. */
+    float scale;                /**< Physical value = raw * scale + offset; 0 is taken as 1. */
+    float offset;               /**< See scale. */
+    uint32_t window;            /**< Frames per aggregated record. */
+    float histogramMin;         /**< Lower end of the percentile sketch range. */
+    float histogramMax;         /**< Upper end of the percentile sketch range. */
+    float percentiles[AGG_MAX_PERCENTILES];     /**< Percentiles to report, 0 - 100. */
+    uint32_t percentileCount;   /**< Entries used in percentiles. */
+} agg_config_t;
+
+/**
+ * @struct agg_channel_t
+ * @brief Statistics of one channel over one window.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    float mean;                             /**< Arithmetic mean. */
+    float min;                              /**< Smallest sample. */
+    float max;                              /**< Largest sample. */
+    float rms;                              /**< Root mean square. */
+    float percentiles[AGG_MAX_PERCENTILES]; /**< Estimates for agg_config_t::percentiles. */
+} agg_channel_t;
+
+/**
+ * @struct agg_record_t
+ * @brief One aggregated window; channels holds agg_config_t::channels entries.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t window;                        /**< Window number, counting from 0. */
+    uint32_t frames;                        /**< Frames reduced into this record. */
+    uint32_t channelCount;                  /**< Entries in channels. */
+    agg_channel_t channels[AGG_MAX_CHANNELS];   /**< Per channel statistics. */
+} agg_record_t;
+
+/** @brief Receives every completed window. */
+typedef void (*agg_emit_t)(const agg_record_t *record, uint32_t size, void *context);
+
+/**
+ * @struct aggregate_t
+ * @brief Running state of an aggregation.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    agg_config_t config;                    /**< Settings, copied at init. */
+    float *scratch;                         /**< De-interleaved samples of the current piece. */
+    uint32_t frames;                        /**< Frames in the current window. */
+    uint64_t window;                        /**< Number of the current window. */
+    double sum[AGG_MAX_CHANNELS];           /**< Running sums. */
+    double sumSquares[AGG_MAX_CHANNELS];    /**< Running sums of squares. */
+    float min[AGG_MAX_CHANNELS];            /**< Running minima. */
+    float max[AGG_MAX_CHANNELS];            /**< Running maxima. */
+    uint32_t *histogram;                    /**< AGG_HISTOGRAM_BINS counters per channel. */
+    uint64_t framesIn;                      /**< Frames consumed. */
+    uint64_t recordsOut;                    /**< Windows emitted. */
+    uint64_t partialFrames;                 /**< Records that ended inside a frame; the partial frame is ignored. */
+} aggregate_t;
+
+/**
+ * @brief Initialises an aggregation.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN for an invalid configuration
+ *         or if memory cannot be allocated.
+ *
+ * @ingroup agg_functions
+ *
+ * ### Example
+ * Below is an example that turns 10 kHz three axis int16 samples into 100 Hz statistics.
+ * @code
+ * aggregate_t accel;
+ * agg_config_t config = { AGG_SAMPLE_INT16, 3, 4, 0.001f, 0.0f, 100, -32.0f, 32.0f, { 50, 99 }, 2 };
+ * int main(){
+ *  if(aggregateInit(&accel, &config) != SERIAL_ERR_OK)
+ *      return -1;
+ *  // behind a framer stage of a pipeline
+ *  pipelineAddStage(&pipeline, "accel", aggregateStage, &accel);
+ *  ...
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t aggregateInit(aggregate_t *agg, const agg_config_t *config);
+
+/**
+ * @brief Releases an aggregation.
+ *
+ * @ingroup agg_functions
+ */
+void aggregateFree(aggregate_t *agg);
+
+/**
+ * @brief Reduces the samples of one record, emitting every window completed by it.
+ *
+ * @param[in] agg Pointer to the aggregation.
+ * @param[in] data Record, agg_config_t::headerBytes of header followed by whole frames.
+ * @param[in] len Bytes in data.
+ * @param[in] emit Receives completed windows.
+ * @param[in] context User pointer passed to emit.
+ *
+ * @return Number of windows emitted.
+ *
+ * @ingroup agg_functions
+ */
+uint32_t aggregateFeed(aggregate_t *agg, const uint8_t *data, size_t len, agg_emit_t emit, void *context);
+
+/**
+ * @brief Pipeline stage aggregating records with the aggregate_t in context; emits agg_record_t records only.
+ *
+ * @ingroup agg_functions
+ */
+void aggregateStage(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+/**
+ * @brief Size of an emitted record with a given number of channels.
+ *
+ * @ingroup agg_functions
+ */
+uint32_t aggregateRecordSize(uint32_t channels);
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "bridge.h"
+
+
+/* header of a chunk in the delay line */
+typedef struct {
+    int64_t due;            /* QPC time to send it */
+    int64_t received;       /* QPC time it was read */
+} delay_header_t;
+
+
+static int64_t ticksToUs(const bridge_t *bridge, int64_t ticks)
+{
+    int64_t frequency = bridge->frequency.QuadPart;
+    return (ticks / frequency) * 1000000 + (ticks % frequency) * 1000000 / frequency;
+}
+
+
+/* xorshift64*, plenty for fault injection */
+static uint32_t nextRandom(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+
+void bridgeInit(bridge_t *bridge, serial_port_t *a, serial_port_t *b, capture_callback_t tap, void *tapContext)
+{
+    memset(bridge, 0, sizeof(*bridge));
+    bridge->tap = tap;
+    bridge->tapContext = tapContext;
+
+    bridge->directions[BRIDGE_A_TO_B].from = a;
+    bridge->directions[BRIDGE_A_TO_B].to = b;
+    bridge->directions[BRIDGE_A_TO_B].tag = "A>B";
+    bridge->directions[BRIDGE_B_TO_A].from = b;
+    bridge->directions[BRIDGE_B_TO_A].to = a;
+    bridge->directions[BRIDGE_B_TO_A].tag = "B>A";
+
+    for (int i = 0; i < 2; i++)
+        bridge->directions[i].bridge = bridge;
+}
+
+
+void bridgeSetImpairment(bridge_t *bridge, bridge_dir_t direction, const bridge_impairment_t *impairment)
+{
+    bridge->directions[direction].impairment = *impairment;
+}
+
+
+static int isDelayed(const bridge_direction_t *dir)
+{
+    return dir->impairment.delayUs != 0 || dir->impairment.jitterUs != 0;
+}
+
+
+/* corrupts and drops bytes in place, returns the length left */
+static uint32_t impair(bridge_direction_t *dir, uint8_t *buf, uint32_t len)
+{
+    const bridge_impairment_t *impairment = &dir->impairment;
+    uint32_t kept = 0;
+
+    if (impairment->corruptPpm == 0 && impairment->dropPpm == 0)
+        return len;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (impairment->dropPpm != 0 && nextRandom(&dir->random) % 1000000 < impairment->dropPpm)
+        {
+            InterlockedIncrement64(&dir->dropped);
+            continue;
+        }
+
+        uint8_t c = buf[i];
+        if (impairment->corruptPpm != 0 && nextRandom(&dir->random) % 1000000 < impairment->corruptPpm)
+        {
+            c ^= (uint8_t)(1u << (nextRandom(&dir->random) & 7));
+            InterlockedIncrement64(&dir->corrupted);
+        }
+        buf[kept++] = c;
+    }
+
+    return kept;
+}
+
+
+static void tapChunk(bridge_direction_t *dir, int64_t arrival, const uint8_t *data, uint32_t len)
+{
+    bridge_t *bridge = dir->bridge;
+    capture_event_t event;
+
+    if (bridge->tap == NULL)
+        return;
+
+    event.timestampUs = (uint64_t)ticksToUs(bridge, arrival - bridge->start.QuadPart);
+    event.port = (uint32_t)(dir - bridge->directions);
+    event.tag = dir->tag;
+    event.data = data;
+    event.len = len;
+    event.late = 0;
+
+    EnterCriticalSection(&bridge->tapLock);
+    bridge->tap(&event, bridge->tapContext);
+    LeaveCriticalSection(&bridge->tapLock);
+}
+
+
+static void countSent(bridge_direction_t *dir, int64_t received, uint32_t len)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    /* only one thread per direction sends, so the maximum needs no compare-exchange */
+    int64_t latency = now.QuadPart - received;
+    InterlockedExchangeAdd64(&dir->latencySum, latency);
+    if (latency > ReadAcquire64(&dir->latencyMax))
+        WriteRelease64(&dir->latencyMax, latency);
+
+    InterlockedIncrement64(&dir->chunks);
+    InterlockedExchangeAdd64(&dir->bytes, len);
+}
+
+
+/* a chunk only counts as forwarded once the other port took it */
+static void forward(bridge_direction_t *dir, int64_t received, uint8_t *data, uint32_t len)
+{
+    if (serialPortWrite(dir->to, data, len) == SERIAL_ERR_OK)
+        countSent(dir, received, len);
+    else
+        InterlockedIncrement64(&dir->writeErrors);
+}
+
+
+static DWORD WINAPI BridgeReader(LPVOID lpParam)
+{
+    bridge_direction_t *dir = (bridge_direction_t*)lpParam;
+    bridge_t *bridge = dir->bridge;
+    const bridge_impairment_t *impairment = &dir->impairment;
+    int delayed = isDelayed(dir);
+    uint8_t direct[BRIDGE_CHUNK];
+
+    while (ReadAcquire(&bridge->running))
+    {
+        uint8_t *slot = NULL;
+        uint8_t *buf = direct;
+        uint64_t got = 0;
+        LARGE_INTEGER now;
+
+        /* delayed chunks are read straight into the delay line */
+        if (delayed)
+        {
+            slot = spscQueueReserveWait(&dir->delayLine, sizeof(delay_header_t) + BRIDGE_CHUNK, BRIDGE_POLL_MS);
+            if (slot == NULL)
+            {
+                InterlockedIncrement64(&dir->stalls);
+                continue;
+            }
+            buf = slot + sizeof(delay_header_t);
+        }
+
+        if (serialPortReadSome(dir->from, buf, BRIDGE_CHUNK, &got) != SERIAL_ERR_OK)
+            break;
+        if (got == 0)
+            continue;
+
+        QueryPerformanceCounter(&now);
+
+        /* same arrival estimate as the capture: first byte one wire time before the read returned */
+        int64_t arrival = now.QuadPart - (int64_t)((double)got * dir->charTicks);
+        if (arrival < dir->lastArrival)
+            arrival = dir->lastArrival;
+        dir->lastArrival = now.QuadPart;
+
+        uint32_t len = impair(dir, buf, (uint32_t)got);
+        if (len == 0)
+            continue;
+
+        tapChunk(dir, arrival, buf, len);
+
+        if (!delayed)
+        {
+            forward(dir, now.QuadPart, buf, len);
+            continue;
+        }
+
+        delay_header_t header;
+        int64_t extra = impairment->delayUs;
+        if (impairment->jitterUs != 0)
+            extra += nextRandom(&dir->random) % (impairment->jitterUs + 1);
+
+        /* a wire cannot overtake itself, so jitter never reorders chunks */
+        header.received = now.QuadPart;
+        header.due = now.QuadPart + extra * bridge->frequency.QuadPart / 1000000;
+        if (header.due < dir->lastDue)
+            header.due = dir->lastDue;
+        dir->lastDue = header.due;
+
+        memcpy(slot, &header, sizeof(header));
+        spscQueueCommit(&dir->delayLine, (uint32_t)sizeof(header) + len);
+    }
+
+    InterlockedExchange(&dir->readerDone, 1);
+    return 0;
+}
+
+
+static DWORD WINAPI BridgeWriter(LPVOID lpParam)
+{
+    bridge_direction_t *dir = (bridge_direction_t*)lpParam;
+    bridge_t *bridge = dir->bridge;
+    const uint8_t *record;
+    uint32_t len;
+
+    while (1)
+    {
+        record = spscQueuePeekWait(&dir->delayLine, &len, BRIDGE_POLL_MS);
+
+        if (record == NULL)
+        {
+            if (!ReadAcquire(&dir->readerDone))
+                continue;
+
+            record = spscQueuePeek(&dir->delayLine, &len);
+            if (record == NULL)
+                break;
+        }
+
+        delay_header_t header;
+        memcpy(&header, record, sizeof(header));
+
+        /* sleep off most of the wait and yield through the last millisecond; once stopping, flush */
+        while (ReadAcquire(&bridge->running))
+        {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+
+            int64_t remaining = header.due - now.QuadPart;
+            if (remaining <= 0)
+                break;
+
+            DWORD ms = (DWORD)(remaining * 1000 / bridge->frequency.QuadPart);
+            if (ms > 1)
+                Sleep(ms - 1);
+            else
+                SwitchToThread();
+        }
+
+        forward(dir, header.received, (uint8_t*)record + sizeof(header), len - (uint32_t)sizeof(header));
+        spscQueueRelease(&dir->delayLine);
+    }
+
+    return 0;
+}
+
+
+serial_port_err_t bridgeStart(bridge_t *bridge)
+{
+    /* the readers poll so they notice bridgeStop; it puts back whatever the ports were set up with */
+    for (int i = 0; i < 2; i++)
+    {
+        if (serialPortSetPollTimeouts(bridge->directions[i].from, BRIDGE_POLL_MS, &bridge->directions[i].savedTimeouts) != SERIAL_ERR_OK)
+        {
+            if (i == 1)
+                serialPortRestoreTimeouts(bridge->directions[0].from, &bridge->directions[0].savedTimeouts);
+            return SERIAL_ERR_UNKNOWN;
+        }
+    }
+
+    QueryPerformanceFrequency(&bridge->frequency);
+    QueryPerformanceCounter(&bridge->start);
+    InitializeCriticalSection(&bridge->tapLock);
+    InterlockedExchange(&bridge->running, 1);
+
+    for (int i = 0; i < 2; i++)
+    {
+        bridge_direction_t *dir = &bridge->directions[i];
+
+        dir->readerDone = 0;
+        dir->lastDue = 0;
+        dir->lastArrival = bridge->start.QuadPart;
+        dir->random = (uint64_t)bridge->start.QuadPart ^ (0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1));
+        dir->charTicks = (double)bridge->frequency.QuadPart * serialPortCharacterBits(dir->from) / (double)dir->from->baud;
+
+        if (isDelayed(dir) && spscQueueInit(&dir->delayLine, BRIDGE_DELAY_CAPACITY) != SERIAL_ERR_OK)
+        {
+            bridgeStop(bridge);
+            return SERIAL_ERR_UNKNOWN;
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        bridge_direction_t *dir = &bridge->directions[i];
+
+        dir->reader = CreateThread(NULL, 0, BridgeReader, dir, 0, NULL);
+        if (dir->reader != NULL && isDelayed(dir))
+            dir->writer = CreateThread(NULL, 0, BridgeWriter, dir, 0, NULL);
+
+        if (dir->reader == NULL || (isDelayed(dir) && dir->writer == NULL))
+        {
+            bridgeStop(bridge);
+            return SERIAL_ERR_UNKNOWN;
+        }
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void bridgeStop(bridge_t *bridge)
+{
+    InterlockedExchange(&bridge->running, 0);
+
+    for (int i = 0; i < 2; i++)
+    {
+        bridge_direction_t *dir = &bridge->directions[i];
+
+        if (dir->reader != NULL)
+        {
+            WaitForSingleObject(dir->reader, INFINITE);
+            CloseHandle(dir->reader);
+            dir->reader = NULL;
+        }
+        InterlockedExchange(&dir->readerDone, 1);
+
+        if (dir->writer != NULL)
+        {
+            WaitForSingleObject(dir->writer, INFINITE);
+            CloseHandle(dir->writer);
+            dir->writer = NULL;
+        }
+
+        if (dir->delayLine.ring != NULL)
+            spscQueueFree(&dir->delayLine);
+        serialPortRestoreTimeouts(dir->from, &dir->savedTimeouts);
+    }
+
+    DeleteCriticalSection(&bridge->tapLock);
+}
+
+
+void bridgeGetStats(bridge_t *bridge, bridge_dir_t direction, bridge_stats_t *stats)
+{
+    bridge_direction_t *dir = &bridge->directions[direction];
+    double ticksPerUs = (double)bridge->frequency.QuadPart / 1e6;
+
+    stats->bytes = (uint64_t)ReadAcquire64(&dir->bytes);
+    stats->chunks = (uint64_t)ReadAcquire64(&dir->chunks);
+    stats->corrupted = (uint64_t)ReadAcquire64(&dir->corrupted);
+    stats->dropped = (uint64_t)ReadAcquire64(&dir->dropped);
+    stats->stalls = (uint64_t)ReadAcquire64(&dir->stalls);
+    stats->writeErrors = (uint64_t)ReadAcquire64(&dir->writeErrors);
+    stats->meanLatencyUs = stats->chunks != 0 ? (double)ReadAcquire64(&dir->latencySum) / ticksPerUs / (double)stats->chunks : 0;
+    stats->maxLatencyUs = (double)ReadAcquire64(&dir->latencyMax) / ticksPerUs;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file bridge.h
+ * @brief Inline tap between two ports with optional delay, jitter and corruption.
+ *
+ * A bridge forwards everything received on one port to the other, in both directions, so the
+ * host can be spliced into a link between two devices (or between a device and a program using
+ * the other end of a virtual null-modem pair). Each direction has its own reader thread that
+ * returns from ReadFile as soon as bytes arrive and writes the same buffer straight out of the
+ * other port. When a direction is given a delay or jitter, received chunks go through a delay
+ * line instead and a writer thread sends each one when it is due, keeping their order. Both
+ * directions can be recorded through a capture callback, e.g. captureTraceSink.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+#include "spscQueue.h"
+#include "capture.h"
+
+/**
+ * @defgroup bridge_functions Bridge
+ * @ingroup functions
+ * @brief Bidirectional forwarding and fault injection between two ports.
+ */
+
+#define BRIDGE_CHUNK            4096    /**< Largest chunk forwarded at once. */
+#define BRIDGE_POLL_MS          10      /**< Longest a reader waits for data before checking for stop. */
+#define BRIDGE_DELAY_CAPACITY   (1 << 20)   /**< Ring size of a direction's delay line. */
+
+/**
+ * @enum bridge_dir_t
+ * @brief Direction of a bridge.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    BRIDGE_A_TO_B,          /**< Received on port A, sent on port B. */
+    BRIDGE_B_TO_A,          /**< Received on port B, sent on port A. */
+} bridge_dir_t;
+
+/**
+ * @struct bridge_impairment_t
+ * @brief Faults injected into one direction.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t delayUs;       /**< Added to every chunk. */
+    uint32_t jitterUs;      /**< Random extra delay from 0 up to this; chunks are never reordered. */
+    uint32_t corruptPpm;    /**< Chance per million bytes of flipping one random bit. */
+    uint32_t dropPpm;       /**< Chance per million bytes of losing the byte. */
+} bridge_impairment_t;
+
+struct bridge_t;
+
+/**
+ * @struct bridge_direction_t
+ * @brief Forwarding state of one direction.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    struct bridge_t *bridge;            /**< Owning bridge. */
+    serial_port_t *from;                /**< Port read. */
+    serial_port_t *to;                  /**< Port written. */
+    const char *tag;                    /**< Tag of the direction in the capture. */
+    bridge_impairment_t impairment;     /**< Injected faults. */
+    spsc_queue_t delayLine;             /**< Chunks waiting for their due time, used with delay or jitter only. */
+    HANDLE reader;                      /**< Reader thread. */
+    HANDLE writer;                      /**< Writer thread of the delay line. */
+    volatile LONG readerDone;           /**< Set once the reader has queued its last chunk. */
+    uint64_t random;                    /**< State of the fault generator. */
+    int64_t lastDue;                    /**< Due time of the newest queued chunk. */
+    int64_t lastArrival;                /**< Arrival stamp of the newest chunk. */
+    double charTicks;                   /**< Wire time of one character of from in QPC ticks. */
+    COMMTIMEOUTS savedTimeouts;         /**< Timeouts of from before bridgeStart. */
+    volatile LONG64 bytes;              /**< Bytes forwarded. */
+    volatile LONG64 chunks;             /**< Chunks forwarded. */
+    volatile LONG64 corrupted;          /**< Bytes corrupted. */
+    volatile LONG64 dropped;            /**< Bytes dropped. */
+    volatile LONG64 stalls;             /**< Reads postponed because the delay line was full. */
+    volatile LONG64 writeErrors;        /**< Chunks lost because writing them to the other port failed. */
+    volatile LONG64 latencySum;         /**< Read completion to write completion, QPC ticks, summed. */
+    volatile LONG64 latencyMax;         /**< Largest of those. */
+} bridge_direction_t;
+
+/**
+ * @struct bridge_stats_t
+ * @brief Counters of one direction.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t bytes;             /**< Bytes forwarded. */
+    uint64_t chunks;            /**< Chunks forwarded. */
+    uint64_t corrupted;         /**< Bytes corrupted. */
+    uint64_t dropped;           /**< Bytes dropped. */
+    uint64_t stalls;            /**< Reads postponed because the delay line was full. */
+    uint64_t writeErrors;       /**< Chunks lost because writing them to the other port failed. */
+    double meanLatencyUs;       /**< Mean time a chunk spent in the bridge, including injected delay. */
+    double maxLatencyUs;        /**< Longest time a chunk spent in the bridge. */
+} bridge_stats_t;
+
+/**
+ * @struct bridge_t
+ * @brief A bridge between two ports.
+ *
+ * @ingroup structs
+ */
+typedef struct bridge_t {
+    bridge_direction_t directions[2];   /**< Indexed by bridge_dir_t. */
+    capture_callback_t tap;             /**< Records both directions, may be NULL. */
+    void *tapContext;                   /**< User pointer passed to tap. */
+    CRITICAL_SECTION tapLock;           /**< Serialises the tap between the two readers. */
+    LARGE_INTEGER frequency;            /**< QPC ticks per second. */
+    LARGE_INTEGER start;                /**< QPC time of bridgeStart. */
+    volatile LONG running;              /**< Cleared by bridgeStop. */
+} bridge_t;
+
+/**
+ * @brief Initialises a bridge between two opened ports without impairments.
+ *
+ * @param[out] bridge Pointer to the bridge.
+ * @param[in] a First port.
+ * @param[in] b Second port.
+ * @param[in] tap Receives every forwarded chunk as it is sent on, after impairment, or NULL.
+ *                capture_event_t::port is the bridge_dir_t of the chunk.
+ * @param[in] tapContext User pointer passed to tap.
+ *
+ * @ingroup bridge_functions
+ *
+ * ### Example
+ * Below is an example that sits between a controller on COM3 and a sensor on COM4, logs both
+ * directions and delays the sensor's replies by 5 - 7 ms.
+ * @code
+ * serial_port_t controller, sensor;
+ * bridge_t bridge;
+ * bridge_impairment_t slowSensor = { 5000, 2000, 0, 0 };
+ * int main(){
+ *  if(serialPortOpen(&controller, "COM3", 115200, 50, 100) != SERIAL_ERR_OK ||
+ *     serialPortOpen(&sensor, "COM4", 115200, 50, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  bridgeInit(&bridge, &controller, &sensor, captureTraceSink, fopen("link.trace", "wb"));
+ *  bridgeSetImpairment(&bridge, BRIDGE_B_TO_A, &slowSensor);
+ *  if(bridgeStart(&bridge) != SERIAL_ERR_OK)
+ *      return -1;
+ *  Sleep(60000);
+ *  bridgeStop(&bridge);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+void bridgeInit(bridge_t *bridge, serial_port_t *a, serial_port_t *b, capture_callback_t tap, void *tapContext);
+
+/**
+ * @brief Sets the faults injected into one direction; only valid before bridgeStart.
+ *
+ * @ingroup bridge_functions
+ */
+void bridgeSetImpairment(bridge_t *bridge, bridge_dir_t direction, const bridge_impairment_t *impairment);
+
+/**
+ * @brief Starts forwarding.
+ *
+ * The read timeouts of both ports are changed for the duration of the bridge.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup bridge_functions
+ */
+serial_port_err_t bridgeStart(bridge_t *bridge);
+
+/**
+ * @brief Stops forwarding, sends what is still in the delay lines without waiting, and restores the port timeouts.
+ *
+ * @ingroup bridge_functions
+ */
+void bridgeStop(bridge_t *bridge);
+
+/**
+ * @brief Reads the counters of one direction.
+ *
+ * @ingroup bridge_functions
+ */
+void bridgeGetStats(bridge_t *bridge, bridge_dir_t direction, bridge_stats_t *stats);
+
+#endif
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "traceFormat.h"
+
+
+/* head record of one port in the merge heap */
+typedef struct {
+    int64_t timestamp;
+    uint32_t port;
+    uint32_t len;
+    const uint8_t *data;
+} heap_entry_t;
+
+
+static int64_t ticksToUs(const capture_t *capture, int64_t ticks)
+{
+    int64_t frequency = capture->frequency.QuadPart;
+
+    /* split so long captures do not overflow the multiplication */
+    return (ticks / frequency) * 1000000 + (ticks % frequency) * 1000000 / frequency;
+}
+
+
+void captureInit(capture_t *capture, uint32_t queueCapacity, uint32_t maxLatencyMs, capture_callback_t callback, void *context)
+{
+    memset(capture, 0, sizeof(*capture));
+    capture->queueCapacity = queueCapacity;
+    capture->callback = callback;
+    capture->context = context;
+
+    QueryPerformanceFrequency(&capture->frequency);
+    capture->maxLatency = capture->frequency.QuadPart * maxLatencyMs / 1000;
+}
+
+
+serial_port_err_t captureAddPort(capture_t *capture, serial_port_t *port, const char *tag)
+{
+    if (capture->portCount == CAPTURE_MAX_PORTS || port == NULL || !port->isOpen)
+        return SERIAL_ERR_UNKNOWN;
+
+    capture_port_t *cp = &capture->ports[capture->portCount++];
+    cp->port = port;
+    cp->capture = capture;
+    strncpy(cp->tag, tag, sizeof(cp->tag) - 1);
+
+    return SERIAL_ERR_OK;
+}
+
+
+static DWORD WINAPI CaptureReader(LPVOID lpParam)
+{
+    capture_port_t *cp = (capture_port_t*)lpParam;
+    capture_t *capture = cp->capture;
+    int64_t previous = capture->start.QuadPart;
+
+    while (ReadAcquire(&capture->running))
+    {
+        LARGE_INTEGER now;
+        uint64_t got = 0;
+
+        /* while the merge is behind the port is left alone; its watermark must not move either */
+        uint8_t *slot = spscQueueReserveWait(&cp->queue, sizeof(int64_t) + CAPTURE_READ_CHUNK, CAPTURE_POLL_MS);
+        if (slot == NULL)
+        {
+            InterlockedIncrement64(&cp->stalls);
+            continue;
+        }
+
+        if (serialPortReadSome(cp->port, slot + sizeof(int64_t), CAPTURE_READ_CHUNK, &got) != SERIAL_ERR_OK)
+            break;
+
+        QueryPerformanceCounter(&now);
+
+        if (got > 0)
+        {
+            /* the last byte just arrived, the first one its wire time earlier, but never before the previous read */
+            int64_t arrival = now.QuadPart - (int64_t)((double)got * cp->charTicks);
+            if (arrival < previous)
+                arrival = previous;
+
+            memcpy(slot, &arrival, sizeof(arrival));
+            spscQueueCommit(&cp->queue, (uint32_t)(sizeof(int64_t) + got));
+            InterlockedIncrement64(&cp->events);
+            InterlockedExchangeAdd64(&cp->bytes, (LONG64)got);
+        }
+
+        /* everything up to now is published, later records are stamped no earlier than this */
+        previous = now.QuadPart;
+        WriteRelease64(&cp->watermark, now.QuadPart);
+
+        if (got > 0)
+            SetEvent(capture->wake);
+    }
+
+    InterlockedExchange(&cp->finished, 1);
+    SetEvent(capture->wake);
+    return 0;
+}
+
+
+static int heapBefore(const heap_entry_t *a, const heap_entry_t *b)
+{
+    return a->timestamp < b->timestamp || (a->timestamp == b->timestamp && a->port < b->port);
+}
+
+
+static void heapPush(heap_entry_t *heap, uint32_t *count, const heap_entry_t *entry)
+{
+    uint32_t i = (*count)++;
+
+    while (i > 0 && heapBefore(entry, &heap[(i - 1) / 2]))
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = *entry;
+}
+
+
+static void heapPop(heap_entry_t *heap, uint32_t *count)
+{
+    heap_entry_t last = heap[--(*count)];
+    uint32_t i = 0;
+
+    while (2 * i + 1 < *count)
+    {
+        uint32_t child = 2 * i + 1;
+        if (child + 1 < *count && heapBefore(&heap[child + 1], &heap[child]))
+            child++;
+        if (!heapBefore(&heap[child], &last))
+            break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+
+/* moves the port's oldest record into the heap, or lowers bound to what the empty port still guarantees */
+static int fetchHead(capture_t *capture, uint32_t index, heap_entry_t *heap, uint32_t *count, int64_t *bound)
+{
+    capture_port_t *cp = &capture->ports[index];
+
+    /* watermark and finished are read before peeking: a record committed before them is then always seen */
+    int64_t watermark = ReadAcquire64(&cp->watermark);
+    LONG finished = ReadAcquire(&cp->finished);
+    uint32_t len;
+    const uint8_t *record = spscQueuePeek(&cp->queue, &len);
+
+    if (record == NULL)
+    {
+        if (!finished && watermark < *bound)
+            *bound = watermark;
+        return 0;
+    }
+
+    heap_entry_t entry;
+    memcpy(&entry.timestamp, record, sizeof(int64_t));
+    entry.port = index;
+    entry.data = record + sizeof(int64_t);
+    entry.len = len - (uint32_t)sizeof(int64_t);
+    heapPush(heap, count, &entry);
+
+    return 1;
+}
+
+
+static DWORD WINAPI CaptureMerger(LPVOID lpParam)
+{
+    capture_t *capture = (capture_t*)lpParam;
+    heap_entry_t heap[CAPTURE_MAX_PORTS];
+    uint8_t queued[CAPTURE_MAX_PORTS] = { 0 };
+    uint32_t count = 0;
+    int64_t newestDelivered = INT64_MIN;
+
+    while (1)
+    {
+        int64_t bound = INT64_MAX;
+        int64_t oldest = INT64_MAX;
+        int64_t newest = INT64_MIN;
+        int done = 1;
+
+        for (uint32_t i = 0; i < capture->portCount; i++)
+        {
+            capture_port_t *cp = &capture->ports[i];
+
+            if (!ReadAcquire(&cp->finished))
+            {
+                int64_t watermark = ReadAcquire64(&cp->watermark);
+                oldest = watermark < oldest ? watermark : oldest;
+                newest = watermark > newest ? watermark : newest;
+                done = 0;
+            }
+
+            if (!queued[i])
+                queued[i] = (uint8_t)fetchHead(capture, i, heap, &count, &bound);
+        }
+
+        if (newest >= oldest)
+        {
+            WriteRelease64(&capture->skew, newest - oldest);
+            if (newest - oldest > capture->maxSkew)
+                WriteRelease64(&capture->maxSkew, newest - oldest);
+        }
+
+        if (count == 0)
+        {
+            if (done)
+                break;
+            WaitForSingleObject(capture->wake, CAPTURE_POLL_MS);
+            continue;
+        }
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        uint32_t delivered = 0;
+
+        /* a record goes out once no port can still produce an older one, or once it waited long enough */
+        while (count > 0 && (heap[0].timestamp <= bound || now.QuadPart - heap[0].timestamp > capture->maxLatency))
+        {
+            heap_entry_t top = heap[0];
+            capture_event_t event;
+
+            heapPop(heap, &count);
+
+            event.timestampUs = (uint64_t)ticksToUs(capture, top.timestamp - capture->start.QuadPart);
+            event.port = top.port;
+            event.tag = capture->ports[top.port].tag;
+            event.data = top.data;
+            event.len = top.len;
+            event.late = top.timestamp < newestDelivered;
+
+            if (event.late)
+                InterlockedIncrement64(&capture->late);
+            else
+                newestDelivered = top.timestamp;
+
+            if (capture->callback != NULL)
+                capture->callback(&event, capture->context);
+
+            InterlockedIncrement64(&capture->merged);
+            spscQueueRelease(&capture->ports[top.port].queue);
+            queued[top.port] = (uint8_t)fetchHead(capture, top.port, heap, &count, &bound);
+            delivered++;
+        }
+
+        if (delivered == 0)
+            WaitForSingleObject(capture->wake, CAPTURE_POLL_MS);
+    }
+
+    return 0;
+}
+
+
+serial_port_err_t captureStart(capture_t *capture)
+{
+    /* the readers poll so they notice captureStop; it puts back whatever the ports were set up with */
+    for (uint32_t i = 0; i < capture->portCount; i++)
+    {
+        if (serialPortSetPollTimeouts(capture->ports[i].port, CAPTURE_POLL_MS, &capture->ports[i].savedTimeouts) != SERIAL_ERR_OK)
+        {
+            while (i-- > 0)
+                serialPortRestoreTimeouts(capture->ports[i].port, &capture->ports[i].savedTimeouts);
+            return SERIAL_ERR_UNKNOWN;
+        }
+    }
+
+    QueryPerformanceCounter(&capture->start);
+    capture->wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (capture->wake == NULL)
+    {
+        captureStop(capture);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    InterlockedExchange(&capture->running, 1);
+
+    for (uint32_t i = 0; i < capture->portCount; i++)
+    {
+        capture_port_t *cp = &capture->ports[i];
+
+        cp->finished = 0;
+        cp->watermark = capture->start.QuadPart;
+        cp->charTicks = (double)capture->frequency.QuadPart * serialPortCharacterBits(cp->port) / (double)cp->port->baud;
+
+        if (spscQueueInit(&cp->queue, capture->queueCapacity) != SERIAL_ERR_OK)
+        {
+            captureStop(capture);
+            return SERIAL_ERR_UNKNOWN;
+        }
+
+        cp->thread = CreateThread(NULL, 0, CaptureReader, cp, 0, NULL);
+        if (cp->thread == NULL)
+        {
+            captureStop(capture);
+            return SERIAL_ERR_UNKNOWN;
+        }
+    }
+
+    capture->merger = CreateThread(NULL, 0, CaptureMerger, capture, 0, NULL);
+    if (capture->merger == NULL)
+    {
+        captureStop(capture);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void captureStop(capture_t *capture)
+{
+    InterlockedExchange(&capture->running, 0);
+
+    for (uint32_t i = 0; i < capture->portCount; i++)
+    {
+        capture_port_t *cp = &capture->ports[i];
+
+        if (cp->thread != NULL)
+        {
+            WaitForSingleObject(cp->thread, INFINITE);
+            CloseHandle(cp->thread);
+            cp->thread = NULL;
+        }
+        InterlockedExchange(&cp->finished, 1);
+    }
+
+    /* with every reader finished the merge thread delivers what is left and exits */
+    if (capture->merger != NULL)
+    {
+        WaitForSingleObject(capture->merger, INFINITE);
+        CloseHandle(capture->merger);
+        capture->merger = NULL;
+    }
+
+    for (uint32_t i = 0; i < capture->portCount; i++)
+    {
+        capture_port_t *cp = &capture->ports[i];
+
+        if (cp->queue.ring != NULL)
+            spscQueueFree(&cp->queue);
+        serialPortRestoreTimeouts(cp->port, &cp->savedTimeouts);
+    }
+
+    if (capture->wake != NULL)
+    {
+        CloseHandle(capture->wake);
+        capture->wake = NULL;
+    }
+}
+
+
+void captureGetStats(capture_t *capture, capture_stats_t *stats)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    stats->merged = (uint64_t)ReadAcquire64(&capture->merged);
+    stats->late = (uint64_t)ReadAcquire64(&capture->late);
+    stats->skewUs = (double)ReadAcquire64(&capture->skew) * 1e6 / (double)capture->frequency.QuadPart;
+    stats->maxSkewUs = (double)ReadAcquire64(&capture->maxSkew) * 1e6 / (double)capture->frequency.QuadPart;
+    stats->portCount = capture->portCount;
+
+    for (uint32_t i = 0; i < capture->portCount; i++)
+    {
+        capture_port_t *cp = &capture->ports[i];
+
+        stats->ports[i].events = (uint64_t)ReadAcquire64(&cp->events);
+        stats->ports[i].bytes = (uint64_t)ReadAcquire64(&cp->bytes);
+        stats->ports[i].stalls = (uint64_t)ReadAcquire64(&cp->stalls);
+        stats->ports[i].lagUs = (double)(now.QuadPart - ReadAcquire64(&cp->watermark)) * 1e6 /
+                                (double)capture->frequency.QuadPart;
+    }
+}
+
+
+void captureTraceSink(const capture_event_t *event, void *context)
+{
+    char line[TRACE_LINE_SIZE(CAPTURE_READ_CHUNK)];
+
+    size_t n = traceFormatLine(event->timestampUs, event->tag, event->data, event->len, TRACE_MODE_HEX,
+                               line, sizeof(line));
+    fwrite(line, 1, n, (FILE*)context);
+}
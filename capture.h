@@ -0,0 +1,211 @@
+/**
+ * @file capture.h
+ * @brief Time aligned capture of several ports into one chronologically ordered stream.
+ *
+ * Every port gets a reader thread that returns from ReadFile as soon as bytes arrive, stamps them
+ * against the shared QueryPerformanceCounter clock (back-dated by their time on the wire, so the
+ * stamp is the estimated arrival of the first byte) and hands them to a merge thread through an
+ * SPSC queue. The merge thread keeps the head record of every port in a min-heap and releases a
+ * record once every idle port's watermark, the time up to which that port is known to have
+ * nothing older, has passed it. A port whose reader falls behind by more than the latency bound
+ * no longer holds the others back; its records are then delivered late and counted.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+#include "spscQueue.h"
+
+/**
+ * @defgroup capture_functions Multi-Port Capture
+ * @ingroup functions
+ * @brief Merged, timestamped capture of several ports.
+ */
+
+#define CAPTURE_MAX_PORTS       16
+#define CAPTURE_READ_CHUNK      4096    /**< Largest record read from a port at once. */
+#define CAPTURE_POLL_MS         10      /**< Longest a reader waits for data before advancing its watermark. */
+
+/**
+ * @struct capture_event_t
+ * @brief One chunk of received data in the merged stream.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t timestampUs;       /**< Estimated arrival of data[0], microseconds since captureStart. */
+    uint32_t port;              /**< Index of the port, in order of captureAddPort. */
+    const char *tag;            /**< Tag of the port. */
+    const uint8_t *data;        /**< Received bytes, valid during the callback only. */
+    uint32_t len;               /**< Number of bytes. */
+    int late;                   /**< Delivered after a newer event because its port exceeded the latency bound. */
+} capture_event_t;
+
+/** @brief Receives the merged stream, called on the merge thread in timestamp order. */
+typedef void (*capture_callback_t)(const capture_event_t *event, void *context);
+
+struct capture_t;
+
+/**
+ * @struct capture_port_t
+ * @brief A port taking part in a capture.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;            /**< Opened port. */
+    char tag[9];                    /**< Tag reported with its events. */
+    struct capture_t *capture;      /**< Owning capture. */
+    spsc_queue_t queue;             /**< Timestamped records for the merge thread. */
+    HANDLE thread;                  /**< Reader thread. */
+    volatile LONG finished;         /**< Set once the reader has published its last record. */
+    volatile LONG64 watermark;      /**< No record older than this QPC time is still to come. */
+    double charTicks;               /**< Time of one character on the wire in QPC ticks. */
+    COMMTIMEOUTS savedTimeouts;     /**< Timeouts of the port before captureStart. */
+    volatile LONG64 events;         /**< Records read. */
+    volatile LONG64 bytes;          /**< Bytes read. */
+    volatile LONG64 stalls;         /**< Reads postponed because the queue was full. */
+} capture_port_t;
+
+/**
+ * @struct capture_port_stats_t
+ * @brief Counters of one port.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t events;            /**< Records read. */
+    uint64_t bytes;             /**< Bytes read. */
+    uint64_t stalls;            /**< Reads postponed because the merge fell behind. */
+    double lagUs;               /**< How far the port's watermark trails the clock. */
+} capture_port_stats_t;
+
+/**
+ * @struct capture_stats_t
+ * @brief Snapshot of a capture's counters.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t merged;            /**< Events delivered. */
+    uint64_t late;              /**< Events delivered out of order. */
+    double skewUs;              /**< Spread between the oldest and newest port watermark at the last merge pass. */
+    double maxSkewUs;           /**< Largest spread seen. */
+    uint32_t portCount;         /**< Entries in ports. */
+    capture_port_stats_t ports[CAPTURE_MAX_PORTS];  /**< Per port counters. */
+} capture_stats_t;
+
+/**
+ * @struct capture_t
+ * @brief A multi-port capture.
+ *
+ * @ingroup structs
+ */
+typedef struct capture_t {
+    capture_port_t ports[CAPTURE_MAX_PORTS];    /**< Ports in order of captureAddPort. */
+    uint32_t portCount;                         /**< Number of ports. */
+    uint32_t queueCapacity;                     /**< Ring size of every port queue. */
+    int64_t maxLatency;                         /**< Latency bound in QPC ticks. */
+    capture_callback_t callback;                /**< Receives the merged stream. */
+    void *context;                              /**< User pointer passed to callback. */
+    LARGE_INTEGER frequency;                    /**< QPC ticks per second. */
+    LARGE_INTEGER start;                        /**< QPC time of captureStart. */
+    HANDLE merger;                              /**< Merge thread. */
+    HANDLE wake;                                /**< Signalled by readers when a record is published. */
+    volatile LONG running;                      /**< Cleared by captureStop. */
+    volatile LONG64 merged;                     /**< Events delivered. */
+    volatile LONG64 late;                       /**< Events delivered out of order. */
+    volatile LONG64 skew;                       /**< Watermark spread at the last merge pass, QPC ticks. */
+    volatile LONG64 maxSkew;                    /**< Largest watermark spread, QPC ticks. */
+} capture_t;
+
+/**
+ * @brief Initialises a capture without ports.
+ *
+ * @param[out] capture Pointer to the capture.
+ * @param[in] queueCapacity Ring size of each port's queue in bytes.
+ * @param[in] maxLatencyMs Longest an event is held back waiting for a slower port.
+ * @param[in] callback Receives the merged stream.
+ * @param[in] context User pointer passed to callback.
+ *
+ * @ingroup capture_functions
+ *
+ * ### Example
+ * Below is an example that logs a Modbus master and two slaves into one trace file.
+ * @code
+ * serial_port_t master, slave1, slave2;
+ * capture_t capture;
+ * int main(){
+ *  FILE *log = fopen("bus.trace", "wb");
+ *  // open the three ports at the bus baud rate
+ *  ...
+ *  captureInit(&capture, 1 << 20, 50, captureTraceSink, log);
+ *  captureAddPort(&capture, &master, "M");
+ *  captureAddPort(&capture, &slave1, "S1");
+ *  captureAddPort(&capture, &slave2, "S2");
+ *  if(captureStart(&capture) != SERIAL_ERR_OK)
+ *      return -1;
+ *  Sleep(60000);
+ *  captureStop(&capture);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+void captureInit(capture_t *capture, uint32_t queueCapacity, uint32_t maxLatencyMs, capture_callback_t callback, void *context);
+
+/**
+ * @brief Adds an opened port; only valid before captureStart.
+ *
+ * @param[in] capture Pointer to the capture.
+ * @param[in] port Opened port, not read by anyone else during the capture.
+ * @param[in] tag Tag of at most 8 characters without spaces.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup capture_functions
+ */
+serial_port_err_t captureAddPort(capture_t *capture, serial_port_t *port, const char *tag);
+
+/**
+ * @brief Starts the reader threads and the merge thread.
+ *
+ * The read timeouts of the ports are changed for the duration of the capture.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup capture_functions
+ */
+serial_port_err_t captureStart(capture_t *capture);
+
+/**
+ * @brief Stops the readers, delivers every record still queued, joins the threads and restores the port timeouts.
+ *
+ * @ingroup capture_functions
+ */
+void captureStop(capture_t *capture);
+
+/**
+ * @brief Reads the counters of a running or stopped capture.
+ *
+ * @ingroup capture_functions
+ */
+void captureGetStats(capture_t *capture, capture_stats_t *stats);
+
+/**
+ * @brief Callback writing every event as a hex trace line to a FILE*, passed as the context.
+ *
+ * @ingroup capture_functions
+ */
+void captureTraceSink(const capture_event_t *event, void *context);
+
+#endif
@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "espLoader.h"
+#include "hexCodec.h"
+#include "miniDeflate.h"
+#include "serialAlloc.h"
+
+
+#define ESP_FLASH_BEGIN         0x02
+#define ESP_FLASH_DATA          0x03
+#define ESP_SYNC                0x08
+#define ESP_SPI_SET_PARAMS      0x0B
+#define ESP_SPI_ATTACH          0x0D
+#define ESP_CHANGE_BAUDRATE     0x0F
+#define ESP_FLASH_DEFL_BEGIN    0x10
+#define ESP_FLASH_DEFL_DATA     0x11
+#define ESP_SPI_FLASH_MD5       0x13
+
+#define ESP_CHECKSUM_SEED       0xEF
+#define ESP_ERASE_MS_PER_MB     30000
+#define ESP_WRITE_MS_PER_MB     40000   /* esptool's allowance for decompressing and writing a block */
+#define ESP_MD5_MS_PER_MB       8000    /* esptool's allowance for hashing flash */
+#define ESP_DEFLATE_MAX_RATIO   1032    /* most a deflate stream can expand, 258 byte matches in under 2 bits */
+#define ESP_SECTOR_SIZE         4096
+
+
+/* ---- MD5 (RFC 1321), the ROM's only way of reporting what it wrote ---- */
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;
+    uint8_t block[64];
+    uint32_t blockLen;
+} md5_t;
+
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5Shift[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5Block(md5_t *ctx, const uint8_t *block)
+{
+    uint32_t m[16];
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+
+    for (int i = 0; i < 16; i++)
+        m[i] = block[4 * i] | ((uint32_t)block[4 * i + 1] << 8) |
+               ((uint32_t)block[4 * i + 2] << 16) | ((uint32_t)block[4 * i + 3] << 24);
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t f;
+        int g;
+
+        if (i < 16)      { f = (b & c) | (~b & d); g = i; }
+        else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) % 16; }
+        else if (i < 48) { f = b ^ c ^ d;          g = (3 * i + 5) % 16; }
+        else             { f = c ^ (b | ~d);       g = (7 * i) % 16; }
+
+        f += a + md5K[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (f << md5Shift[i]) | (f >> (32 - md5Shift[i]));
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+}
+
+static void md5Init(md5_t *ctx)
+{
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+    ctx->blockLen = 0;
+}
+
+static void md5Update(md5_t *ctx, const uint8_t *data, size_t len)
+{
+    ctx->length += len;
+
+    while (len > 0)
+    {
+        size_t n = 64 - ctx->blockLen;
+        if (n > len)
+            n = len;
+
+        memcpy(ctx->block + ctx->blockLen, data, n);
+        ctx->blockLen += (uint32_t)n;
+        data += n;
+        len -= n;
+
+        if (ctx->blockLen == 64)
+        {
+            md5Block(ctx, ctx->block);
+            ctx->blockLen = 0;
+        }
+    }
+}
+
+static void md5Final(md5_t *ctx, uint8_t digest[16])
+{
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    uint8_t lengthBytes[8];
+
+    md5Update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->blockLen != 56)
+        md5Update(ctx, &pad, 1);
+
+    for (int i = 0; i < 8; i++)
+        lengthBytes[i] = (uint8_t)(bits >> (8 * i));
+    md5Update(ctx, lengthBytes, 8);
+
+    for (int i = 0; i < 4; i++)
+    {
+        digest[4 * i] = (uint8_t)ctx->state[i];
+        digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 8);
+        digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 16);
+        digest[4 * i + 3] = (uint8_t)(ctx->state[i] >> 24);
+    }
+}
+
+
+/* ---- image preparation ---- */
+
+static DWORD WINAPI PrepareImage(LPVOID lpParam)
+{
+    esp_image_t *image = (esp_image_t*)lpParam;
+    md5_t md5;
+
+    /* the ROM writes whole words, the tail is padded with the erased value */
+    uint8_t *padded = serialAlloc(image->paddedLen ? image->paddedLen : 1);
+    if (padded == NULL)
+    {
+        image->status = SERIAL_ERR_UNKNOWN;
+        return 0;
+    }
+
+    memcpy(padded, image->data, image->len);
+    memset(padded + image->len, 0xFF, image->paddedLen - image->len);
+
+    md5Init(&md5);
+    md5Update(&md5, padded, image->paddedLen);
+    md5Final(&md5, image->md5);
+
+    size_t capacity = miniDeflateBound(image->paddedLen);
+    image->compressed = serialAlloc(capacity);
+    if (image->compressed != NULL)
+        image->compressedLen = miniDeflateCompress(padded, image->paddedLen, image->compressed, capacity);
+
+    serialFree(padded, image->paddedLen ? image->paddedLen : 1);
+
+    image->status = image->compressedLen > 0 ? SERIAL_ERR_OK : SERIAL_ERR_UNKNOWN;
+    return 0;
+}
+
+
+serial_port_err_t espImagePrepare(esp_image_t *image, const uint8_t *data, size_t len)
+{
+    memset(image, 0, sizeof(*image));
+    image->data = data;
+    image->len = len;
+    image->paddedLen = (len + 3) & ~(size_t)3;
+    image->status = SERIAL_ERR_UNKNOWN;
+
+    image->worker = CreateThread(NULL, 0, PrepareImage, image, 0, NULL);
+    if (image->worker == NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t espImageWait(esp_image_t *image)
+{
+    if (image->worker != NULL)
+    {
+        WaitForSingleObject(image->worker, INFINITE);
+        CloseHandle(image->worker);
+        image->worker = NULL;
+    }
+
+    return image->status;
+}
+
+
+void espImageFree(esp_image_t *image)
+{
+    espImageWait(image);
+    serialFree(image->compressed, miniDeflateBound(image->paddedLen));
+    image->compressed = NULL;
+    image->compressedLen = 0;
+}
+
+
+/* ---- protocol ---- */
+
+static void putLe32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+
+static uint32_t getLe32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint32_t statusLen(const esp_loader_t *esp)
+{
+    return esp->chip == ESP_CHIP_ESP8266 ? 2 : 4;
+}
+
+
+/* waits for the response to op; data points at the response payload inside esp->packet */
+static serial_port_err_t readResponse(esp_loader_t *esp, uint8_t op, uint32_t timeoutMs, const uint8_t **data, uint32_t *dataLen)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+
+    while (1)
+    {
+        if (esp->rxPos == esp->rxLen)
+        {
+            int available = bytesAvailable(esp->port);
+            uint64_t want = available > 0 ? (uint64_t)available : 1;
+            uint64_t got;
+
+            if (want > sizeof(esp->rx))
+                want = sizeof(esp->rx);
+
+            if (serialPortReadSome(esp->port, esp->rx, want, &got) != SERIAL_ERR_OK)
+                return SERIAL_ERR_READ_UNKNOWN;
+
+            esp->rxPos = 0;
+            esp->rxLen = (uint32_t)got;
+
+            if (got == 0)
+            {
+                if (GetTickCount64() >= deadline)
+                    return SERIAL_ERR_READ_TIMEOUT;
+                continue;
+            }
+        }
+
+        esp->rxPos += (uint32_t)slipDecode(&esp->decoder, esp->rx + esp->rxPos, esp->rxLen - esp->rxPos);
+        if (!esp->decoder.complete)
+            continue;
+
+        /* direction 1, command, 16 bit size, 32 bit value, payload; stale replies are skipped */
+        const uint8_t *p = esp->decoder.buf;
+        uint32_t size;
+
+        if (esp->decoder.len < 8 || p[0] != 0x01 || p[1] != op)
+            continue;
+
+        size = p[2] | ((uint32_t)p[3] << 8);
+        if (8 + size > esp->decoder.len || size < statusLen(esp))
+            return SERIAL_ERR_FRAME;
+
+        /* the status bytes close the payload, a non-zero first byte is a failure */
+        if (p[8 + size - statusLen(esp)] != 0)
+            return SERIAL_ERR_NACK;
+
+        if (data != NULL)
+            *data = p + 8;
+        if (dataLen != NULL)
+            *dataLen = size - statusLen(esp);
+
+        return SERIAL_ERR_OK;
+    }
+}
+
+
+static serial_port_err_t command(esp_loader_t *esp, uint8_t op, const uint8_t *data, uint32_t len, uint32_t checksum,
+                                 uint32_t timeoutMs, const uint8_t **reply, uint32_t *replyLen)
+{
+    static const uint32_t maxPayload = ESP_MAX_PACKET - 8;
+    uint8_t packet[ESP_MAX_PACKET];
+    uint8_t encoded[SLIP_ENCODED_MAX(ESP_MAX_PACKET)];
+
+    if (len > maxPayload)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    /* direction 0, command, 16 bit size, 32 bit checksum, payload */
+    packet[0] = 0x00;
+    packet[1] = op;
+    packet[2] = (uint8_t)len;
+    packet[3] = (uint8_t)(len >> 8);
+    putLe32(packet + 4, checksum);
+    memcpy(packet + 8, data, len);
+
+    size_t encodedLen = slipEncode(packet, 8 + len, encoded);
+
+    serial_port_err_t err = serialPortWrite(esp->port, encoded, encodedLen);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    return readResponse(esp, op, timeoutMs, reply, replyLen);
+}
+
+
+static void resetInput(esp_loader_t *esp)
+{
+    PurgeComm(esp->port->handle, PURGE_RXCLEAR);
+    esp->port->rxPendingLen = 0;
+    esp->rxLen = 0;
+    esp->rxPos = 0;
+    slipDecoderInit(&esp->decoder, esp->packet, sizeof(esp->packet));
+}
+
+
+serial_port_err_t espConnect(esp_loader_t *esp, serial_port_t *port, esp_chip_t chip)
+{
+    uint8_t sync[36] = { 0x07, 0x07, 0x12, 0x20 };
+
+    memset(esp, 0, sizeof(*esp));
+    esp->port = port;
+    esp->chip = chip;
+    esp->commandTimeout = 3000;
+
+    memset(sync + 4, 0x55, sizeof(sync) - 4);
+
+    for (int attempt = 0; attempt < 5; attempt++)
+    {
+        /* EN low with GPIO0 high, then GPIO0 low while EN is released: boot into the ROM loader */
+        EscapeCommFunction(port->handle, CLRDTR);
+        EscapeCommFunction(port->handle, SETRTS);
+        Sleep(100);
+        EscapeCommFunction(port->handle, SETDTR);
+        EscapeCommFunction(port->handle, CLRRTS);
+        Sleep(50);
+        EscapeCommFunction(port->handle, CLRDTR);
+
+        resetInput(esp);
+
+        for (int retry = 0; retry < 5; retry++)
+        {
+            if (command(esp, ESP_SYNC, sync, sizeof(sync), 0, 100, NULL, NULL) == SERIAL_ERR_OK)
+            {
+                /* the ROM answers one SYNC with several replies, drop the rest */
+                Sleep(50);
+                resetInput(esp);
+                return SERIAL_ERR_OK;
+            }
+        }
+    }
+
+    return SERIAL_ERR_READ_TIMEOUT;
+}
+
+
+serial_port_err_t espChangeBaud(esp_loader_t *esp, uint32_t baud)
+{
+    uint8_t params[8];
+
+    /* new rate, then the current rate which the ROM expects as 0 */
+    putLe32(params, baud);
+    putLe32(params + 4, 0);
+
+    serial_port_err_t err = command(esp, ESP_CHANGE_BAUDRATE, params, sizeof(params), 0, esp->commandTimeout, NULL, NULL);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    if (setBaud(esp->port, baud) != SERIAL_ERR_OK)
+        return SERIAL_ERR_UNKNOWN;
+
+    /* let the ROM switch over and throw away anything garbled by the change */
+    Sleep(50);
+    resetInput(esp);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t espAttachFlash(esp_loader_t *esp, uint32_t flashSize)
+{
+    uint8_t attach[8] = {0};
+    uint8_t params[24];
+
+    if (esp->chip == ESP_CHIP_ESP8266)
+        return SERIAL_ERR_OK;
+
+    serial_port_err_t err = command(esp, ESP_SPI_ATTACH, attach, sizeof(attach), 0, esp->commandTimeout, NULL, NULL);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    /* id, total size, block, sector and page size, status mask */
+    putLe32(params, 0);
+    putLe32(params + 4, flashSize);
+    putLe32(params + 8, 64 * 1024);
+    putLe32(params + 12, ESP_SECTOR_SIZE);
+    putLe32(params + 16, 256);
+    putLe32(params + 20, 0xFFFF);
+
+    return command(esp, ESP_SPI_SET_PARAMS, params, sizeof(params), 0, esp->commandTimeout, NULL, NULL);
+}
+
+
+/* commands whose work grows with the data get esptool's allowance per MB, never less than an ordinary one */
+static uint32_t timeoutPerMb(const esp_loader_t *esp, uint32_t msPerMb, uint64_t size)
+{
+    uint64_t timeout = (uint64_t)msPerMb * size / 1000000;
+
+    return timeout > esp->commandTimeout ? (uint32_t)timeout : esp->commandTimeout;
+}
+
+
+serial_port_err_t espFlashMd5(esp_loader_t *esp, uint32_t offset, uint32_t len, uint8_t md5[16])
+{
+    uint8_t params[16] = {0};
+    const uint8_t *reply;
+    uint32_t replyLen;
+
+    putLe32(params, offset);
+    putLe32(params + 4, len);
+
+    /* hashing runs at flash read speed */
+    serial_port_err_t err = command(esp, ESP_SPI_FLASH_MD5, params, sizeof(params), 0,
+                                    timeoutPerMb(esp, ESP_MD5_MS_PER_MB, len), &reply, &replyLen);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    /* the ROM reports 32 hex digits, a flasher stub 16 raw bytes */
+    if (replyLen >= 32)
+        return hexDecode((const char*)reply, 16, md5) == 0 ? SERIAL_ERR_OK : SERIAL_ERR_FRAME;
+    if (replyLen >= 16)
+    {
+        memcpy(md5, reply, 16);
+        return SERIAL_ERR_OK;
+    }
+
+    return SERIAL_ERR_FRAME;
+}
+
+
+/* the ESP8266 ROM erases more than asked for, esptool's compensation of that bug */
+static uint32_t esp8266EraseSize(uint32_t offset, uint32_t size)
+{
+    uint32_t sectorsPerBlock = 16;
+    uint32_t numSectors = (size + ESP_SECTOR_SIZE - 1) / ESP_SECTOR_SIZE;
+    uint32_t startSector = offset / ESP_SECTOR_SIZE;
+    uint32_t headSectors = sectorsPerBlock - (startSector % sectorsPerBlock);
+
+    if (numSectors < headSectors)
+        headSectors = numSectors;
+
+    if (numSectors < 2 * headSectors)
+        return (numSectors + 1) / 2 * ESP_SECTOR_SIZE;
+
+    return (numSectors - headSectors) * ESP_SECTOR_SIZE;
+}
+
+
+static serial_port_err_t sendBlocks(esp_loader_t *esp, uint8_t op, const uint8_t *data, size_t len, int pad,
+                                    size_t rawTotal, esp_progress_t progress, void *context)
+{
+    uint8_t payload[16 + ESP_FLASH_BLOCK_SIZE];
+    uint32_t seq = 0;
+
+    for (size_t pos = 0; pos < len; pos += ESP_FLASH_BLOCK_SIZE, seq++)
+    {
+        uint32_t n = (uint32_t)(len - pos < ESP_FLASH_BLOCK_SIZE ? len - pos : ESP_FLASH_BLOCK_SIZE);
+        uint32_t blockLen = pad ? ESP_FLASH_BLOCK_SIZE : n;
+        uint8_t checksum = ESP_CHECKSUM_SEED;
+
+        /* data size, sequence number, two reserved words, data */
+        putLe32(payload, blockLen);
+        putLe32(payload + 4, seq);
+        putLe32(payload + 8, 0);
+        putLe32(payload + 12, 0);
+        memcpy(payload + 16, data + pos, n);
+        memset(payload + 16 + n, 0xFF, blockLen - n);
+
+        for (uint32_t i = 0; i < blockLen; i++)
+            checksum ^= payload[16 + i];
+
+        /*
+         * the ROM answers once the block is in flash; how much a compressed block inflates to is not
+         * known without inflating it, so the allowance covers deflate's densest case, capped by the image
+         */
+        uint64_t written = pad ? blockLen : (uint64_t)n * ESP_DEFLATE_MAX_RATIO;
+        if (written > rawTotal)
+            written = rawTotal;
+        uint32_t timeout = timeoutPerMb(esp, ESP_WRITE_MS_PER_MB, written);
+
+        serial_port_err_t err = command(esp, op, payload, 16 + blockLen, checksum, timeout, NULL, NULL);
+        if (err != SERIAL_ERR_OK)
+            return err;
+
+        if (progress != NULL)
+        {
+            /* compressed progress is scaled to the raw image */
+            size_t done = pos + n;
+            progress(pad ? done : (size_t)((uint64_t)done * rawTotal / len), rawTotal, context);
+        }
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t espFlashImage(esp_loader_t *esp, uint32_t offset, esp_image_t *image, esp_progress_t progress, void *context)
+{
+    uint8_t params[20];
+    uint32_t paramsLen = 16;
+    uint8_t md5[16];
+    ULONGLONG start;
+    serial_port_err_t err;
+
+    if ((err = espImageWait(image)) != SERIAL_ERR_OK)
+        return err;
+
+    start = GetTickCount64();
+
+    uint32_t size = (uint32_t)image->paddedLen;
+    uint32_t eraseTimeout = (uint32_t)((uint64_t)ESP_ERASE_MS_PER_MB * (size + 0xFFFFF) / 0x100000);
+    if (eraseTimeout < esp->commandTimeout)
+        eraseTimeout = esp->commandTimeout;
+
+    if (esp->chip == ESP_CHIP_ESP8266)
+    {
+        /* the ESP8266 ROM cannot inflate, send plain blocks */
+        uint32_t blocks = (size + ESP_FLASH_BLOCK_SIZE - 1) / ESP_FLASH_BLOCK_SIZE;
+
+        putLe32(params, esp8266EraseSize(offset, size));
+        putLe32(params + 4, blocks);
+        putLe32(params + 8, ESP_FLASH_BLOCK_SIZE);
+        putLe32(params + 12, offset);
+
+        if ((err = command(esp, ESP_FLASH_BEGIN, params, paramsLen, 0, eraseTimeout, NULL, NULL)) != SERIAL_ERR_OK ||
+            (err = sendBlocks(esp, ESP_FLASH_DATA, image->data, image->len, 1, image->len, progress, context)) != SERIAL_ERR_OK)
+            return err;
+    }
+    else
+    {
+        uint32_t blocks = (uint32_t)((image->compressedLen + ESP_FLASH_BLOCK_SIZE - 1) / ESP_FLASH_BLOCK_SIZE);
+
+        /* uncompressed size to erase, whole blocks as esptool sends it to the ROM; compressed block count, block size, offset */
+        putLe32(params, (size + ESP_FLASH_BLOCK_SIZE - 1) / ESP_FLASH_BLOCK_SIZE * ESP_FLASH_BLOCK_SIZE);
+        putLe32(params + 4, blocks);
+        putLe32(params + 8, ESP_FLASH_BLOCK_SIZE);
+        putLe32(params + 12, offset);
+
+        /* newer ROMs also take the flash encryption flag */
+        if (esp->chip != ESP_CHIP_ESP32)
+        {
+            putLe32(params + 16, 0);
+            paramsLen = 20;
+        }
+
+        if ((err = command(esp, ESP_FLASH_DEFL_BEGIN, params, paramsLen, 0, eraseTimeout, NULL, NULL)) != SERIAL_ERR_OK ||
+            (err = sendBlocks(esp, ESP_FLASH_DEFL_DATA, image->compressed, image->compressedLen, 0, image->len, progress, context)) != SERIAL_ERR_OK)
+            return err;
+
+        /* the ESP8266 ROM has no MD5 command, the others hash what they wrote */
+        if ((err = espFlashMd5(esp, offset, size, md5)) != SERIAL_ERR_OK)
+            return err;
+
+        if (memcmp(md5, image->md5, sizeof(md5)) != 0)
+            return SERIAL_ERR_CHECKSUM;
+    }
+
+    esp->elapsedMs = GetTickCount64() - start;
+    esp->bytesPerSecond = esp->elapsedMs > 0 ? image->len * 1000 / esp->elapsedMs : 0;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t espReboot(esp_loader_t *esp)
+{
+    /* pulse EN with GPIO0 released */
+    EscapeCommFunction(esp->port->handle, CLRDTR);
+    EscapeCommFunction(esp->port->handle, SETRTS);
+    Sleep(100);
+    EscapeCommFunction(esp->port->handle, CLRRTS);
+
+    return SERIAL_ERR_OK;
+}
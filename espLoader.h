@@ -0,0 +1,202 @@
+/**
+ * @file espLoader.h
+ * @brief Espressif ROM serial loader: SLIP framed commands, baud switching and compressed flashing.
+ * 
+ * Talks to the ESP8266 / ESP32 family boot ROM directly over a serial port. Images are compressed
+ * on a worker thread as soon as they are prepared, so compression overlaps with resetting,
+ * synchronising and switching the baud rate of the device. Compressed images are sent with
+ * FLASH_DEFL_DATA (the ESP8266 ROM, which cannot inflate, gets plain FLASH_DATA blocks) and the
+ * result is checked against the MD5 the ROM computes over the written flash region.
+ * 
+ * Loader contexts share nothing, so any number of devices can be flashed in parallel from one
+ * process, one thread per device, and a prepared image may be shared by all of them.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef ESPLOADER_H
+#define ESPLOADER_H
+
+#include "serialPort.h"
+#include "slip.h"
+
+/**
+ * @defgroup esp_functions ESP Loader
+ * @ingroup functions
+ * @brief Flashing Espressif chips through the ROM serial loader.
+ */
+
+#define ESP_ROM_BAUD            115200  /**< Baud rate of the ROM loader after reset. */
+#define ESP_FLASH_BLOCK_SIZE    0x400   /**< Flash data block size accepted by the ROM loaders. */
+#define ESP_MAX_PACKET          (8 + 16 + ESP_FLASH_BLOCK_SIZE)
+
+/**
+ * @enum esp_chip_t
+ * @brief Chip family, selecting the command variants the ROM understands.
+ * 
+ * @ingroup enums
+ */
+typedef enum {
+    ESP_CHIP_ESP8266,           /**< No compressed flashing, 2 status bytes. */
+    ESP_CHIP_ESP32,             /**< Compressed flashing, 4 status bytes. */
+    ESP_CHIP_ESP32S2,           /**< As ESP32, FLASH_BEGIN takes an encryption flag. */
+    ESP_CHIP_ESP32S3,           /**< As ESP32S2. */
+    ESP_CHIP_ESP32C3            /**< As ESP32S2. */
+} esp_chip_t;
+
+/**
+ * @struct esp_image_t
+ * @brief An image prepared for flashing: compressed and hashed on a worker thread.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    const uint8_t *data;        /**< Raw image, owned by the caller. */
+    size_t len;                 /**< Length of data. */
+    uint8_t *compressed;        /**< zlib stream of data. */
+    size_t compressedLen;       /**< Length of compressed. */
+    uint8_t md5[16];            /**< MD5 of data, padded to the flash block size as written. */
+    size_t paddedLen;           /**< Length the MD5 covers. */
+    HANDLE worker;              /**< Thread compressing the image. */
+    serial_port_err_t status;   /**< Result of the preparation, valid after espImageWait. */
+} esp_image_t;
+
+/** @brief Progress callback, called after each flash block. */
+typedef void (*esp_progress_t)(size_t bytesDone, size_t bytesTotal, void *context);
+
+/**
+ * @struct esp_loader_t
+ * @brief Connection to an Espressif ROM loader.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;        /**< Port connected to the chip's UART0. */
+    esp_chip_t chip;            /**< Chip family. */
+    uint32_t commandTimeout;    /**< Timeout for ordinary commands in milliseconds. */
+    slip_decoder_t decoder;     /**< Response decoder. */
+    uint8_t packet[ESP_MAX_PACKET]; /**< Decoded response packet. */
+    uint8_t rx[512];            /**< Received bytes not yet decoded. */
+    uint32_t rxLen;             /**< Valid bytes in rx. */
+    uint32_t rxPos;             /**< Decode position in rx. */
+    uint64_t elapsedMs;         /**< Duration of the last espFlashImage. */
+    uint64_t bytesPerSecond;    /**< Effective throughput (uncompressed bytes) of the last espFlashImage. */
+} esp_loader_t;
+
+/**
+ * @brief Starts compressing and hashing an image on a worker thread.
+ * 
+ * @param[out] image Image to prepare.
+ * @param[in] data Raw image; must stay valid until espImageFree.
+ * @param[in] len Length of data.
+ * 
+ * @return SERIAL_ERR_OK if the worker started, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup esp_functions
+ */
+serial_port_err_t espImagePrepare(esp_image_t *image, const uint8_t *data, size_t len);
+
+/**
+ * @brief Waits for the worker of a prepared image.
+ * 
+ * @return The preparation result.
+ *
+ * @ingroup esp_functions
+ */
+serial_port_err_t espImageWait(esp_image_t *image);
+
+/**
+ * @brief Releases the compressed copy of an image.
+ * 
+ * @ingroup esp_functions
+ */
+void espImageFree(esp_image_t *image);
+
+/**
+ * @brief Resets the chip into the ROM loader through DTR/RTS and synchronises with it.
+ * 
+ * Uses the usual auto-reset wiring (RTS to EN, DTR to GPIO0). The port must be opened at ESP_ROM_BAUD.
+ * 
+ * @param[out] esp Pointer to the loader connection.
+ * @param[in] port Opened serial port.
+ * @param[in] chip Chip family.
+ * 
+ * @return SERIAL_ERR_OK if the ROM answered SYNC, otherwise SERIAL_ERR_READ_TIMEOUT.
+ *
+ * @ingroup esp_functions
+ * 
+ * ### Example
+ * Below is an example that flashes an application image at 0x10000 at 2 Mbaud.
+ * @code
+ * serial_port_t myPort;
+ * esp_loader_t esp;
+ * esp_image_t image;
+ * int main(){
+ *  espImagePrepare(&image, appBin, appLen);                 // compression starts right away
+ *  if(serialPortOpen(&myPort, "COM9", ESP_ROM_BAUD, 100, 1000) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(espConnect(&esp, &myPort, ESP_CHIP_ESP32) != SERIAL_ERR_OK ||
+ *     espChangeBaud(&esp, 2000000) != SERIAL_ERR_OK ||
+ *     espAttachFlash(&esp, 4 * 1024 * 1024) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(espFlashImage(&esp, 0x10000, &image, NULL, NULL) != SERIAL_ERR_OK)
+ *      return -1;
+ *  espImageFree(&image);
+ *  return espReboot(&esp);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t espConnect(esp_loader_t *esp, serial_port_t *port, esp_chip_t chip);
+
+/**
+ * @brief Switches loader and port to a new baud rate with CHANGE_BAUDRATE.
+ * 
+ * @ingroup esp_functions
+ */
+serial_port_err_t espChangeBaud(esp_loader_t *esp, uint32_t baud);
+
+/**
+ * @brief Attaches the SPI flash and configures its size (no-op on the ESP8266).
+ * 
+ * @ingroup esp_functions
+ */
+serial_port_err_t espAttachFlash(esp_loader_t *esp, uint32_t flashSize);
+
+/**
+ * @brief Writes a prepared image to flash and verifies it by MD5.
+ * 
+ * Waits for the image's worker if compression is still running.
+ * 
+ * @param[in] esp Pointer to the loader connection.
+ * @param[in] offset Flash offset, a multiple of 4 KiB.
+ * @param[in] image Prepared image.
+ * @param[in] progress Optional progress callback, may be NULL.
+ * @param[in] context User pointer passed to progress.
+ * 
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_CHECKSUM if the MD5 does not match,
+ *         otherwise the failing command's error.
+ *
+ * @ingroup esp_functions
+ */
+serial_port_err_t espFlashImage(esp_loader_t *esp, uint32_t offset, esp_image_t *image, esp_progress_t progress, void *context);
+
+/**
+ * @brief Reads the MD5 of a flash region as computed by the ROM.
+ * 
+ * @ingroup esp_functions
+ */
+serial_port_err_t espFlashMd5(esp_loader_t *esp, uint32_t offset, uint32_t len, uint8_t md5[16]);
+
+/**
+ * @brief Leaves the loader and runs the application through an EN reset.
+ * 
+ * @ingroup esp_functions
+ */
+serial_port_err_t espReboot(esp_loader_t *esp);
+
+#endif
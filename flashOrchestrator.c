@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "flashOrchestrator.h"
+#include "serialAlloc.h"
+
+
+#define FLASH_ESP_DEFAULT_SIZE  (4u * 1024 * 1024)
+#define FLASH_ESP_SECTOR        4096u
+
+
+/* per device context of the loader progress callbacks and the image source */
+typedef struct {
+    flash_orchestrator_t *orchestrator;
+    flash_device_t *device;
+    uint32_t segment;           /* segment being streamed */
+    uint32_t pos;               /* read position in that segment */
+    uint64_t base;              /* image bytes of the segments before it */
+} flash_job_t;
+
+
+/* ---- image ---- */
+
+/* appends data at address, extending the last segment when it is contiguous */
+static serial_port_err_t appendData(flash_image_t *image, uint32_t address, const uint8_t *data, uint32_t len)
+{
+    flash_segment_t *last = image->segmentCount > 0 ? &image->segments[image->segmentCount - 1] : NULL;
+
+    if (last == NULL || last->address + last->len != address)
+    {
+        /* the segment table grows in steps, segments themselves by doubling */
+        if (image->segmentCount % 16 == 0)
+        {
+            flash_segment_t *segments = serialRealloc(image->segments, image->segmentCount * sizeof(*segments),
+                                                      (image->segmentCount + 16) * sizeof(*segments));
+            if (segments == NULL)
+                return SERIAL_ERR_UNKNOWN;
+            image->segments = segments;
+        }
+
+        last = &image->segments[image->segmentCount++];
+        memset(last, 0, sizeof(*last));
+        last->address = address;
+    }
+
+    if (last->len + len > last->capacity)
+    {
+        uint32_t newCapacity = last->capacity > 0 ? last->capacity : 4096;
+        while (newCapacity < last->len + len)
+            newCapacity *= 2;
+
+        uint8_t *grown = serialRealloc(last->data, last->capacity, newCapacity);
+        if (grown == NULL)
+            return SERIAL_ERR_UNKNOWN;
+
+        last->data = grown;
+        last->capacity = newCapacity;
+    }
+
+    memcpy(last->data + last->len, data, len);
+    last->len += len;
+    image->totalLen += len;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t flashImageLoadHex(flash_image_t *image, const char *path)
+{
+    hex_reader_t *reader;
+    hex_segment_t segment;
+    serial_port_err_t err;
+
+    memset(image, 0, sizeof(*image));
+
+    /* the reader carries a segment buffer, keep it off the stack */
+    reader = serialAlloc(sizeof(*reader));
+    if (reader == NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    if ((err = hexReaderOpen(reader, path, HEX_FORMAT_AUTO)) != SERIAL_ERR_OK)
+    {
+        serialFree(reader, sizeof(*reader));
+        return err;
+    }
+
+    while ((err = hexReaderNext(reader, &segment)) == SERIAL_ERR_OK && segment.len > 0)
+    {
+        if ((err = appendData(image, segment.address, segment.data, segment.len)) != SERIAL_ERR_OK)
+            break;
+    }
+
+    hexReaderClose(reader);
+
+    if (err == SERIAL_ERR_OK)
+        image->startAddress = reader->startAddress != 0 ? reader->startAddress :
+                              image->segmentCount > 0 ? image->segments[0].address : 0;
+
+    serialFree(reader, sizeof(*reader));
+
+    if (err != SERIAL_ERR_OK)
+        flashImageFree(image);
+
+    return err;
+}
+
+
+serial_port_err_t flashImageLoadBinary(flash_image_t *image, const char *path, uint32_t baseAddress)
+{
+    uint8_t chunk[4096];
+    uint32_t address = baseAddress;
+    serial_port_err_t err = SERIAL_ERR_OK;
+    size_t got;
+
+    memset(image, 0, sizeof(*image));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    while (err == SERIAL_ERR_OK && (got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        err = appendData(image, address, chunk, (uint32_t)got);
+        address += (uint32_t)got;
+    }
+
+    if (ferror(file))
+        err = SERIAL_ERR_UNKNOWN;
+
+    fclose(file);
+
+    if (err != SERIAL_ERR_OK)
+    {
+        flashImageFree(image);
+        return err;
+    }
+
+    image->startAddress = baseAddress;
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t flashImagePrepareEsp(flash_image_t *image)
+{
+    serial_port_err_t err = SERIAL_ERR_OK;
+
+    if (image->espPrepared)
+        return SERIAL_ERR_OK;
+
+    /* the ROM erases whole sectors from the segment address on, anything unaligned would wipe the data before it */
+    for (uint32_t i = 0; i < image->segmentCount; i++)
+    {
+        if (image->segments[i].address % FLASH_ESP_SECTOR != 0)
+            return SERIAL_ERR_FRAME;
+    }
+
+    /* every segment compresses on its own thread, then all are joined before sharing */
+    for (uint32_t i = 0; i < image->segmentCount; i++)
+        espImagePrepare(&image->segments[i].esp, image->segments[i].data, image->segments[i].len);
+
+    for (uint32_t i = 0; i < image->segmentCount; i++)
+    {
+        serial_port_err_t result = espImageWait(&image->segments[i].esp);
+        if (err == SERIAL_ERR_OK)
+            err = result;
+    }
+
+    image->espPrepared = err == SERIAL_ERR_OK;
+    return err;
+}
+
+
+void flashImageFree(flash_image_t *image)
+{
+    for (uint32_t i = 0; i < image->segmentCount; i++)
+    {
+        espImageFree(&image->segments[i].esp);
+        serialFree(image->segments[i].data, image->segments[i].capacity);
+    }
+
+    serialFree(image->segments, (image->segmentCount + 15) / 16 * 16 * sizeof(*image->segments));
+    memset(image, 0, sizeof(*image));
+}
+
+
+/* ---- workers ---- */
+
+static void setState(flash_job_t *job, flash_state_t state)
+{
+    InterlockedExchange(&job->device->state, state);
+
+    if (job->orchestrator->progress != NULL)
+        job->orchestrator->progress(job->device, job->orchestrator->context);
+}
+
+
+static void reportBytes(flash_job_t *job, uint64_t bytesDone)
+{
+    InterlockedExchange64(&job->device->bytesDone, (LONG64)bytesDone);
+
+    if (job->orchestrator->progress != NULL)
+        job->orchestrator->progress(job->device, job->orchestrator->context);
+}
+
+
+/* stm32 source over the shared image, each device keeps its own cursor */
+static int nextImageBlock(void *context, uint32_t *address, uint8_t *data, uint32_t maxLen)
+{
+    flash_job_t *job = (flash_job_t*)context;
+    const flash_image_t *image = job->orchestrator->image;
+
+    while (job->segment < image->segmentCount && job->pos == image->segments[job->segment].len)
+    {
+        job->segment++;
+        job->pos = 0;
+    }
+
+    if (job->segment == image->segmentCount)
+        return 0;
+
+    const flash_segment_t *segment = &image->segments[job->segment];
+    uint32_t n = segment->len - job->pos;
+    if (n > maxLen)
+        n = maxLen;
+
+    *address = segment->address + job->pos;
+    memcpy(data, segment->data + job->pos, n);
+    job->pos += n;
+
+    return (int)n;
+}
+
+
+static void stm32Progress(uint32_t address, uint64_t bytesDone, void *context)
+{
+    (void)address;
+    reportBytes((flash_job_t*)context, bytesDone);
+}
+
+
+static void espProgress(size_t bytesDone, size_t bytesTotal, void *context)
+{
+    flash_job_t *job = (flash_job_t*)context;
+
+    (void)bytesTotal;
+    reportBytes(job, job->base + bytesDone);
+}
+
+
+static serial_port_err_t flashStm32(flash_job_t *job, serial_port_t *port)
+{
+    stm32_boot_t boot;
+    stm32_source_t source = { nextImageBlock, job };
+    serial_port_err_t err;
+
+    if ((err = stm32Connect(&boot, port)) != SERIAL_ERR_OK)
+        return err;
+
+    setState(job, FLASH_STATE_ERASING);
+    if ((err = stm32MassErase(&boot)) != SERIAL_ERR_OK)
+        return err;
+
+    setState(job, FLASH_STATE_WRITING);
+    if ((err = stm32Flash(&boot, &source, stm32Progress, job)) != SERIAL_ERR_OK)
+        return err;
+
+    return stm32Go(&boot, job->orchestrator->image->startAddress);
+}
+
+
+static serial_port_err_t flashEsp(flash_job_t *job, serial_port_t *port)
+{
+    flash_image_t *image = job->orchestrator->image;
+    flash_device_t *device = job->device;
+    esp_loader_t esp;
+    serial_port_err_t err;
+
+    if ((err = espConnect(&esp, port, device->chip)) != SERIAL_ERR_OK)
+        return err;
+
+    if (device->baud != 0 && device->baud != ESP_ROM_BAUD && (err = espChangeBaud(&esp, device->baud)) != SERIAL_ERR_OK)
+        return err;
+
+    if ((err = espAttachFlash(&esp, device->flashSize != 0 ? device->flashSize : FLASH_ESP_DEFAULT_SIZE)) != SERIAL_ERR_OK)
+        return err;
+
+    /* the ROM erases as part of each begin command */
+    setState(job, FLASH_STATE_WRITING);
+
+    for (uint32_t i = 0; i < image->segmentCount; i++)
+    {
+        flash_segment_t *segment = &image->segments[i];
+
+        if ((err = espFlashImage(&esp, segment->address, &segment->esp, espProgress, job)) != SERIAL_ERR_OK)
+            return err;
+
+        job->base += segment->len;
+    }
+
+    return espReboot(&esp);
+}
+
+
+static void flashDevice(flash_orchestrator_t *orchestrator, flash_device_t *device)
+{
+    flash_job_t job = { orchestrator, device, 0, 0, 0 };
+    serial_port_t port;
+    ULONGLONG start = GetTickCount64();
+    uint32_t baud = device->target == FLASH_TARGET_ESP ? ESP_ROM_BAUD : device->baud;
+
+    setState(&job, FLASH_STATE_CONNECTING);
+
+    serial_port_err_t err = serialPortOpen(&port, device->portName, baud, 50, 1000);
+    if (err == SERIAL_ERR_OK)
+    {
+        err = device->target == FLASH_TARGET_ESP ? flashEsp(&job, &port) : flashStm32(&job, &port);
+        serialPortClose(&port);
+    }
+
+    device->result = err;
+    device->elapsedMs = GetTickCount64() - start;
+    device->bytesPerSecond = device->elapsedMs > 0 ? (uint64_t)device->bytesDone * 1000 / device->elapsedMs : 0;
+
+    setState(&job, err == SERIAL_ERR_OK ? FLASH_STATE_DONE : FLASH_STATE_FAILED);
+}
+
+
+static DWORD WINAPI FlashWorker(LPVOID lpParam)
+{
+    flash_orchestrator_t *orchestrator = (flash_orchestrator_t*)lpParam;
+    LONG index;
+
+    /* devices are claimed one at a time so a slow board never holds up a whole batch */
+    while ((index = InterlockedIncrement(&orchestrator->nextDevice) - 1) < (LONG)orchestrator->deviceCount)
+        flashDevice(orchestrator, &orchestrator->devices[index]);
+
+    return 0;
+}
+
+
+/* ---- orchestration ---- */
+
+serial_port_err_t flashOrchestratorStart(flash_orchestrator_t *orchestrator, flash_image_t *image, flash_device_t *devices,
+                                         uint32_t deviceCount, uint32_t threadCount, flash_progress_t progress, void *context)
+{
+    memset(orchestrator, 0, sizeof(*orchestrator));
+    orchestrator->image = image;
+    orchestrator->devices = devices;
+    orchestrator->deviceCount = deviceCount;
+    orchestrator->progress = progress;
+    orchestrator->context = context;
+
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        devices[i].state = FLASH_STATE_PENDING;
+        devices[i].bytesDone = 0;
+        devices[i].result = SERIAL_ERR_OK;
+
+        /* compress once up front instead of once per device */
+        if (devices[i].target == FLASH_TARGET_ESP)
+        {
+            serial_port_err_t err = flashImagePrepareEsp(image);
+            if (err != SERIAL_ERR_OK)
+                return err;
+        }
+    }
+
+    if (threadCount == 0 || threadCount > deviceCount)
+        threadCount = deviceCount;
+    if (threadCount > FLASH_MAX_THREADS)
+        threadCount = FLASH_MAX_THREADS;
+
+    orchestrator->start = GetTickCount64();
+
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        orchestrator->threads[i] = CreateThread(NULL, 0, FlashWorker, orchestrator, 0, NULL);
+        if (orchestrator->threads[i] == NULL)
+            break;
+        orchestrator->threadCount++;
+    }
+
+    /* a partial pool still drains the whole device list */
+    if (orchestrator->threadCount == 0 && deviceCount > 0)
+        return SERIAL_ERR_UNKNOWN;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t flashOrchestratorWait(flash_orchestrator_t *orchestrator)
+{
+    serial_port_err_t err = SERIAL_ERR_OK;
+    uint64_t totalBytes = 0;
+
+    if (orchestrator->threadCount > 0)
+        WaitForMultipleObjects(orchestrator->threadCount, orchestrator->threads, TRUE, INFINITE);
+
+    for (uint32_t i = 0; i < orchestrator->threadCount; i++)
+        CloseHandle(orchestrator->threads[i]);
+    orchestrator->threadCount = 0;
+
+    for (uint32_t i = 0; i < orchestrator->deviceCount; i++)
+    {
+        totalBytes += (uint64_t)orchestrator->devices[i].bytesDone;
+        if (err == SERIAL_ERR_OK)
+            err = orchestrator->devices[i].result;
+    }
+
+    orchestrator->elapsedMs = GetTickCount64() - orchestrator->start;
+    orchestrator->bytesPerSecond = orchestrator->elapsedMs > 0 ? totalBytes * 1000 / orchestrator->elapsedMs : 0;
+
+    return err;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file flashOrchestrator.h
+ * @brief Flashing one image into many devices on many ports at once.
+ *
+ * The image is parsed once into memory and, when ESP targets are present, compressed once; every
+ * device then streams from the same read-only copy. Devices are handed out to a small pool of
+ * worker threads which run the STM32 or ESP loader protocol and publish per-device state and
+ * progress, so a production fixture with dozens of adapters runs from a single process at close
+ * to the single device throughput on every port.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef FLASHORCHESTRATOR_H
+#define FLASHORCHESTRATOR_H
+
+#include <windows.h>
+#include "serialPort.h"
+#include "hexRecord.h"
+#include "stm32Boot.h"
+#include "espLoader.h"
+
+/**
+ * @defgroup flash_functions Flash Orchestrator
+ * @ingroup functions
+ * @brief Parallel flashing of many devices.
+ */
+
+#define FLASH_MAX_THREADS   MAXIMUM_WAIT_OBJECTS    /**< Largest worker pool. */
+
+/**
+ * @struct flash_segment_t
+ * @brief A contiguous piece of the image.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t address;           /**< Target address of data[0]. */
+    uint32_t len;               /**< Bytes in data. */
+    uint8_t *data;              /**< Segment data. */
+    uint32_t capacity;          /**< Allocated size of data. */
+    esp_image_t esp;            /**< Compressed form for ESP targets, valid after flashImagePrepareEsp. */
+} flash_segment_t;
+
+/**
+ * @struct flash_image_t
+ * @brief An image parsed once and shared read-only by all devices.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    flash_segment_t *segments;  /**< Segments in file order. */
+    uint32_t segmentCount;      /**< Number of segments. */
+    uint64_t totalLen;          /**< Sum of all segment lengths. */
+    uint32_t startAddress;      /**< Entry point from the image, or the first segment's address. */
+    int espPrepared;            /**< Non-zero once every segment has been compressed. */
+} flash_image_t;
+
+/**
+ * @enum flash_target_t
+ * @brief Loader protocol spoken by a device.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    FLASH_TARGET_STM32,         /**< STM32 USART system bootloader. */
+    FLASH_TARGET_ESP,           /**< ESP8266 / ESP32 ROM loader. */
+} flash_target_t;
+
+/**
+ * @enum flash_state_t
+ * @brief Progress of a single device.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    FLASH_STATE_PENDING,        /**< Waiting for a worker. */
+    FLASH_STATE_CONNECTING,     /**< Opening the port and synchronising with the loader. */
+    FLASH_STATE_ERASING,        /**< Erasing flash. */
+    FLASH_STATE_WRITING,        /**< Streaming the image. */
+    FLASH_STATE_DONE,           /**< Flashed and started. */
+    FLASH_STATE_FAILED,         /**< Gave up, see result. */
+} flash_state_t;
+
+/**
+ * @struct flash_device_t
+ * @brief One device of a flashing run; the caller fills in the settings, the workers the results.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    const char *portName;       /**< Port the device is connected to, e.g. "\\\\.\\COM12". */
+    flash_target_t target;      /**< Loader protocol. */
+    esp_chip_t chip;            /**< Chip family for FLASH_TARGET_ESP. */
+    uint32_t baud;              /**< STM32: bootloader baud rate. ESP: rate switched to after sync, 0 keeps ESP_ROM_BAUD. */
+    uint32_t flashSize;         /**< ESP flash size in bytes, 0 for 4 MB. */
+    volatile LONG state;        /**< Current flash_state_t. */
+    volatile LONG64 bytesDone;  /**< Image bytes written so far. */
+    serial_port_err_t result;   /**< Outcome once state is FLASH_STATE_DONE or FLASH_STATE_FAILED. */
+    uint64_t elapsedMs;         /**< Time spent on this device. */
+    uint64_t bytesPerSecond;    /**< Effective throughput of this device. */
+} flash_device_t;
+
+/** @brief Progress callback, called from worker threads whenever a device advances. */
+typedef void (*flash_progress_t)(const flash_device_t *device, void *context);
+
+/**
+ * @struct flash_orchestrator_t
+ * @brief A running parallel flashing job.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    flash_image_t *image;               /**< Shared image. */
+    flash_device_t *devices;            /**< Devices to flash. */
+    uint32_t deviceCount;               /**< Number of devices. */
+    flash_progress_t progress;          /**< Optional progress callback. */
+    void *context;                      /**< User pointer passed to progress. */
+    volatile LONG nextDevice;           /**< Index of the next device to hand out. */
+    HANDLE threads[FLASH_MAX_THREADS];  /**< Worker pool. */
+    uint32_t threadCount;               /**< Workers in the pool. */
+    ULONGLONG start;                    /**< Tick count at flashOrchestratorStart. */
+    uint64_t elapsedMs;                 /**< Duration of the whole run, valid after flashOrchestratorWait. */
+    uint64_t bytesPerSecond;            /**< Aggregate throughput over all devices. */
+} flash_orchestrator_t;
+
+/**
+ * @brief Loads an Intel HEX or S-record file into a shared image.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_FRAME or SERIAL_ERR_CHECKSUM for a malformed
+ *         file, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup flash_functions
+ */
+serial_port_err_t flashImageLoadHex(flash_image_t *image, const char *path);
+
+/**
+ * @brief Loads a raw binary file into a shared image at a base address.
+ *
+ * @ingroup flash_functions
+ */
+serial_port_err_t flashImageLoadBinary(flash_image_t *image, const char *path, uint32_t baseAddress);
+
+/**
+ * @brief Compresses every segment for the ESP loader, in parallel.
+ *
+ * Called by flashOrchestratorStart when ESP devices are present; calling it earlier overlaps the
+ * compression with other setup.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_FRAME if a segment does not start on a 4 KiB
+ *         flash sector, otherwise the compression error.
+ *
+ * @ingroup flash_functions
+ */
+serial_port_err_t flashImagePrepareEsp(flash_image_t *image);
+
+/**
+ * @brief Releases the memory of an image.
+ *
+ * @ingroup flash_functions
+ */
+void flashImageFree(flash_image_t *image);
+
+/**
+ * @brief Starts flashing all devices on a pool of worker threads.
+ *
+ * @param[out] orchestrator Pointer to the job.
+ * @param[in] image Shared image; must stay valid until flashOrchestratorWait returns.
+ * @param[in,out] devices Devices to flash.
+ * @param[in] deviceCount Number of devices.
+ * @param[in] threadCount Workers to use, 0 for one per device; capped at FLASH_MAX_THREADS.
+ * @param[in] progress Optional progress callback, may be NULL.
+ * @param[in] context User pointer passed to progress.
+ *
+ * @return SERIAL_ERR_OK if the workers were started, the error of flashImagePrepareEsp if ESP
+ *         devices are present and the image cannot be prepared, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup flash_functions
+ *
+ * ### Example
+ * Below is an example that flashes the same image into four boards.
+ * @code
+ * flash_image_t image;
+ * flash_orchestrator_t job;
+ * flash_device_t boards[4] = {
+ *     { "COM3", FLASH_TARGET_STM32, 0, 115200 }, { "COM4", FLASH_TARGET_STM32, 0, 115200 },
+ *     { "COM5", FLASH_TARGET_STM32, 0, 115200 }, { "COM6", FLASH_TARGET_STM32, 0, 115200 },
+ * };
+ * int main(){
+ *  if(flashImageLoadHex(&image, "firmware.hex") != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(flashOrchestratorStart(&job, &image, boards, 4, 0, NULL, NULL) != SERIAL_ERR_OK)
+ *      return -1;
+ *  serial_port_err_t err = flashOrchestratorWait(&job);
+ *  printf("%llu B/s in total\n", job.bytesPerSecond);
+ *  flashImageFree(&image);
+ *  return err;
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t flashOrchestratorStart(flash_orchestrator_t *orchestrator, flash_image_t *image, flash_device_t *devices,
+                                         uint32_t deviceCount, uint32_t threadCount, flash_progress_t progress, void *context);
+
+/**
+ * @brief Waits until every device is done or failed.
+ *
+ * @return SERIAL_ERR_OK if all devices were flashed, otherwise the result of the first failed device.
+ *
+ * @ingroup flash_functions
+ */
+serial_port_err_t flashOrchestratorWait(flash_orchestrator_t *orchestrator);
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * @file hdlc.h
+ * @brief HDLC-like framing (RFC 1662 octet stuffing with FCS-16).
+ *
+ * Frames are delimited by flag bytes; flag and escape bytes inside the frame are sent as the
+ * escape byte followed by the original byte XOR 0x20. Every frame ends with the 16 bit frame check
+ * sequence of its payload, so corrupted frames are detected rather than delivered. No address,
+ * control or protocol fields are added. The decoder is incremental and can be fed received data
+ * in any chunk size.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef HDLC_H
+#define HDLC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup hdlc_functions HDLC
+ * @ingroup functions
+ * @brief HDLC-like packet framing.
+ */
+
+#define HDLC_FLAG               0x7E
+#define HDLC_ESC                0x7D
+#define HDLC_ESC_XOR            0x20
+#define HDLC_FCS_INIT           0xFFFF
+#define HDLC_FCS_GOOD           0xF0B8  /**< FCS over a frame including its own FCS bytes. */
+
+/** @brief Worst case size of an encoded frame. */
+#define HDLC_ENCODED_MAX(len)   (2 * ((len) + 2) + 2)
+
+/**
+ * @struct hdlc_decoder_t
+ * @brief Incremental HDLC decoder writing into a caller supplied buffer.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t *buf;               /**< Frame buffer, must hold the payload and the 2 FCS bytes. */
+    size_t capacity;            /**< Size of buf. */
+    size_t len;                 /**< Bytes of the current frame in buf; the payload length once complete. */
+    uint8_t escaped;            /**< The previous byte was ESC. */
+    uint8_t overflow;           /**< The current frame did not fit and will be dropped. */
+    uint8_t complete;           /**< buf holds a complete frame with a good FCS. */
+    uint32_t errors;            /**< Frames dropped for a bad FCS or for not fitting. */
+} hdlc_decoder_t;
+
+/**
+ * @brief Updates a frame check sequence with more data.
+ *
+ * @param[in] fcs Running value, HDLC_FCS_INIT for a new frame.
+ * @param[in] data Bytes to add.
+ * @param[in] len Number of bytes.
+ *
+ * @return The updated value.
+ *
+ * @ingroup hdlc_functions
+ */
+uint16_t hdlcFcs(uint16_t fcs, const uint8_t *data, size_t len);
+
+/**
+ * @brief Encodes a frame, including the FCS and the leading and trailing flags.
+ *
+ * @param[in] src Payload to encode.
+ * @param[in] len Length of src.
+ * @param[out] dst Buffer of at least HDLC_ENCODED_MAX(len) bytes.
+ *
+ * @return Length of the encoded frame.
+ *
+ * @ingroup hdlc_functions
+ */
+size_t hdlcEncode(const uint8_t *src, size_t len, uint8_t *dst);
+
+/**
+ * @brief Initialises a decoder.
+ *
+ * @ingroup hdlc_functions
+ */
+void hdlcDecoderInit(hdlc_decoder_t *decoder, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Feeds received bytes until a frame completes.
+ *
+ * When a frame with a good FCS completes, decoding stops after its closing flag,
+ * decoder->complete is set and the payload is in decoder->buf, without the FCS. The next call
+ * starts a new frame. Empty frames are skipped; frames with a bad FCS and oversized frames are
+ * dropped and counted in decoder->errors.
+ *
+ * @param[in] decoder Pointer to the decoder.
+ * @param[in] data Received bytes.
+ * @param[in] len Number of bytes.
+ *
+ * @return Number of bytes consumed.
+ *
+ * @ingroup hdlc_functions
+ */
+size_t hdlcDecode(hdlc_decoder_t *decoder, const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "hexCodec.h"
+#include "serialSimd.h"
+
+
+static const char hexUpper[] = "0123456789ABCDEF";
+static const char hexLower[] = "0123456789abcdef";
+
+
+int hexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    /* folding to lower case maps 'A'-'F' onto 'a'-'f' */
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+
+void hexEncode(const uint8_t *src, size_t len, char *dst, int upperCase)
+{
+    const char *digits = upperCase ? hexUpper : hexLower;
+
+#ifdef SERIAL_SSE2
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    /* distance from '9' + 1 to 'A' or 'a' */
+    const __m128i letterGap = _mm_set1_epi8(upperCase ? 'A' - '0' - 10 : 'a' - '0' - 10);
+
+    while (len >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)src);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask);
+        __m128i lo = _mm_and_si128(bytes, nibbleMask);
+
+        /* nibble + '0', plus the letter gap for nibbles above 9 */
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letterGap));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letterGap));
+
+        /* interleave so that the high digit of every byte comes first */
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+
+        src += 16;
+        dst += 32;
+        len -= 16;
+    }
+#endif
+
+    while (len--)
+    {
+        *dst++ = digits[*src >> 4];
+        *dst++ = digits[*src & 0x0F];
+        src++;
+    }
+}
+
+
+#ifdef SERIAL_SSE2
+/* converts 16 hex characters to their nibble values, returns 0 if any is not a hex digit */
+static int decodeNibbles(__m128i chars, __m128i *values)
+{
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i ten = _mm_set1_epi8(10);
+
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+
+    /* unsigned range checks: x <= n  <=>  min(x, n) == x */
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, five), letter);
+
+    *values = _mm_or_si128(_mm_and_si128(isDigit, digit),
+                           _mm_and_si128(isLetter, _mm_add_epi8(letter, ten)));
+
+    return _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) == 0xFFFF;
+}
+
+
+/* packs 16 nibbles, high nibble first, into 8 bytes held in the low half of each 16 bit lane */
+static __m128i packNibbles(__m128i values)
+{
+    __m128i hi = _mm_and_si128(_mm_slli_epi16(values, 4), _mm_set1_epi16(0x00F0));
+    __m128i lo = _mm_srli_epi16(values, 8);
+
+    return _mm_or_si128(hi, lo);
+}
+#endif
+
+
+int hexDecode(const char *src, size_t len, uint8_t *dst)
+{
+#ifdef SERIAL_SSE2
+    while (len >= 16)
+    {
+        __m128i first, second;
+
+        if (!decodeNibbles(_mm_loadu_si128((const __m128i*)src), &first) ||
+            !decodeNibbles(_mm_loadu_si128((const __m128i*)(src + 16)), &second))
+            return -1;
+
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(packNibbles(first), packNibbles(second)));
+
+        src += 32;
+        dst += 16;
+        len -= 16;
+    }
+#endif
+
+    while (len--)
+    {
+        int hi = hexDigitValue(src[0]);
+        int lo = hexDigitValue(src[1]);
+
+        if (hi < 0 || lo < 0)
+            return -1;
+
+        *dst++ = (uint8_t)((hi << 4) | lo);
+        src += 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file hexCodec.h
+ * @brief Fast conversion between binary data and ASCII hexadecimal text.
+ * 
+ * Several of the ASCII protocols carried over serial ports (Modbus ASCII, SLCAN, Intel HEX, trace logs)
+ * spend most of their time converting between bytes and hex digits. These routines convert 16 bytes
+ * per step using SSE2 when the compiler targets it and fall back to a table driven loop otherwise.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef HEXCODEC_H
+#define HEXCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup hex_functions Hex Conversion
+ * @ingroup functions
+ * @brief Binary to hexadecimal text conversion helpers.
+ */
+
+/**
+ * @brief Converts binary data to hexadecimal text.
+ * 
+ * Writes exactly 2 * len characters to dst. No terminating NUL is written.
+ * 
+ * @param[in] src Bytes to convert.
+ * @param[in] len Number of bytes in src.
+ * @param[out] dst Destination for 2 * len hex digits.
+ * @param[in] upperCase Non-zero for 'A'-'F', zero for 'a'-'f'.
+ *
+ * @ingroup hex_functions
+ * 
+ * ### Example
+ * @code
+ * uint8_t data[] = {0x01, 0xAB};
+ * char text[5] = {0};
+ * hexEncode(data, sizeof(data), text, 1);   // text = "01AB"
+ * @endcode
+ * 
+ * 
+ */
+void hexEncode(const uint8_t *src, size_t len, char *dst, int upperCase);
+
+/**
+ * @brief Converts hexadecimal text to binary data.
+ * 
+ * Reads exactly 2 * len characters from src, accepting both upper and lower case digits.
+ * 
+ * @param[in] src Hex digits to convert.
+ * @param[in] len Number of bytes to produce.
+ * @param[out] dst Destination for len bytes.
+ * 
+ * @return 0 if successful, or -1 if src contains a character that is not a hex digit.
+ *
+ * @ingroup hex_functions
+ * 
+ * ### Example
+ * @code
+ * uint8_t data[2];
+ * if (hexDecode("01ab", 2, data) != 0)
+ *     return -1;
+ * @endcode
+ * 
+ * 
+ */
+int hexDecode(const char *src, size_t len, uint8_t *dst);
+
+/**
+ * @brief Converts a single hex digit to its value.
+ * 
+ * @param[in] c Character to convert.
+ * 
+ * @return Value 0 - 15, or -1 if c is not a hex digit.
+ *
+ * @ingroup hex_functions
+ */
+int hexDigitValue(char c);
+
+#endif
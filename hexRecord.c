@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "hexRecord.h"
+#include "hexCodec.h"
+#include "serialSimd.h"
+
+
+/* longest valid record is ':' plus 260 bytes in hex, leave room for trailing blanks */
+#define HEX_LINE_MAX    1024
+
+
+/* modulo 256 sum of a record, 16 bytes per step with SSE2 */
+static uint8_t byteSum(const uint8_t *data, size_t len)
+{
+    uint32_t sum = 0;
+    size_t i = 0;
+
+#ifdef SERIAL_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+
+    for (; i + 16 <= len; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(data + i)), zero));
+
+    sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+
+    for (; i < len; i++)
+        sum += data[i];
+
+    return (uint8_t)sum;
+}
+
+
+static void resetReader(hex_reader_t *reader, hex_format_t format)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->format = format;
+    reader->error = SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t hexReaderOpen(hex_reader_t *reader, const char *path, hex_format_t format)
+{
+    LARGE_INTEGER size;
+
+    resetReader(reader, format);
+
+    reader->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (reader->file == INVALID_HANDLE_VALUE)
+    {
+        reader->file = NULL;
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    if (!GetFileSizeEx(reader->file, &size))
+    {
+        hexReaderClose(reader);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    reader->fileSize = (uint64_t)size.QuadPart;
+
+    /* an empty file cannot be mapped, it simply has no records */
+    if (reader->fileSize == 0)
+    {
+        reader->done = 1;
+        return SERIAL_ERR_OK;
+    }
+
+    reader->mapping = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (reader->mapping == NULL)
+    {
+        hexReaderClose(reader);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void hexReaderInitMemory(hex_reader_t *reader, const char *text, size_t len, hex_format_t format)
+{
+    resetReader(reader, format);
+    reader->fileSize = len;
+    reader->view = text;
+    reader->viewLen = len;
+}
+
+
+void hexReaderClose(hex_reader_t *reader)
+{
+    if (reader->file != NULL)
+    {
+        if (reader->view != NULL)
+            UnmapViewOfFile(reader->view);
+        if (reader->mapping != NULL)
+            CloseHandle(reader->mapping);
+        CloseHandle(reader->file);
+    }
+
+    reader->file = NULL;
+    reader->mapping = NULL;
+    reader->view = NULL;
+    reader->viewLen = 0;
+}
+
+
+/* slides the mapped window so that it covers a whole line starting at reader->pos */
+static int mapWindow(hex_reader_t *reader)
+{
+    uint64_t end = reader->pos + HEX_LINE_MAX;
+
+    if (end > reader->fileSize)
+        end = reader->fileSize;
+
+    if (reader->view != NULL && reader->pos >= reader->viewOffset && end <= reader->viewOffset + reader->viewLen)
+        return 0;
+
+    /* only a file backed reader can move its window */
+    if (reader->mapping == NULL)
+        return -1;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    uint64_t offset = reader->pos - reader->pos % info.dwAllocationGranularity;
+    uint64_t len = reader->fileSize - offset;
+    if (len > HEX_VIEW_SIZE)
+        len = HEX_VIEW_SIZE;
+
+    if (reader->view != NULL)
+        UnmapViewOfFile(reader->view);
+
+    reader->view = (const char*)MapViewOfFile(reader->mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, (size_t)len);
+    if (reader->view == NULL)
+    {
+        reader->viewLen = 0;
+        return -1;
+    }
+
+    reader->viewOffset = offset;
+    reader->viewLen = (size_t)len;
+
+    return 0;
+}
+
+
+/* returns the next non-blank line without its line ending, 0 at the end of the text, -1 on errors */
+static int nextLine(hex_reader_t *reader, const char **line, size_t *len)
+{
+    while (reader->pos < reader->fileSize)
+    {
+        if (mapWindow(reader) != 0)
+        {
+            reader->error = SERIAL_ERR_UNKNOWN;
+            return -1;
+        }
+
+        const char *start = reader->view + (reader->pos - reader->viewOffset);
+        size_t available = (size_t)(reader->viewOffset + reader->viewLen - reader->pos);
+        const char *newline = memchr(start, '\n', available);
+        size_t n = newline != NULL ? (size_t)(newline - start) : available;
+
+        if (newline == NULL && reader->pos + available < reader->fileSize)
+        {
+            reader->error = SERIAL_ERR_FRAME;
+            return -1;
+        }
+
+        reader->pos += n + (newline != NULL);
+        reader->lineNumber++;
+
+        while (n > 0 && (start[n - 1] == '\r' || start[n - 1] == ' ' || start[n - 1] == '\t'))
+            n--;
+
+        if (n > 0)
+        {
+            *line = start;
+            *len = n;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* decodes one Intel HEX line, returns 1 for data, 0 for the end record, 2 for other records */
+static int parseIntel(hex_reader_t *reader, const char *line, size_t len)
+{
+    uint8_t record[5 + 255];
+
+    /* ':' count(1) address(2) type(1) data(count) checksum(1) */
+    if (len < 11 || (len - 1) % 2 != 0 || (len - 1) / 2 > sizeof(record))
+        return -1;
+
+    size_t bytes = (len - 1) / 2;
+    if (hexDecode(line + 1, bytes, record) != 0 || record[0] + 5u != bytes)
+        return -1;
+
+    if (byteSum(record, bytes) != 0)
+    {
+        reader->error = SERIAL_ERR_CHECKSUM;
+        return -1;
+    }
+
+    uint16_t offset = (uint16_t)((record[1] << 8) | record[2]);
+    const uint8_t *data = record + 4;
+
+    switch (record[3])
+    {
+        case 0x00:
+            memcpy(reader->record, data, record[0]);
+            reader->recordLen = record[0];
+            reader->recordPos = 0;
+            reader->recordAddress = reader->baseAddress + offset;
+            return 1;
+        case 0x01:
+            return 0;
+        case 0x02:
+            if (record[0] != 2)
+                return -1;
+            reader->baseAddress = (uint32_t)((data[0] << 8) | data[1]) << 4;
+            return 2;
+        case 0x03:
+            if (record[0] != 4)
+                return -1;
+            /* CS:IP */
+            reader->startAddress = ((uint32_t)((data[0] << 8) | data[1]) << 4) + (uint32_t)((data[2] << 8) | data[3]);
+            return 2;
+        case 0x04:
+            if (record[0] != 2)
+                return -1;
+            reader->baseAddress = (uint32_t)((data[0] << 8) | data[1]) << 16;
+            return 2;
+        case 0x05:
+            if (record[0] != 4)
+                return -1;
+            reader->startAddress = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+
+/* decodes one S-record line, same results as parseIntel */
+static int parseSrec(hex_reader_t *reader, const char *line, size_t len)
+{
+    /* address width of S0 - S9, S4 is reserved */
+    static const uint8_t addressLen[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+    uint8_t record[1 + 255];
+
+    /* 'S' type count(1) address(2-4) data checksum(1), count covers everything after itself */
+    if (len < 10 || (len - 2) % 2 != 0 || (len - 2) / 2 > sizeof(record) || line[1] < '0' || line[1] > '9')
+        return -1;
+
+    int type = line[1] - '0';
+    size_t bytes = (len - 2) / 2;
+
+    if (addressLen[type] == 0 || hexDecode(line + 2, bytes, record) != 0 || record[0] + 1u != bytes ||
+        record[0] < addressLen[type] + 1u)
+        return -1;
+
+    if (byteSum(record, bytes) != 0xFF)
+    {
+        reader->error = SERIAL_ERR_CHECKSUM;
+        return -1;
+    }
+
+    uint32_t address = 0;
+    for (int i = 0; i < addressLen[type]; i++)
+        address = (address << 8) | record[1 + i];
+
+    uint32_t dataLen = record[0] - addressLen[type] - 1u;
+
+    switch (type)
+    {
+        case 1:
+        case 2:
+        case 3:
+            memcpy(reader->record, record + 1 + addressLen[type], dataLen);
+            reader->recordLen = dataLen;
+            reader->recordPos = 0;
+            reader->recordAddress = address;
+            return 1;
+        case 7:
+        case 8:
+        case 9:
+            reader->startAddress = address;
+            return 0;
+        default:
+            /* header and record counts carry no image data */
+            return 2;
+    }
+}
+
+
+/* loads the next data record, returns 1 when one is available, 0 at the end and -1 on errors */
+static int readRecord(hex_reader_t *reader)
+{
+    const char *line;
+    size_t len;
+    int result;
+
+    while (!reader->done)
+    {
+        result = nextLine(reader, &line, &len);
+        if (result < 0)
+            return -1;
+        if (result == 0)
+            break;
+
+        if (reader->format == HEX_FORMAT_AUTO)
+            reader->format = line[0] == 'S' ? HEX_FORMAT_SREC : HEX_FORMAT_INTEL;
+
+        if (reader->format == HEX_FORMAT_INTEL)
+            result = line[0] == ':' ? parseIntel(reader, line, len) : -1;
+        else
+            result = line[0] == 'S' ? parseSrec(reader, line, len) : -1;
+
+        if (result < 0)
+        {
+            if (reader->error == SERIAL_ERR_OK)
+                reader->error = SERIAL_ERR_FRAME;
+            return -1;
+        }
+
+        if (result == 0)
+            break;
+
+        if (result == 1 && reader->recordLen > 0)
+        {
+            reader->records++;
+            reader->dataBytes += reader->recordLen;
+            return 1;
+        }
+    }
+
+    reader->done = 1;
+    return 0;
+}
+
+
+int hexReaderRead(hex_reader_t *reader, uint32_t *address, uint8_t *data, uint32_t maxLen)
+{
+    uint32_t len = 0;
+
+    if (reader->error != SERIAL_ERR_OK)
+        return -1;
+
+    while (len < maxLen)
+    {
+        if (reader->recordPos == reader->recordLen)
+        {
+            /* a failure after some data first hands out the run, the next call reports it */
+            int result = readRecord(reader);
+            if (result < 0)
+                return len > 0 ? (int)len : -1;
+            if (result == 0)
+                break;
+        }
+
+        /* a run only holds contiguous data, the record waits for the next call otherwise */
+        if (len > 0 && reader->recordAddress != *address + len)
+            break;
+
+        if (len == 0)
+            *address = reader->recordAddress;
+
+        uint32_t n = reader->recordLen - reader->recordPos;
+        if (n > maxLen - len)
+            n = maxLen - len;
+
+        memcpy(data + len, reader->record + reader->recordPos, n);
+        reader->recordPos += n;
+        reader->recordAddress += n;
+        len += n;
+    }
+
+    return (int)len;
+}
+
+
+serial_port_err_t hexReaderNext(hex_reader_t *reader, hex_segment_t *segment)
+{
+    int len = hexReaderRead(reader, &segment->address, reader->segment, sizeof(reader->segment));
+
+    segment->data = reader->segment;
+    segment->len = len > 0 ? (uint32_t)len : 0;
+
+    return len < 0 ? reader->error : SERIAL_ERR_OK;
+}
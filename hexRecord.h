@@ -0,0 +1,156 @@
+/**
+ * @file hexRecord.h
+ * @brief Streaming Intel HEX and Motorola S-record reader.
+ *
+ * Firmware images are read through a sliding memory mapped view of the file, so memory use stays
+ * bounded no matter how large the image is. Lines are located with memchr and decoded with the
+ * SSE2 hex codec, every record checksum is verified, and adjacent records are coalesced into
+ * contiguous address / data segments that can be handed straight to a flasher's transmit path.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef HEXRECORD_H
+#define HEXRECORD_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+
+/**
+ * @defgroup hexrecord_functions Hex Record Reader
+ * @ingroup functions
+ * @brief Streaming Intel HEX / Motorola S-record parsing.
+ */
+
+#define HEX_VIEW_SIZE       (4u * 1024 * 1024)  /**< Size of the mapped window into the file. */
+#define HEX_SEGMENT_MAX     4096                /**< Largest segment returned by hexReaderNext. */
+
+/**
+ * @enum hex_format_t
+ * @brief Record format of the image.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    HEX_FORMAT_AUTO,        /**< Detect from the first record. */
+    HEX_FORMAT_INTEL,       /**< Intel HEX (':' records). */
+    HEX_FORMAT_SREC,        /**< Motorola S-record ('S' records). */
+} hex_format_t;
+
+/**
+ * @struct hex_segment_t
+ * @brief A run of contiguous image data.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t address;       /**< Target address of data[0]. */
+    const uint8_t *data;    /**< Segment data, valid until the next call on the reader. */
+    uint32_t len;           /**< Number of bytes in data. */
+} hex_segment_t;
+
+/**
+ * @struct hex_reader_t
+ * @brief State of a streaming record reader.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    HANDLE file;                    /**< Image file, NULL when reading from memory. */
+    HANDLE mapping;                 /**< File mapping object. */
+    uint64_t fileSize;              /**< Size of the image text. */
+    const char *view;               /**< Current window into the text. */
+    uint64_t viewOffset;            /**< File offset of view[0]. */
+    size_t viewLen;                 /**< Bytes in the current window. */
+    uint64_t pos;                   /**< File offset of the next unread line. */
+    hex_format_t format;            /**< Record format in use. */
+    uint32_t baseAddress;           /**< Intel HEX extended segment / linear base. */
+    uint32_t startAddress;          /**< Entry point from a start address record, 0 if none. */
+    int done;                       /**< End of file record seen or text exhausted. */
+    uint8_t record[255];            /**< Data of the current record not yet handed out. */
+    uint32_t recordLen;             /**< Bytes in record. */
+    uint32_t recordPos;             /**< Read position in record. */
+    uint32_t recordAddress;         /**< Address of record[recordPos]. */
+    uint8_t segment[HEX_SEGMENT_MAX];   /**< Buffer backing the segments of hexReaderNext. */
+    serial_port_err_t error;        /**< Reason of the last failure. */
+    uint64_t lineNumber;            /**< Line of the last record read, for error messages. */
+    uint64_t records;               /**< Data records read. */
+    uint64_t dataBytes;             /**< Data bytes read. */
+} hex_reader_t;
+
+/**
+ * @brief Opens an image file for streaming.
+ *
+ * @param[out] reader Pointer to the reader.
+ * @param[in] path Path of the image.
+ * @param[in] format Record format, or HEX_FORMAT_AUTO.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup hexrecord_functions
+ *
+ * ### Example
+ * Below is an example that prints the segments of an image.
+ * @code
+ * hex_reader_t reader;
+ * hex_segment_t segment;
+ * int main(){
+ *  if(hexReaderOpen(&reader, "firmware.hex", HEX_FORMAT_AUTO) != SERIAL_ERR_OK)
+ *      return -1;
+ *  while(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK && segment.len > 0)
+ *      printf("%08X %u\n", segment.address, segment.len);
+ *  hexReaderClose(&reader);
+ *  return reader.error;
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t hexReaderOpen(hex_reader_t *reader, const char *path, hex_format_t format);
+
+/**
+ * @brief Reads records from text already in memory.
+ *
+ * @ingroup hexrecord_functions
+ */
+void hexReaderInitMemory(hex_reader_t *reader, const char *text, size_t len, hex_format_t format);
+
+/**
+ * @brief Fills a buffer with the next contiguous run of image data.
+ *
+ * Data of adjacent records is coalesced; a run ends at an address gap or when data is full.
+ * The signature matches stm32_source_next_t so a reader can directly back a flashing source.
+ *
+ * @param[in] reader Pointer to the reader.
+ * @param[out] address Target address of the run.
+ * @param[out] data Buffer for the run.
+ * @param[in] maxLen Capacity of data.
+ *
+ * @return Number of bytes stored, 0 at the end of the image, or -1 on a malformed image with
+ *         reader->error set to SERIAL_ERR_FRAME or SERIAL_ERR_CHECKSUM.
+ *
+ * @ingroup hexrecord_functions
+ */
+int hexReaderRead(hex_reader_t *reader, uint32_t *address, uint8_t *data, uint32_t maxLen);
+
+/**
+ * @brief Returns the next segment of at most HEX_SEGMENT_MAX bytes.
+ *
+ * @return SERIAL_ERR_OK with segment->len 0 at the end of the image, otherwise as hexReaderRead.
+ *
+ * @ingroup hexrecord_functions
+ */
+serial_port_err_t hexReaderNext(hex_reader_t *reader, hex_segment_t *segment);
+
+/**
+ * @brief Unmaps and closes the image file.
+ *
+ * @ingroup hexrecord_functions
+ */
+void hexReaderClose(hex_reader_t *reader);
+
+#endif
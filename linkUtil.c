@@ -0,0 +1,316 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "linkUtil.h"
+
+
+static uint64_t ticksToMs(const link_monitor_t *monitor, int64_t ticks)
+{
+    return (uint64_t)(ticks * 1000 / monitor->frequency.QuadPart);
+}
+
+
+static void report(link_monitor_t *monitor, link_util_t *link, link_dir_t direction, link_event_type_t type, uint64_t durationMs)
+{
+    link_event_t event;
+
+    event.type = type;
+    event.direction = direction;
+    event.port = link->port;
+    event.user = link->user;
+    event.average = link->dir[direction].average;
+    event.peak = link->dir[direction].windowPeak;
+    event.durationMs = durationMs;
+
+    if (monitor->callback != NULL)
+        monitor->callback(&event, monitor->context);
+}
+
+
+/* saturation needs the average at or above threshold for sustainMs, and ends below clearThreshold */
+static void checkSaturation(link_monitor_t *monitor, link_util_t *link, link_dir_t direction, int64_t now)
+{
+    link_util_dir_t *dir = &link->dir[direction];
+
+    if (!dir->saturated)
+    {
+        if (dir->average < link->config.threshold)
+        {
+            dir->aboveSince = 0;
+            return;
+        }
+
+        if (dir->aboveSince == 0)
+            dir->aboveSince = now;
+
+        uint64_t aboveMs = ticksToMs(monitor, now - dir->aboveSince);
+        if (aboveMs < link->config.sustainMs)
+            return;
+
+        dir->saturated = TRUE;
+        dir->saturatedSince = dir->aboveSince;
+        dir->saturations++;
+        report(monitor, link, direction, LINK_EVENT_SATURATED, aboveMs);
+    }
+    else if (dir->average < link->config.clearThreshold)
+    {
+        uint64_t durationMs = ticksToMs(monitor, now - dir->saturatedSince);
+
+        dir->saturated = FALSE;
+        dir->aboveSince = 0;
+        dir->saturatedMs += durationMs;
+        report(monitor, link, direction, LINK_EVENT_CLEARED, durationMs);
+    }
+}
+
+
+static void sampleLink(link_monitor_t *monitor, link_util_t *link, int64_t now)
+{
+    serial_port_t *port = link->port;
+    double seconds = (double)(now - link->lastSample) / (double)monitor->frequency.QuadPart;
+
+    if (seconds <= 0)
+        return;
+    link->lastSample = now;
+
+    /* baud rate and format may have changed since the last sample, one character carries one byte */
+    double charBits = serialPortCharacterBits(port);
+    link->capacity = charBits > 0 ? (double)port->baud / charBits : 0;
+
+    /* a moving average with a time constant instead of a fixed weight copes with uneven sampling */
+    double alpha = 1.0 - exp(-seconds * 1000.0 / link->config.averageMs);
+    int windowDone = ticksToMs(monitor, now - link->windowStart) >= link->config.peakWindowMs;
+
+    for (int d = LINK_RX; d <= LINK_TX; d++)
+    {
+        link_util_dir_t *dir = &link->dir[d];
+        uint64_t bytes = (uint64_t)ReadAcquire64(d == LINK_RX ? &port->rxBytes : &port->txBytes);
+
+        /* reopening the port restarts its counters */
+        uint64_t delta = bytes >= dir->lastBytes ? bytes - dir->lastBytes : bytes;
+        dir->lastBytes = bytes;
+
+        dir->bytesPerSecond = (double)delta / seconds;
+        dir->current = link->capacity > 0 ? dir->bytesPerSecond / link->capacity : 0;
+        dir->average += alpha * (dir->current - dir->average);
+        if (dir->current > dir->windowPeak)
+            dir->windowPeak = dir->current;
+
+        checkSaturation(monitor, link, (link_dir_t)d, now);
+
+        /* the callback removed the port */
+        if (link->monitor != monitor)
+            return;
+    }
+
+    if (windowDone)
+    {
+        for (int d = LINK_RX; d <= LINK_TX; d++)
+        {
+            link->dir[d].peak = link->dir[d].windowPeak;
+            link->dir[d].windowPeak = 0;
+        }
+        link->windowStart = now;
+    }
+}
+
+
+void linkUtilInit(link_monitor_t *monitor, uint32_t sampleMs, link_callback_t callback, void *context)
+{
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->sampleMs = sampleMs != 0 ? sampleMs : LINK_DEFAULT_SAMPLE_MS;
+    monitor->callback = callback;
+    monitor->context = context;
+
+    QueryPerformanceFrequency(&monitor->frequency);
+    InitializeCriticalSection(&monitor->lock);
+}
+
+
+void linkUtilFree(link_monitor_t *monitor)
+{
+    DeleteCriticalSection(&monitor->lock);
+}
+
+
+serial_port_err_t linkUtilAdd(link_monitor_t *monitor, link_util_t *link, serial_port_t *port, const link_util_config_t *config, void *user)
+{
+    LARGE_INTEGER now;
+
+    if (port == NULL || !port->isOpen)
+        return SERIAL_ERR_UNKNOWN;
+
+    memset(link, 0, sizeof(*link));
+    if (config != NULL)
+        link->config = *config;
+
+    if (link->config.averageMs == 0)
+        link->config.averageMs = 5000;
+    if (link->config.peakWindowMs == 0)
+        link->config.peakWindowMs = 1000;
+    if (link->config.threshold <= 0)
+        link->config.threshold = 0.9f;
+    if (link->config.clearThreshold <= 0 || link->config.clearThreshold >= link->config.threshold)
+        link->config.clearThreshold = link->config.threshold - 0.1f;
+    if (link->config.sustainMs == 0)
+        link->config.sustainMs = 3000;
+
+    link->monitor = monitor;
+    link->port = port;
+    link->user = user;
+
+    EnterCriticalSection(&monitor->lock);
+
+    /* rates start from the counters as they are now */
+    QueryPerformanceCounter(&now);
+    link->lastSample = now.QuadPart;
+    link->windowStart = now.QuadPart;
+    link->dir[LINK_RX].lastBytes = (uint64_t)ReadAcquire64(&port->rxBytes);
+    link->dir[LINK_TX].lastBytes = (uint64_t)ReadAcquire64(&port->txBytes);
+
+    link->next = monitor->head;
+    monitor->head = link;
+
+    LeaveCriticalSection(&monitor->lock);
+
+    return SERIAL_ERR_OK;
+}
+
+
+void linkUtilRemove(link_util_t *link)
+{
+    link_monitor_t *monitor = link->monitor;
+
+    if (monitor == NULL)
+        return;
+
+    /* the lock is reentrant, so this also works from the callback */
+    EnterCriticalSection(&monitor->lock);
+
+    for (link_util_t **p = &monitor->head; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == link)
+        {
+            *p = link->next;
+            break;
+        }
+    }
+
+    /* a sampling pass in progress continues after the removed port */
+    if (monitor->cursor == link)
+        monitor->cursor = link->next;
+
+    link->next = NULL;
+    link->monitor = NULL;
+
+    LeaveCriticalSection(&monitor->lock);
+}
+
+
+void linkUtilSample(link_monitor_t *monitor)
+{
+    LARGE_INTEGER now;
+
+    EnterCriticalSection(&monitor->lock);
+
+    QueryPerformanceCounter(&now);
+
+    /*
+     * the callback may remove any port, including the next one, so the position lives in the
+     * monitor where linkUtilRemove can move it along
+     */
+    link_util_t *link;
+    monitor->cursor = monitor->head;
+    while ((link = monitor->cursor) != NULL)
+    {
+        monitor->cursor = link->next;
+        sampleLink(monitor, link, now.QuadPart);
+    }
+
+    LeaveCriticalSection(&monitor->lock);
+}
+
+
+static DWORD WINAPI LinkUtilThread(LPVOID lpParam)
+{
+    link_monitor_t *monitor = (link_monitor_t*)lpParam;
+
+    while (ReadAcquire(&monitor->running))
+    {
+        linkUtilSample(monitor);
+        Sleep(monitor->sampleMs);
+    }
+
+    return 0;
+}
+
+
+serial_port_err_t linkUtilStart(link_monitor_t *monitor)
+{
+    if (monitor->thread != NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    InterlockedExchange(&monitor->running, 1);
+
+    monitor->thread = CreateThread(NULL, 0, LinkUtilThread, monitor, 0, NULL);
+    if (monitor->thread == NULL)
+    {
+        InterlockedExchange(&monitor->running, 0);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void linkUtilStop(link_monitor_t *monitor)
+{
+    InterlockedExchange(&monitor->running, 0);
+
+    if (monitor->thread != NULL)
+    {
+        WaitForSingleObject(monitor->thread, INFINITE);
+        CloseHandle(monitor->thread);
+        monitor->thread = NULL;
+    }
+}
+
+
+void linkUtilGetStats(link_util_t *link, link_dir_t direction, link_util_stats_t *stats)
+{
+    link_monitor_t *monitor = link->monitor;
+    const link_util_dir_t *dir = &link->dir[direction];
+
+    if (monitor != NULL)
+        EnterCriticalSection(&monitor->lock);
+
+    stats->capacity = link->capacity;
+    stats->bytesPerSecond = dir->bytesPerSecond;
+    stats->current = dir->current;
+    stats->average = dir->average;
+    stats->peak = dir->peak;
+    stats->saturated = dir->saturated;
+    stats->saturations = dir->saturations;
+    stats->saturatedMs = dir->saturatedMs;
+
+    if (monitor != NULL)
+        LeaveCriticalSection(&monitor->lock);
+}
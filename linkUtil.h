@@ -0,0 +1,272 @@
+/**
+ * @file linkUtil.h
+ * @brief Link utilisation and saturation estimation per port.
+ *
+ * Bytes per second mean little without the line rate. A sampler thread reads the byte counters
+ * every port keeps in serial_port_t at a fixed interval and divides the rates by the capacity of
+ * the link, the baud rate over the bits one character takes with the configured frame format
+ * (start, data, parity and stop bits, see serialPortCharacterBits). For each direction it keeps
+ * the utilisation of the last sample, an exponential moving average and the peak of the last
+ * completed window, and reports sustained saturation, the average staying above a threshold for
+ * a given time, together with its end, the hint to raise the baud rate, compress or split traffic.
+ *
+ * Received bytes are counted when the application reads them and transmitted bytes when the
+ * write completes, so single samples jitter with the reading pattern; the average does not.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef LINKUTIL_H
+#define LINKUTIL_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+
+/**
+ * @defgroup linkutil_functions Link Utilisation
+ * @ingroup functions
+ * @brief Utilisation of each port's line rate.
+ */
+
+#define LINK_DEFAULT_SAMPLE_MS  100     /**< Sampling interval used when linkUtilInit is given 0. */
+
+/**
+ * @enum link_dir_t
+ * @brief Direction of a link.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    LINK_RX,                /**< Received data. */
+    LINK_TX,                /**< Transmitted data. */
+} link_dir_t;
+
+/**
+ * @enum link_event_type_t
+ * @brief Kind of a utilisation event.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    LINK_EVENT_SATURATED,   /**< The average stayed at or above the threshold for sustainMs. */
+    LINK_EVENT_CLEARED,     /**< The average fell below the clear threshold again. */
+} link_event_type_t;
+
+/**
+ * @struct link_util_config_t
+ * @brief Averaging and saturation settings of a port; zero fields take the defaults in brackets.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t averageMs;         /**< Time constant of the moving average [5000]. */
+    uint32_t peakWindowMs;      /**< Window over which the peak is taken [1000]. */
+    float threshold;            /**< Utilisation counting as saturated, 0 - 1 [0.9]. */
+    float clearThreshold;       /**< Utilisation ending a saturation, below threshold [threshold - 0.1]. */
+    uint32_t sustainMs;         /**< How long the average has to stay at or above threshold [3000]. */
+} link_util_config_t;
+
+/**
+ * @struct link_event_t
+ * @brief Start or end of a saturation.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    link_event_type_t type;     /**< Saturated or cleared. */
+    link_dir_t direction;       /**< Direction concerned. */
+    serial_port_t *port;        /**< The port. */
+    void *user;                 /**< User pointer given to linkUtilAdd. */
+    double average;             /**< Moving average utilisation, 0 - 1. */
+    double peak;                /**< Highest sample utilisation in the current window. */
+    uint64_t durationMs;        /**< Saturated: time above the threshold so far. Cleared: length of the saturation. */
+} link_event_t;
+
+/** @brief Receives utilisation events, called on the thread running linkUtilSample. */
+typedef void (*link_callback_t)(const link_event_t *event, void *context);
+
+/**
+ * @struct link_util_stats_t
+ * @brief Utilisation of one direction of a port.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    double capacity;            /**< Bytes per second the line carries at most with the current baud rate and format. */
+    double bytesPerSecond;      /**< Rate of the last sample. */
+    double current;             /**< Utilisation of the last sample, 0 - 1. */
+    double average;             /**< Moving average utilisation. */
+    double peak;                /**< Highest sample utilisation of the last completed window. */
+    int saturated;              /**< In a saturation. */
+    uint32_t saturations;       /**< Saturations reported. */
+    uint64_t saturatedMs;       /**< Total time spent in ended saturations. */
+} link_util_stats_t;
+
+/**
+ * @struct link_util_dir_t
+ * @brief Estimator state of one direction.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t lastBytes;         /**< Counter at the previous sample. */
+    double bytesPerSecond;      /**< Rate of the last sample. */
+    double current;             /**< Utilisation of the last sample. */
+    double average;             /**< Moving average. */
+    double windowPeak;          /**< Peak of the window in progress. */
+    double peak;                /**< Peak of the last completed window. */
+    int64_t aboveSince;         /**< QPC time the average reached the threshold, 0 when below. */
+    int64_t saturatedSince;     /**< QPC time the current saturation started. */
+    int saturated;              /**< In a saturation. */
+    uint32_t saturations;       /**< Saturations reported. */
+    uint64_t saturatedMs;       /**< Total time spent in ended saturations. */
+} link_util_dir_t;
+
+struct link_monitor_t;
+
+/**
+ * @struct link_util_t
+ * @brief A port under observation, owned by the caller.
+ *
+ * @ingroup structs
+ */
+typedef struct link_util_t {
+    struct link_util_t *next;           /**< Next port of the monitor. */
+    struct link_monitor_t *monitor;     /**< Monitor sampling it, NULL when not added. */
+    serial_port_t *port;                /**< Observed port. */
+    void *user;                         /**< Reported with its events. */
+    link_util_config_t config;          /**< Settings with the defaults filled in. */
+    double capacity;                    /**< Bytes per second at the last sample. */
+    int64_t lastSample;                 /**< QPC time of the previous sample. */
+    int64_t windowStart;                /**< QPC time the current peak window started. */
+    link_util_dir_t dir[2];             /**< State by link_dir_t. */
+} link_util_t;
+
+/**
+ * @struct link_monitor_t
+ * @brief Sampler of any number of ports.
+ *
+ * @ingroup structs
+ */
+typedef struct link_monitor_t {
+    link_util_t *head;                  /**< Observed ports. */
+    link_util_t *cursor;                /**< Next port of the sampling pass in progress. */
+    uint32_t sampleMs;                  /**< Sampling interval of the thread. */
+    LARGE_INTEGER frequency;            /**< QPC ticks per second. */
+    CRITICAL_SECTION lock;              /**< Serialises the list and the estimators between the sampler and the callers. */
+    link_callback_t callback;           /**< Receives the events. */
+    void *context;                      /**< User pointer passed to callback. */
+    HANDLE thread;                      /**< Thread of linkUtilStart, NULL without one. */
+    volatile LONG running;              /**< Cleared by linkUtilStop. */
+} link_monitor_t;
+
+/**
+ * @brief Initialises a monitor without ports.
+ *
+ * @param[out] monitor Pointer to the monitor.
+ * @param[in] sampleMs Sampling interval, 0 for LINK_DEFAULT_SAMPLE_MS.
+ * @param[in] callback Receives saturation events, may be NULL.
+ * @param[in] context User pointer passed to callback.
+ *
+ * @ingroup linkutil_functions
+ *
+ * ### Example
+ * Below is an example that warns when the telemetry downlink runs above 85 % of its line rate for 10 s.
+ * @code
+ * serial_port_t radio;
+ * link_util_t radioLink;
+ * link_monitor_t links;
+ *
+ * void onLink(const link_event_t *event, void *context){
+ *  if(event->type == LINK_EVENT_SATURATED)
+ *      printf("%s %s at %.0f %% for %llu ms\n", event->port->name, event->direction == LINK_RX ? "RX" : "TX",
+ *             event->average * 100, event->durationMs);
+ * }
+ *
+ * int main(){
+ *  link_util_config_t config = { 0 };
+ *  if(serialPortOpen(&radio, "COM5", 57600, 100, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  config.threshold = 0.85f;
+ *  config.sustainMs = 10000;
+ *  linkUtilInit(&links, 0, onLink, NULL);
+ *  linkUtilAdd(&links, &radioLink, &radio, &config, NULL);
+ *  linkUtilStart(&links);
+ *  ...
+ *  linkUtilStop(&links);
+ *  linkUtilFree(&links);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+void linkUtilInit(link_monitor_t *monitor, uint32_t sampleMs, link_callback_t callback, void *context);
+
+/**
+ * @brief Releases a monitor; every port must have been removed and the thread stopped.
+ *
+ * @ingroup linkutil_functions
+ */
+void linkUtilFree(link_monitor_t *monitor);
+
+/**
+ * @brief Starts observing a port.
+ *
+ * @param[in] monitor Pointer to the monitor.
+ * @param[out] link Estimator state, kept alive by the caller until linkUtilRemove.
+ * @param[in] port Opened port.
+ * @param[in] config Settings, or NULL for the defaults.
+ * @param[in] user Reported with the port's events.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup linkutil_functions
+ */
+serial_port_err_t linkUtilAdd(link_monitor_t *monitor, link_util_t *link, serial_port_t *port, const link_util_config_t *config, void *user);
+
+/**
+ * @brief Stops observing a port; may be called from the callback for the port being reported.
+ *
+ * @ingroup linkutil_functions
+ */
+void linkUtilRemove(link_util_t *link);
+
+/**
+ * @brief Samples every port once and reports saturations.
+ *
+ * Called by the thread of linkUtilStart, or directly by a caller running its own loop every few
+ * hundred milliseconds.
+ *
+ * @ingroup linkutil_functions
+ */
+void linkUtilSample(link_monitor_t *monitor);
+
+/**
+ * @brief Starts a thread calling linkUtilSample every sampleMs.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup linkutil_functions
+ */
+serial_port_err_t linkUtilStart(link_monitor_t *monitor);
+
+/**
+ * @brief Stops and joins the thread of linkUtilStart.
+ *
+ * @ingroup linkutil_functions
+ */
+void linkUtilStop(link_monitor_t *monitor);
+
+/**
+ * @brief Reads the utilisation of one direction of an observed port.
+ *
+ * @ingroup linkutil_functions
+ */
+void linkUtilGetStats(link_util_t *link, link_dir_t direction, link_util_stats_t *stats);
+
+#endif
@@ -0,0 +1,300 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "liveness.h"
+
+
+#define LIVE_SLOT_MASK  (LIVE_WHEEL_SLOTS - 1)
+
+
+/*
+ * an entry goes into the slot of the first tick at or after its deadline, but never into a tick
+ * already processed; deadlines more than one turn of the wheel away share the slot and are put
+ * back when they come up early
+ */
+static void wheelLink(live_monitor_t *monitor, live_entry_t *entry, uint64_t deadline)
+{
+    uint64_t tick = (deadline + monitor->tickMs - 1) / monitor->tickMs;
+    if (tick < monitor->tick)
+        tick = monitor->tick;
+
+    live_entry_t **head = &monitor->slots[tick & LIVE_SLOT_MASK];
+
+    entry->deadline = deadline;
+    entry->next = *head;
+    entry->pprev = head;
+    if (*head != NULL)
+        (*head)->pprev = &entry->next;
+    *head = entry;
+}
+
+
+static void wheelUnlink(live_entry_t *entry)
+{
+    if (entry->pprev == NULL)
+        return;
+
+    *entry->pprev = entry->next;
+    if (entry->next != NULL)
+        entry->next->pprev = entry->pprev;
+
+    entry->next = NULL;
+    entry->pprev = NULL;
+}
+
+
+/* how often a stalled port is looked at for data, which bounds the error of the gap */
+static uint64_t recheckMs(const live_monitor_t *monitor, const live_entry_t *entry)
+{
+    uint32_t period = entry->intervalMs / 4;
+    return period > monitor->tickMs ? period : monitor->tickMs;
+}
+
+
+static void report(live_monitor_t *monitor, live_entry_t *entry, live_event_type_t type, uint64_t lastRxTick, uint64_t gapMs)
+{
+    live_event_t event;
+
+    event.type = type;
+    event.port = entry->port;
+    event.user = entry->user;
+    event.lastRxTick = lastRxTick;
+    event.gapMs = gapMs;
+
+    if (monitor->callback != NULL)
+        monitor->callback(&event, monitor->context);
+}
+
+
+static void expire(live_monitor_t *monitor, live_entry_t *entry, uint64_t now)
+{
+    InterlockedIncrement64(&monitor->visits);
+
+    /* a later turn of the wheel */
+    if (entry->deadline > now)
+    {
+        wheelLink(monitor, entry, entry->deadline);
+        return;
+    }
+
+    uint64_t activity = (uint64_t)ReadAcquire64(&entry->port->lastRxTick);
+    if (activity < entry->since)
+        activity = entry->since;
+
+    if (!entry->stalled)
+    {
+        /* data arrived since the entry was scheduled, count the interval from there */
+        if (activity + entry->intervalMs > now)
+        {
+            wheelLink(monitor, entry, activity + entry->intervalMs);
+            return;
+        }
+
+        entry->stalled = TRUE;
+        entry->stallStart = activity;
+        entry->stalls++;
+        wheelLink(monitor, entry, now + recheckMs(monitor, entry));
+        report(monitor, entry, LIVE_EVENT_STALL, activity, now - activity);
+        return;
+    }
+
+    if (activity == entry->stallStart)
+    {
+        wheelLink(monitor, entry, now + recheckMs(monitor, entry));
+        return;
+    }
+
+    /* the stamp is the latest read, at most one recheck period after the first byte of the burst */
+    uint64_t gap = activity - entry->stallStart;
+
+    entry->stalled = FALSE;
+    entry->stalledMs += gap;
+    if (gap > entry->longestGapMs)
+        entry->longestGapMs = gap;
+
+    wheelLink(monitor, entry, activity + entry->intervalMs);
+    report(monitor, entry, LIVE_EVENT_RECOVERY, entry->stallStart, gap);
+}
+
+
+void livenessInit(live_monitor_t *monitor, uint32_t tickMs, live_callback_t callback, void *context)
+{
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->tickMs = tickMs != 0 ? tickMs : LIVE_DEFAULT_TICK_MS;
+    monitor->tick = GetTickCount64() / monitor->tickMs;
+    monitor->callback = callback;
+    monitor->context = context;
+
+    InitializeCriticalSection(&monitor->lock);
+}
+
+
+void livenessFree(live_monitor_t *monitor)
+{
+    DeleteCriticalSection(&monitor->lock);
+}
+
+
+serial_port_err_t livenessWatch(live_monitor_t *monitor, live_entry_t *entry, serial_port_t *port, uint32_t intervalMs, void *user)
+{
+    if (port == NULL || !port->isOpen || intervalMs == 0)
+        return SERIAL_ERR_UNKNOWN;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->monitor = monitor;
+    entry->port = port;
+    entry->user = user;
+    entry->intervalMs = intervalMs;
+
+    EnterCriticalSection(&monitor->lock);
+
+    entry->since = GetTickCount64();
+    wheelLink(monitor, entry, entry->since + intervalMs);
+    monitor->count++;
+
+    LeaveCriticalSection(&monitor->lock);
+
+    return SERIAL_ERR_OK;
+}
+
+
+void livenessUnwatch(live_entry_t *entry)
+{
+    live_monitor_t *monitor = entry->monitor;
+
+    if (monitor == NULL)
+        return;
+
+    /* the lock is reentrant, so this also works from the callback */
+    EnterCriticalSection(&monitor->lock);
+
+    wheelUnlink(entry);
+    entry->monitor = NULL;
+    monitor->count--;
+
+    LeaveCriticalSection(&monitor->lock);
+}
+
+
+uint32_t livenessPoll(live_monitor_t *monitor)
+{
+    EnterCriticalSection(&monitor->lock);
+
+    uint64_t now = GetTickCount64();
+    uint64_t target = now / monitor->tickMs;
+
+    /* after a long delay one turn of the wheel visits every entry once, that is enough */
+    if (target >= monitor->tick + LIVE_WHEEL_SLOTS)
+        monitor->tick = target - LIVE_WHEEL_SLOTS + 1;
+
+    while (monitor->tick <= target)
+    {
+        live_entry_t **slot = &monitor->slots[monitor->tick & LIVE_SLOT_MASK];
+        live_entry_t *entry;
+
+        /*
+         * the slot is moved aside first: entries put back land in a later tick, and the callback
+         * may unwatch any entry, including the ones still waiting here, through their pprev links
+         */
+        monitor->tick++;
+        monitor->expiring = *slot;
+        *slot = NULL;
+        if (monitor->expiring != NULL)
+            monitor->expiring->pprev = &monitor->expiring;
+
+        while ((entry = monitor->expiring) != NULL)
+        {
+            wheelUnlink(entry);
+            expire(monitor, entry, now);
+        }
+    }
+
+    uint64_t next = monitor->tick * monitor->tickMs;
+
+    LeaveCriticalSection(&monitor->lock);
+
+    return next > now ? (uint32_t)(next - now) : 0;
+}
+
+
+static DWORD WINAPI LivenessThread(LPVOID lpParam)
+{
+    live_monitor_t *monitor = (live_monitor_t*)lpParam;
+
+    while (ReadAcquire(&monitor->running))
+        Sleep(livenessPoll(monitor));
+
+    return 0;
+}
+
+
+serial_port_err_t livenessStart(live_monitor_t *monitor)
+{
+    if (monitor->thread != NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    InterlockedExchange(&monitor->running, 1);
+
+    monitor->thread = CreateThread(NULL, 0, LivenessThread, monitor, 0, NULL);
+    if (monitor->thread == NULL)
+    {
+        InterlockedExchange(&monitor->running, 0);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void livenessStop(live_monitor_t *monitor)
+{
+    InterlockedExchange(&monitor->running, 0);
+
+    if (monitor->thread != NULL)
+    {
+        WaitForSingleObject(monitor->thread, INFINITE);
+        CloseHandle(monitor->thread);
+        monitor->thread = NULL;
+    }
+}
+
+
+void livenessGetStats(live_entry_t *entry, live_stats_t *stats)
+{
+    live_monitor_t *monitor = entry->monitor;
+
+    if (monitor != NULL)
+        EnterCriticalSection(&monitor->lock);
+
+    uint64_t activity = (uint64_t)ReadAcquire64(&entry->port->lastRxTick);
+    uint64_t now = GetTickCount64();
+
+    if (activity < entry->since)
+        activity = entry->since;
+
+    stats->stalled = entry->stalled;
+    stats->stalls = entry->stalls;
+    stats->silentMs = now > activity ? now - activity : 0;
+    stats->longestGapMs = entry->longestGapMs;
+    stats->stalledMs = entry->stalledMs;
+
+    if (monitor != NULL)
+        LeaveCriticalSection(&monitor->lock);
+}
@@ -0,0 +1,238 @@
+/**
+ * @file liveness.h
+ * @brief Stall detection for ports that are expected to send regularly.
+ *
+ * A device that stops sending looks exactly like a quiet one to a reader blocked in
+ * isDataAvailable or serialPortReadSome. Here every watched port declares the longest silence it
+ * may have, and one monitor checks all of them on a hashed timing wheel: the reads of the core
+ * API only stamp serial_port_t::lastRxTick, and an entry is looked at when its deadline comes up,
+ * at which point it is pushed back to the last stamp plus its interval if data arrived meanwhile.
+ * Adding, removing and rescheduling are O(1), a tick only visits the entries that are due, and
+ * a port that keeps sending costs one visit per interval, so thousands of ports are watched by a
+ * single thread (or the caller's own loop) at negligible CPU.
+ *
+ * Stalls and recoveries are reported to a callback; a recovery carries the length of the gap.
+ * Reads issued by the Asio and std::execution adapters bypass the core API and do not stamp the
+ * port.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+
+/**
+ * @defgroup liveness_functions Liveness
+ * @ingroup functions
+ * @brief Detecting ports that stopped sending.
+ */
+
+#define LIVE_WHEEL_SLOTS        512     /**< Slots of the timing wheel, a power of two. */
+#define LIVE_DEFAULT_TICK_MS    50      /**< Wheel resolution used when livenessInit is given 0. */
+
+/**
+ * @enum live_event_type_t
+ * @brief Kind of a liveness event.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    LIVE_EVENT_STALL,       /**< Nothing was received for the port's interval. */
+    LIVE_EVENT_RECOVERY,    /**< Data arrived again after a stall. */
+} live_event_type_t;
+
+/**
+ * @struct live_event_t
+ * @brief A change in the liveness of a port.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    live_event_type_t type;     /**< Stall or recovery. */
+    serial_port_t *port;        /**< The port concerned. */
+    void *user;                 /**< User pointer given to livenessWatch. */
+    uint64_t lastRxTick;        /**< GetTickCount64 time of the last data before the gap. */
+    uint64_t gapMs;             /**< Stall: silence so far. Recovery: length of the whole gap, accurate to a quarter of the interval. */
+} live_event_t;
+
+/** @brief Receives liveness events, called on the thread running livenessPoll. */
+typedef void (*live_callback_t)(const live_event_t *event, void *context);
+
+struct live_monitor_t;
+
+/**
+ * @struct live_entry_t
+ * @brief A watched port, owned by the caller and linked into the monitor's wheel.
+ *
+ * @ingroup structs
+ */
+typedef struct live_entry_t {
+    struct live_entry_t *next;          /**< Next entry in the same wheel slot. */
+    struct live_entry_t **pprev;        /**< Link pointing at this entry, NULL when not linked. */
+    struct live_monitor_t *monitor;     /**< Monitor watching it, NULL when not watched. */
+    serial_port_t *port;                /**< Watched port. */
+    void *user;                         /**< Reported with its events. */
+    uint32_t intervalMs;                /**< Longest expected silence. */
+    uint64_t since;                     /**< Time of livenessWatch, the activity baseline of a port that never sent. */
+    uint64_t deadline;                  /**< When the entry is next looked at. */
+    uint64_t stallStart;                /**< Last activity before the current stall. */
+    uint8_t stalled;                    /**< A stall was reported and no recovery yet. */
+    uint32_t stalls;                    /**< Stalls reported. */
+    uint64_t longestGapMs;              /**< Longest gap that ended in a recovery. */
+    uint64_t stalledMs;                 /**< Sum of the gaps that ended in a recovery. */
+} live_entry_t;
+
+/**
+ * @struct live_stats_t
+ * @brief Liveness of one port.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    int stalled;                /**< Currently stalled. */
+    uint32_t stalls;            /**< Stalls reported. */
+    uint64_t silentMs;          /**< Time since the last received data. */
+    uint64_t longestGapMs;      /**< Longest gap that ended in a recovery. */
+    uint64_t stalledMs;         /**< Sum of the gaps that ended in a recovery. */
+} live_stats_t;
+
+/**
+ * @struct live_monitor_t
+ * @brief A timing wheel watching any number of ports.
+ *
+ * @ingroup structs
+ */
+typedef struct live_monitor_t {
+    live_entry_t *slots[LIVE_WHEEL_SLOTS];  /**< Entries by the wheel tick of their deadline. */
+    live_entry_t *expiring;                 /**< Slot being processed. */
+    uint32_t tickMs;                        /**< Wheel resolution. */
+    uint64_t tick;                          /**< Next wheel tick to process. */
+    uint32_t count;                         /**< Entries watched. */
+    CRITICAL_SECTION lock;                  /**< Serialises the wheel between livenessPoll and the watch calls. */
+    live_callback_t callback;               /**< Receives the events. */
+    void *context;                          /**< User pointer passed to callback. */
+    HANDLE thread;                          /**< Thread of livenessStart, NULL without one. */
+    volatile LONG running;                  /**< Cleared by livenessStop. */
+    volatile LONG64 visits;                 /**< Entries looked at so far, the whole cost of the monitor. */
+} live_monitor_t;
+
+/**
+ * @brief Initialises a monitor without entries.
+ *
+ * @param[out] monitor Pointer to the monitor.
+ * @param[in] tickMs Resolution of the wheel, 0 for LIVE_DEFAULT_TICK_MS; stalls are reported at most one tick late.
+ * @param[in] callback Receives stall and recovery events.
+ * @param[in] context User pointer passed to callback.
+ *
+ * @ingroup liveness_functions
+ *
+ * ### Example
+ * Below is an example that reports sensors silent for more than 500 ms.
+ * @code
+ * serial_port_t sensors[64];
+ * live_entry_t entries[64];
+ * live_monitor_t monitor;
+ *
+ * void onLiveness(const live_event_t *event, void *context){
+ *  if(event->type == LIVE_EVENT_STALL)
+ *      printf("%s silent for %llu ms\n", event->port->name, event->gapMs);
+ *  else
+ *      printf("%s back after %llu ms\n", event->port->name, event->gapMs);
+ * }
+ *
+ * int main(){
+ *  livenessInit(&monitor, 0, onLiveness, NULL);
+ *  for(int i = 0; i < 64; i++){
+ *      // open sensors[i] and start reading it
+ *      ...
+ *      livenessWatch(&monitor, &entries[i], &sensors[i], 500, NULL);
+ *  }
+ *  if(livenessStart(&monitor) != SERIAL_ERR_OK)
+ *      return -1;
+ *  ...
+ *  livenessStop(&monitor);
+ *  livenessFree(&monitor);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+void livenessInit(live_monitor_t *monitor, uint32_t tickMs, live_callback_t callback, void *context);
+
+/**
+ * @brief Releases a monitor; every entry must have been unwatched and the thread stopped.
+ *
+ * @ingroup liveness_functions
+ */
+void livenessFree(live_monitor_t *monitor);
+
+/**
+ * @brief Starts watching a port.
+ *
+ * The port counts as active at the time of the call. May be called at any time, also from the callback.
+ *
+ * @param[in] monitor Pointer to the monitor.
+ * @param[out] entry Entry to link, kept alive by the caller until livenessUnwatch.
+ * @param[in] port Opened port.
+ * @param[in] intervalMs Longest silence before a stall is reported.
+ * @param[in] user Reported with the port's events.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup liveness_functions
+ */
+serial_port_err_t livenessWatch(live_monitor_t *monitor, live_entry_t *entry, serial_port_t *port, uint32_t intervalMs, void *user);
+
+/**
+ * @brief Stops watching a port; entries that are not watched are ignored.
+ *
+ * May be called from the callback, also for the entry being reported.
+ *
+ * @ingroup liveness_functions
+ */
+void livenessUnwatch(live_entry_t *entry);
+
+/**
+ * @brief Looks at every entry that has come due and reports what changed.
+ *
+ * Called by the thread of livenessStart, or directly by a caller running its own loop, e.g.
+ * next to serialPortProcessReady.
+ *
+ * @return Milliseconds until the next wheel tick.
+ *
+ * @ingroup liveness_functions
+ */
+uint32_t livenessPoll(live_monitor_t *monitor);
+
+/**
+ * @brief Starts a thread calling livenessPoll once per tick.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup liveness_functions
+ */
+serial_port_err_t livenessStart(live_monitor_t *monitor);
+
+/**
+ * @brief Stops and joins the thread of livenessStart.
+ *
+ * @ingroup liveness_functions
+ */
+void livenessStop(live_monitor_t *monitor);
+
+/**
+ * @brief Reads the liveness of a watched port.
+ *
+ * @ingroup liveness_functions
+ */
+void livenessGetStats(live_entry_t *entry, live_stats_t *stats);
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "mavlink.h"
+
+
+/* parser states */
+#define STATE_IDLE      0
+#define STATE_HEADER    1
+#define STATE_BODY      2
+
+#define HEADER_LEN_V1   6
+#define HEADER_LEN_V2   10
+
+
+/* ---- SHA-256, only needed for the 48 bit v2 signature ---- */
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    uint32_t blockLen;
+} sha256_t;
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256Block(sha256_t *ctx, const uint8_t *block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+static void sha256Init(sha256_t *ctx)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->blockLen = 0;
+}
+
+static void sha256Update(sha256_t *ctx, const uint8_t *data, size_t len)
+{
+    ctx->length += len;
+
+    while (len > 0)
+    {
+        size_t n = 64 - ctx->blockLen;
+        if (n > len)
+            n = len;
+
+        memcpy(ctx->block + ctx->blockLen, data, n);
+        ctx->blockLen += (uint32_t)n;
+        data += n;
+        len -= n;
+
+        if (ctx->blockLen == 64)
+        {
+            sha256Block(ctx, ctx->block);
+            ctx->blockLen = 0;
+        }
+    }
+}
+
+static void sha256Final(sha256_t *ctx, uint8_t digest[32])
+{
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    uint8_t lengthBytes[8];
+
+    sha256Update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->blockLen != 56)
+        sha256Update(ctx, &pad, 1);
+
+    for (int i = 0; i < 8; i++)
+        lengthBytes[i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha256Update(ctx, lengthBytes, 8);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+
+/* ---- parser ---- */
+
+uint16_t mavlinkCrcAccumulate(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while (len--)
+    {
+        uint8_t tmp = *data++ ^ (uint8_t)(crc & 0xFF);
+        tmp ^= (uint8_t)(tmp << 4);
+        crc = (uint16_t)((crc >> 8) ^ ((uint16_t)tmp << 8) ^ ((uint16_t)tmp << 3) ^ (tmp >> 4));
+    }
+
+    return crc;
+}
+
+
+const mavlink_msg_entry_t *mavlinkFindEntry(const mavlink_msg_entry_t *table, size_t tableLen, uint32_t msgid)
+{
+    size_t lo = 0;
+    size_t hi = tableLen;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (table[mid].msgid == msgid)
+            return &table[mid];
+        if (table[mid].msgid < msgid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+
+void mavlinkParserInit(mavlink_parser_t *parser, const mavlink_msg_entry_t *table, size_t tableLen)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->table = table;
+    parser->tableLen = tableLen;
+    parser->state = STATE_IDLE;
+}
+
+
+static uint16_t headerLen(const mavlink_parser_t *p)
+{
+    return p->frame[0] == MAVLINK_STX_V2 ? HEADER_LEN_V2 : HEADER_LEN_V1;
+}
+
+
+/* a corrupt frame may hide the start of a real one, so everything after its start byte is scanned again */
+static void rejectFrame(mavlink_parser_t *p)
+{
+    memcpy(p->replay, p->frame + 1, p->frameLen - 1u);
+    p->replayLen = p->frameLen - 1;
+    p->frameLen = 0;
+    p->state = STATE_IDLE;
+}
+
+
+static int signatureValid(const mavlink_parser_t *p)
+{
+    uint16_t signedLen = headerLen(p) + p->frame[1] + 2 + 7;
+    uint8_t digest[32];
+    sha256_t sha;
+
+    /* sha256(key + header + payload + crc + link id + timestamp), first 48 bits */
+    sha256Init(&sha);
+    sha256Update(&sha, p->secretKey, 32);
+    sha256Update(&sha, p->frame, signedLen);
+    sha256Final(&sha, digest);
+
+    return memcmp(digest, p->frame + signedLen, 6) == 0;
+}
+
+
+static size_t finishFrame(mavlink_parser_t *p, mavlink_handler_t handler, void *context)
+{
+    uint16_t hdr = headerLen(p);
+    uint8_t payloadLen = p->frame[1];
+    int v2 = p->frame[0] == MAVLINK_STX_V2;
+    int isSigned = v2 && (p->frame[2] & MAVLINK_IFLAG_SIGNED);
+    mavlink_message_t msg;
+
+    msg.msgid = v2 ? (p->frame[7] | ((uint32_t)p->frame[8] << 8) | ((uint32_t)p->frame[9] << 16)) : p->frame[5];
+    msg.entry = mavlinkFindEntry(p->table, p->tableLen, msg.msgid);
+
+    if (msg.entry == NULL && !p->acceptUnknown)
+    {
+        p->unknownMessages++;
+        rejectFrame(p);
+        return 0;
+    }
+
+    if (msg.entry != NULL)
+    {
+        uint16_t crc = mavlinkCrcAccumulate(p->crc, &msg.entry->crcExtra, 1);
+        uint16_t received = p->frame[hdr + payloadLen] | ((uint16_t)p->frame[hdr + payloadLen + 1] << 8);
+
+        if (crc != received)
+        {
+            p->crcErrors++;
+            rejectFrame(p);
+            return 0;
+        }
+    }
+
+    /* the frame is intact from here on, a signing failure does not need a rescan */
+    if (p->secretKey != NULL && (isSigned ? !signatureValid(p) : p->requireSigning))
+    {
+        p->signatureErrors++;
+        p->frameLen = 0;
+        p->state = STATE_IDLE;
+        return 0;
+    }
+
+    msg.frame = p->frame;
+    msg.frameLen = p->frameLen;
+    msg.payload = p->frame + hdr;
+    msg.payloadLen = payloadLen;
+    msg.version = v2 ? 2 : 1;
+    msg.incompatFlags = v2 ? p->frame[2] : 0;
+    msg.compatFlags = v2 ? p->frame[3] : 0;
+    msg.seq = p->frame[v2 ? 4 : 2];
+    msg.sysid = p->frame[v2 ? 5 : 3];
+    msg.compid = p->frame[v2 ? 6 : 4];
+
+    p->messages++;
+    handler(&msg, context);
+
+    p->frameLen = 0;
+    p->state = STATE_IDLE;
+    return 1;
+}
+
+
+/* consumes bytes for the current state, returns how many were used */
+static size_t step(mavlink_parser_t *p, const uint8_t *data, size_t len, mavlink_handler_t handler, void *context, size_t *delivered)
+{
+    if (p->state == STATE_IDLE)
+    {
+        size_t i = 0;
+
+        while (i < len && data[i] != MAVLINK_STX_V2 && data[i] != MAVLINK_STX_V1)
+            i++;
+
+        if (i == len)
+            return len;
+
+        p->frame[0] = data[i];
+        p->frameLen = 1;
+        p->expected = headerLen(p);
+        p->crc = 0xFFFF;
+        p->state = STATE_HEADER;
+        return i + 1;
+    }
+
+    size_t n = (size_t)(p->expected - p->frameLen);
+    if (n > len)
+        n = len;
+
+    uint16_t from = p->frameLen;
+    uint16_t to = (uint16_t)(from + n);
+    memcpy(p->frame + from, data, n);
+    p->frameLen = to;
+
+    /* the CRC covers everything after the start byte up to the end of the payload */
+    uint16_t crcEnd = p->state == STATE_HEADER ? to : (uint16_t)(headerLen(p) + p->frame[1]);
+    if (from < crcEnd)
+        p->crc = mavlinkCrcAccumulate(p->crc, p->frame + from, (to < crcEnd ? to : crcEnd) - from);
+
+    if (p->frameLen < p->expected)
+        return n;
+
+    if (p->state == STATE_HEADER)
+    {
+        int v2 = p->frame[0] == MAVLINK_STX_V2;
+
+        /* unknown incompatibility flags mean the frame cannot be understood */
+        if (v2 && (p->frame[2] & ~MAVLINK_IFLAG_SIGNED))
+        {
+            rejectFrame(p);
+            return n;
+        }
+
+        p->expected = headerLen(p) + p->frame[1] + 2;
+        if (v2 && (p->frame[2] & MAVLINK_IFLAG_SIGNED))
+            p->expected += MAVLINK_SIGNATURE_LEN;
+        p->state = STATE_BODY;
+        return n;
+    }
+
+    *delivered += finishFrame(p, handler, context);
+    return n;
+}
+
+
+size_t mavlinkParse(mavlink_parser_t *parser, const uint8_t *data, size_t len, mavlink_handler_t handler, void *context)
+{
+    size_t delivered = 0;
+    size_t pos = 0;
+
+    while (pos < len || parser->replayLen > 0)
+    {
+        if (parser->replayLen > 0)
+        {
+            uint8_t pending[MAVLINK_MAX_FRAME];
+            size_t count = parser->replayLen;
+            size_t i = 0;
+
+            memcpy(pending, parser->replay, count);
+            parser->replayLen = 0;
+
+            while (i < count)
+            {
+                i += step(parser, pending + i, count - i, handler, context, &delivered);
+
+                /* another rejection: its tail goes in front of what is left of this replay */
+                if (parser->replayLen > 0)
+                {
+                    memcpy(parser->replay + parser->replayLen, pending + i, count - i);
+                    parser->replayLen += (uint16_t)(count - i);
+                    break;
+                }
+            }
+            continue;
+        }
+
+        pos += step(parser, data + pos, len - pos, handler, context, &delivered);
+    }
+
+    return delivered;
+}
+
+
+/* ---- router ---- */
+
+typedef struct {
+    mavlink_router_t *router;
+    int link;
+} route_context_t;
+
+
+static uint32_t componentSlot(uint32_t key)
+{
+    return (key * 2654435761u) >> 22;
+}
+
+
+static void learnRoute(mavlink_router_t *router, int link, uint8_t sysid, uint8_t compid)
+{
+    uint32_t key = (((uint32_t)sysid << 8) | compid) + 1;
+    uint32_t slot = componentSlot(key);
+
+    router->systemLinks[sysid] |= 1u << link;
+
+    for (int probe = 0; probe < 1024; probe++, slot = (slot + 1) & 1023)
+    {
+        if (router->componentKeys[slot] == key || router->componentKeys[slot] == 0)
+        {
+            router->componentKeys[slot] = key;
+            router->componentLinks[slot] |= 1u << link;
+            return;
+        }
+    }
+}
+
+
+static uint32_t componentRoute(const mavlink_router_t *router, uint8_t sysid, uint8_t compid)
+{
+    uint32_t key = (((uint32_t)sysid << 8) | compid) + 1;
+    uint32_t slot = componentSlot(key);
+
+    for (int probe = 0; probe < 1024; probe++, slot = (slot + 1) & 1023)
+    {
+        if (router->componentKeys[slot] == key)
+            return router->componentLinks[slot];
+        if (router->componentKeys[slot] == 0)
+            break;
+    }
+
+    return 0;
+}
+
+
+static void routeMessage(const mavlink_message_t *msg, void *context)
+{
+    route_context_t *ctx = (route_context_t*)context;
+    mavlink_router_t *router = ctx->router;
+    uint32_t mask = ((router->linkCount >= 32) ? 0xFFFFFFFFu : ((1u << router->linkCount) - 1)) & ~(1u << ctx->link);
+    const mavlink_msg_entry_t *entry = msg->entry;
+
+    learnRoute(router, ctx->link, msg->sysid, msg->compid);
+
+    if (router->hook != NULL)
+        router->hook(ctx->link, msg, router->hookContext);
+
+    /* v2 trims trailing zero bytes, a target field past the end of the payload is 0 (broadcast) */
+    if (entry != NULL && (entry->flags & MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_SYSTEM) &&
+        entry->targetSystemOfs < msg->payloadLen && msg->payload[entry->targetSystemOfs] != 0)
+    {
+        uint8_t targetSystem = msg->payload[entry->targetSystemOfs];
+        uint8_t targetComponent = 0;
+        uint32_t targets = 0;
+
+        if ((entry->flags & MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_COMPONENT) && entry->targetComponentOfs < msg->payloadLen)
+            targetComponent = msg->payload[entry->targetComponentOfs];
+
+        if (targetComponent != 0)
+            targets = componentRoute(router, targetSystem, targetComponent);
+        if (targets == 0)
+            targets = router->systemLinks[targetSystem];
+
+        mask &= targets;
+    }
+
+    for (int i = 0; mask != 0; i++, mask >>= 1)
+    {
+        if (!(mask & 1))
+            continue;
+
+        /* straight out of the parser's frame buffer */
+        if (serialPortWrite(router->links[i].port, (uint8_t*)msg->frame, msg->frameLen) == SERIAL_ERR_OK)
+            router->links[i].forwarded++;
+        else
+            router->links[i].writeErrors++;
+    }
+}
+
+
+void mavlinkRouterInit(mavlink_router_t *router, mavlink_router_hook_t hook, void *context)
+{
+    memset(router, 0, sizeof(*router));
+    router->hook = hook;
+    router->hookContext = context;
+}
+
+
+int mavlinkRouterAddLink(mavlink_router_t *router, serial_port_t *port, const mavlink_msg_entry_t *table, size_t tableLen)
+{
+    if (router->linkCount >= MAVLINK_ROUTER_MAX_LINKS)
+        return -1;
+
+    mavlink_link_t *link = &router->links[router->linkCount];
+
+    link->port = port;
+    link->forwarded = 0;
+    link->writeErrors = 0;
+    mavlinkParserInit(&link->parser, table, tableLen);
+
+    /* a router must pass on messages from dialects it does not know */
+    link->parser.acceptUnknown = 1;
+
+    return router->linkCount++;
+}
+
+
+size_t mavlinkRouterPoll(mavlink_router_t *router)
+{
+    uint8_t chunk[MAVLINK_ROUTER_RX_CHUNK];
+    size_t messages = 0;
+
+    for (int i = 0; i < router->linkCount; i++)
+    {
+        int available = bytesAvailable(router->links[i].port);
+        uint64_t got;
+
+        if (available <= 0)
+            continue;
+
+        if (available > MAVLINK_ROUTER_RX_CHUNK)
+            available = MAVLINK_ROUTER_RX_CHUNK;
+
+        if (serialPortReadSome(router->links[i].port, chunk, (uint64_t)available, &got) != SERIAL_ERR_OK)
+            continue;
+
+        route_context_t context = { router, i };
+        messages += mavlinkParse(&router->links[i].parser, chunk, (size_t)got, routeMessage, &context);
+    }
+
+    return messages;
+}
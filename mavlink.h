@@ -0,0 +1,261 @@
+/**
+ * @file mavlink.h
+ * @brief Streaming MAVLink v1/v2 framer and a zero-copy router between serial ports.
+ * 
+ * The parser consumes received bytes in whatever chunks they arrive, accumulates the X.25 CRC
+ * while copying, validates CRC_EXTRA against a caller supplied message table and optionally
+ * checks v2 signatures. Complete messages are handed out as views into the parser's frame
+ * buffer. The router feeds several ports through one parser each and forwards the raw frames
+ * straight from that buffer to the links where the target system was last seen.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef MAVLINK_H
+#define MAVLINK_H
+
+#include "serialPort.h"
+
+/**
+ * @defgroup mavlink_functions MAVLink
+ * @ingroup functions
+ * @brief MAVLink parsing and routing.
+ */
+
+#define MAVLINK_STX_V1              0xFE    /**< Start byte of a MAVLink 1 frame. */
+#define MAVLINK_STX_V2              0xFD    /**< Start byte of a MAVLink 2 frame. */
+#define MAVLINK_SIGNATURE_LEN       13      /**< Link id, 48 bit timestamp and 48 bit signature. */
+#define MAVLINK_MAX_FRAME           (10 + 255 + 2 + MAVLINK_SIGNATURE_LEN)
+#define MAVLINK_IFLAG_SIGNED        0x01    /**< Incompatibility flag: frame carries a signature. */
+
+#define MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_SYSTEM       0x01    /**< Payload carries a target system. */
+#define MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_COMPONENT    0x02    /**< Payload carries a target component. */
+
+#define MAVLINK_ROUTER_MAX_LINKS    32      /**< Maximum number of ports in a router. */
+#define MAVLINK_ROUTER_RX_CHUNK     4096    /**< Bytes read from a link per poll. */
+
+/**
+ * @struct mavlink_msg_entry_t
+ * @brief Per-message information from the dialect, the same layout as MAVLINK_MESSAGE_CRCS
+ *        generated by mavgen.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t msgid;                 /**< Message id. */
+    uint8_t crcExtra;               /**< CRC_EXTRA seed of the message definition. */
+    uint8_t minLen;                 /**< Length of the MAVLink 1 part of the payload. */
+    uint8_t maxLen;                 /**< Length including extension fields. */
+    uint8_t flags;                  /**< MAVLINK_MSG_ENTRY_FLAGS_* bits. */
+    uint8_t targetSystemOfs;        /**< Payload offset of target_system. */
+    uint8_t targetComponentOfs;     /**< Payload offset of target_component. */
+} mavlink_msg_entry_t;
+
+/**
+ * @struct mavlink_message_t
+ * @brief View of a received message. Points into the parser and is only valid inside the handler.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    const uint8_t *frame;           /**< The complete frame as received, start byte to signature. */
+    uint16_t frameLen;              /**< Length of frame. */
+    const uint8_t *payload;         /**< Payload inside frame. v2 payloads may be trimmed of trailing zeros. */
+    uint8_t payloadLen;             /**< Length of payload. */
+    uint8_t version;                /**< 1 or 2. */
+    uint8_t incompatFlags;          /**< v2 incompatibility flags. */
+    uint8_t compatFlags;            /**< v2 compatibility flags. */
+    uint8_t seq;                    /**< Sequence number. */
+    uint8_t sysid;                  /**< Sending system. */
+    uint8_t compid;                 /**< Sending component. */
+    uint32_t msgid;                 /**< Message id. */
+    const mavlink_msg_entry_t *entry; /**< Dialect entry, NULL for unknown messages. */
+} mavlink_message_t;
+
+/** @brief Called for every valid message. */
+typedef void (*mavlink_handler_t)(const mavlink_message_t *msg, void *context);
+
+/**
+ * @struct mavlink_parser_t
+ * @brief Streaming MAVLink parser state.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    const mavlink_msg_entry_t *table;   /**< Dialect table sorted by msgid. */
+    size_t tableLen;                    /**< Number of entries in table. */
+    int acceptUnknown;                  /**< Deliver messages missing from the table without CRC check. */
+    const uint8_t *secretKey;           /**< 32 byte signing key, NULL to skip signature checks. */
+    int requireSigning;                 /**< Drop unsigned frames when a key is set. */
+
+    uint8_t state;                      /**< Internal parser state. */
+    uint8_t frame[MAVLINK_MAX_FRAME];   /**< Frame being assembled. */
+    uint16_t frameLen;                  /**< Bytes collected in frame. */
+    uint16_t expected;                  /**< Bytes needed for the current header or frame. */
+    uint16_t crc;                       /**< Running X.25 CRC. */
+    uint8_t replay[MAVLINK_MAX_FRAME];  /**< Bytes to re-scan after a corrupt frame. */
+    uint16_t replayLen;                 /**< Number of bytes in replay. */
+
+    uint64_t messages;                  /**< Valid messages delivered. */
+    uint64_t crcErrors;                 /**< Frames dropped for a CRC mismatch. */
+    uint64_t signatureErrors;           /**< Frames dropped for a bad or missing signature. */
+    uint64_t unknownMessages;           /**< Frames dropped because the id is not in the table. */
+} mavlink_parser_t;
+
+/**
+ * @struct mavlink_link_t
+ * @brief One port attached to a router.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;                /**< Port of the link. */
+    mavlink_parser_t parser;            /**< Parser for data received on the link. */
+    uint64_t forwarded;                 /**< Frames written to this link. */
+    uint64_t writeErrors;               /**< Frames that failed to be written. */
+} mavlink_link_t;
+
+/** @brief Optional hook seeing every message the router receives. */
+typedef void (*mavlink_router_hook_t)(int link, const mavlink_message_t *msg, void *context);
+
+/**
+ * @struct mavlink_router_t
+ * @brief Routes MAVLink frames between serial ports by system and component id.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    mavlink_link_t links[MAVLINK_ROUTER_MAX_LINKS]; /**< Attached links. */
+    int linkCount;                      /**< Number of attached links. */
+    uint32_t systemLinks[256];          /**< Links on which each system id has been seen (bit mask). */
+    uint32_t componentKeys[1024];       /**< Open addressed table of seen components, (sysid << 8 | compid) + 1, 0 = empty. */
+    uint32_t componentLinks[1024];      /**< Link mask for each entry in componentKeys. */
+    mavlink_router_hook_t hook;         /**< Optional hook, may be NULL. */
+    void *hookContext;                  /**< User pointer passed to hook. */
+} mavlink_router_t;
+
+/**
+ * @brief Initialises a parser.
+ * 
+ * @param[out] parser Pointer to the parser.
+ * @param[in] table Dialect table sorted by msgid, e.g. built from mavgen's MAVLINK_MESSAGE_CRCS.
+ * @param[in] tableLen Number of entries in table.
+ *
+ * @ingroup mavlink_functions
+ */
+void mavlinkParserInit(mavlink_parser_t *parser, const mavlink_msg_entry_t *table, size_t tableLen);
+
+/**
+ * @brief Feeds received bytes into the parser.
+ * 
+ * Frames may be split across any number of calls. The handler runs once per valid message.
+ * 
+ * @param[in] parser Pointer to the parser.
+ * @param[in] data Received bytes.
+ * @param[in] len Number of bytes.
+ * @param[in] handler Function called for each message.
+ * @param[in] context User pointer passed to handler.
+ * 
+ * @return Number of messages delivered.
+ *
+ * @ingroup mavlink_functions
+ * 
+ * ### Example
+ * @code
+ * static const mavlink_msg_entry_t dialect[] = MAVLINK_MESSAGE_CRCS;
+ * mavlink_parser_t parser;
+ * 
+ * void onMessage(const mavlink_message_t *msg, void *context) {
+ *     printf("msg %u from %u/%u\n", msg->msgid, msg->sysid, msg->compid);
+ * }
+ * 
+ * void onSerialDataReceived(char* data, int length) {
+ *     mavlinkParse(&parser, (uint8_t*)data, length, onMessage, NULL);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+size_t mavlinkParse(mavlink_parser_t *parser, const uint8_t *data, size_t len, mavlink_handler_t handler, void *context);
+
+/**
+ * @brief Accumulates bytes into a running X.25 (CRC-16/MCRF4XX) checksum.
+ * 
+ * @ingroup mavlink_functions
+ */
+uint16_t mavlinkCrcAccumulate(uint16_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief Looks up a message id in a sorted dialect table.
+ * 
+ * @return The entry, or NULL if the id is not in the table.
+ *
+ * @ingroup mavlink_functions
+ */
+const mavlink_msg_entry_t *mavlinkFindEntry(const mavlink_msg_entry_t *table, size_t tableLen, uint32_t msgid);
+
+/**
+ * @brief Initialises an empty router.
+ * 
+ * @param[out] router Pointer to the router.
+ * @param[in] hook Optional function seeing every received message, may be NULL.
+ * @param[in] context User pointer passed to hook.
+ *
+ * @ingroup mavlink_functions
+ */
+void mavlinkRouterInit(mavlink_router_t *router, mavlink_router_hook_t hook, void *context);
+
+/**
+ * @brief Attaches an opened port to the router.
+ * 
+ * @param[in] router Pointer to the router.
+ * @param[in] port Opened serial port.
+ * @param[in] table Dialect table used to validate frames and find target ids.
+ * @param[in] tableLen Number of entries in table.
+ * 
+ * @return Index of the link, or -1 if the router is full.
+ *
+ * @ingroup mavlink_functions
+ */
+int mavlinkRouterAddLink(mavlink_router_t *router, serial_port_t *port, const mavlink_msg_entry_t *table, size_t tableLen);
+
+/**
+ * @brief Reads every link once and forwards all complete messages.
+ * 
+ * Messages without a target, or with target system 0, go to every other link. Targeted
+ * messages go only to the links on which the target component (or system) has been seen.
+ * Frames are written from the parser buffer without being copied.
+ * 
+ * @param[in] router Pointer to the router.
+ * 
+ * @return Number of messages received during this poll.
+ *
+ * @ingroup mavlink_functions
+ * 
+ * ### Example
+ * Below is an example that bridges a telemetry radio and an autopilot.
+ * @code
+ * static const mavlink_msg_entry_t dialect[] = MAVLINK_MESSAGE_CRCS;
+ * serial_port_t radio, autopilot;
+ * mavlink_router_t router;
+ * int main(){
+ *  if(serialPortOpen(&radio, "COM3", 57600, 10, 100) != SERIAL_ERR_OK ||
+ *     serialPortOpen(&autopilot, "COM4", 921600, 10, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  mavlinkRouterInit(&router, NULL, NULL);
+ *  mavlinkRouterAddLink(&router, &radio, dialect, sizeof(dialect) / sizeof(dialect[0]));
+ *  mavlinkRouterAddLink(&router, &autopilot, dialect, sizeof(dialect) / sizeof(dialect[0]));
+ *  while(1)
+ *      if(mavlinkRouterPoll(&router) == 0)
+ *          Sleep(1);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+size_t mavlinkRouterPoll(mavlink_router_t *router);
+
+#endif
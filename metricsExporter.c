@@ -0,0 +1,626 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#include <stddef.h>
+#include <string.h>
+#include "metricsExporter.h"
+#include "serialAlloc.h"
+
+
+#define METRICS_REQUEST_MAX     2048    /* longest request header read */
+#define METRICS_CONTENT_TYPE    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+
+/* output being rendered; running out of room only sets a flag, the caller grows the buffer and renders again */
+typedef struct {
+    char *buf;
+    size_t capacity;
+    size_t len;
+    int overflow;
+} text_t;
+
+
+static void put(text_t *text, const char *data, size_t len)
+{
+    if (text->len + len > text->capacity)
+    {
+        text->overflow = TRUE;
+        return;
+    }
+
+    memcpy(text->buf + text->len, data, len);
+    text->len += len;
+}
+
+
+static void putStr(text_t *text, const char *str)
+{
+    put(text, str, strlen(str));
+}
+
+
+static void putU64(text_t *text, uint64_t value)
+{
+    char digits[20];
+    size_t i = sizeof(digits);
+
+    do
+    {
+        digits[--i] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    put(text, digits + i, sizeof(digits) - i);
+}
+
+
+/* microseconds as decimal seconds, without going through floating point */
+static void putSeconds(text_t *text, uint64_t us)
+{
+    char fraction[7] = { '.' };
+    uint32_t rest = (uint32_t)(us % 1000000);
+
+    for (int i = 6; i > 0; i--)
+    {
+        fraction[i] = (char)('0' + rest % 10);
+        rest /= 10;
+    }
+
+    putU64(text, us / 1000000);
+    put(text, fraction, sizeof(fraction));
+}
+
+
+/* label values escape backslash, quote and newline; port names like \\.\COM10 need it */
+static void putLabel(text_t *text, const char *name, const char *value)
+{
+    putStr(text, name);
+    put(text, "=\"", 2);
+
+    const char *p = value != NULL ? value : "";
+
+    /* plain names go in one piece */
+    size_t plain = strcspn(p, "\\\"\n");
+    put(text, p, plain);
+
+    for (p += plain; *p != '\0'; p++)
+    {
+        if (*p == '\\' || *p == '"')
+        {
+            put(text, "\\", 1);
+            put(text, p, 1);
+        }
+        else if (*p == '\n')
+            put(text, "\\n", 2);
+        else
+            put(text, p, 1);
+    }
+
+    put(text, "\"", 1);
+}
+
+
+static void putFamily(text_t *text, const char *name, const char *type, const char *help)
+{
+    putStr(text, "# TYPE ");
+    putStr(text, name);
+    put(text, " ", 1);
+    putStr(text, type);
+    putStr(text, "\n# HELP ");
+    putStr(text, name);
+    put(text, " ", 1);
+    putStr(text, help);
+    put(text, "\n", 1);
+}
+
+
+static void putSample(text_t *text, const char *name, const char *suffix, const serial_port_t *port)
+{
+    putStr(text, name);
+    putStr(text, suffix);
+    put(text, "{", 1);
+    putLabel(text, "port", port->name);
+    put(text, "} ", 2);
+}
+
+
+/* one counter family over all ports, the counter found at offset in serial_port_t */
+static void portCounter(text_t *text, metrics_exporter_t *exporter, const char *name, const char *help, size_t offset)
+{
+    putFamily(text, name, "counter", help);
+
+    for (uint32_t i = 0; i < exporter->portCount; i++)
+    {
+        const serial_port_t *port = exporter->ports[i];
+
+        putSample(text, name, "_total", port);
+        putU64(text, (uint64_t)ReadAcquire64((const volatile LONG64*)((const char*)port + offset)));
+        put(text, "\n", 1);
+    }
+}
+
+
+static void portLatency(text_t *text, metrics_exporter_t *exporter)
+{
+    static const char name[] = "serial_port_write_latency_seconds";
+    char bounds[SERIAL_LATENCY_BUCKETS][24];
+    size_t boundLen[SERIAL_LATENCY_BUCKETS];
+
+    putFamily(text, name, "histogram", "Time for a write to complete.");
+
+    /* the le labels are the same for every port, format them once */
+    for (uint32_t b = 0; b < SERIAL_LATENCY_BUCKETS; b++)
+    {
+        text_t bound = { bounds[b], sizeof(bounds[b]), 0, FALSE };
+
+        putStr(&bound, ",le=\"");
+        if (b < SERIAL_LATENCY_BUCKETS - 1)
+            putSeconds(&bound, serialLatencyBoundsUs[b]);
+        else
+            putStr(&bound, "+Inf");
+        putStr(&bound, "\"} ");
+        boundLen[b] = bound.len;
+    }
+
+    for (uint32_t i = 0; i < exporter->portCount; i++)
+    {
+        const serial_port_t *port = exporter->ports[i];
+        uint64_t count = 0;
+        char prefix[256];
+        text_t line = { prefix, sizeof(prefix), 0, FALSE };
+
+        /* the bucket lines of a port only differ after the port label */
+        putStr(&line, name);
+        putStr(&line, "_bucket{");
+        putLabel(&line, "port", port->name);
+        if (line.overflow)
+            line.len = 0;
+
+        /* count is the sum of the buckets read, so the histogram stays consistent with itself */
+        for (uint32_t b = 0; b < SERIAL_LATENCY_BUCKETS; b++)
+        {
+            count += (uint64_t)ReadAcquire64(&port->txLatency[b]);
+
+            if (line.len != 0)
+                put(text, prefix, line.len);
+            else
+            {
+                putStr(text, name);
+                putStr(text, "_bucket{");
+                putLabel(text, "port", port->name);
+            }
+            put(text, bounds[b], boundLen[b]);
+            putU64(text, count);
+            put(text, "\n", 1);
+        }
+
+        putSample(text, name, "_count", port);
+        putU64(text, count);
+        put(text, "\n", 1);
+        putSample(text, name, "_sum", port);
+        putSeconds(text, (uint64_t)ReadAcquire64(&port->txLatencyUs));
+        put(text, "\n", 1);
+    }
+}
+
+
+static void portSilence(text_t *text, metrics_exporter_t *exporter)
+{
+    static const char name[] = "serial_port_silence_seconds";
+    uint64_t now = GetTickCount64();
+
+    putFamily(text, name, "gauge", "Time since data was last received.");
+
+    for (uint32_t i = 0; i < exporter->portCount; i++)
+    {
+        const serial_port_t *port = exporter->ports[i];
+        uint64_t last = (uint64_t)ReadAcquire64(&port->lastRxTick);
+
+        putSample(text, name, "", port);
+        putSeconds(text, now > last ? (now - last) * 1000 : 0);
+        put(text, "\n", 1);
+    }
+}
+
+
+/* one family over all pipeline stages; counters are found at offset in pipeline_stage_t, gauges are queue readings */
+typedef enum { STAGE_COUNTER, STAGE_QUEUE_DEPTH, STAGE_QUEUE_BYTES } stage_value_t;
+
+static void stageFamily(text_t *text, metrics_exporter_t *exporter, const char *name, stage_value_t kind, const char *help, size_t offset)
+{
+    putFamily(text, name, kind == STAGE_COUNTER ? "counter" : "gauge", help);
+
+    for (uint32_t p = 0; p < exporter->pipelineCount; p++)
+    {
+        const pipeline_t *pipeline = exporter->pipelines[p];
+
+        for (uint32_t s = 0; s < pipeline->stageCount; s++)
+        {
+            const pipeline_stage_t *stage = &pipeline->stages[s];
+            uint64_t value;
+
+            if (kind == STAGE_COUNTER)
+                value = (uint64_t)ReadAcquire64((const volatile LONG64*)((const char*)stage + offset));
+            else if (stage->input == NULL)
+                value = 0;
+            else
+                value = kind == STAGE_QUEUE_DEPTH ? spscQueueDepth(stage->input) : spscQueueBytes(stage->input);
+
+            putStr(text, name);
+            if (kind == STAGE_COUNTER)
+                putStr(text, "_total");
+            put(text, "{", 1);
+            putLabel(text, "pipeline", exporter->pipelineNames[p]);
+            put(text, ",", 1);
+            putLabel(text, "stage", stage->name);
+            put(text, "} ", 2);
+            putU64(text, value);
+            put(text, "\n", 1);
+        }
+    }
+}
+
+
+static void renderAll(text_t *text, metrics_exporter_t *exporter)
+{
+    /* line errors are only counted when the driver's error state is read, which a quiet port may never do */
+    for (uint32_t i = 0; i < exporter->portCount; i++)
+    {
+        if (exporter->ports[i]->isOpen)
+            serialPortCollectErrors(exporter->ports[i]);
+    }
+
+    portCounter(text, exporter, "serial_port_received_bytes", "Bytes received.", offsetof(serial_port_t, rxBytes));
+    portCounter(text, exporter, "serial_port_transmitted_bytes", "Bytes transmitted.", offsetof(serial_port_t, txBytes));
+    portCounter(text, exporter, "serial_port_read_errors", "Reads that failed.", offsetof(serial_port_t, readErrors));
+    portCounter(text, exporter, "serial_port_write_errors", "Writes that failed.", offsetof(serial_port_t, writeErrors));
+    portCounter(text, exporter, "serial_port_line_errors", "Framing, parity and overrun errors.", offsetof(serial_port_t, lineErrors));
+    portSilence(text, exporter);
+    portLatency(text, exporter);
+
+    if (exporter->pipelineCount != 0)
+    {
+        stageFamily(text, exporter, "serial_pipeline_records_in", STAGE_COUNTER, "Records consumed by the stage.", offsetof(pipeline_stage_t, recordsIn));
+        stageFamily(text, exporter, "serial_pipeline_bytes_in", STAGE_COUNTER, "Bytes consumed by the stage.", offsetof(pipeline_stage_t, bytesIn));
+        stageFamily(text, exporter, "serial_pipeline_records_out", STAGE_COUNTER, "Records emitted by the stage.", offsetof(pipeline_stage_t, recordsOut));
+        stageFamily(text, exporter, "serial_pipeline_bytes_out", STAGE_COUNTER, "Bytes emitted by the stage.", offsetof(pipeline_stage_t, bytesOut));
+        stageFamily(text, exporter, "serial_pipeline_dropped", STAGE_COUNTER, "Records the stage could not pass on.", offsetof(pipeline_stage_t, dropped));
+        stageFamily(text, exporter, "serial_pipeline_queue_depth", STAGE_QUEUE_DEPTH, "Records waiting in the stage's input queue.", 0);
+        stageFamily(text, exporter, "serial_pipeline_queue_bytes", STAGE_QUEUE_BYTES, "Ring bytes used by the stage's input queue.", 0);
+    }
+
+    putFamily(text, "serial_exporter_scrapes", "counter", "Scrapes served.");
+    putStr(text, "serial_exporter_scrapes_total ");
+    putU64(text, (uint64_t)ReadAcquire64(&exporter->scrapes));
+    put(text, "\n", 1);
+    putFamily(text, "serial_exporter_render_seconds", "gauge", "Render time of the previous scrape.");
+    putStr(text, "serial_exporter_render_seconds ");
+    putSeconds(text, (uint64_t)ReadAcquire64(&exporter->renderUs));
+    putStr(text, "\n# EOF\n");
+}
+
+
+void metricsInit(metrics_exporter_t *exporter)
+{
+    memset(exporter, 0, sizeof(*exporter));
+    exporter->listener = INVALID_SOCKET;
+}
+
+
+serial_port_err_t metricsAddPort(metrics_exporter_t *exporter, serial_port_t *port)
+{
+    if (exporter->portCount == METRICS_MAX_PORTS || port == NULL || exporter->thread != NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    exporter->ports[exporter->portCount++] = port;
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t metricsAddPipeline(metrics_exporter_t *exporter, pipeline_t *pipeline, const char *name)
+{
+    if (exporter->pipelineCount == METRICS_MAX_PIPELINES || pipeline == NULL || exporter->thread != NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    exporter->pipelines[exporter->pipelineCount] = pipeline;
+    exporter->pipelineNames[exporter->pipelineCount] = name;
+    exporter->pipelineCount++;
+    return SERIAL_ERR_OK;
+}
+
+
+const char *metricsRender(metrics_exporter_t *exporter, size_t *length)
+{
+    LARGE_INTEGER start, end, frequency;
+    text_t text;
+
+    QueryPerformanceCounter(&start);
+
+    /* a first guess from the number of series, after that the buffer only grows */
+    if (exporter->buf == NULL)
+    {
+        size_t guess = 4096 + (size_t)exporter->portCount * 2048 + (size_t)exporter->pipelineCount * PIPELINE_MAX_STAGES * 1024;
+        exporter->buf = serialAlloc(guess);
+        if (exporter->buf == NULL)
+            return NULL;
+        exporter->capacity = guess;
+    }
+
+    for (;;)
+    {
+        text.buf = exporter->buf;
+        text.capacity = exporter->capacity;
+        text.len = 0;
+        text.overflow = FALSE;
+
+        renderAll(&text, exporter);
+        if (!text.overflow)
+            break;
+
+        char *grown = serialRealloc(exporter->buf, exporter->capacity, exporter->capacity * 2);
+        if (grown == NULL)
+            return NULL;
+        exporter->buf = grown;
+        exporter->capacity *= 2;
+    }
+
+    QueryPerformanceCounter(&end);
+    QueryPerformanceFrequency(&frequency);
+    InterlockedExchange64(&exporter->renderUs, (end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart);
+
+    *length = text.len;
+    return exporter->buf;
+}
+
+
+static int sendAll(SOCKET client, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int sent = send(client, data, len > 0x40000000 ? 0x40000000 : (int)len, 0);
+        if (sent <= 0)
+        {
+            /* a client that stopped reading is reset, not left to the stack to drain at its pace */
+            struct linger reset = { 1, 0 };
+            setsockopt(client, SOL_SOCKET, SO_LINGER, (const char*)&reset, sizeof(reset));
+            return FALSE;
+        }
+
+        data += sent;
+        len -= (size_t)sent;
+    }
+
+    return TRUE;
+}
+
+
+static void respond(SOCKET client, const char *status, const char *type, const char *body, size_t len)
+{
+    char header[256];
+    text_t text = { header, sizeof(header), 0, FALSE };
+
+    putStr(&text, "HTTP/1.1 ");
+    putStr(&text, status);
+    putStr(&text, "\r\nContent-Type: ");
+    putStr(&text, type);
+    putStr(&text, "\r\nContent-Length: ");
+    putU64(&text, len);
+    putStr(&text, "\r\nConnection: close\r\n\r\n");
+
+    if (sendAll(client, header, text.len))
+        sendAll(client, body, len);
+}
+
+
+/* one request per connection; anything but a GET of / or /metrics is refused */
+static void serveClient(metrics_exporter_t *exporter, SOCKET client)
+{
+    char request[METRICS_REQUEST_MAX + 1];
+    DWORD timeout = METRICS_REQUEST_MS;
+    DWORD sendTimeout = METRICS_SEND_MS;
+    int len = 0;
+
+    /* clients are served one at a time, so neither a slow request nor a slow reader may hold up the next */
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
+
+    while (len < METRICS_REQUEST_MAX)
+    {
+        int got = recv(client, request + len, METRICS_REQUEST_MAX - len, 0);
+        if (got <= 0)
+            return;
+
+        len += got;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL)
+            break;
+    }
+
+    if (strncmp(request, "GET ", 4) != 0)
+    {
+        respond(client, "405 Method Not Allowed", "text/plain", "", 0);
+        return;
+    }
+
+    const char *path = request + 4;
+    size_t pathLen = strcspn(path, " ?\r\n");
+    if (!(pathLen == 1 && path[0] == '/') && !(pathLen == 8 && strncmp(path, "/metrics", 8) == 0))
+    {
+        respond(client, "404 Not Found", "text/plain", "", 0);
+        return;
+    }
+
+    size_t length;
+    const char *body = metricsRender(exporter, &length);
+    if (body == NULL)
+    {
+        respond(client, "500 Internal Server Error", "text/plain", "", 0);
+        return;
+    }
+
+    InterlockedIncrement64(&exporter->scrapes);
+    respond(client, "200 OK", METRICS_CONTENT_TYPE, body, length);
+}
+
+
+static DWORD WINAPI MetricsThread(LPVOID lpParam)
+{
+    metrics_exporter_t *exporter = (metrics_exporter_t*)lpParam;
+
+    while (ReadAcquire(&exporter->running))
+    {
+        /* metricsStop closes the listener, which ends the accept */
+        SOCKET client = accept(exporter->listener, NULL, NULL);
+        if (client == INVALID_SOCKET)
+        {
+            if (ReadAcquire(&exporter->running))
+                Sleep(10);
+            continue;
+        }
+
+        serveClient(exporter, client);
+        closesocket(client);
+    }
+
+    return 0;
+}
+
+
+static SOCKET listenUnix(const char *path)
+{
+    SOCKADDR_UN address = {0};
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        return INVALID_SOCKET;
+
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    /* a socket file left behind by a previous run blocks the bind */
+    DeleteFileA(path);
+
+    SOCKET listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET)
+        return INVALID_SOCKET;
+
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        closesocket(listener);
+        return INVALID_SOCKET;
+    }
+
+    return listener;
+}
+
+
+static SOCKET listenTcp(const char *address)
+{
+    char host[256];
+    const char *colon = strrchr(address, ':');
+    struct addrinfo hints = {0};
+    struct addrinfo *result;
+
+    if (colon == NULL || (size_t)(colon - address) >= sizeof(host))
+        return INVALID_SOCKET;
+
+    /* [::1]:9464 style IPv6 hosts lose their brackets */
+    size_t hostLen = (size_t)(colon - address);
+    if (hostLen >= 2 && address[0] == '[' && address[hostLen - 1] == ']')
+    {
+        address++;
+        hostLen -= 2;
+    }
+    memcpy(host, address, hostLen);
+    host[hostLen] = '\0';
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(hostLen != 0 ? host : NULL, colon + 1, &hints, &result) != 0)
+        return INVALID_SOCKET;
+
+    SOCKET listener = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (listener != INVALID_SOCKET &&
+        (bind(listener, result->ai_addr, (int)result->ai_addrlen) != 0 || listen(listener, SOMAXCONN) != 0))
+    {
+        closesocket(listener);
+        listener = INVALID_SOCKET;
+    }
+
+    freeaddrinfo(result);
+    return listener;
+}
+
+
+serial_port_err_t metricsStart(metrics_exporter_t *exporter, const char *address)
+{
+    WSADATA wsa;
+
+    if (exporter->thread != NULL || address == NULL || WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return SERIAL_ERR_OPEN;
+
+    if (strncmp(address, "unix:", 5) == 0)
+        exporter->listener = listenUnix(address + 5);
+    else
+        exporter->listener = listenTcp(address);
+
+    if (exporter->listener == INVALID_SOCKET)
+    {
+        WSACleanup();
+        return SERIAL_ERR_OPEN;
+    }
+
+    InterlockedExchange(&exporter->running, 1);
+
+    exporter->thread = CreateThread(NULL, 0, MetricsThread, exporter, 0, NULL);
+    if (exporter->thread == NULL)
+    {
+        InterlockedExchange(&exporter->running, 0);
+        closesocket(exporter->listener);
+        exporter->listener = INVALID_SOCKET;
+        WSACleanup();
+        return SERIAL_ERR_OPEN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void metricsStop(metrics_exporter_t *exporter)
+{
+    if (exporter->thread == NULL)
+        return;
+
+    InterlockedExchange(&exporter->running, 0);
+    closesocket(exporter->listener);
+    exporter->listener = INVALID_SOCKET;
+
+    WaitForSingleObject(exporter->thread, INFINITE);
+    CloseHandle(exporter->thread);
+    exporter->thread = NULL;
+
+    serialFree(exporter->buf, exporter->capacity);
+    exporter->buf = NULL;
+    exporter->capacity = 0;
+
+    WSACleanup();
+}
@@ -0,0 +1,145 @@
+/**
+ * @file metricsExporter.h
+ * @brief OpenMetrics (Prometheus) exporter for port and pipeline counters.
+ *
+ * The exporter serves the counters every port keeps in serial_port_t (bytes, errors, write
+ * latency histogram, time since the last received data) and the counters and queue depths of
+ * pipeline stages in the OpenMetrics text format, over HTTP on a local TCP listener or on an
+ * AF_UNIX socket. Ports and pipelines are registered before the exporter starts and the list is
+ * fixed afterwards, so a scrape only reads the atomics of the I/O threads and asks the driver of
+ * every open port for its line errors: it takes no lock, never delays a read or write, and renders
+ * with a hand-rolled formatter into a buffer that is reused between scrapes.
+ *
+ * Link with ws2_32.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <winsock2.h>
+#include <stdint.h>
+#include "serialPort.h"
+#include "pipeline.h"
+
+/**
+ * @defgroup metrics_functions Metrics Exporter
+ * @ingroup functions
+ * @brief Serving counters to Prometheus.
+ */
+
+#define METRICS_MAX_PORTS       1024
+#define METRICS_MAX_PIPELINES   64
+#define METRICS_REQUEST_MS      1000    /**< Longest a client may take to send its request. */
+#define METRICS_SEND_MS         1000    /**< Longest a send may wait for a client to take the response. */
+
+/**
+ * @struct metrics_exporter_t
+ * @brief An exporter and the objects it reports.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *ports[METRICS_MAX_PORTS];            /**< Ports in order of metricsAddPort. */
+    uint32_t portCount;                                 /**< Number of ports. */
+    pipeline_t *pipelines[METRICS_MAX_PIPELINES];       /**< Pipelines in order of metricsAddPipeline. */
+    const char *pipelineNames[METRICS_MAX_PIPELINES];   /**< Value of their pipeline label. */
+    uint32_t pipelineCount;                             /**< Number of pipelines. */
+    SOCKET listener;                                    /**< Listening socket, INVALID_SOCKET when stopped. */
+    HANDLE thread;                                      /**< Thread serving the scrapes. */
+    volatile LONG running;                              /**< Cleared by metricsStop. */
+    char *buf;                                          /**< Response buffer, grown as needed. */
+    size_t capacity;                                    /**< Size of buf. */
+    volatile LONG64 scrapes;                            /**< Scrapes served. */
+    volatile LONG64 renderUs;                           /**< Render time of the last scrape in microseconds. */
+} metrics_exporter_t;
+
+/**
+ * @brief Initialises an exporter without ports or pipelines.
+ *
+ * @param[out] exporter Pointer to the exporter.
+ *
+ * @ingroup metrics_functions
+ *
+ * ### Example
+ * Below is an example that exports two ports and a pipeline on http://127.0.0.1:9464/metrics.
+ * @code
+ * serial_port_t gps, imu;
+ * pipeline_t pipeline;
+ * metrics_exporter_t exporter;
+ * int main(){
+ *  // open the ports and set up the pipeline reading imu
+ *  ...
+ *  metricsInit(&exporter);
+ *  metricsAddPort(&exporter, &gps);
+ *  metricsAddPort(&exporter, &imu);
+ *  metricsAddPipeline(&exporter, &pipeline, "imu");
+ *  if(metricsStart(&exporter, "127.0.0.1:9464") != SERIAL_ERR_OK)
+ *      return -1;
+ *  ...
+ *  metricsStop(&exporter);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+void metricsInit(metrics_exporter_t *exporter);
+
+/**
+ * @brief Adds a port, labelled with its name; only valid before metricsStart.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup metrics_functions
+ */
+serial_port_err_t metricsAddPort(metrics_exporter_t *exporter, serial_port_t *port);
+
+/**
+ * @brief Adds the stages of a pipeline, labelled with the given name and their own; only valid before metricsStart.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup metrics_functions
+ */
+serial_port_err_t metricsAddPipeline(metrics_exporter_t *exporter, pipeline_t *pipeline, const char *name);
+
+/**
+ * @brief Renders the OpenMetrics text of every registered object into the exporter's buffer.
+ *
+ * Used by the serving thread; can also be called directly to publish the text another way.
+ * Must not run concurrently with a started exporter.
+ *
+ * @param[in] exporter Pointer to the exporter.
+ * @param[out] length Length of the text.
+ *
+ * @return The text, valid until the next render, or NULL if the buffer could not be grown.
+ *
+ * @ingroup metrics_functions
+ */
+const char *metricsRender(metrics_exporter_t *exporter, size_t *length);
+
+/**
+ * @brief Starts serving the metrics over HTTP.
+ *
+ * @param[in] exporter Pointer to the exporter.
+ * @param[in] address "host:port" for TCP, e.g. "127.0.0.1:9464", or "unix:" followed by a socket path.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_OPEN.
+ *
+ * @ingroup metrics_functions
+ */
+serial_port_err_t metricsStart(metrics_exporter_t *exporter, const char *address);
+
+/**
+ * @brief Stops serving, joins the thread and releases the buffer.
+ *
+ * @ingroup metrics_functions
+ */
+void metricsStop(metrics_exporter_t *exporter);
+
+#endif
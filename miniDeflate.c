@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "miniDeflate.h"
+#include "serialAlloc.h"
+
+
+#define WINDOW_SIZE     32768
+#define WINDOW_MASK     (WINDOW_SIZE - 1)
+#define HASH_BITS       15
+#define HASH_SIZE       (1 << HASH_BITS)
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+#define MAX_CHAIN       32      /* match candidates tried per position */
+
+typedef struct {
+    uint8_t *out;
+    size_t pos;
+    size_t capacity;
+    uint64_t bits;
+    uint32_t count;
+    int overflow;
+} bit_writer_t;
+
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+
+uint32_t miniDeflateAdler32(uint32_t adler, const uint8_t *data, size_t len)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (len > 0)
+    {
+        /* 5552 bytes is the most that can be summed before the 32 bit sums may overflow */
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+
+        while (n--)
+        {
+            a += *data++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+
+size_t miniDeflateBound(size_t len)
+{
+    /* fixed Huffman literals take at most 9 bits */
+    return len + len / 8 + 16;
+}
+
+
+static void putBits(bit_writer_t *w, uint32_t value, uint32_t count)
+{
+    w->bits |= (uint64_t)value << w->count;
+    w->count += count;
+
+    while (w->count >= 8)
+    {
+        if (w->pos == w->capacity)
+        {
+            w->overflow = 1;
+            return;
+        }
+        w->out[w->pos++] = (uint8_t)w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+
+/* Huffman codes are sent most significant bit first, the bit writer is LSB first */
+static uint32_t reverseBits(uint32_t code, uint32_t count)
+{
+    uint32_t result = 0;
+
+    while (count--)
+    {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+
+    return result;
+}
+
+
+static void putLiteral(bit_writer_t *w, uint32_t symbol)
+{
+    /* the fixed literal/length code of RFC 1951 section 3.2.6 */
+    if (symbol < 144)
+        putBits(w, reverseBits(0x30 + symbol, 8), 8);
+    else if (symbol < 256)
+        putBits(w, reverseBits(0x190 + symbol - 144, 9), 9);
+    else if (symbol < 280)
+        putBits(w, reverseBits(symbol - 256, 7), 7);
+    else
+        putBits(w, reverseBits(0xC0 + symbol - 280, 8), 8);
+}
+
+
+static void putMatch(bit_writer_t *w, uint32_t length, uint32_t distance)
+{
+    int code = 28;
+    while (lengthBase[code] > length)
+        code--;
+
+    putLiteral(w, 257 + (uint32_t)code);
+    putBits(w, length - lengthBase[code], lengthExtra[code]);
+
+    code = 29;
+    while (distBase[code] > distance)
+        code--;
+
+    putBits(w, reverseBits((uint32_t)code, 5), 5);
+    putBits(w, distance - distBase[code], distExtra[code]);
+}
+
+
+static uint32_t hash3(const uint8_t *p)
+{
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+size_t miniDeflateCompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity)
+{
+    bit_writer_t w = { dst, 0, capacity, 0, 0, 0 };
+    int32_t *head = serialAlloc(HASH_SIZE * sizeof(int32_t));
+    int32_t *prev = serialAlloc(WINDOW_SIZE * sizeof(int32_t));
+    size_t pos = 0;
+
+    if (head == NULL || prev == NULL || capacity < 6)
+    {
+        serialFree(head, HASH_SIZE * sizeof(int32_t));
+        serialFree(prev, WINDOW_SIZE * sizeof(int32_t));
+        return 0;
+    }
+
+    memset(head, 0xFF, HASH_SIZE * sizeof(int32_t));
+
+    /* zlib header: deflate, 32K window, no dictionary, fastest level */
+    putBits(&w, 0x78, 8);
+    putBits(&w, 0x01, 8);
+
+    /* one final block with fixed Huffman codes */
+    putBits(&w, 1, 1);
+    putBits(&w, 1, 2);
+
+    while (pos < len && !w.overflow)
+    {
+        uint32_t bestLen = 0;
+        uint32_t bestDist = 0;
+
+        if (len - pos >= MIN_MATCH)
+        {
+            uint32_t h = hash3(src + pos);
+            int32_t candidate = head[h];
+            size_t maxLen = len - pos < MAX_MATCH ? len - pos : MAX_MATCH;
+
+            for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && pos - (size_t)candidate <= WINDOW_SIZE; chain++)
+            {
+                const uint8_t *a = src + candidate;
+                const uint8_t *b = src + pos;
+                uint32_t n = 0;
+
+                if (a[bestLen] == b[bestLen])
+                {
+                    while (n < maxLen && a[n] == b[n])
+                        n++;
+
+                    if (n > bestLen)
+                    {
+                        bestLen = n;
+                        bestDist = (uint32_t)(pos - (size_t)candidate);
+                        if (n == maxLen)
+                            break;
+                    }
+                }
+
+                /* older occurrences of the same hash */
+                int32_t older = prev[candidate & WINDOW_MASK];
+                if (older >= candidate)
+                    break;
+                candidate = older;
+            }
+        }
+
+        size_t advance = bestLen >= MIN_MATCH ? bestLen : 1;
+
+        if (bestLen >= MIN_MATCH)
+            putMatch(&w, bestLen, bestDist);
+        else
+            putLiteral(&w, src[pos]);
+
+        /* index every position covered, so later matches can start inside this one */
+        for (size_t i = 0; i < advance; i++, pos++)
+        {
+            if (len - pos >= MIN_MATCH)
+            {
+                uint32_t h = hash3(src + pos);
+                prev[pos & WINDOW_MASK] = head[h];
+                head[h] = (int32_t)pos;
+            }
+        }
+    }
+
+    serialFree(head, HASH_SIZE * sizeof(int32_t));
+    serialFree(prev, WINDOW_SIZE * sizeof(int32_t));
+
+    /* end of block, then pad to a byte boundary */
+    putLiteral(&w, 256);
+    putBits(&w, 0, (8 - w.count % 8) % 8);
+
+    uint32_t adler = miniDeflateAdler32(1, src, len);
+    putBits(&w, adler >> 24, 8);
+    putBits(&w, (adler >> 16) & 0xFF, 8);
+    putBits(&w, (adler >> 8) & 0xFF, 8);
+    putBits(&w, adler & 0xFF, 8);
+
+    return w.overflow ? 0 : w.pos;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file miniDeflate.h
+ * @brief Small zlib-format (RFC 1950 / 1951) compressor.
+ * 
+ * Produces a single fixed-Huffman deflate block from a greedy LZ77 match finder with a 32 KiB
+ * window. The compression ratio is below zlib's, but firmware images typically shrink by a third
+ * to a half, which is what matters for uploads to boot ROMs that inflate on the fly.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef MINIDEFLATE_H
+#define MINIDEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup deflate_functions Deflate
+ * @ingroup functions
+ * @brief zlib stream compression.
+ */
+
+/**
+ * @brief Upper bound of the compressed size of len input bytes.
+ * 
+ * @ingroup deflate_functions
+ */
+size_t miniDeflateBound(size_t len);
+
+/**
+ * @brief Compresses a buffer into a zlib stream.
+ * 
+ * @param[in] src Data to compress.
+ * @param[in] len Length of src.
+ * @param[out] dst Destination buffer, miniDeflateBound(len) bytes are always enough.
+ * @param[in] capacity Size of dst.
+ * 
+ * @return Length of the zlib stream, or 0 if dst is too small or memory ran out.
+ *
+ * @ingroup deflate_functions
+ * 
+ * ### Example
+ * @code
+ * uint8_t *packed = malloc(miniDeflateBound(imageLen));
+ * size_t packedLen = miniDeflateCompress(image, imageLen, packed, miniDeflateBound(imageLen));
+ * @endcode
+ * 
+ * 
+ */
+size_t miniDeflateCompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity);
+
+/**
+ * @brief Updates an Adler-32 checksum (start with 1).
+ * 
+ * @ingroup deflate_functions
+ */
+uint32_t miniDeflateAdler32(uint32_t adler, const uint8_t *data, size_t len);
+
+#endif
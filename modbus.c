@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "modbus.h"
+#include "hexCodec.h"
+
+
+/* ':' + hex(address + PDU + LRC) + CRLF */
+#define MODBUS_ASCII_MAX_FRAME  (1 + 2 * (1 + MODBUS_MAX_PDU + 1) + 2)
+/* address + PDU + CRC */
+#define MODBUS_RTU_MAX_FRAME    (1 + MODBUS_MAX_PDU + 2)
+
+
+static const uint16_t crc16Table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+
+uint8_t modbusLrcUpdate(uint8_t sum, const uint8_t *data, size_t len)
+{
+    while (len--)
+        sum += *data++;
+
+    return sum;
+}
+
+
+uint8_t modbusLrcFinal(uint8_t sum)
+{
+    return (uint8_t)(-sum);
+}
+
+
+uint16_t modbusCrc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+        crc = (crc >> 8) ^ crc16Table[(crc ^ *data++) & 0xFF];
+
+    return crc;
+}
+
+
+/* RTU frames end at 3.5 character times of silence; let the driver's interval timeout find the gap */
+static serial_port_err_t applyModeTimeouts(modbus_t *mb)
+{
+    if (mb->mode != MODBUS_MODE_RTU)
+        return setTimeouts(mb->port, mb->port->readTimeout, mb->port->writeTimeout);
+
+    /* 3.5 characters of 11 bits, fixed at 1.75 ms above 19200 bps as the spec recommends */
+    DWORD silence = 2;
+    if (mb->port->baud > 0 && mb->port->baud <= 19200)
+        silence = (DWORD)((3.5 * 11 * 1000 + mb->port->baud - 1) / mb->port->baud) + 1;
+
+    /* the whole frame comes in one read, so the total timeout grows by one character time per byte */
+    DWORD perByte = 0;
+    if (mb->port->baud > 0)
+        perByte = (DWORD)ceil(serialPortCharacterBits(mb->port) * 1000.0 / mb->port->baud);
+
+    COMMTIMEOUTS timeouts;
+    timeouts.ReadIntervalTimeout = silence;
+    timeouts.ReadTotalTimeoutConstant = mb->port->readTimeout;
+    timeouts.ReadTotalTimeoutMultiplier = perByte;
+    timeouts.WriteTotalTimeoutConstant = mb->port->writeTimeout;
+    timeouts.WriteTotalTimeoutMultiplier = 0;
+
+    if (!SetCommTimeouts(mb->port->handle, &timeouts))
+        return SERIAL_ERR_UNKNOWN;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t modbusInit(modbus_t *mb, serial_port_t *port, modbus_mode_t mode, uint8_t unitId)
+{
+    if (port == NULL || !port->isOpen)
+        return SERIAL_ERR_UNKNOWN;
+
+    mb->port = port;
+    mb->mode = mode;
+    mb->unitId = unitId;
+
+    return applyModeTimeouts(mb);
+}
+
+
+serial_port_err_t modbusSetMode(modbus_t *mb, modbus_mode_t mode)
+{
+    mb->mode = mode;
+
+    /* bytes buffered by the line mode belong to the old framing */
+    mb->port->rxPendingLen = 0;
+
+    return applyModeTimeouts(mb);
+}
+
+
+serial_port_err_t modbusSendFrame(modbus_t *mb, uint8_t unit, const uint8_t *pdu, uint16_t len)
+{
+    if (len == 0 || len > MODBUS_MAX_PDU)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    if (mb->mode == MODBUS_MODE_RTU)
+    {
+        uint8_t frame[MODBUS_RTU_MAX_FRAME];
+
+        frame[0] = unit;
+        memcpy(frame + 1, pdu, len);
+
+        /* the CRC goes out low byte first */
+        uint16_t crc = modbusCrc16(frame, len + 1);
+        frame[len + 1] = (uint8_t)(crc & 0xFF);
+        frame[len + 2] = (uint8_t)(crc >> 8);
+
+        return serialPortWrite(mb->port, frame, len + 3);
+    }
+
+    char frame[MODBUS_ASCII_MAX_FRAME];
+    char *out = frame;
+    uint8_t lrc = modbusLrcUpdate(unit, pdu, len);
+
+    *out++ = ':';
+    hexEncode(&unit, 1, out, 1);
+    out += 2;
+    hexEncode(pdu, len, out, 1);
+    out += 2 * len;
+
+    lrc = modbusLrcFinal(lrc);
+    hexEncode(&lrc, 1, out, 1);
+    out += 2;
+    *out++ = '\r';
+    *out++ = '\n';
+
+    return serialPortWrite(mb->port, (uint8_t*)frame, (uint64_t)(out - frame));
+}
+
+
+static serial_port_err_t receiveRtu(modbus_t *mb, uint8_t *unit, uint8_t *pdu, uint16_t size, uint16_t *len)
+{
+    uint8_t frame[MODBUS_RTU_MAX_FRAME];
+    uint64_t got;
+
+    /* the read returns once the line has been silent for 3.5 character times */
+    serial_port_err_t err = serialPortReadSome(mb->port, frame, sizeof(frame), &got);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    if (got == 0)
+        return SERIAL_ERR_READ_TIMEOUT;
+
+    if (got < 4)
+        return SERIAL_ERR_FRAME;
+
+    /* running the CRC over data and CRC leaves zero for an intact frame */
+    if (modbusCrc16(frame, got) != 0)
+        return SERIAL_ERR_CHECKSUM;
+
+    if (got - 3 > size)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    *unit = frame[0];
+    *len = (uint16_t)(got - 3);
+    memcpy(pdu, frame + 1, *len);
+
+    return SERIAL_ERR_OK;
+}
+
+
+static serial_port_err_t receiveAscii(modbus_t *mb, uint8_t *unit, uint8_t *pdu, uint16_t size, uint16_t *len)
+{
+    uint8_t line[MODBUS_ASCII_MAX_FRAME + 64];
+    uint8_t frame[1 + MODBUS_MAX_PDU + 1];
+    uint64_t lineLen;
+
+    serial_port_err_t err = serialPortReadUntil(mb->port, line, sizeof(line), '\n', &lineLen);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    /* anything before the last ':' is noise or an abandoned frame */
+    uint8_t *start = NULL;
+    for (uint64_t i = lineLen; i-- > 0; )
+    {
+        if (line[i] == ':')
+        {
+            start = line + i + 1;
+            break;
+        }
+    }
+
+    if (start == NULL || lineLen < 2 || line[lineLen - 2] != '\r')
+        return SERIAL_ERR_FRAME;
+
+    size_t hexLen = (size_t)((line + lineLen - 2) - start);
+
+    /* address, function code and LRC at minimum, always whole bytes */
+    if ((hexLen & 1) || hexLen < 6 || hexLen / 2 > sizeof(frame))
+        return SERIAL_ERR_FRAME;
+
+    size_t frameLen = hexLen / 2;
+    if (hexDecode((const char*)start, frameLen, frame) != 0)
+        return SERIAL_ERR_FRAME;
+
+    if (modbusLrcUpdate(0, frame, frameLen) != 0)
+        return SERIAL_ERR_CHECKSUM;
+
+    if (frameLen - 2 > size)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    *unit = frame[0];
+    *len = (uint16_t)(frameLen - 2);
+    memcpy(pdu, frame + 1, *len);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t modbusReceiveFrame(modbus_t *mb, uint8_t *unit, uint8_t *pdu, uint16_t size, uint16_t *len)
+{
+    *len = 0;
+
+    if (mb->mode == MODBUS_MODE_RTU)
+        return receiveRtu(mb, unit, pdu, size, len);
+
+    return receiveAscii(mb, unit, pdu, size, len);
+}
+
+
+serial_port_err_t modbusTransact(modbus_t *mb, uint8_t unit, const uint8_t *req, uint16_t reqLen, uint8_t *rsp, uint16_t rspSize, uint16_t *rspLen)
+{
+    uint8_t from;
+
+    *rspLen = 0;
+
+    serial_port_err_t err = modbusSendFrame(mb, unit, req, reqLen);
+    if (err != SERIAL_ERR_OK || unit == MODBUS_BROADCAST)
+        return err;
+
+    err = modbusReceiveFrame(mb, &from, rsp, rspSize, rspLen);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    if (from != unit)
+        return SERIAL_ERR_FRAME;
+
+    /* return OK */
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t modbusSlavePoll(modbus_t *mb, modbus_request_handler_t handler, void *context)
+{
+    uint8_t req[MODBUS_MAX_PDU];
+    uint8_t rsp[MODBUS_MAX_PDU];
+    uint16_t reqLen;
+    uint16_t rspLen = 0;
+    uint8_t unit;
+
+    serial_port_err_t err = modbusReceiveFrame(mb, &unit, req, sizeof(req), &reqLen);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    /* not for us */
+    if (unit != mb->unitId && unit != MODBUS_BROADCAST)
+        return SERIAL_ERR_OK;
+
+    handler(req, reqLen, rsp, &rspLen, context);
+
+    if (unit == MODBUS_BROADCAST || rspLen == 0)
+        return SERIAL_ERR_OK;
+
+    return modbusSendFrame(mb, mb->unitId, rsp, rspLen);
+}
@@ -0,0 +1,222 @@
+/**
+ * @file modbus.h
+ * @brief Modbus RTU and Modbus ASCII framing on top of the serial port API.
+ * 
+ * Both transmission modes share one master/slave engine: the application builds and consumes
+ * plain PDUs (function code followed by data) and the engine adds the address, checksum and
+ * line framing for the mode selected in the configuration. RTU frames are delimited by line
+ * silence and protected by CRC-16, ASCII frames are ':' ... CRLF hex lines protected by an LRC
+ * and are received through the port's line-oriented receive mode.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef MODBUS_H
+#define MODBUS_H
+
+#include "serialPort.h"
+
+/**
+ * @defgroup modbus_functions Modbus
+ * @ingroup functions
+ * @brief Modbus RTU / ASCII master and slave engine.
+ */
+
+/** @brief Maximum size of a Modbus PDU (function code and data). */
+#define MODBUS_MAX_PDU          253
+
+/** @brief Unit address used for broadcast requests, which are never answered. */
+#define MODBUS_BROADCAST        0
+
+/**
+ * @enum modbus_mode_t
+ * @brief Modbus serial transmission modes.
+ * 
+ * @ingroup enums
+ */
+typedef enum {
+    MODBUS_MODE_RTU,    /**< Binary frames delimited by 3.5 character times of silence, CRC-16. */
+    MODBUS_MODE_ASCII   /**< ':' prefixed, CRLF terminated hex lines, LRC. */
+} modbus_mode_t;
+
+/**
+ * @struct modbus_t
+ * @brief State of a Modbus engine bound to a serial port.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;    /**< Port carrying the Modbus traffic. */
+    modbus_mode_t mode;     /**< Transmission mode. */
+    uint8_t unitId;         /**< Own address when acting as a slave. */
+} modbus_t;
+
+/**
+ * @brief Slave request handler.
+ * 
+ * Called with the request PDU; fills rsp with the response PDU and sets *rspLen to its length.
+ * Leaving *rspLen at zero sends no response.
+ */
+typedef void (*modbus_request_handler_t)(const uint8_t *req, uint16_t reqLen, uint8_t *rsp, uint16_t *rspLen, void *context);
+
+/**
+ * @brief Binds a Modbus engine to an opened serial port.
+ * 
+ * @param[out] mb Pointer to the Modbus engine.
+ * @param[in] port Pointer to an opened serial port.
+ * @param[in] mode Transmission mode.
+ * @param[in] unitId Own address when acting as a slave, ignored by masters.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup modbus_functions
+ * 
+ * ### Example
+ * Below is an example that reads two holding registers from unit 5 using Modbus ASCII.
+ * @code
+ * serial_port_t myPort;
+ * modbus_t mb;
+ * uint8_t req[] = {0x03, 0x00, 0x10, 0x00, 0x02};
+ * uint8_t rsp[MODBUS_MAX_PDU];
+ * uint16_t rspLen;
+ * int main(){
+ *  if(serialPortOpen(&myPort, "COM3", 9600, 500, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(modbusInit(&mb, &myPort, MODBUS_MODE_ASCII, 0) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(modbusTransact(&mb, 5, req, sizeof(req), rsp, sizeof(rsp), &rspLen) != SERIAL_ERR_OK)
+ *      return -1;
+ *  return 0;
+ * }
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t modbusInit(modbus_t *mb, serial_port_t *port, modbus_mode_t mode, uint8_t unitId);
+
+/**
+ * @brief Switches the transmission mode of an engine.
+ * 
+ * @param[in] mb Pointer to the Modbus engine.
+ * @param[in] mode New transmission mode.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup modbus_functions
+ */
+serial_port_err_t modbusSetMode(modbus_t *mb, modbus_mode_t mode);
+
+/**
+ * @brief Sends one PDU to a unit, framed for the current mode.
+ * 
+ * @param[in] mb Pointer to the Modbus engine.
+ * @param[in] unit Destination address (or source address when a slave answers).
+ * @param[in] pdu Function code followed by data.
+ * @param[in] len Length of pdu, at most MODBUS_MAX_PDU.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise an appropriate error code.
+ *
+ * @ingroup modbus_functions
+ */
+serial_port_err_t modbusSendFrame(modbus_t *mb, uint8_t unit, const uint8_t *pdu, uint16_t len);
+
+/**
+ * @brief Receives one frame and validates its checksum.
+ * 
+ * @param[in] mb Pointer to the Modbus engine.
+ * @param[out] unit Address carried by the frame.
+ * @param[out] pdu Buffer for the PDU.
+ * @param[in] size Size of pdu.
+ * @param[out] len Length of the received PDU.
+ * 
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_READ_TIMEOUT if nothing arrived,
+ *         SERIAL_ERR_FRAME or SERIAL_ERR_CHECKSUM for damaged frames, otherwise an appropriate error code.
+ *
+ * @ingroup modbus_functions
+ */
+serial_port_err_t modbusReceiveFrame(modbus_t *mb, uint8_t *unit, uint8_t *pdu, uint16_t size, uint16_t *len);
+
+/**
+ * @brief Master side: sends a request and waits for the matching response.
+ * 
+ * Broadcast requests return immediately with *rspLen set to zero. Exception responses
+ * (function code with bit 7 set) are returned as regular responses.
+ * 
+ * @param[in] mb Pointer to the Modbus engine.
+ * @param[in] unit Destination address.
+ * @param[in] req Request PDU.
+ * @param[in] reqLen Length of req.
+ * @param[out] rsp Buffer for the response PDU.
+ * @param[in] rspSize Size of rsp.
+ * @param[out] rspLen Length of the response PDU.
+ * 
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_FRAME if a different unit answered,
+ *         otherwise an appropriate error code.
+ *
+ * @ingroup modbus_functions
+ */
+serial_port_err_t modbusTransact(modbus_t *mb, uint8_t unit, const uint8_t *req, uint16_t reqLen, uint8_t *rsp, uint16_t rspSize, uint16_t *rspLen);
+
+/**
+ * @brief Slave side: waits for one request addressed to this unit and answers it.
+ * 
+ * Frames for other units are ignored. Broadcast requests are passed to the handler but never answered.
+ * 
+ * @param[in] mb Pointer to the Modbus engine.
+ * @param[in] handler Function building the response PDU.
+ * @param[in] context User pointer passed to the handler.
+ * 
+ * @return SERIAL_ERR_OK if a request was served or ignored, otherwise the receive or send error.
+ *
+ * @ingroup modbus_functions
+ * 
+ * ### Example
+ * @code
+ * void onRequest(const uint8_t *req, uint16_t reqLen, uint8_t *rsp, uint16_t *rspLen, void *context) {
+ *     rsp[0] = req[0] | 0x80;     // answer everything with "illegal function"
+ *     rsp[1] = 0x01;
+ *     *rspLen = 2;
+ * }
+ * 
+ * while (1)
+ *     modbusSlavePoll(&mb, onRequest, NULL);
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t modbusSlavePoll(modbus_t *mb, modbus_request_handler_t handler, void *context);
+
+/**
+ * @brief Accumulates bytes into a running LRC sum.
+ * 
+ * Start with 0, feed any number of chunks and finish with @ref modbusLrcFinal.
+ * Feeding a complete frame including its LRC byte yields 0.
+ * 
+ * @param[in] sum Running sum.
+ * @param[in] data Bytes to add.
+ * @param[in] len Number of bytes.
+ * 
+ * @return Updated running sum.
+ *
+ * @ingroup modbus_functions
+ */
+uint8_t modbusLrcUpdate(uint8_t sum, const uint8_t *data, size_t len);
+
+/**
+ * @brief Converts a running LRC sum into the LRC byte (its two's complement).
+ * 
+ * @ingroup modbus_functions
+ */
+uint8_t modbusLrcFinal(uint8_t sum);
+
+/**
+ * @brief Computes the Modbus RTU CRC-16 of a buffer.
+ * 
+ * @ingroup modbus_functions
+ */
+uint16_t modbusCrc16(const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "patternMatch.h"
+#include "serialAlloc.h"
+#include "serialSimd.h"
+
+
+#define MATCH_OUTPUT    0x80000000u     /* delta entries with this bit lead to a state with output */
+#define MATCH_NONE      0xFFFFFFFFu
+
+
+static uint8_t foldByte(const match_set_t *set, uint8_t c)
+{
+    return (set->caseInsensitive && c >= 'A' && c <= 'Z') ? (uint8_t)(c | 0x20) : c;
+}
+
+
+void patternMatchInit(match_set_t *set, int caseInsensitive)
+{
+    memset(set, 0, sizeof(*set));
+    set->caseInsensitive = caseInsensitive;
+}
+
+
+serial_port_err_t patternMatchAdd(match_set_t *set, const uint8_t *pattern, uint32_t len, uint32_t id)
+{
+    if (len == 0 || set->delta != NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    /* the pattern tables grow in steps of 64 entries */
+    if (set->patternCount % 64 == 0)
+    {
+        size_t oldSize = set->patternCount * sizeof(uint32_t);
+        size_t newSize = (set->patternCount + 64) * sizeof(uint32_t);
+
+        /* all three grow together, so the sizes patternMatchFree derives from patternCount stay right */
+        uint32_t *start = serialAlloc(newSize);
+        uint32_t *length = serialAlloc(newSize);
+        uint32_t *ids = serialAlloc(newSize);
+        if (start == NULL || length == NULL || ids == NULL)
+        {
+            serialFree(start, newSize);
+            serialFree(length, newSize);
+            serialFree(ids, newSize);
+            return SERIAL_ERR_UNKNOWN;
+        }
+
+        if (oldSize != 0)
+        {
+            memcpy(start, set->patternStart, oldSize);
+            memcpy(length, set->patternLen, oldSize);
+            memcpy(ids, set->patternId, oldSize);
+        }
+
+        serialFree(set->patternStart, oldSize);
+        serialFree(set->patternLen, oldSize);
+        serialFree(set->patternId, oldSize);
+        set->patternStart = start;
+        set->patternLen = length;
+        set->patternId = ids;
+    }
+
+    uint8_t *text = serialRealloc(set->text, set->textLen, set->textLen + len);
+    if (text == NULL)
+        return SERIAL_ERR_UNKNOWN;
+    set->text = text;
+
+    memcpy(set->text + set->textLen, pattern, len);
+    set->patternStart[set->patternCount] = set->textLen;
+    set->patternLen[set->patternCount] = len;
+    set->patternId[set->patternCount] = id;
+    set->patternCount++;
+    set->textLen += len;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t patternMatchCompile(match_set_t *set)
+{
+    uint8_t used[256] = {0};
+    uint32_t maxStates = set->textLen + 1;
+    serial_port_err_t err = SERIAL_ERR_UNKNOWN;
+
+    /* bytes that never occur in a pattern all share column 0 */
+    for (uint32_t i = 0; i < set->textLen; i++)
+        used[foldByte(set, set->text[i])] = 1;
+
+    set->classCount = 1;
+    for (int c = 0; c < 256; c++)
+    {
+        if (used[c])
+            used[c] = (uint8_t)set->classCount++;
+    }
+    for (int c = 0; c < 256; c++)
+        set->byteClass[c] = used[foldByte(set, (uint8_t)c)];
+
+    uint32_t classCount = set->classCount;
+    if ((uint64_t)maxStates * classCount >= MATCH_OUTPUT)
+        return SERIAL_ERR_UNKNOWN;
+
+    uint32_t *next = serialCalloc((size_t)maxStates * classCount, sizeof(uint32_t));
+    uint32_t *fail = serialCalloc(maxStates, sizeof(uint32_t));
+    uint32_t *queue = serialAlloc(maxStates * sizeof(uint32_t));
+    set->firstPattern = serialAlloc(maxStates * sizeof(uint32_t));
+    set->nextPattern = serialAlloc((set->patternCount + 1) * sizeof(uint32_t));
+    set->dictLink = serialCalloc(maxStates, sizeof(uint32_t));
+
+    if (next == NULL || fail == NULL || queue == NULL || set->firstPattern == NULL ||
+        set->nextPattern == NULL || set->dictLink == NULL)
+        goto done;
+
+    memset(set->firstPattern, 0xFF, maxStates * sizeof(uint32_t));
+
+    /* trie; 0 is the root, which is never a child, so 0 also means "no edge" */
+    set->stateCount = 1;
+    for (uint32_t p = 0; p < set->patternCount; p++)
+    {
+        const uint8_t *pattern = set->text + set->patternStart[p];
+        uint32_t state = 0;
+
+        for (uint32_t i = 0; i < set->patternLen[p]; i++)
+        {
+            uint32_t *edge = &next[state * classCount + set->byteClass[pattern[i]]];
+            if (*edge == 0)
+                *edge = set->stateCount++;
+            state = *edge;
+        }
+
+        set->nextPattern[p] = set->firstPattern[state];
+        set->firstPattern[state] = p;
+    }
+
+    /* breadth first: failure links, then missing edges borrowed from the failure state's complete row */
+    uint32_t head = 0, tail = 0;
+    queue[tail++] = 0;
+
+    while (head < tail)
+    {
+        uint32_t state = queue[head++];
+        uint32_t *row = &next[state * classCount];
+
+        for (uint32_t c = 0; c < classCount; c++)
+        {
+            uint32_t child = row[c];
+
+            if (child != 0)
+            {
+                uint32_t link = state == 0 ? 0 : next[fail[state] * classCount + c];
+
+                fail[child] = link;
+                set->dictLink[child] = set->firstPattern[link] != MATCH_NONE ? link : set->dictLink[link];
+                queue[tail++] = child;
+            }
+            else if (state != 0)
+                row[c] = next[fail[state] * classCount + c];
+        }
+    }
+
+    /* entries become row offsets so the scan loop needs no multiply */
+    for (uint32_t i = 0; i < set->stateCount * classCount; i++)
+    {
+        uint32_t target = next[i];
+        int output = set->firstPattern[target] != MATCH_NONE || set->dictLink[target] != 0;
+
+        next[i] = target * classCount | (output ? MATCH_OUTPUT : 0);
+    }
+
+    /* the prefilter looks for the bytes that leave the start state */
+    set->startByteCount = 0;
+    for (int c = 0; c < 256; c++)
+    {
+        if (next[set->byteClass[c]] == 0)
+            continue;
+
+        if (set->startByteCount == MATCH_PREFILTER_MAX)
+        {
+            set->startByteCount = 0;
+            break;
+        }
+        set->startBytes[set->startByteCount++] = (uint8_t)c;
+    }
+
+    set->delta = next;
+    next = NULL;
+    err = SERIAL_ERR_OK;
+
+done:
+    serialFree(next, (size_t)maxStates * classCount * sizeof(uint32_t));
+    serialFree(fail, maxStates * sizeof(uint32_t));
+    serialFree(queue, maxStates * sizeof(uint32_t));
+    return err;
+}
+
+
+void patternMatchFree(match_set_t *set)
+{
+    size_t tableSize = (set->patternCount + 63) / 64 * 64 * sizeof(uint32_t);
+    size_t maxStates = (size_t)set->textLen + 1;
+
+    serialFree(set->text, set->textLen);
+    serialFree(set->patternStart, tableSize);
+    serialFree(set->patternLen, tableSize);
+    serialFree(set->patternId, tableSize);
+    serialFree(set->delta, maxStates * set->classCount * sizeof(uint32_t));
+    serialFree(set->firstPattern, maxStates * sizeof(uint32_t));
+    serialFree(set->nextPattern, (set->patternCount + 1) * sizeof(uint32_t));
+    serialFree(set->dictLink, maxStates * sizeof(uint32_t));
+    patternMatchInit(set, set->caseInsensitive);
+}
+
+
+void patternMatchStreamInit(match_stream_t *stream, const match_set_t *set, match_callback_t callback, void *context)
+{
+    stream->set = set;
+    stream->state = 0;
+    stream->offset = 0;
+    stream->matches = 0;
+    stream->callback = callback;
+    stream->context = context;
+}
+
+
+/* reports every pattern ending in state, which was entered at stream offset end */
+static uint32_t report(match_stream_t *stream, uint32_t state, uint64_t end, uint64_t timestamp)
+{
+    const match_set_t *set = stream->set;
+    match_event_t event;
+    uint32_t count = 0;
+
+    event.timestamp = timestamp;
+
+    for (uint32_t s = (state & ~MATCH_OUTPUT) / set->classCount; s != 0; s = set->dictLink[s])
+    {
+        for (uint32_t p = set->firstPattern[s]; p != MATCH_NONE; p = set->nextPattern[p])
+        {
+            event.patternId = set->patternId[p];
+            event.length = set->patternLen[p];
+            event.offset = end + 1 - set->patternLen[p];
+            count++;
+
+            if (stream->callback != NULL)
+                stream->callback(&event, stream->context);
+        }
+    }
+
+    return count;
+}
+
+
+uint32_t patternMatchFeed(match_stream_t *stream, const uint8_t *data, size_t len, uint64_t timestamp)
+{
+    const match_set_t *set = stream->set;
+    const uint32_t *delta = set->delta;
+    const uint8_t *byteClass = set->byteClass;
+    uint32_t state = stream->state;
+    uint32_t count = 0;
+    size_t i = 0;
+
+    if (delta == NULL)
+        return 0;
+
+#ifdef SERIAL_SSE2
+    __m128i starts[MATCH_PREFILTER_MAX];
+    uint32_t startCount = set->startByteCount;
+
+    for (uint32_t k = 0; k < startCount; k++)
+        starts[k] = _mm_set1_epi8((char)set->startBytes[k]);
+#endif
+
+    while (i < len)
+    {
+#ifdef SERIAL_SSE2
+        /* in the start state nothing happens until a pattern's first byte shows up */
+        if (state == 0 && startCount > 0)
+        {
+            while (i + 16 <= len)
+            {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+                __m128i hit = _mm_cmpeq_epi8(chunk, starts[0]);
+
+                for (uint32_t k = 1; k < startCount; k++)
+                    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, starts[k]));
+
+                uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+                if (mask != 0)
+                {
+                    i += simdLowestBit(mask);
+                    break;
+                }
+                i += 16;
+            }
+
+            if (i == len)
+                break;
+        }
+#endif
+
+        state = delta[(state & ~MATCH_OUTPUT) + byteClass[data[i]]];
+
+        if (state & MATCH_OUTPUT)
+            count += report(stream, state, stream->offset + i, timestamp);
+
+        i++;
+    }
+
+    stream->state = state & ~MATCH_OUTPUT;
+    stream->offset += len;
+    stream->matches += count;
+
+    return count;
+}
+
+
+void patternMatchStage(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    FILETIME now;
+
+    GetSystemTimePreciseAsFileTime(&now);
+    patternMatchFeed((match_stream_t*)context, data, len, ((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime);
+
+    pipelineEmit(stage, data, len);
+}
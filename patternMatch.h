@@ -0,0 +1,178 @@
+/**
+ * @file patternMatch.h
+ * @brief Multi-pattern search on the raw receive stream (Aho-Corasick).
+ *
+ * A pattern set is compiled once into a deterministic automaton whose rows are indexed by byte
+ * class rather than by byte, so only bytes that occur in some pattern get a column and the table
+ * stays small enough for the cache. While the automaton sits in its start state an SSE2 prefilter
+ * skips 16 bytes at a time up to the next byte that can begin a pattern. The compiled set is
+ * read-only and shared by any number of streams, one per port, each carrying its own state and
+ * offset so matches that straddle two chunks are still found.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef PATTERNMATCH_H
+#define PATTERNMATCH_H
+
+#include <stdint.h>
+#include "serialPort.h"
+#include "pipeline.h"
+
+/**
+ * @defgroup match_functions Pattern Matching
+ * @ingroup functions
+ * @brief Streaming multi-pattern search.
+ */
+
+#define MATCH_PREFILTER_MAX     8   /**< Most distinct start bytes the SIMD prefilter handles. */
+
+/**
+ * @struct match_set_t
+ * @brief A set of patterns and, once compiled, its automaton.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    int caseInsensitive;        /**< Fold ASCII letters when matching. */
+    uint8_t *text;              /**< Concatenated pattern bytes. */
+    uint32_t textLen;           /**< Bytes in text. */
+    uint32_t *patternStart;     /**< Offset of each pattern in text. */
+    uint32_t *patternLen;       /**< Length of each pattern. */
+    uint32_t *patternId;        /**< User id of each pattern. */
+    uint32_t patternCount;      /**< Number of patterns. */
+    uint8_t byteClass[256];     /**< Column of each byte in the transition table. */
+    uint32_t classCount;        /**< Columns per state. */
+    uint32_t *delta;            /**< Transition table; entries are row offsets, bit 31 marks output states. */
+    uint32_t stateCount;        /**< Number of states. */
+    uint32_t *firstPattern;     /**< First pattern ending in each state, UINT32_MAX if none. */
+    uint32_t *nextPattern;      /**< Next pattern ending in the same state. */
+    uint32_t *dictLink;         /**< Nearest state on the failure chain with output, 0 if none. */
+    uint8_t startBytes[MATCH_PREFILTER_MAX];    /**< Bytes leaving the start state, for the prefilter. */
+    uint32_t startByteCount;    /**< Entries in startBytes, 0 if there are too many for the prefilter. */
+} match_set_t;
+
+/**
+ * @struct match_event_t
+ * @brief A pattern found in the stream.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t patternId;         /**< Id given to patternMatchAdd. */
+    uint64_t offset;            /**< Stream offset of the first byte of the match. */
+    uint32_t length;            /**< Length of the pattern. */
+    uint64_t timestamp;         /**< Timestamp passed with the chunk holding the last byte. */
+} match_event_t;
+
+/** @brief Match callback, called on the thread feeding the stream. */
+typedef void (*match_callback_t)(const match_event_t *event, void *context);
+
+/**
+ * @struct match_stream_t
+ * @brief Matching state of one stream.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    const match_set_t *set;     /**< Compiled pattern set. */
+    uint32_t state;             /**< Current automaton row offset. */
+    uint64_t offset;            /**< Bytes consumed so far. */
+    uint64_t matches;           /**< Matches reported so far. */
+    match_callback_t callback;  /**< Match callback. */
+    void *context;              /**< User pointer passed to callback. */
+} match_stream_t;
+
+/**
+ * @brief Initialises an empty pattern set.
+ *
+ * @param[out] set Pointer to the set.
+ * @param[in] caseInsensitive Non-zero to match ASCII letters regardless of case.
+ *
+ * @ingroup match_functions
+ *
+ * ### Example
+ * Below is an example that reports error strings in a port's console output.
+ * @code
+ * static void alarm(const match_event_t *event, void *context){
+ *  printf("pattern %u at byte %llu\n", event->patternId, event->offset);
+ * }
+ *
+ * match_set_t alarms;
+ * match_stream_t console;
+ * int main(){
+ *  patternMatchInit(&alarms, 1);
+ *  patternMatchAdd(&alarms, (const uint8_t*)"kernel panic", 12, 1);
+ *  patternMatchAdd(&alarms, (const uint8_t*)"watchdog reset", 14, 2);
+ *  if(patternMatchCompile(&alarms) != SERIAL_ERR_OK)
+ *      return -1;
+ *  patternMatchStreamInit(&console, &alarms, alarm, NULL);
+ *  // feed every received chunk, or insert patternMatchStage into a pipeline
+ *  patternMatchFeed(&console, buffer, bytes, GetTickCount64());
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+void patternMatchInit(match_set_t *set, int caseInsensitive);
+
+/**
+ * @brief Adds a pattern; only valid before patternMatchCompile.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup match_functions
+ */
+serial_port_err_t patternMatchAdd(match_set_t *set, const uint8_t *pattern, uint32_t len, uint32_t id);
+
+/**
+ * @brief Builds the automaton of all added patterns.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup match_functions
+ */
+serial_port_err_t patternMatchCompile(match_set_t *set);
+
+/**
+ * @brief Releases a pattern set.
+ *
+ * @ingroup match_functions
+ */
+void patternMatchFree(match_set_t *set);
+
+/**
+ * @brief Starts a stream at offset 0 on a compiled set.
+ *
+ * @ingroup match_functions
+ */
+void patternMatchStreamInit(match_stream_t *stream, const match_set_t *set, match_callback_t callback, void *context);
+
+/**
+ * @brief Scans the next chunk of a stream.
+ *
+ * @param[in] stream Pointer to the stream.
+ * @param[in] data Chunk to scan.
+ * @param[in] len Bytes in data.
+ * @param[in] timestamp Reported with every match ending in this chunk.
+ *
+ * @return Number of matches found in the chunk.
+ *
+ * @ingroup match_functions
+ */
+uint32_t patternMatchFeed(match_stream_t *stream, const uint8_t *data, size_t len, uint64_t timestamp);
+
+/**
+ * @brief Pipeline stage scanning every record with the match_stream_t in context and passing it on unchanged.
+ *
+ * Timestamps are the system time in 100 ns FILETIME units.
+ *
+ * @ingroup match_functions
+ */
+void patternMatchStage(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+#endif
@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <winsock2.h>
+#include <string.h>
+#include "pipeline.h"
+
+
+/* how long an idle stage sleeps before checking whether its upstream has finished */
+#define PIPELINE_POLL_MS    20
+
+
+static void countOut(pipeline_stage_t *stage, uint32_t len)
+{
+    InterlockedIncrement64(&stage->recordsOut);
+    InterlockedExchangeAdd64(&stage->bytesOut, len);
+}
+
+
+static void countIn(pipeline_stage_t *stage, uint32_t len)
+{
+    InterlockedIncrement64(&stage->recordsIn);
+    InterlockedExchangeAdd64(&stage->bytesIn, len);
+}
+
+
+serial_port_err_t pipelineInit(pipeline_t *pipeline, serial_port_t *port, uint32_t queueCapacity)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->port = port;
+    pipeline->stageCount = 1;
+
+    /* a queue only hands out records up to half its size, smaller ones would never fit a read chunk */
+    pipeline->queueCapacity = queueCapacity > PIPELINE_MIN_QUEUE ? queueCapacity : PIPELINE_MIN_QUEUE;
+
+    pipeline_stage_t *source = &pipeline->stages[0];
+    source->name = "source";
+    source->priority = THREAD_PRIORITY_NORMAL;
+    source->pipeline = pipeline;
+
+    return SERIAL_ERR_OK;
+}
+
+
+pipeline_stage_t *pipelineAddStage(pipeline_t *pipeline, const char *name, pipeline_process_t process, void *context)
+{
+    if (pipeline->stageCount == PIPELINE_MAX_STAGES)
+        return NULL;
+
+    /* the new stage reads what the current last stage writes */
+    spsc_queue_t *queue = &pipeline->queues[pipeline->stageCount - 1];
+    if (spscQueueInit(queue, pipeline->queueCapacity) != SERIAL_ERR_OK)
+        return NULL;
+
+    pipeline_stage_t *stage = &pipeline->stages[pipeline->stageCount];
+    memset(stage, 0, sizeof(*stage));
+    stage->name = name;
+    stage->process = process;
+    stage->context = context;
+    stage->priority = THREAD_PRIORITY_NORMAL;
+    stage->pipeline = pipeline;
+    stage->input = queue;
+
+    pipeline->stages[pipeline->stageCount - 1].output = queue;
+    pipeline->stageCount++;
+
+    return stage;
+}
+
+
+void pipelineSetAffinity(pipeline_stage_t *stage, DWORD_PTR affinity, int priority)
+{
+    stage->affinity = affinity;
+    stage->priority = priority;
+}
+
+
+serial_port_err_t pipelineEmit(pipeline_stage_t *stage, const uint8_t *data, uint32_t len)
+{
+    if (stage->output == NULL)
+    {
+        countOut(stage, len);
+        return SERIAL_ERR_OK;
+    }
+
+    /* back pressure: a full queue stalls this stage until the next one catches up */
+    uint8_t *slot = spscQueueReserveWait(stage->output, len, INFINITE);
+    if (slot == NULL)
+    {
+        InterlockedIncrement64(&stage->dropped);
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+    }
+
+    memcpy(slot, data, len);
+    spscQueueCommit(stage->output, len);
+    countOut(stage, len);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t pipelinePush(pipeline_t *pipeline, const uint8_t *data, uint32_t len)
+{
+    pipeline_stage_t *source = &pipeline->stages[0];
+
+    countIn(source, len);
+    return pipelineEmit(source, data, len);
+}
+
+
+static void runSource(pipeline_stage_t *stage)
+{
+    pipeline_t *pipeline = stage->pipeline;
+
+    while (ReadAcquire(&pipeline->running))
+    {
+        uint64_t got = 0;
+
+        /* the port is read straight into the queue, the chunk is only published if data came in */
+        uint8_t *slot = spscQueueReserveWait(stage->output, PIPELINE_READ_CHUNK, PIPELINE_POLL_MS);
+        if (slot == NULL)
+            continue;
+
+        if (serialPortReadSome(pipeline->port, slot, PIPELINE_READ_CHUNK, &got) != SERIAL_ERR_OK)
+            break;
+
+        if (got > 0)
+        {
+            countIn(stage, (uint32_t)got);
+            spscQueueCommit(stage->output, (uint32_t)got);
+            countOut(stage, (uint32_t)got);
+        }
+    }
+}
+
+
+static void runStage(pipeline_stage_t *stage)
+{
+    pipeline_stage_t *previous = stage - 1;
+    const uint8_t *data;
+    uint32_t len;
+
+    while (1)
+    {
+        data = spscQueuePeekWait(stage->input, &len, PIPELINE_POLL_MS);
+
+        if (data == NULL)
+        {
+            /* upstream publishes everything before it finishes, so one more look is final */
+            if (!ReadAcquire(&previous->finished))
+                continue;
+
+            data = spscQueuePeek(stage->input, &len);
+            if (data == NULL)
+                break;
+        }
+
+        countIn(stage, len);
+        stage->process(stage, data, len, stage->context);
+        spscQueueRelease(stage->input);
+    }
+}
+
+
+static DWORD WINAPI StageThread(LPVOID lpParam)
+{
+    pipeline_stage_t *stage = (pipeline_stage_t*)lpParam;
+
+    if (stage->input == NULL)
+        runSource(stage);
+    else
+        runStage(stage);
+
+    InterlockedExchange(&stage->finished, 1);
+    return 0;
+}
+
+
+serial_port_err_t pipelineStart(pipeline_t *pipeline)
+{
+    if (pipeline->port != NULL)
+    {
+        /* the source polls so it notices pipelineStop */
+        if (serialPortSetPollTimeouts(pipeline->port, PIPELINE_POLL_MS, &pipeline->savedTimeouts) != SERIAL_ERR_OK)
+            return SERIAL_ERR_UNKNOWN;
+    }
+
+    InterlockedExchange(&pipeline->running, 1);
+
+    for (uint32_t i = 0; i < pipeline->stageCount; i++)
+    {
+        pipeline_stage_t *stage = &pipeline->stages[i];
+
+        stage->finished = 0;
+        stage->sampleTicks = GetTickCount64();
+
+        /* without a port the caller's thread is the source */
+        if (i == 0 && (pipeline->port == NULL || stage->output == NULL))
+            continue;
+
+        stage->thread = CreateThread(NULL, 0, StageThread, stage, CREATE_SUSPENDED, NULL);
+        if (stage->thread == NULL)
+        {
+            pipelineStop(pipeline);
+            return SERIAL_ERR_UNKNOWN;
+        }
+
+        if (stage->affinity != 0)
+            SetThreadAffinityMask(stage->thread, stage->affinity);
+        SetThreadPriority(stage->thread, stage->priority);
+        ResumeThread(stage->thread);
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void pipelineStop(pipeline_t *pipeline)
+{
+    InterlockedExchange(&pipeline->running, 0);
+
+    /* a source without a thread ends here, every other stage ends once its input is drained */
+    if (pipeline->stages[0].thread == NULL)
+        InterlockedExchange(&pipeline->stages[0].finished, 1);
+
+    for (uint32_t i = 0; i < pipeline->stageCount; i++)
+    {
+        pipeline_stage_t *stage = &pipeline->stages[i];
+
+        if (stage->thread != NULL)
+        {
+            WaitForSingleObject(stage->thread, INFINITE);
+            CloseHandle(stage->thread);
+            stage->thread = NULL;
+        }
+        else
+            InterlockedExchange(&stage->finished, 1);
+    }
+
+    for (uint32_t i = 0; i + 1 < pipeline->stageCount; i++)
+        spscQueueFree(&pipeline->queues[i]);
+
+    if (pipeline->port != NULL)
+        serialPortRestoreTimeouts(pipeline->port, &pipeline->savedTimeouts);
+}
+
+
+void pipelineGetStats(pipeline_stage_t *stage, pipeline_stats_t *stats)
+{
+    ULONGLONG now = GetTickCount64();
+
+    stats->recordsIn = (uint64_t)ReadAcquire64(&stage->recordsIn);
+    stats->bytesIn = (uint64_t)ReadAcquire64(&stage->bytesIn);
+    stats->recordsOut = (uint64_t)ReadAcquire64(&stage->recordsOut);
+    stats->bytesOut = (uint64_t)ReadAcquire64(&stage->bytesOut);
+    stats->dropped = (uint64_t)ReadAcquire64(&stage->dropped);
+    stats->queueDepth = stage->input != NULL ? spscQueueDepth(stage->input) : 0;
+    stats->queueBytes = stage->input != NULL ? spscQueueBytes(stage->input) : 0;
+
+    double seconds = (double)(now - stage->sampleTicks) / 1000.0;
+    stats->recordsPerSecond = seconds > 0 ? (double)(stats->recordsIn - stage->sampleRecords) / seconds : 0;
+    stats->bytesPerSecond = seconds > 0 ? (double)(stats->bytesIn - stage->sampleBytes) / seconds : 0;
+
+    stage->sampleTicks = now;
+    stage->sampleRecords = stats->recordsIn;
+    stage->sampleBytes = stats->bytesIn;
+}
+
+
+/* ---- built-in stages ---- */
+
+void pipelineDelimiterFramer(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    pipeline_framer_t *framer = (pipeline_framer_t*)context;
+    const uint8_t *end = data + len;
+
+    while (data < end)
+    {
+        const uint8_t *delimiter = memchr(data, framer->delimiter, (size_t)(end - data));
+        uint32_t n = (uint32_t)((delimiter != NULL ? delimiter + 1 : end) - data);
+
+        /* whole records inside the chunk go out without being copied */
+        if (delimiter != NULL && framer->len == 0)
+        {
+            pipelineEmit(stage, data, n);
+            data += n;
+            continue;
+        }
+
+        /* an overlong record is handed out in pieces rather than lost */
+        if (framer->len + n > sizeof(framer->buf))
+        {
+            if (framer->len != 0)
+                pipelineEmit(stage, framer->buf, framer->len);
+            framer->len = 0;
+            if (n > sizeof(framer->buf))
+                n = sizeof(framer->buf);
+        }
+
+        memcpy(framer->buf + framer->len, data, n);
+        framer->len += n;
+        data += n;
+
+        if (delimiter != NULL && data == delimiter + 1)
+        {
+            pipelineEmit(stage, framer->buf, framer->len);
+            framer->len = 0;
+        }
+    }
+}
+
+
+void pipelineSlipFramer(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    pipeline_framer_t *framer = (pipeline_framer_t*)context;
+
+    if (!framer->slipReady)
+    {
+        slipDecoderInit(&framer->slip, framer->buf, sizeof(framer->buf));
+        framer->slipReady = 1;
+    }
+
+    while (len > 0)
+    {
+        size_t used = slipDecode(&framer->slip, data, len);
+
+        data += used;
+        len -= (uint32_t)used;
+
+        if (framer->slip.complete)
+            pipelineEmit(stage, framer->slip.buf, (uint32_t)framer->slip.len);
+    }
+}
+
+
+void pipelineFileSink(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    FILE *file = (FILE*)context;
+
+    if (fwrite(data, 1, len, file) != len)
+        InterlockedIncrement64(&stage->dropped);
+}
+
+
+void pipelineSocketSink(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    SOCKET socket = *(SOCKET*)context;
+
+    while (len > 0)
+    {
+        int sent = send(socket, (const char*)data, (int)len, 0);
+        if (sent == SOCKET_ERROR)
+        {
+            InterlockedIncrement64(&stage->dropped);
+            return;
+        }
+
+        data += sent;
+        len -= (uint32_t)sent;
+    }
+}
+
+
+serial_port_err_t pipelineShmSinkOpen(pipeline_shm_sink_t *sink, const char *name, uint32_t capacity)
+{
+    uint32_t size = 4096;
+
+    memset(sink, 0, sizeof(*sink));
+
+    while (size < capacity && size < 0x40000000u)
+        size <<= 1;
+
+    sink->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size + sizeof(pipeline_shm_header_t), name);
+    if (sink->mapping == NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    /* another sink or a reader's view owns the name; resetting its ring under the reader would corrupt it */
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        pipelineShmSinkClose(sink);
+        return SERIAL_ERR_OPEN;
+    }
+
+    sink->header = (pipeline_shm_header_t*)MapViewOfFile(sink->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (sink->header == NULL)
+    {
+        pipelineShmSinkClose(sink);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    sink->ring = (uint8_t*)(sink->header + 1);
+    sink->header->capacity = size;
+    sink->header->writePos = 0;
+    sink->header->records = 0;
+    InterlockedExchange((volatile LONG*)&sink->header->magic, PIPELINE_SHM_MAGIC);
+
+    return SERIAL_ERR_OK;
+}
+
+
+void pipelineShmSinkClose(pipeline_shm_sink_t *sink)
+{
+    if (sink->header != NULL)
+        UnmapViewOfFile(sink->header);
+    if (sink->mapping != NULL)
+        CloseHandle(sink->mapping);
+
+    sink->header = NULL;
+    sink->mapping = NULL;
+    sink->ring = NULL;
+}
+
+
+void pipelineShmSink(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context)
+{
+    pipeline_shm_sink_t *sink = (pipeline_shm_sink_t*)context;
+    uint32_t capacity = sink->header->capacity;
+    uint32_t need = 4 + ((len + 3) & ~3u);
+    uint64_t writePos = (uint64_t)sink->header->writePos;
+    uint32_t offset = (uint32_t)(writePos & (capacity - 1));
+
+    if (need > capacity / 2)
+    {
+        InterlockedIncrement64(&stage->dropped);
+        return;
+    }
+
+    /* the ring never blocks the pipeline, slow readers are lapped and notice from writePos */
+    if (capacity - offset < need)
+    {
+        *(uint32_t*)(sink->ring + offset) = 0xFFFFFFFFu;
+        writePos += capacity - offset;
+        offset = 0;
+    }
+
+    *(uint32_t*)(sink->ring + offset) = len;
+    memcpy(sink->ring + offset + 4, data, len);
+
+    InterlockedIncrement64(&sink->header->records);
+    InterlockedExchange64(&sink->header->writePos, (LONG64)(writePos + need));
+}
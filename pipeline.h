@@ -0,0 +1,314 @@
+/**
+ * @file pipeline.h
+ * @brief Multi-threaded stream processing pipeline for serial data.
+ *
+ * A pipeline is a chain of stages: a source reading the port, followed by any number of user or
+ * built-in stages such as framers, decoders, filters and sinks. Every stage runs on its own
+ * thread, optionally pinned to a set of cores, and hands its output records to the next stage
+ * through a bounded lock-free SPSC queue, so a chain spreads over several cores without the
+ * stages themselves containing any threading code. Each stage counts its own throughput and
+ * exposes the depth of its input queue.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <windows.h>
+#include <stdio.h>
+#include "serialPort.h"
+#include "spscQueue.h"
+#include "slip.h"
+
+/**
+ * @defgroup pipeline_functions Pipeline
+ * @ingroup functions
+ * @brief Composable multi-threaded processing chains.
+ */
+
+#define PIPELINE_MAX_STAGES     16
+#define PIPELINE_READ_CHUNK     4096    /**< Largest record produced by the port source. */
+#define PIPELINE_MAX_RECORD     65536   /**< Largest record built by the framers. */
+#define PIPELINE_MIN_QUEUE      (2 * (PIPELINE_READ_CHUNK + 8))    /**< Smallest queue, a source chunk and its header fit in half of it. */
+
+typedef struct pipeline_stage_t pipeline_stage_t;
+
+/**
+ * @brief Processes one input record of a stage.
+ *
+ * Runs on the stage's thread. The record is only valid during the call; results are passed on
+ * with pipelineEmit, any number of times, or not at all to drop the record.
+ */
+typedef void (*pipeline_process_t)(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+/**
+ * @struct pipeline_stats_t
+ * @brief Snapshot of a stage's counters.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t recordsIn;         /**< Records consumed. */
+    uint64_t bytesIn;           /**< Bytes consumed. */
+    uint64_t recordsOut;        /**< Records emitted. */
+    uint64_t bytesOut;          /**< Bytes emitted. */
+    uint64_t dropped;           /**< Records that could not be emitted. */
+    double recordsPerSecond;    /**< Input rate since the previous snapshot. */
+    double bytesPerSecond;      /**< Input byte rate since the previous snapshot. */
+    uint32_t queueDepth;        /**< Records waiting in the input queue. */
+    uint32_t queueBytes;        /**< Ring bytes used by the input queue. */
+} pipeline_stats_t;
+
+struct pipeline_t;
+
+/**
+ * @struct pipeline_stage_t
+ * @brief One stage of a pipeline.
+ *
+ * @ingroup structs
+ */
+struct pipeline_stage_t {
+    const char *name;               /**< Name for diagnostics. */
+    pipeline_process_t process;     /**< Record handler, NULL for the source. */
+    void *context;                  /**< User pointer passed to process. */
+    DWORD_PTR affinity;             /**< Cores the stage's thread may run on, 0 for any. */
+    int priority;                   /**< Thread priority, THREAD_PRIORITY_NORMAL by default. */
+    struct pipeline_t *pipeline;    /**< Owning pipeline. */
+    spsc_queue_t *input;            /**< Queue from the previous stage, NULL for the source. */
+    spsc_queue_t *output;           /**< Queue to the next stage, NULL for the last stage. */
+    HANDLE thread;                  /**< Stage thread. */
+    volatile LONG finished;         /**< Set once the thread has drained its input and exited. */
+    volatile LONG64 recordsIn;      /**< Records consumed. */
+    volatile LONG64 bytesIn;        /**< Bytes consumed. */
+    volatile LONG64 recordsOut;     /**< Records emitted. */
+    volatile LONG64 bytesOut;       /**< Bytes emitted. */
+    volatile LONG64 dropped;        /**< Records too large for the output queue. */
+    ULONGLONG sampleTicks;          /**< Time of the previous stats snapshot. */
+    uint64_t sampleRecords;         /**< recordsIn at the previous snapshot. */
+    uint64_t sampleBytes;           /**< bytesIn at the previous snapshot. */
+};
+
+/**
+ * @struct pipeline_t
+ * @brief A chain of stages fed from a serial port or by the caller.
+ *
+ * @ingroup structs
+ */
+typedef struct pipeline_t {
+    serial_port_t *port;                            /**< Port read by the source, NULL when fed with pipelinePush. */
+    pipeline_stage_t stages[PIPELINE_MAX_STAGES];   /**< stages[0] is the source. */
+    spsc_queue_t queues[PIPELINE_MAX_STAGES];       /**< queues[i] feeds stages[i + 1]. */
+    uint32_t stageCount;                            /**< Stages including the source. */
+    uint32_t queueCapacity;                         /**< Ring size of every queue. */
+    volatile LONG running;                          /**< Cleared by pipelineStop. */
+    COMMTIMEOUTS savedTimeouts;                     /**< Timeouts of the port before pipelineStart, restored by pipelineStop. */
+} pipeline_t;
+
+/**
+ * @struct pipeline_framer_t
+ * @brief State of the delimiter and SLIP framing stages.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t delimiter;                  /**< End of record byte for pipelineDelimiterFramer. */
+    uint8_t buf[PIPELINE_MAX_RECORD];   /**< Record being assembled. */
+    uint32_t len;                       /**< Bytes in buf. */
+    slip_decoder_t slip;                /**< Decoder of pipelineSlipFramer. */
+    int slipReady;                      /**< slip has been initialised. */
+} pipeline_framer_t;
+
+/**
+ * @struct pipeline_shm_sink_t
+ * @brief Shared memory ring written by pipelineShmSink.
+ *
+ * The mapping starts with a pipeline_shm_header_t followed by the ring. Records are written as a
+ * 32 bit length and the data, padded to 4 bytes; a length of 0xFFFFFFFF means the record continues
+ * at the start of the ring. Readers in other processes follow writePos and detect being lapped by
+ * comparing it with their own position.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    HANDLE mapping;                     /**< Named file mapping. */
+    struct pipeline_shm_header_t *header;   /**< Start of the mapping. */
+    uint8_t *ring;                      /**< Record ring after the header. */
+} pipeline_shm_sink_t;
+
+/**
+ * @struct pipeline_shm_header_t
+ * @brief Header of the shared memory ring.
+ *
+ * @ingroup structs
+ */
+typedef struct pipeline_shm_header_t {
+    uint32_t magic;                     /**< PIPELINE_SHM_MAGIC. */
+    uint32_t capacity;                  /**< Ring size in bytes, a power of two. */
+    volatile LONG64 writePos;           /**< Free running write position. */
+    volatile LONG64 records;            /**< Records written. */
+} pipeline_shm_header_t;
+
+#define PIPELINE_SHM_MAGIC      0x50495045  /**< "PIPE" */
+
+/**
+ * @brief Initialises a pipeline with its source stage.
+ *
+ * @param[out] pipeline Pointer to the pipeline.
+ * @param[in] port Opened port to read, or NULL to feed the pipeline with pipelinePush.
+ * @param[in] queueCapacity Ring size of each inter-stage queue in bytes, raised to PIPELINE_MIN_QUEUE if smaller.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup pipeline_functions
+ *
+ * ### Example
+ * Below is an example that splits the input into lines, keeps the ones starting with '$' and
+ * logs them to a file, with the framer pinned to core 2.
+ * @code
+ * static void keepNmea(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context){
+ *  if(len > 0 && data[0] == '$')
+ *      pipelineEmit(stage, data, len);
+ * }
+ *
+ * serial_port_t myPort;
+ * pipeline_t pipeline;
+ * pipeline_framer_t lines = { '\n' };
+ * int main(){
+ *  if(serialPortOpen(&myPort, "COM3", 115200, 50, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  pipelineInit(&pipeline, &myPort, 1 << 20);
+ *  pipeline_stage_t *framer = pipelineAddStage(&pipeline, "lines", pipelineDelimiterFramer, &lines);
+ *  pipelineAddStage(&pipeline, "nmea", keepNmea, NULL);
+ *  pipelineAddStage(&pipeline, "log", pipelineFileSink, fopen("nmea.log", "wb"));
+ *  pipelineSetAffinity(framer, 1 << 2, THREAD_PRIORITY_NORMAL);
+ *  pipelineStart(&pipeline);
+ *  Sleep(60000);
+ *  pipelineStop(&pipeline);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t pipelineInit(pipeline_t *pipeline, serial_port_t *port, uint32_t queueCapacity);
+
+/**
+ * @brief Appends a stage to the end of the chain.
+ *
+ * @return The new stage, or NULL if the pipeline is full or its queue cannot be allocated.
+ *
+ * @ingroup pipeline_functions
+ */
+pipeline_stage_t *pipelineAddStage(pipeline_t *pipeline, const char *name, pipeline_process_t process, void *context);
+
+/**
+ * @brief Sets the cores and priority of a stage's thread; takes effect at pipelineStart.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineSetAffinity(pipeline_stage_t *stage, DWORD_PTR affinity, int priority);
+
+/**
+ * @brief Starts one thread per stage.
+ *
+ * The port's read timeouts are switched to return whatever arrived within a short poll interval
+ * until pipelineStop puts the previous timeouts back.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup pipeline_functions
+ */
+serial_port_err_t pipelineStart(pipeline_t *pipeline);
+
+/**
+ * @brief Stops the source, lets every stage drain its input, joins the threads and frees the queues.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineStop(pipeline_t *pipeline);
+
+/**
+ * @brief Passes a record to the next stage, waiting while its queue is full.
+ *
+ * @return SERIAL_ERR_OK if successful or the stage is the last one, SERIAL_ERR_BUFFER_OVERFLOW if
+ *         the record is larger than half a queue and was dropped.
+ *
+ * @ingroup pipeline_functions
+ */
+serial_port_err_t pipelineEmit(pipeline_stage_t *stage, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Feeds data into a pipeline created without a port; call from a single thread only.
+ *
+ * @ingroup pipeline_functions
+ */
+serial_port_err_t pipelinePush(pipeline_t *pipeline, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Reads a stage's counters and its rates since the previous call.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineGetStats(pipeline_stage_t *stage, pipeline_stats_t *stats);
+
+/**
+ * @brief Built-in stage splitting the stream at pipeline_framer_t::delimiter; the delimiter is kept.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineDelimiterFramer(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+/**
+ * @brief Built-in stage emitting the decoded payload of every SLIP frame.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineSlipFramer(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+/**
+ * @brief Built-in sink writing every record to a FILE*, passed as the context.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineFileSink(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+/**
+ * @brief Built-in sink sending every record on a connected SOCKET, passed as a pointer in context.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineSocketSink(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+/**
+ * @brief Creates the named shared memory ring used by pipelineShmSink.
+ *
+ * @param[out] sink Pointer to the sink.
+ * @param[in] name Name of the mapping, e.g. "Local\\serialCapture".
+ * @param[in] capacity Ring size in bytes, rounded up to a power of two.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_OPEN if a mapping of that name already exists,
+ * otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup pipeline_functions
+ */
+serial_port_err_t pipelineShmSinkOpen(pipeline_shm_sink_t *sink, const char *name, uint32_t capacity);
+
+/**
+ * @brief Unmaps and closes a shared memory ring.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineShmSinkClose(pipeline_shm_sink_t *sink);
+
+/**
+ * @brief Built-in sink appending every record to a shared memory ring, passed as the context.
+ *
+ * @ingroup pipeline_functions
+ */
+void pipelineShmSink(pipeline_stage_t *stage, const uint8_t *data, uint32_t len, void *context);
+
+#endif
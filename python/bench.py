@@ -0,0 +1,117 @@
+"""Receive throughput of serialport_c against pyserial.
+
+Connect two ports back to back (a null-modem cable, two USB adapters with TX and RX crossed or a
+virtual pair) and run
+
+    python bench.py COM3 COM4 3000000 10
+
+Data is written on the first port for the given number of seconds and received on the second,
+once with pyserial, once with serialport_c.Port.read and once in callback mode. Throughput and
+the CPU time spent per megabyte are printed for each.
+"""
+
+import sys
+import threading
+import time
+
+import serialport_c
+
+try:
+    import serial
+except ImportError:
+    serial = None
+
+
+BLOCK = bytes(range(256)) * 256
+
+
+def writer(write, seconds, done):
+    end = time.perf_counter() + seconds
+    while time.perf_counter() < end:
+        write(BLOCK)
+    done.set()
+
+
+def report(name, received, elapsed, cpu):
+    mb = received / 1e6
+    print(f"{name:24s} {mb / elapsed:8.3f} MB/s   {cpu * 1e3 / max(mb, 1e-9):8.2f} ms CPU per MB")
+
+
+def measure(name, tx_write, receive, seconds):
+    done = threading.Event()
+    thread = threading.Thread(target=writer, args=(tx_write, seconds, done))
+    start, cpu = time.perf_counter(), time.process_time()
+    thread.start()
+    received = receive(done)
+    report(name, received, time.perf_counter() - start, time.process_time() - cpu)
+    thread.join()
+
+
+def bench_pyserial(tx_name, rx_name, baud, seconds):
+    tx = serial.Serial(tx_name, baud, timeout=0.1)
+    rx = serial.Serial(rx_name, baud, timeout=0.1)
+
+    def receive(done):
+        received = 0
+        while True:
+            data = rx.read(max(1, rx.in_waiting))
+            received += len(data)
+            if not data and done.is_set():
+                return received
+
+    measure("pyserial read", tx.write, receive, seconds)
+    tx.close()
+    rx.close()
+
+
+def bench_read(tx_name, rx_name, baud, seconds):
+    with serialport_c.Port(tx_name, baud) as tx, serialport_c.Port(rx_name, baud) as rx:
+        def receive(done):
+            received = 0
+            while True:
+                n = len(rx.read())
+                received += n
+                if n == 0 and done.is_set():
+                    return received
+
+        measure("serialport_c read", tx.write, receive, seconds)
+        print(" " * 25, rx.stats)
+
+
+def bench_callback(tx_name, rx_name, baud, seconds):
+    with serialport_c.Port(tx_name, baud) as tx, serialport_c.Port(rx_name, baud) as rx:
+        received = [0]
+
+        def on_data(view):
+            received[0] += len(view)
+
+        def receive(done):
+            rx.start(on_data)
+            done.wait()
+            time.sleep(0.2)
+            rx.stop()
+            return received[0]
+
+        measure("serialport_c callback", tx.write, receive, seconds)
+        print(" " * 25, rx.stats)
+
+
+def main():
+    if len(sys.argv) < 4:
+        print(__doc__)
+        return 1
+
+    tx_name, rx_name, baud = sys.argv[1], sys.argv[2], int(sys.argv[3])
+    seconds = float(sys.argv[4]) if len(sys.argv) > 4 else 10.0
+
+    if serial is not None:
+        bench_pyserial(tx_name, rx_name, baud, seconds)
+    else:
+        print("pyserial not installed, skipping it")
+    bench_read(tx_name, rx_name, baud, seconds)
+    bench_callback(tx_name, rx_name, baud, seconds)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,726 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * CPython extension "serialport_c".
+ *
+ * Received data is handed to Python as memoryviews over buffers taken from a per-port pool, so a
+ * read costs no copy and, once the pool is warm, no allocation; a buffer goes back to the pool when
+ * the last view on it is released. Every blocking call releases the GIL. In callback mode a native
+ * reader thread collects data into pooled buffers without the GIL, batching everything that
+ * arrives within a short window, and only takes the GIL once per batch to call the Python callback.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <windows.h>
+#include "serialPort.h"
+#include "serialAlloc.h"
+
+
+#define DEFAULT_CHUNK_SIZE      65536   /* size of every pooled buffer */
+#define DEFAULT_POOL_SIZE       16      /* buffers kept for reuse */
+#define DEFAULT_BATCH_MS        2       /* longest a callback batch is held back after its first byte */
+#define READER_POLL_MS          10      /* longest the reader waits before checking for stop */
+
+
+typedef struct {
+    PyObject_HEAD
+    serial_port_t port;
+    int isOpen;
+    Py_ssize_t chunkSize;
+    CRITICAL_SECTION poolLock;
+    uint8_t **pool;                 /* free buffers */
+    Py_ssize_t poolCount;
+    Py_ssize_t poolCapacity;
+    volatile LONG reading;          /* a read is in progress, reads share the port's receive event */
+    volatile LONG writing;          /* a write is in progress */
+    HANDLE reader;                  /* callback mode thread */
+    DWORD readerId;
+    volatile LONG running;
+    PyObject *callback;
+    Py_ssize_t batchBytes;
+    int64_t batchTicks;             /* batch window in QueryPerformanceCounter ticks */
+    COMMTIMEOUTS savedTimeouts;     /* timeouts of the port before start(), restored by stop() */
+    volatile LONG64 bytesRead;
+    volatile LONG64 batches;
+    volatile LONG64 poolMisses;
+} PortObject;
+
+
+/* a pooled buffer exported through the buffer protocol */
+typedef struct {
+    PyObject_HEAD
+    PortObject *owner;
+    uint8_t *data;
+    Py_ssize_t len;
+} ChunkObject;
+
+
+static PyTypeObject PortType;
+static PyTypeObject ChunkType;
+
+
+/* ---- buffer pool ---- */
+
+/* callable without the GIL */
+static uint8_t *takeBuffer(PortObject *self)
+{
+    uint8_t *buf = NULL;
+
+    EnterCriticalSection(&self->poolLock);
+    if (self->poolCount > 0)
+        buf = self->pool[--self->poolCount];
+    LeaveCriticalSection(&self->poolLock);
+
+    if (buf == NULL)
+    {
+        InterlockedIncrement64(&self->poolMisses);
+        buf = serialAlloc((size_t)self->chunkSize);
+    }
+
+    return buf;
+}
+
+
+static void giveBuffer(PortObject *self, uint8_t *buf)
+{
+    EnterCriticalSection(&self->poolLock);
+    if (self->poolCount < self->poolCapacity)
+    {
+        self->pool[self->poolCount++] = buf;
+        buf = NULL;
+    }
+    LeaveCriticalSection(&self->poolLock);
+
+    /* the pool is full, this one was allocated on a miss */
+    serialFree(buf, (size_t)self->chunkSize);
+}
+
+
+/* wraps len bytes of a pooled buffer in a memoryview; the buffer returns to the pool with the view */
+static PyObject *viewBuffer(PortObject *self, uint8_t *buf, Py_ssize_t len)
+{
+    ChunkObject *chunk = PyObject_New(ChunkObject, &ChunkType);
+    if (chunk == NULL)
+    {
+        giveBuffer(self, buf);
+        return NULL;
+    }
+
+    Py_INCREF(self);
+    chunk->owner = self;
+    chunk->data = buf;
+    chunk->len = len;
+
+    PyObject *view = PyMemoryView_FromObject((PyObject*)chunk);
+    Py_DECREF(chunk);
+    return view;
+}
+
+
+static int chunkGetBuffer(ChunkObject *self, Py_buffer *view, int flags)
+{
+    return PyBuffer_FillInfo(view, (PyObject*)self, self->data, self->len, 0, flags);
+}
+
+
+static void chunkDealloc(ChunkObject *self)
+{
+    giveBuffer(self->owner, self->data);
+    Py_DECREF(self->owner);
+    PyObject_Free(self);
+}
+
+
+static PyBufferProcs chunkBufferProcs = {
+    (getbufferproc)chunkGetBuffer,
+    NULL,
+};
+
+
+static PyTypeObject ChunkType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "serialport_c._Chunk",
+    .tp_basicsize = sizeof(ChunkObject),
+    .tp_dealloc = (destructor)chunkDealloc,
+    .tp_as_buffer = &chunkBufferProcs,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Pooled receive buffer.",
+};
+
+
+/* ---- helpers ---- */
+
+static PyObject *serialError(const char *what, serial_port_err_t err)
+{
+    PyErr_Format(PyExc_OSError, "%s failed (serial_port_err_t %d, Win32 error %lu)", what, (int)err, (unsigned long)GetLastError());
+    return NULL;
+}
+
+
+static int checkOpen(PortObject *self)
+{
+    if (!self->isOpen)
+    {
+        PyErr_SetString(PyExc_ValueError, "port is closed");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* only one blocking read and one blocking write at a time, and no reads in callback mode */
+static int enter(PortObject *self, volatile LONG *flag)
+{
+    if (checkOpen(self) < 0)
+        return -1;
+
+    if (flag == &self->reading && self->running)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "port is in callback mode");
+        return -1;
+    }
+
+    if (InterlockedExchange(flag, 1) != 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "another thread is using the port in the same direction");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* ---- callback mode ---- */
+
+static DWORD WINAPI PortReader(LPVOID lpParam)
+{
+    PortObject *self = (PortObject*)lpParam;
+
+    while (self->running)
+    {
+        uint8_t *buf = takeBuffer(self);
+        Py_ssize_t len = 0;
+        LARGE_INTEGER first = { 0 }, now;
+
+        if (buf == NULL)
+        {
+            Sleep(READER_POLL_MS);
+            continue;
+        }
+
+        /* keep reading while data flows, up to the batch size or the batch window */
+        while (self->running && len < self->batchBytes)
+        {
+            uint64_t got = 0;
+
+            if (serialPortReadSome(&self->port, buf + len, (uint64_t)(self->batchBytes - len), &got) != SERIAL_ERR_OK)
+            {
+                InterlockedExchange(&self->running, 0);
+                break;
+            }
+
+            if (got == 0)
+            {
+                if (len > 0)
+                    break;
+                continue;
+            }
+
+            /* the tick count only moves every 15.6 ms, too coarse for a window of a few ms */
+            QueryPerformanceCounter(&now);
+            if (len == 0)
+                first = now;
+            len += (Py_ssize_t)got;
+
+            if (now.QuadPart - first.QuadPart >= self->batchTicks)
+                break;
+        }
+
+        if (len == 0)
+        {
+            giveBuffer(self, buf);
+            continue;
+        }
+
+        InterlockedExchangeAdd64(&self->bytesRead, len);
+        InterlockedIncrement64(&self->batches);
+
+        PyGILState_STATE gil = PyGILState_Ensure();
+        PyObject *view = viewBuffer(self, buf, len);
+        PyObject *result = view != NULL ? PyObject_CallOneArg(self->callback, view) : NULL;
+
+        if (result == NULL)
+            PyErr_WriteUnraisable(self->callback);
+
+        Py_XDECREF(result);
+        Py_XDECREF(view);
+        PyGILState_Release(gil);
+    }
+
+    return 0;
+}
+
+
+static void stopReader(PortObject *self)
+{
+    if (self->reader == NULL)
+        return;
+
+    InterlockedExchange(&self->running, 0);
+
+    /* the reader may be waiting for the GIL to deliver its last batch */
+    Py_BEGIN_ALLOW_THREADS
+    WaitForSingleObject(self->reader, INFINITE);
+    Py_END_ALLOW_THREADS
+
+    CloseHandle(self->reader);
+    self->reader = NULL;
+    serialPortRestoreTimeouts(&self->port, &self->savedTimeouts);
+    Py_CLEAR(self->callback);
+    Py_DECREF(self);
+}
+
+
+/* ---- Port ---- */
+
+static int portInit(PortObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "name", "baud", "read_timeout", "write_timeout", "chunk_size", "pool_size", NULL };
+    const char *name;
+    unsigned long long baud;
+    unsigned int readTimeout = 100, writeTimeout = 100;
+    Py_ssize_t chunkSize = DEFAULT_CHUNK_SIZE, poolSize = DEFAULT_POOL_SIZE;
+    serial_port_err_t err;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sK|IInn", keywords, &name, &baud, &readTimeout,
+                                     &writeTimeout, &chunkSize, &poolSize))
+        return -1;
+
+    if (self->isOpen || self->pool != NULL)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "port is already initialised");
+        return -1;
+    }
+
+    if (chunkSize <= 0 || chunkSize > 0x40000000 || poolSize < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "invalid chunk_size or pool_size");
+        return -1;
+    }
+
+    /* serialPortOpen keeps the pointer, the copy lives as long as the port */
+    size_t nameLen = strlen(name) + 1;
+    char *nameCopy = PyMem_Malloc(nameLen);
+    if (nameCopy == NULL)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(nameCopy, name, nameLen);
+
+    Py_BEGIN_ALLOW_THREADS
+    err = serialPortOpen(&self->port, nameCopy, baud, readTimeout, writeTimeout);
+    Py_END_ALLOW_THREADS
+
+    if (err != SERIAL_ERR_OK)
+    {
+        PyMem_Free(nameCopy);
+        serialError("serialPortOpen", err);
+        return -1;
+    }
+
+    self->isOpen = 1;
+    self->chunkSize = chunkSize;
+    self->batchBytes = chunkSize;
+
+    /* the pool is filled up front, so steady state reads do not allocate */
+    self->pool = PyMem_Calloc(poolSize > 0 ? (size_t)poolSize : 1, sizeof(uint8_t*));
+    if (self->pool == NULL)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->poolCapacity = poolSize;
+    for (Py_ssize_t i = 0; i < poolSize; i++)
+    {
+        uint8_t *buf = serialAlloc((size_t)chunkSize);
+        if (buf == NULL)
+            break;
+        self->pool[self->poolCount++] = buf;
+    }
+
+    return 0;
+}
+
+
+static PyObject *portNew(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    (void)args;
+    (void)kwds;
+
+    PortObject *self = (PortObject*)type->tp_alloc(type, 0);
+    if (self != NULL)
+        InitializeCriticalSection(&self->poolLock);
+
+    return (PyObject*)self;
+}
+
+
+static void closePort(PortObject *self)
+{
+    stopReader(self);
+
+    if (self->isOpen)
+    {
+        /* no new read or write can start past checkOpen from here on */
+        self->isOpen = 0;
+
+        /*
+         * a read or write of another thread may still be in flight on the handle and events;
+         * cancel it and wait for it to leave before they go away. The cancel is repeated as
+         * an operation may have passed enter() without having been issued yet.
+         */
+        Py_BEGIN_ALLOW_THREADS
+        while (ReadAcquire(&self->reading) || ReadAcquire(&self->writing))
+        {
+            CancelIoEx(self->port.handle, NULL);
+            Sleep(1);
+        }
+        serialPortClose(&self->port);
+        Py_END_ALLOW_THREADS
+
+        PyMem_Free((void*)self->port.name);
+    }
+}
+
+
+static void portDealloc(PortObject *self)
+{
+    closePort(self);
+
+    /* every chunk holds a reference, so all buffers are back in the pool by now */
+    for (Py_ssize_t i = 0; i < self->poolCount; i++)
+        serialFree(self->pool[i], (size_t)self->chunkSize);
+    PyMem_Free(self->pool);
+
+    DeleteCriticalSection(&self->poolLock);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static PyObject *portRead(PortObject *self, PyObject *args)
+{
+    Py_ssize_t size = -1;
+    uint64_t got = 0;
+    serial_port_err_t err;
+
+    if (!PyArg_ParseTuple(args, "|n", &size))
+        return NULL;
+
+    if (enter(self, &self->reading) < 0)
+        return NULL;
+
+    if (size < 0 || size > self->chunkSize)
+        size = self->chunkSize;
+
+    uint8_t *buf = takeBuffer(self);
+    if (buf == NULL)
+    {
+        InterlockedExchange(&self->reading, 0);
+        return PyErr_NoMemory();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    err = serialPortReadSome(&self->port, buf, (uint64_t)size, &got);
+    Py_END_ALLOW_THREADS
+
+    InterlockedExchange(&self->reading, 0);
+
+    if (err != SERIAL_ERR_OK)
+    {
+        giveBuffer(self, buf);
+        return serialError("serialPortReadSome", err);
+    }
+
+    InterlockedExchangeAdd64(&self->bytesRead, (LONG64)got);
+    return viewBuffer(self, buf, (Py_ssize_t)got);
+}
+
+
+static PyObject *portReadinto(PortObject *self, PyObject *args)
+{
+    Py_buffer target;
+    uint64_t got = 0;
+    serial_port_err_t err;
+
+    if (!PyArg_ParseTuple(args, "w*", &target))
+        return NULL;
+
+    if (enter(self, &self->reading) < 0)
+    {
+        PyBuffer_Release(&target);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    err = serialPortReadSome(&self->port, target.buf, (uint64_t)target.len, &got);
+    Py_END_ALLOW_THREADS
+
+    InterlockedExchange(&self->reading, 0);
+    PyBuffer_Release(&target);
+
+    if (err != SERIAL_ERR_OK)
+        return serialError("serialPortReadSome", err);
+
+    InterlockedExchangeAdd64(&self->bytesRead, (LONG64)got);
+    return PyLong_FromUnsignedLongLong(got);
+}
+
+
+static PyObject *portWrite(PortObject *self, PyObject *args)
+{
+    Py_buffer data;
+    serial_port_err_t err;
+
+    if (!PyArg_ParseTuple(args, "y*", &data))
+        return NULL;
+
+    if (enter(self, &self->writing) < 0)
+    {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    err = serialPortWrite(&self->port, data.buf, (uint64_t)data.len);
+    Py_END_ALLOW_THREADS
+
+    InterlockedExchange(&self->writing, 0);
+    Py_ssize_t len = data.len;
+    PyBuffer_Release(&data);
+
+    if (err != SERIAL_ERR_OK)
+        return serialError("serialPortWrite", err);
+
+    return PyLong_FromSsize_t(len);
+}
+
+
+static PyObject *portStart(PortObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "callback", "batch_bytes", "batch_ms", NULL };
+    PyObject *callback;
+    Py_ssize_t batchBytes = self->chunkSize;
+    unsigned int batchMs = DEFAULT_BATCH_MS;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nI", keywords, &callback, &batchBytes, &batchMs))
+        return NULL;
+
+    if (checkOpen(self) < 0)
+        return NULL;
+
+    if (!PyCallable_Check(callback))
+    {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+
+    if (self->reader != NULL || self->reading)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "port is already being read");
+        return NULL;
+    }
+
+    self->batchBytes = batchBytes > 0 && batchBytes <= self->chunkSize ? batchBytes : self->chunkSize;
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    self->batchTicks = (int64_t)batchMs * frequency.QuadPart / 1000;
+
+    /* the reader polls so it notices stop() */
+    serial_port_err_t err = serialPortSetPollTimeouts(&self->port, READER_POLL_MS, &self->savedTimeouts);
+    if (err != SERIAL_ERR_OK)
+        return serialError("serialPortSetPollTimeouts", err);
+
+    /* the reader thread calls into Python */
+#if PY_VERSION_HEX < 0x03090000
+    PyEval_InitThreads();
+#endif
+
+    /* the reader keeps the port alive until stop() or close() */
+    Py_INCREF(callback);
+    Py_INCREF(self);
+    self->callback = callback;
+    self->running = 1;
+    self->reader = CreateThread(NULL, 0, PortReader, self, 0, &self->readerId);
+    if (self->reader == NULL)
+    {
+        self->running = 0;
+        Py_CLEAR(self->callback);
+        Py_DECREF(self);
+        serialPortRestoreTimeouts(&self->port, &self->savedTimeouts);
+        return serialError("CreateThread", SERIAL_ERR_UNKNOWN);
+    }
+
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *portStop(PortObject *self, PyObject *unused)
+{
+    (void)unused;
+
+    if (self->reader != NULL && GetCurrentThreadId() == self->readerId)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "stop() cannot be called from the callback");
+        return NULL;
+    }
+
+    stopReader(self);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *portClose(PortObject *self, PyObject *unused)
+{
+    (void)unused;
+
+    if (self->reader != NULL && GetCurrentThreadId() == self->readerId)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "close() cannot be called from the callback");
+        return NULL;
+    }
+
+    closePort(self);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *portEnter(PortObject *self, PyObject *unused)
+{
+    (void)unused;
+
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
+
+static PyObject *portExit(PortObject *self, PyObject *args)
+{
+    (void)args;
+    return portClose(self, NULL);
+}
+
+
+static PyObject *portInWaiting(PortObject *self, void *closure)
+{
+    (void)closure;
+
+    if (checkOpen(self) < 0)
+        return NULL;
+
+    return PyLong_FromLong(bytesAvailable(&self->port) + (long)self->port.rxPendingLen);
+}
+
+
+static PyObject *portStats(PortObject *self, void *closure)
+{
+    (void)closure;
+
+    return Py_BuildValue("{s:L,s:L,s:L,s:n}",
+                         "bytes_read", (long long)self->bytesRead,
+                         "batches", (long long)self->batches,
+                         "pool_misses", (long long)self->poolMisses,
+                         "pool_free", self->poolCount);
+}
+
+
+static PyMethodDef portMethods[] = {
+    { "read", (PyCFunction)portRead, METH_VARARGS,
+      "read(size=chunk_size) -> memoryview\n\n"
+      "Returns what arrives within the read timeout, at most size bytes, as a view on a pooled\n"
+      "buffer; empty on timeout. The GIL is released while waiting." },
+    { "readinto", (PyCFunction)portReadinto, METH_VARARGS,
+      "readinto(buffer) -> int\n\n"
+      "Reads what arrives within the read timeout straight into a writable buffer." },
+    { "write", (PyCFunction)portWrite, METH_VARARGS,
+      "write(data) -> int\n\n"
+      "Writes any bytes-like object without copying it. The GIL is released while writing." },
+    { "start", (PyCFunction)(void(*)(void))portStart, METH_VARARGS | METH_KEYWORDS,
+      "start(callback, batch_bytes=chunk_size, batch_ms=2)\n\n"
+      "Starts callback mode: a native thread reads without the GIL and calls callback(memoryview)\n"
+      "once per batch, i.e. per batch_bytes or batch_ms after the first byte, whichever comes first,\n"
+      "or as soon as the line goes idle." },
+    { "stop", (PyCFunction)portStop, METH_NOARGS, "stop()\n\nLeaves callback mode." },
+    { "close", (PyCFunction)portClose, METH_NOARGS, "close()\n\nStops callback mode and closes the port." },
+    { "__enter__", (PyCFunction)portEnter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction)portExit, METH_VARARGS, NULL },
+    { NULL, NULL, 0, NULL },
+};
+
+
+static PyGetSetDef portGetSet[] = {
+    { "in_waiting", (getter)portInWaiting, NULL, "Bytes received and not read yet.", NULL },
+    { "stats", (getter)portStats, NULL, "Counters: bytes_read, batches, pool_misses, pool_free.", NULL },
+    { NULL, NULL, NULL, NULL, NULL },
+};
+
+
+static PyTypeObject PortType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "serialport_c.Port",
+    .tp_basicsize = sizeof(PortObject),
+    .tp_dealloc = (destructor)portDealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Port(name, baud, read_timeout=100, write_timeout=100, chunk_size=65536, pool_size=16)\n\n"
+              "Serial port opened through serialPort_C. Timeouts are in milliseconds; chunk_size is the\n"
+              "size of the pooled receive buffers and pool_size how many are kept for reuse.",
+    .tp_methods = portMethods,
+    .tp_getset = portGetSet,
+    .tp_init = (initproc)portInit,
+    .tp_new = portNew,
+};
+
+
+static struct PyModuleDef serialportModule = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "serialport_c",
+    .m_doc = "Zero-copy, GIL-free serial port I/O on top of serialPort_C.",
+    .m_size = -1,
+};
+
+
+PyMODINIT_FUNC PyInit_serialport_c(void)
+{
+    if (PyType_Ready(&PortType) < 0 || PyType_Ready(&ChunkType) < 0)
+        return NULL;
+
+    PyObject *module = PyModule_Create(&serialportModule);
+    if (module == NULL)
+        return NULL;
+
+    Py_INCREF(&PortType);
+    if (PyModule_AddObject(module, "Port", (PyObject*)&PortType) < 0)
+    {
+        Py_DECREF(&PortType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
@@ -0,0 +1,23 @@
+# Builds the serialport_c extension from the library sources one directory up.
+#
+#   cd python
+#   pip install .
+#
+# Windows only; needs the MSVC build tools matching the Python installation.
+
+from setuptools import setup, Extension
+
+serialport_c = Extension(
+    "serialport_c",
+    sources=["serialportmodule.c", "../serialPort.c", "../serialAlloc.c"],
+    include_dirs=[".."],
+)
+
+setup(
+    name="serialport_c",
+    version="1.0.0",
+    description="Zero-copy, GIL-free serial port I/O on top of serialPort_C",
+    license="GPL-3.0-or-later",
+    python_requires=">=3.9",
+    ext_modules=[serialport_c],
+)
@@ -0,0 +1,114 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "serialAlloc.h"
+
+
+/* malloc already returns 16 byte aligned blocks on the 64 bit targets, 32 bit ones only promise 8 */
+static void *heapAllocate(void *context, size_t size, size_t alignment)
+{
+    (void)context;
+#ifdef _WIN64
+    (void)alignment;
+    return malloc(size ? size : 1);
+#else
+    return _aligned_malloc(size ? size : 1, alignment);
+#endif
+}
+
+
+static void heapDeallocate(void *context, void *ptr, size_t size, size_t alignment)
+{
+    (void)context;
+    (void)size;
+    (void)alignment;
+#ifdef _WIN64
+    free(ptr);
+#else
+    _aligned_free(ptr);
+#endif
+}
+
+
+static serial_allocator_t allocator = { heapAllocate, heapDeallocate, NULL };
+
+
+void serialSetAllocator(const serial_allocator_t *replacement)
+{
+    if (replacement != NULL)
+        allocator = *replacement;
+    else
+    {
+        allocator.allocate = heapAllocate;
+        allocator.deallocate = heapDeallocate;
+        allocator.context = NULL;
+    }
+}
+
+
+const serial_allocator_t *serialGetAllocator(void)
+{
+    return &allocator;
+}
+
+
+void *serialAlloc(size_t size)
+{
+    return allocator.allocate(allocator.context, size, SERIAL_ALLOC_ALIGN);
+}
+
+
+void *serialCalloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    void *ptr = serialAlloc(count * size);
+    if (ptr != NULL)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+
+void *serialRealloc(void *ptr, size_t oldSize, size_t newSize)
+{
+    void *grown = serialAlloc(newSize);
+    if (grown == NULL)
+        return NULL;
+
+    if (ptr != NULL)
+    {
+        memcpy(grown, ptr, oldSize < newSize ? oldSize : newSize);
+        serialFree(ptr, oldSize);
+    }
+
+    return grown;
+}
+
+
+void serialFree(void *ptr, size_t size)
+{
+    if (ptr != NULL)
+        allocator.deallocate(allocator.context, ptr, size, SERIAL_ALLOC_ALIGN);
+}
@@ -0,0 +1,137 @@
+/**
+ * @file serialAlloc.h
+ * @brief Replaceable memory allocator of the library.
+ *
+ * Every module that needs memory (queue rings, pattern tables, aggregation windows, flash images,
+ * compression state, tunnel buffers) gets it through the allocator installed here instead of
+ * calling malloc directly. Processes that forbid heap use after startup can install an arena or a
+ * locked pool, and count calls through it to verify that nothing allocates in steady state.
+ * Deallocation is given the size and alignment of the block, so the allocator does not need to
+ * keep headers; this maps one to one onto std::pmr::memory_resource (see serialPortPmr.hpp).
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SERIALALLOC_H
+#define SERIALALLOC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup alloc_functions Allocator
+ * @ingroup functions
+ * @brief Replacing the memory allocator used by the library.
+ */
+
+#define SERIAL_ALLOC_ALIGN      16      /**< Alignment of every block the library requests, enough for SSE loads. */
+
+/**
+ * @struct serial_allocator_t
+ * @brief Allocator interface.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    void *(*allocate)(void *context, size_t size, size_t alignment);               /**< Returns a block, or NULL on failure. */
+    void (*deallocate)(void *context, void *ptr, size_t size, size_t alignment);   /**< Releases a block with its original size and alignment. */
+    void *context;                                                                  /**< User pointer passed to both. */
+} serial_allocator_t;
+
+/**
+ * @brief Installs the allocator used by every module.
+ *
+ * Call it during startup, before anything is allocated; memory must be released through the
+ * allocator that provided it, so it cannot change while objects of the library are alive.
+ *
+ * @param[in] allocator Allocator to copy, or NULL to go back to malloc and free.
+ *
+ * @ingroup alloc_functions
+ *
+ * ### Example
+ * Below is an example that serves all of the library's memory from a fixed arena and fails instead of touching the heap.
+ * @code
+ * static uint8_t arena[8 << 20];
+ * static size_t used;
+ *
+ * void *arenaAllocate(void *context, size_t size, size_t alignment){
+ *  size_t start = (used + alignment - 1) & ~(alignment - 1);
+ *  if(start + size > sizeof(arena))
+ *      return NULL;
+ *  used = start + size;
+ *  return arena + start;
+ * }
+ *
+ * void arenaDeallocate(void *context, void *ptr, size_t size, size_t alignment){ }
+ *
+ * int main(){
+ *  serial_allocator_t allocator = { arenaAllocate, arenaDeallocate, NULL };
+ *  serialSetAllocator(&allocator);
+ *  // set up queues, pattern sets and pipelines, then run without further allocation
+ *  ...
+ * }
+ * @endcode
+ *
+ *
+ */
+void serialSetAllocator(const serial_allocator_t *allocator);
+
+/**
+ * @brief Returns the installed allocator.
+ *
+ * @ingroup alloc_functions
+ */
+const serial_allocator_t *serialGetAllocator(void);
+
+/**
+ * @brief Allocates size bytes aligned to SERIAL_ALLOC_ALIGN through the installed allocator.
+ *
+ * @return The block, or NULL on failure.
+ *
+ * @ingroup alloc_functions
+ */
+void *serialAlloc(size_t size);
+
+/**
+ * @brief Allocates a zeroed array through the installed allocator.
+ *
+ * @return The block, or NULL on failure or overflow.
+ *
+ * @ingroup alloc_functions
+ */
+void *serialCalloc(size_t count, size_t size);
+
+/**
+ * @brief Resizes a block, moving it to a new one.
+ *
+ * @param[in] ptr Block from serialAlloc, or NULL.
+ * @param[in] oldSize Size ptr was allocated with.
+ * @param[in] newSize Size wanted.
+ *
+ * @return The new block, or NULL on failure, in which case ptr is left untouched.
+ *
+ * @ingroup alloc_functions
+ */
+void *serialRealloc(void *ptr, size_t oldSize, size_t newSize);
+
+/**
+ * @brief Releases a block; NULL is ignored.
+ *
+ * @param[in] ptr Block from serialAlloc, serialCalloc or serialRealloc.
+ * @param[in] size Size it was allocated with.
+ *
+ * @ingroup alloc_functions
+ */
+void serialFree(void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,6 +19,7 @@
 
 
 #include <stdio.h>
+#include <string.h>
 #include "serialPort.h"
 #include <windows.h>
 #include <errno.h>
@@ -30,6 +31,123 @@
 DWORD WINAPI MonitorSerialRX(LPVOID lpParam);
 char input_buf[4096];    
 
+const uint32_t serialLatencyBoundsUs[SERIAL_LATENCY_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+};
+
+/* QueryPerformanceCounter ticks per microsecond, set by the first serialPortOpen */
+static LONG64 qpcPerUs;
+
+
+/*
+ * the handle is overlapped so a read pending on one thread does not hold up a write from another;
+ * every call still waits for its own transfer, keeping the blocking semantics of the API
+ */
+static BOOL finishIo(serial_port_t* port, BOOL done, OVERLAPPED *ov, DWORD *count)
+{
+    if (!done && GetLastError() != ERROR_IO_PENDING)
+        return FALSE;
+
+    return GetOverlappedResult(port->handle, ov, count, TRUE);
+}
+
+
+/*
+ * the low bit on the event keeps these completions off any I/O completion port the handle is
+ * attached to (Asio, IOCP based adapters), they are always collected right here
+ */
+#define QUIET_EVENT(event)  ((HANDLE)((uintptr_t)(event) | 1))
+
+
+/* reads and clears the driver's error flags, counting line errors for the port statistics */
+static BOOL clearErrors(serial_port_t* port, COMSTAT *comStat)
+{
+    DWORD errors;
+
+    if (!ClearCommError(port->handle, &errors, comStat))
+        return FALSE;
+
+    if (errors & (CE_FRAME | CE_RXPARITY | CE_OVERRUN | CE_RXOVER))
+        InterlockedIncrement64(&port->lineErrors);
+
+    return TRUE;
+}
+
+
+static BOOL readPort(serial_port_t* port, void *buf, DWORD size, DWORD *count)
+{
+    OVERLAPPED ov = {0};
+    ov.hEvent = QUIET_EVENT(port->rxEvent);
+
+    *count = 0;
+    if (!finishIo(port, ReadFile(port->handle, buf, size, NULL, &ov), &ov, count))
+    {
+        COMSTAT comStat;
+
+        /* with fAbortOnError set a line error fails every read until it is cleared */
+        InterlockedIncrement64(&port->readErrors);
+        clearErrors(port, &comStat);
+        return FALSE;
+    }
+
+    /* activity stamp for the liveness monitor, which reads it from its own thread */
+    if (*count != 0)
+    {
+        InterlockedExchange64(&port->lastRxTick, (LONG64)GetTickCount64());
+        InterlockedExchangeAdd64(&port->rxBytes, *count);
+    }
+
+    return TRUE;
+}
+
+
+static BOOL writePort(serial_port_t* port, const void *buf, DWORD size, DWORD *count)
+{
+    OVERLAPPED ov = {0};
+    ov.hEvent = QUIET_EVENT(port->txEvent);
+    LARGE_INTEGER start, end;
+
+    *count = 0;
+    QueryPerformanceCounter(&start);
+    if (!finishIo(port, WriteFile(port->handle, buf, size, NULL, &ov), &ov, count))
+    {
+        InterlockedIncrement64(&port->writeErrors);
+        return FALSE;
+    }
+    QueryPerformanceCounter(&end);
+
+    /* a write completes once the driver has taken the data, so this is mostly time on the wire */
+    LONG64 us = (end.QuadPart - start.QuadPart) / qpcPerUs;
+    uint32_t bucket = 0;
+    while (bucket < SERIAL_LATENCY_BUCKETS - 1 && us > serialLatencyBoundsUs[bucket])
+        bucket++;
+
+    InterlockedIncrement64(&port->txLatency[bucket]);
+    InterlockedExchangeAdd64(&port->txLatencyUs, us);
+    InterlockedExchangeAdd64(&port->txBytes, *count);
+
+    return TRUE;
+}
+
+
+/* moves up to size bytes out of the pending receive buffer; a NULL buf discards them */
+static uint64_t takePending(serial_port_t* port, uint8_t *buf, uint64_t size)
+{
+    uint64_t count = port->rxPendingLen < size ? port->rxPendingLen : size;
+
+    if (count == 0)
+        return 0;
+
+    if (buf != NULL)
+        memcpy(buf, port->rxPending, count);
+
+    /* shift the remainder to the front of the buffer */
+    memmove(port->rxPending, port->rxPending + count, port->rxPendingLen - count);
+    port->rxPendingLen -= count;
+
+    return count;
+}
+
 
 serial_port_err_t setTimeouts(serial_port_t* port, uint64_t readTimeout, uint64_t writeTimeout)
 {
@@ -54,6 +172,37 @@ serial_port_err_t setTimeouts(serial_port_t* port, uint64_t readTimeout, uint64_
 }
 
 
+serial_port_err_t serialPortSetPollTimeouts(serial_port_t* port, uint32_t pollMs, COMMTIMEOUTS* saved)
+{
+    COMMTIMEOUTS timeouts;
+
+    if (!GetCommTimeouts(port->handle, &timeouts))
+        return SERIAL_ERR_UNKNOWN;
+
+    if (saved != NULL)
+        *saved = timeouts;
+
+    /* ReadFile returns as soon as anything arrived, or after pollMs without data; writes are left alone */
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = pollMs;
+
+    if (!SetCommTimeouts(port->handle, &timeouts))
+        return SERIAL_ERR_UNKNOWN;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t serialPortRestoreTimeouts(serial_port_t* port, const COMMTIMEOUTS* saved)
+{
+    if (!SetCommTimeouts(port->handle, (COMMTIMEOUTS*)saved))
+        return SERIAL_ERR_UNKNOWN;
+
+    return SERIAL_ERR_OK;
+}
+
+
 serial_port_err_t setBaud(serial_port_t* port, uint64_t baudRate)
 {
     /* create a DCB structure and set the Baudrate */
@@ -78,6 +227,45 @@ serial_port_err_t setBaud(serial_port_t* port, uint64_t baudRate)
 }
 
 
+serial_port_err_t setFrameFormat(serial_port_t* port, uint8_t dataBits, uint8_t parity, uint8_t stopBits)
+{
+    DCB dcb = {0};
+    dcb.DCBlength = sizeof(DCB);
+
+    /* get the current DCB state */
+    if (!GetCommState(port->handle, &dcb))
+        return SERIAL_ERR_UNKNOWN;
+
+    dcb.ByteSize = dataBits;
+    dcb.Parity = parity;
+    dcb.StopBits = stopBits;
+    dcb.fParity = (parity != NOPARITY);
+
+    /* set the new DCB values for the serial port */
+    if (!SetCommState(port->handle, &dcb))
+        return SERIAL_ERR_UNKNOWN;
+
+    port->dataBits = dataBits;
+    port->parity = parity;
+    port->stopBits = stopBits;
+
+    /* return OK */
+    return SERIAL_ERR_OK;
+}
+
+
+double serialPortCharacterBits(const serial_port_t* port)
+{
+    /* start bit, data bits and the optional parity bit */
+    double bits = 1.0 + port->dataBits + (port->parity != NOPARITY ? 1 : 0);
+
+    if (port->stopBits == ONE5STOPBITS)
+        return bits + 1.5;
+
+    return bits + (port->stopBits == TWOSTOPBITS ? 2 : 1);
+}
+
+
 serial_port_err_t serialPortOpen(serial_port_t* port, const char* name, uint64_t baud, uint32_t readTimeout, uint32_t writeTimeout) 
 {
 
@@ -95,7 +283,7 @@ serial_port_err_t serialPortOpen(serial_port_t* port, const char* name, uint64_t
     port->writeTimeout = writeTimeout;
     
     /* open the serial port by opening it as a file with the following attributes */
-    port->handle = CreateFileA(port->name, FILE_RW_MODE, FILE_NO_SHARED_ACCESS, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    port->handle = CreateFileA(port->name, FILE_RW_MODE, FILE_NO_SHARED_ACCESS, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
 
     /* set the baud rate and the timeouts */
     setBaud(port, baud);
@@ -107,10 +295,54 @@ serial_port_err_t serialPortOpen(serial_port_t* port, const char* name, uint64_t
         return SERIAL_ERR_OPEN;
     }
 
+    /* one completion event per direction */
+    port->rxEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    port->txEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (port->rxEvent == NULL || port->txEvent == NULL)
+    {
+        if (port->rxEvent != NULL)
+            CloseHandle(port->rxEvent);
+        if (port->txEvent != NULL)
+            CloseHandle(port->txEvent);
+        CloseHandle(port->handle);
+        return SERIAL_ERR_OPEN;
+    }
+
+    /* remember the character format the driver currently uses */
+    DCB dcb = {0};
+    dcb.DCBlength = sizeof(DCB);
+    port->dataBits = 8;
+    port->parity = NOPARITY;
+    port->stopBits = ONESTOPBIT;
+    if (GetCommState(port->handle, &dcb))
+    {
+        port->dataBits = dcb.ByteSize;
+        port->parity = dcb.Parity;
+        port->stopBits = dcb.StopBits;
+    }
+
     /* set the port is open to TRUE */
     port->isOpen = TRUE;
 
     port->serialEventHandler = NULL;
+    port->readyEvent = NULL;
+    port->readyArmed = FALSE;
+    port->rxPendingLen = 0;
+    port->lastRxTick = (LONG64)GetTickCount64();
+    port->rxBytes = 0;
+    port->txBytes = 0;
+    port->readErrors = 0;
+    port->writeErrors = 0;
+    port->lineErrors = 0;
+    memset((void*)port->txLatency, 0, sizeof(port->txLatency));
+    port->txLatencyUs = 0;
+
+    if (qpcPerUs == 0)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        qpcPerUs = frequency.QuadPart / 1000000 > 0 ? frequency.QuadPart / 1000000 : 1;
+    }
 
     /* return OK */
     return SERIAL_ERR_OK;
@@ -119,9 +351,13 @@ serial_port_err_t serialPortOpen(serial_port_t* port, const char* name, uint64_t
 
 serial_port_err_t serialPortClose(serial_port_t* port)
 {
+    serialPortDisableReady(port);
+
     /* Close the port handle and set the isOpen to FALSE upon success*/
     if (CloseHandle(port->handle))
     {
+        CloseHandle(port->rxEvent);
+        CloseHandle(port->txEvent);
         port->isOpen = FALSE;
         /* return OK */
         return SERIAL_ERR_OK;
@@ -137,10 +373,17 @@ serial_port_err_t serialPortClose(serial_port_t* port)
 serial_port_err_t serialPortRead(serial_port_t* port, uint8_t *buf, uint64_t size)
 {
     /* to store the actual bytes read */
-    uint64_t bytesRead;
+    DWORD bytesRead = 0;
+
+    /* hand out bytes left over by the line-oriented read mode first */
+    uint64_t fromPending = takePending(port, buf, size);
+    buf += fromPending;
+    size -= fromPending;
+    if (size == 0)
+        return SERIAL_ERR_OK;
 
     /* read from the serial port and check if it's a successful read */
-    if(ReadFile(port->handle, buf, size, (LPDWORD)&bytesRead, NULL) != TRUE)
+    if(readPort(port, buf, (DWORD)size, &bytesRead) != TRUE)
     {
         
         return SERIAL_ERR_READ_UNKNOWN;
@@ -155,13 +398,88 @@ serial_port_err_t serialPortRead(serial_port_t* port, uint8_t *buf, uint64_t siz
 }
 
 
+serial_port_err_t serialPortReadSome(serial_port_t* port, uint8_t *buf, uint64_t size, uint64_t *bytesRead)
+{
+    DWORD count = 0;
+
+    *bytesRead = takePending(port, buf, size);
+    if (*bytesRead != 0)
+        return SERIAL_ERR_OK;
+
+    /* a short read is fine here, the caller gets whatever arrived before the timeout */
+    if (readPort(port, buf, (DWORD)size, &count) != TRUE)
+        return SERIAL_ERR_READ_UNKNOWN;
+
+    *bytesRead = count;
+
+    /* return OK */
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t serialPortReadUntil(serial_port_t* port, uint8_t *buf, uint64_t size, uint8_t delimiter, uint64_t *length)
+{
+    ULONGLONG deadline = GetTickCount64() + port->readTimeout;
+    uint32_t scanned = 0;
+
+    *length = 0;
+
+    while (1)
+    {
+        /* only scan the bytes that arrived since the last pass */
+        uint8_t *end = memchr(port->rxPending + scanned, delimiter, port->rxPendingLen - scanned);
+
+        if (end != NULL)
+        {
+            uint64_t lineLen = (uint64_t)(end - port->rxPending) + 1;
+
+            /* the line does not fit; drop it so the next call starts on a fresh line */
+            if (lineLen > size)
+            {
+                takePending(port, NULL, lineLen);
+                return SERIAL_ERR_BUFFER_OVERFLOW;
+            }
+
+            *length = takePending(port, buf, lineLen);
+            return SERIAL_ERR_OK;
+        }
+
+        scanned = port->rxPendingLen;
+
+        /* a full buffer without a delimiter is garbage, resynchronise */
+        if (port->rxPendingLen == SERIAL_RX_PENDING_SIZE)
+        {
+            port->rxPendingLen = 0;
+            return SERIAL_ERR_BUFFER_OVERFLOW;
+        }
+
+        /* pull everything the driver already holds, or block for at least one byte */
+        int available = bytesAvailable(port);
+        uint64_t want = available > 0 ? (uint64_t)available : 1;
+        uint64_t space = SERIAL_RX_PENDING_SIZE - port->rxPendingLen;
+        DWORD got = 0;
+
+        if (want > space)
+            want = space;
+
+        if (readPort(port, port->rxPending + port->rxPendingLen, (DWORD)want, &got) != TRUE)
+            return SERIAL_ERR_READ_UNKNOWN;
+
+        port->rxPendingLen += got;
+
+        if (got == 0 && GetTickCount64() >= deadline)
+            return SERIAL_ERR_READ_TIMEOUT;
+    }
+}
+
+
 serial_port_err_t serialPortWrite(serial_port_t* port, uint8_t *buf, uint64_t size)
 {
     /* to store the actual bytes written */
-    uint64_t bytesWrite;
+    DWORD bytesWrite = 0;
 
     /* write to the serial port and check if it's a successful write */
-    if(WriteFile(port->handle, buf, size, (LPDWORD)&bytesWrite, NULL) != TRUE)
+    if(writePort(port, buf, (DWORD)size, &bytesWrite) != TRUE)
     {
         
         return SERIAL_ERR_WRITE_UNKNOWN;
@@ -178,10 +496,9 @@ serial_port_err_t serialPortWrite(serial_port_t* port, uint8_t *buf, uint64_t si
 
 int bytesAvailable(serial_port_t *hSerial) {
     COMSTAT comStat;
-    DWORD errors;
 
     // Clear any communication errors and get the current status of the serial port
-    if (ClearCommError(hSerial->handle, &errors, &comStat)) {
+    if (clearErrors(hSerial, &comStat)) {
         // Return the number of bytes available in the input buffer
         return comStat.cbInQue;
     } else {
@@ -191,14 +508,26 @@ int bytesAvailable(serial_port_t *hSerial) {
 }
 
 
+void serialPortCollectErrors(serial_port_t* port)
+{
+    COMSTAT comStat;
+
+    clearErrors(port, &comStat);
+}
+
+
 int isDataAvailable(serial_port_t *hSerial) {
-    DWORD eventMask;
+    DWORD eventMask = 0;
+    DWORD unused;
+    OVERLAPPED ov = {0};
+    ov.hEvent = QUIET_EVENT(hSerial->rxEvent);
+
     if (!SetCommMask(hSerial->handle, EV_RXCHAR)) {
         return -1;
     }
 
     // Wait for an event to occur (like receiving a character)
-    if (WaitCommEvent(hSerial->handle, &eventMask, NULL)) {
+    if (finishIo(hSerial, WaitCommEvent(hSerial->handle, &eventMask, &ov), &ov, &unused)) {
         if (eventMask & EV_RXCHAR) {
             return 1;
         }
@@ -248,4 +577,133 @@ DWORD WINAPI MonitorSerialRX(LPVOID lpParam) {
     }
     
     return 0;
+}
+
+
+/*
+ * arms an overlapped receive event wait on readyEvent; EV_RXCHAR only reports characters arriving
+ * after the wait starts, so anything already queued signals the event by hand
+ */
+static void armReady(serial_port_t *hSerial)
+{
+    if (!hSerial->readyArmed)
+    {
+        memset(&hSerial->readyOverlapped, 0, sizeof(hSerial->readyOverlapped));
+        hSerial->readyOverlapped.hEvent = QUIET_EVENT(hSerial->readyEvent);
+
+        if (WaitCommEvent(hSerial->handle, &hSerial->readyMask, &hSerial->readyOverlapped))
+            SetEvent(hSerial->readyEvent);
+        else if (GetLastError() == ERROR_IO_PENDING)
+            hSerial->readyArmed = TRUE;
+        else
+            SetEvent(hSerial->readyEvent);  /* let the loop come back and retry */
+    }
+
+    if (bytesAvailable(hSerial) > 0 || hSerial->rxPendingLen != 0)
+        SetEvent(hSerial->readyEvent);
+}
+
+
+serial_port_err_t serialPortEnableReady(serial_port_t *hSerial, void (*event_handler)(char*, int), HANDLE *readyHandle)
+{
+    if (event_handler == NULL || hSerial->serialEventHandler != NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    hSerial->readyEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (hSerial->readyEvent == NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    if (!SetCommMask(hSerial->handle, EV_RXCHAR))
+    {
+        CloseHandle(hSerial->readyEvent);
+        hSerial->readyEvent = NULL;
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    hSerial->serialEventHandler = event_handler;
+    hSerial->readyArmed = FALSE;
+    armReady(hSerial);
+
+    *readyHandle = hSerial->readyEvent;
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t serialPortProcessReady(serial_port_t *hSerial)
+{
+    uint8_t chunk[SERIAL_READY_CHUNK];
+    DWORD unused;
+
+    if (hSerial->readyEvent == NULL)
+        return SERIAL_ERR_UNKNOWN;
+
+    /*
+     * reset first: a wait completing after this signals the event again, one completing before it
+     * is collected below; the other order could erase a signal and leave the wait armed forever
+     */
+    ResetEvent(hSerial->readyEvent);
+
+    /* collect the wait if it has fired, otherwise leave it pending */
+    if (hSerial->readyArmed)
+    {
+        if (GetOverlappedResult(hSerial->handle, &hSerial->readyOverlapped, &unused, FALSE) ||
+            GetLastError() != ERROR_IO_INCOMPLETE)
+            hSerial->readyArmed = FALSE;
+    }
+
+    /* leftovers of the line mode go first */
+    while (hSerial->rxPendingLen != 0)
+    {
+        uint64_t count = takePending(hSerial, chunk, sizeof(chunk));
+        hSerial->serialEventHandler((char*)chunk, (int)count);
+    }
+
+    /* only what is queued right now, it is all in the driver so none of these reads block */
+    int available = bytesAvailable(hSerial);
+    if (available < 0)
+        return SERIAL_ERR_READ_UNKNOWN;
+
+    while (available > 0)
+    {
+        DWORD want = available < (int)sizeof(chunk) ? (DWORD)available : (DWORD)sizeof(chunk);
+        DWORD got = 0;
+
+        if (readPort(hSerial, chunk, want, &got) != TRUE)
+        {
+            SetEvent(hSerial->readyEvent);
+            return SERIAL_ERR_READ_UNKNOWN;
+        }
+
+        if (got == 0)
+            break;
+
+        available -= (int)got;
+        hSerial->serialEventHandler((char*)chunk, (int)got);
+    }
+
+    armReady(hSerial);
+
+    /* return OK */
+    return SERIAL_ERR_OK;
+}
+
+
+void serialPortDisableReady(serial_port_t *hSerial)
+{
+    DWORD unused;
+
+    if (hSerial->readyEvent == NULL)
+        return;
+
+    /* clearing the mask completes the pending wait */
+    if (hSerial->readyArmed)
+    {
+        SetCommMask(hSerial->handle, 0);
+        GetOverlappedResult(hSerial->handle, &hSerial->readyOverlapped, &unused, TRUE);
+        hSerial->readyArmed = FALSE;
+    }
+
+    CloseHandle(hSerial->readyEvent);
+    hSerial->readyEvent = NULL;
+    hSerial->serialEventHandler = NULL;
 }
\ No newline at end of file
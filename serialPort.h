@@ -18,6 +18,23 @@
 #include <stdint.h>
 #include <windows.h>
 
+/**
+ * @brief Size of the per-port receive buffer used by the line-oriented read mode.
+ *
+ * Bytes received past a delimiter are kept here and handed out by the next read call.
+ */
+#define SERIAL_RX_PENDING_SIZE  1024
+
+/** @brief Largest chunk serialPortProcessReady hands to the callback at once. */
+#define SERIAL_READY_CHUNK      4096
+
+/**
+ * @brief Buckets of the write latency histogram of every port, the last one is unbounded.
+ *
+ * The upper bounds of the others, in microseconds, are in serialLatencyBoundsUs.
+ */
+#define SERIAL_LATENCY_BUCKETS  14
+
 /**
  * @defgroup structs Structures
  * @brief Structures used for serial port communication.
@@ -46,15 +63,37 @@
  * @ingroup structs
  */
 typedef struct {
-    HANDLE handle;          /**< File handle for the serial port. */
+    HANDLE handle;          /**< File handle for the serial port, opened for overlapped I/O. */
+    HANDLE rxEvent;         /**< Completion event of reads and receive event waits. */
+    HANDLE txEvent;         /**< Completion event of writes, so one thread can write while another reads. */
     const char *name;       /**< Name of the serial port (e.g., COM1). */
     uint8_t isOpen;         /**< Indicates if the port is open. */
     uint64_t baud;          /**< Baud rate of the port. */
     uint32_t readTimeout;   /**< Read timeout in milliseconds. */
     uint32_t writeTimeout;  /**< Write timeout in milliseconds. */
+    uint8_t dataBits;       /**< Data bits per character (5 - 8). */
+    uint8_t parity;         /**< Parity, NOPARITY / ODDPARITY / EVENPARITY / MARKPARITY / SPACEPARITY. */
+    uint8_t stopBits;       /**< Stop bits, ONESTOPBIT / ONE5STOPBITS / TWOSTOPBITS. */
     void (*serialEventHandler)(char*, int); /**< Callback for received data events. */
+    HANDLE readyEvent;      /**< Signalled when serialPortProcessReady has work, NULL unless ready mode is enabled. */
+    OVERLAPPED readyOverlapped; /**< Receive event wait behind readyEvent. */
+    DWORD readyMask;        /**< Events reported by that wait. */
+    uint8_t readyArmed;     /**< The wait is pending. */
+    uint8_t rxPending[SERIAL_RX_PENDING_SIZE]; /**< Bytes received but not yet consumed by the line-oriented read mode. */
+    uint32_t rxPendingLen;  /**< Number of valid bytes in rxPending. */
+    volatile LONG64 lastRxTick; /**< GetTickCount64 time of the last read that returned data, or of opening the port. */
+    volatile LONG64 rxBytes;    /**< Bytes received since the port was opened. */
+    volatile LONG64 txBytes;    /**< Bytes transmitted since the port was opened. */
+    volatile LONG64 readErrors; /**< Reads that failed. */
+    volatile LONG64 writeErrors;    /**< Writes that failed. */
+    volatile LONG64 lineErrors; /**< Framing, parity and overrun errors reported by the driver. */
+    volatile LONG64 txLatency[SERIAL_LATENCY_BUCKETS];  /**< Writes by time to completion, see serialLatencyBoundsUs. */
+    volatile LONG64 txLatencyUs;    /**< Sum of the completion times of all writes in microseconds. */
 } serial_port_t;
 
+/** @brief Upper bounds in microseconds of the first SERIAL_LATENCY_BUCKETS - 1 buckets of serial_port_t::txLatency. */
+extern const uint32_t serialLatencyBoundsUs[SERIAL_LATENCY_BUCKETS - 1];
+
 /**
  * @enum serial_port_err_t
  * @brief Error codes for serial port operations.
@@ -69,7 +108,12 @@ typedef enum {
     SERIAL_ERR_READ_UNKNOWN,       /**< Unknown error during read operation. */
     SERIAL_ERR_READ_SIZE_MISMATCH, /**< Bytes read do not match expected size. */
     SERIAL_ERR_WRITE_UNKNOWN,      /**< Unknown error during write operation. */
-    SERIAL_ERR_WRITE_SIZE_MISMATCH /**< Bytes written do not match buffer size. */
+    SERIAL_ERR_WRITE_SIZE_MISMATCH, /**< Bytes written do not match buffer size. */
+    SERIAL_ERR_READ_TIMEOUT,       /**< No complete frame or line arrived within the read timeout. */
+    SERIAL_ERR_BUFFER_OVERFLOW,    /**< Received data does not fit into the supplied buffer. */
+    SERIAL_ERR_FRAME,              /**< Received frame is malformed. */
+    SERIAL_ERR_CHECKSUM,           /**< Received frame failed its checksum. */
+    SERIAL_ERR_NACK                /**< The device rejected the command. */
 } serial_port_err_t;
 
 /**
@@ -157,6 +201,92 @@ serial_port_err_t setBaud(serial_port_t* port, uint64_t baudRate);
  */
 serial_port_err_t setTimeouts(serial_port_t* port, uint64_t readTimeout, uint64_t writeTimeout);
 
+/**
+ * @brief Switches reads to polling: a read returns as soon as any data arrived, or empty after pollMs.
+ * 
+ * Used by the modules that run their own reader thread, so the thread wakes up regularly to notice
+ * it is being stopped. The write timeouts are kept.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ * @param[in] pollMs Longest time a read waits for the first byte, in milliseconds.
+ * @param[out] saved Receives the timeouts in effect before the call, for serialPortRestoreTimeouts; may be NULL.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup HL_functions
+ */
+serial_port_err_t serialPortSetPollTimeouts(serial_port_t* port, uint32_t pollMs, COMMTIMEOUTS* saved);
+
+/**
+ * @brief Puts back the timeouts saved by serialPortSetPollTimeouts.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ * @param[in] saved Timeouts returned by serialPortSetPollTimeouts.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup HL_functions
+ */
+serial_port_err_t serialPortRestoreTimeouts(serial_port_t* port, const COMMTIMEOUTS* saved);
+
+
+/**
+ * @brief Sets the character format (data bits, parity and stop bits) of the serial port.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ * @param[in] dataBits Data bits per character, 5 to 8.
+ * @param[in] parity One of NOPARITY, ODDPARITY, EVENPARITY, MARKPARITY or SPACEPARITY.
+ * @param[in] stopBits One of ONESTOPBIT, ONE5STOPBITS or TWOSTOPBITS.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup HL_functions
+ * 
+ * ### Example
+ * Below is an example that switches the port to 8E1, as used by the STM32 system bootloader.
+ * @code
+ * serial_port_t myPort;
+ * int main(){
+ *  if(serialPortOpen(&myPort, "COM3", 115200, 100, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(setFrameFormat(&myPort, 8, EVENPARITY, ONESTOPBIT) != SERIAL_ERR_OK)
+ *      return -1;
+ *  return 0;
+ * }
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t setFrameFormat(serial_port_t* port, uint8_t dataBits, uint8_t parity, uint8_t stopBits);
+
+
+/**
+ * @brief Returns the bits one character takes on the wire with the current format.
+ * 
+ * Start bit, data bits, parity bit if any and stop bits, e.g. 10 for 8N1 and 11.5 for 8E1.5.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ * 
+ * @return Bits per character.
+ *
+ * @ingroup HL_functions
+ */
+double serialPortCharacterBits(const serial_port_t* port);
+
+
+/**
+ * @brief Collects the line errors the driver has flagged since the last check.
+ * 
+ * Framing, parity and overrun errors are counted in lineErrors whenever the driver's error state
+ * is read, which failed reads, bytesAvailable and this function do. A monitor calls it before reporting
+ * the counters, so errors on a port nobody polls are not missed.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ *
+ * @ingroup HL_functions
+ */
+void serialPortCollectErrors(serial_port_t* port);
+
 
 /**
  * @brief Closes the serial port.
@@ -221,6 +351,72 @@ serial_port_err_t serialPortClose(serial_port_t* port);
 serial_port_err_t serialPortRead(serial_port_t* port, uint8_t *buf, uint64_t size);
 
 
+/**
+ * @brief Reads whatever data arrives within the read timeout, up to a maximum size.
+ * 
+ * Unlike @ref serialPortRead, a short read is not an error: the function returns as soon as
+ * the driver completes the read and reports the actual number of bytes received.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ * @param[out] buf Buffer to store the read data.
+ * @param[in] size Maximum number of bytes to read.
+ * @param[out] bytesRead Number of bytes actually stored in buf.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_READ_UNKNOWN.
+ *
+ * @ingroup HL_functions
+ * 
+ * ### Example
+ * Below is an example that drains everything currently buffered by the driver.
+ * @code
+ * uint8_t buffer[256];
+ * uint64_t got;
+ * int available = bytesAvailable(&myPort);
+ * if (available > 0 && serialPortReadSome(&myPort, buffer, sizeof(buffer), &got) == SERIAL_ERR_OK)
+ *     printf("Received %llu bytes\n", got);
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t serialPortReadSome(serial_port_t* port, uint8_t *buf, uint64_t size, uint64_t *bytesRead);
+
+
+/**
+ * @brief Reads one delimiter-terminated line from the serial port.
+ * 
+ * This is the line-oriented receive mode used by ASCII protocols. Data is pulled from the driver
+ * in bulk and scanned for the delimiter; anything received after the delimiter is kept in the
+ * port structure and returned by the next call to this function or to @ref serialPortRead.
+ * The returned line includes the delimiter.
+ * 
+ * @param[in] port Pointer to the serial port structure.
+ * @param[out] buf Buffer to store the line.
+ * @param[in] size Size of the buffer.
+ * @param[in] delimiter Byte terminating a line, e.g. '\n' or '\r'.
+ * @param[out] length Number of bytes stored in buf, including the delimiter.
+ * 
+ * @return SERIAL_ERR_OK if a line was read, SERIAL_ERR_READ_TIMEOUT if no complete line arrived
+ *         within the read timeout, SERIAL_ERR_BUFFER_OVERFLOW if the line did not fit (the line is
+ *         discarded), otherwise SERIAL_ERR_READ_UNKNOWN.
+ *
+ * @ingroup HL_functions
+ * 
+ * ### Example
+ * Below is an example that prints NMEA sentences as they arrive.
+ * @code
+ * uint8_t line[128];
+ * uint64_t length;
+ * while (1) {
+ *     if (serialPortReadUntil(&myPort, line, sizeof(line), '\n', &length) == SERIAL_ERR_OK)
+ *         printf("%.*s", (int)length, line);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t serialPortReadUntil(serial_port_t* port, uint8_t *buf, uint64_t size, uint8_t delimiter, uint64_t *length);
+
+
 /**
  * @brief Writes data to the serial port.
  * 
@@ -339,4 +535,83 @@ int bytesAvailable(serial_port_t *hSerial);
  */
 serial_port_err_t enableSerialEvent(serial_port_t *hSerial, void (*event_handler)(char* buffer, int bytes));
 
+
+/**
+ * @brief Registers a receive callback driven by the caller's own event loop instead of a thread.
+ *
+ * No thread is created. The returned handle is a manual-reset event that becomes signalled when
+ * data is waiting; add it to the loop the application already runs (WaitForMultipleObjects,
+ * MsgWaitForMultipleObjects, a GPollFD with G_IO_IN in GLib, RegisterWaitForSingleObject for
+ * libuv and thread pools) and call serialPortProcessReady when it fires. The read and the callback
+ * then run on the loop's own thread, saving the hand-off from a monitoring thread for every chunk.
+ * Windows serial ports have no readiness file descriptor; the event is the pollable object and
+ * readable is its only condition.
+ *
+ * Ready mode and enableSerialEvent are mutually exclusive, and isDataAvailable must not be used
+ * while it is enabled.
+ *
+ * @param[in] hSerial Pointer to a serial_port_t structure.
+ * @param[in] event_handler Callback receiving each chunk, as for enableSerialEvent.
+ * @param[out] readyHandle Event to wait on.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN if a handler is already registered or on error.
+ *
+ * @ingroup HL_functions
+ *
+ * ### Example
+ * Below is an example of a loop serving a port next to another event source without any extra thread.
+ * @code
+ * void onSerialDataReceived(char* data, int length) {
+ *     printf("Data received: %.*s\n", length, data);
+ * }
+ *
+ * serial_port_t myPort;
+ *
+ * int main() {
+ *     HANDLE handles[2];
+ *     if (serialPortOpen(&myPort, "COM3", 115200, 100, 100) != SERIAL_ERR_OK)
+ *         return -1;
+ *     if (serialPortEnableReady(&myPort, onSerialDataReceived, &handles[0]) != SERIAL_ERR_OK)
+ *         return -1;
+ *     handles[1] = GetStdHandle(STD_INPUT_HANDLE);
+ *     while (1) {
+ *         DWORD which = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+ *         if (which == WAIT_OBJECT_0)
+ *             serialPortProcessReady(&myPort);
+ *         else
+ *             FlushConsoleInputBuffer(handles[1]);
+ *     }
+ *     return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t serialPortEnableReady(serial_port_t *hSerial, void (*event_handler)(char* buffer, int bytes), HANDLE *readyHandle);
+
+/**
+ * @brief Reads what has arrived and passes it to the ready mode callback, without blocking.
+ *
+ * Call this whenever the handle from serialPortEnableReady is signalled; spurious calls are
+ * harmless. Only the bytes already received when the call starts are processed, in chunks of at
+ * most SERIAL_READY_CHUNK, so one busy port cannot starve the rest of the loop; the handle stays
+ * signalled while more is waiting.
+ *
+ * @param[in] hSerial Pointer to a serial_port_t structure in ready mode.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_READ_UNKNOWN if the read fails, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup HL_functions
+ */
+serial_port_err_t serialPortProcessReady(serial_port_t *hSerial);
+
+/**
+ * @brief Leaves ready mode, cancelling the pending wait and closing the handle.
+ *
+ * @param[in] hSerial Pointer to a serial_port_t structure.
+ *
+ * @ingroup HL_functions
+ */
+void serialPortDisableReady(serial_port_t *hSerial);
+
 #endif
@@ -0,0 +1,235 @@
+/**
+ * @file serialPortAsio.hpp
+ * @brief Asio stream adapter for serial_port_t.
+ *
+ * serialport::asio_port models the Asio AsyncReadStream and AsyncWriteStream concepts on top of
+ * a port opened with serialPortOpen, so the port works with asio::async_read, async_read_until,
+ * async_write and any composed operation built on them. The port's overlapped handle is attached
+ * straight to the io_context's completion port, so completions are delivered by the threads
+ * running the io_context without a monitoring thread, a copy or a cross-thread post per chunk.
+ * Operations take any completion token (callbacks, asio::use_future, asio::use_awaitable,
+ * deferred) and are allocated through the handler's associated allocator, which by default
+ * recycles the memory of the previous operation on the same thread.
+ *
+ * Works with standalone Asio, or with Boost.Asio when SERIALPORT_ASIO_BOOST is defined.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SERIALPORTASIO_HPP
+#define SERIALPORTASIO_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#ifdef SERIALPORT_ASIO_BOOST
+#include <boost/asio.hpp>
+#else
+#include <asio.hpp>
+#endif
+
+extern "C" {
+#include "serialPort.h"
+}
+
+/**
+ * @defgroup asio_functions Asio Adapter
+ * @ingroup functions
+ * @brief C++ Asio stream over a serial port.
+ */
+
+namespace serialport {
+
+#ifdef SERIALPORT_ASIO_BOOST
+namespace asio = boost::asio;
+using error_code = boost::system::error_code;
+using system_error = boost::system::system_error;
+#else
+using error_code = asio::error_code;
+using system_error = asio::system_error;
+#endif
+
+/**
+ * @brief Asynchronous stream over an opened serial_port_t.
+ *
+ * The adapter does not own the port; it must be destroyed before the port is closed. While it
+ * exists, reads on the port complete as soon as at least one byte is available, also for the
+ * blocking C API, and the previous timeouts are restored by the destructor. Once attached, the
+ * port's handle stays associated with the io_context's completion port; the C API keeps
+ * working on it.
+ *
+ * @ingroup asio_functions
+ *
+ * ### Example
+ * Below is an example that echoes lines with a coroutine.
+ * @code
+ * asio::awaitable<void> echo(serialport::asio_port &port){
+ *  std::string line;
+ *  for(;;){
+ *      std::size_t n = co_await asio::async_read_until(port, asio::dynamic_buffer(line), '\n', asio::use_awaitable);
+ *      co_await asio::async_write(port, asio::buffer(line, n), asio::use_awaitable);
+ *      line.erase(0, n);
+ *  }
+ * }
+ *
+ * int main(){
+ *  serial_port_t myPort;
+ *  if(serialPortOpen(&myPort, "COM3", 115200, 50, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  asio::io_context io;
+ *  serialport::asio_port port(io, myPort);
+ *  asio::co_spawn(io, echo(port), asio::detached);
+ *  io.run();
+ * }
+ * @endcode
+ */
+template <typename Executor = asio::any_io_executor>
+class basic_asio_port
+{
+public:
+    /** @brief Executor used for completions not bound to another executor. */
+    using executor_type = Executor;
+
+    /**
+     * @brief Attaches an opened port to an executor's io_context.
+     *
+     * @throws system_error if the handle cannot be attached.
+     */
+    basic_asio_port(const executor_type &executor, serial_port_t &port)
+        : port_(&port), handle_(executor)
+    {
+        attach();
+    }
+
+    /** @brief Attaches an opened port to an io_context. */
+    template <typename ExecutionContext,
+              typename std::enable_if<std::is_convertible<ExecutionContext&, asio::execution_context&>::value, int>::type = 0>
+    basic_asio_port(ExecutionContext &context, serial_port_t &port)
+        : port_(&port), handle_(context)
+    {
+        attach();
+    }
+
+    basic_asio_port(const basic_asio_port&) = delete;
+    basic_asio_port &operator=(const basic_asio_port&) = delete;
+
+    /** @brief Cancels outstanding operations and restores the port's timeouts. */
+    ~basic_asio_port()
+    {
+        error_code ignored;
+        handle_.close(ignored);
+        serialPortRestoreTimeouts(port_, &savedTimeouts_);
+    }
+
+    /** @brief Returns the executor. */
+    executor_type get_executor() noexcept
+    {
+        return handle_.get_executor();
+    }
+
+    /** @brief Returns the wrapped port. */
+    serial_port_t &port() noexcept
+    {
+        return *port_;
+    }
+
+    /**
+     * @brief Starts reading at least one byte into buffers.
+     *
+     * Bytes left over by serialPortReadUntil are handed out first.
+     * The completion signature is void(error_code, std::size_t).
+     */
+    template <typename MutableBufferSequence,
+              typename ReadToken = asio::default_completion_token_t<executor_type>>
+    auto async_read_some(const MutableBufferSequence &buffers,
+                         ReadToken &&token = asio::default_completion_token_t<executor_type>())
+    {
+        return asio::async_initiate<ReadToken, void(error_code, std::size_t)>(
+            initiate_read<MutableBufferSequence>{ this }, token, buffers);
+    }
+
+    /**
+     * @brief Starts writing at least one byte from buffers.
+     *
+     * The completion signature is void(error_code, std::size_t).
+     */
+    template <typename ConstBufferSequence,
+              typename WriteToken = asio::default_completion_token_t<executor_type>>
+    auto async_write_some(const ConstBufferSequence &buffers,
+                          WriteToken &&token = asio::default_completion_token_t<executor_type>())
+    {
+        return handle_.async_write_some(buffers, std::forward<WriteToken>(token));
+    }
+
+    /** @brief Cancels outstanding reads and writes; they complete with asio::error::operation_aborted. */
+    void cancel()
+    {
+        handle_.cancel();
+    }
+
+private:
+    template <typename MutableBufferSequence>
+    struct initiate_read
+    {
+        basic_asio_port *self;
+
+        template <typename Handler>
+        void operator()(Handler &&handler, const MutableBufferSequence &buffers) const
+        {
+            serial_port_t *port = self->port_;
+
+            if (port->rxPendingLen == 0)
+            {
+                self->handle_.async_read_some(buffers, std::forward<Handler>(handler));
+                return;
+            }
+
+            /* leftovers of the line mode complete at once, but never inside the initiating call */
+            std::size_t n = asio::buffer_copy(buffers, asio::buffer(port->rxPending, port->rxPendingLen));
+            std::memmove(port->rxPending, port->rxPending + n, port->rxPendingLen - n);
+            port->rxPendingLen -= static_cast<uint32_t>(n);
+
+            auto executor = asio::get_associated_executor(handler, self->handle_.get_executor());
+            asio::post(self->handle_.get_executor(),
+                       asio::bind_executor(executor, [h = std::move(handler), n]() mutable {
+                           std::move(h)(error_code(), n);
+                       }));
+        }
+    };
+
+    void attach()
+    {
+        /* the duplicate shares the port's file object; closing it leaves the port open */
+        HANDLE duplicate = NULL;
+        if (!DuplicateHandle(GetCurrentProcess(), port_->handle, GetCurrentProcess(), &duplicate,
+                             0, FALSE, DUPLICATE_SAME_ACCESS))
+            throw system_error(error_code(static_cast<int>(GetLastError()), asio::error::get_system_category()),
+                               "DuplicateHandle");
+
+        handle_.assign(duplicate);
+
+        /*
+         * a read completing with no data would look like end of file, so wait for at least one byte;
+         * the destructor puts back whatever the port was set up with
+         */
+        if (serialPortSetPollTimeouts(port_, MAXDWORD - 1, &savedTimeouts_) != SERIAL_ERR_OK)
+            throw system_error(error_code(static_cast<int>(GetLastError()), asio::error::get_system_category()),
+                               "SetCommTimeouts");
+    }
+
+    serial_port_t *port_;
+    COMMTIMEOUTS savedTimeouts_;
+    asio::windows::basic_stream_handle<executor_type> handle_;
+};
+
+/** @brief Adapter on the default polymorphic executor. */
+using asio_port = basic_asio_port<>;
+
+} // namespace serialport
+
+#endif
@@ -0,0 +1,745 @@
+/**
+ * @file serialPortExec.hpp
+ * @brief std::execution (P2300, stdexec) senders for serial port operations.
+ *
+ * serialport::exec_context is a reactor built on an I/O completion port; the thread calling its
+ * run() is the port's reactor thread. serialport::exec_port attaches an opened serial_port_t to a
+ * context and exposes read_some, write, read_until and transact as senders, so serial I/O composes
+ * with then, let_value, when_all and the rest of a sender pipeline. Nothing blocks while an
+ * operation is in flight: the overlapped transfer is started by start() and the completion packet
+ * resumes the receiver on the reactor thread, which every sender advertises as its value completion
+ * scheduler. Operation states hold their own OVERLAPPED, so connecting and starting does not
+ * allocate. A stop request on the receiver's stop token calls CancelIoEx on the transfer in flight
+ * and the operation completes with set_stopped.
+ *
+ * Needs C++20 and stdexec.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SERIALPORTEXEC_HPP
+#define SERIALPORTEXEC_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+#include <stdexec/execution.hpp>
+
+extern "C" {
+#include "serialPort.h"
+}
+
+/**
+ * @defgroup exec_functions Sender Interface
+ * @ingroup functions
+ * @brief C++ std::execution senders over a serial port.
+ */
+
+namespace serialport {
+
+class exec_context;
+class exec_port;
+
+namespace detail {
+
+/* every operation begins with its OVERLAPPED, the completion packet leads straight back to it */
+struct io_op
+{
+    OVERLAPPED overlapped;
+    DWORD failed;       /* error of a transfer that could not be started, delivered through a posted packet */
+    void (*complete)(io_op *op, DWORD error, DWORD bytes) noexcept;
+};
+
+inline std::error_code win32_error(DWORD error) noexcept
+{
+    return std::error_code(static_cast<int>(error), std::system_category());
+}
+
+} // namespace detail
+
+/**
+ * @brief Scheduler running work on the reactor thread of an exec_context.
+ *
+ * @ingroup exec_functions
+ */
+class exec_scheduler
+{
+public:
+    using scheduler_concept = stdexec::scheduler_t;
+
+    struct env
+    {
+        exec_context *context;
+
+        exec_scheduler query(stdexec::get_completion_scheduler_t<stdexec::set_value_t>) const noexcept
+        {
+            return exec_scheduler(context);
+        }
+    };
+
+    template <typename Receiver>
+    struct schedule_op : detail::io_op
+    {
+        using operation_state_concept = stdexec::operation_state_t;
+
+        exec_context *context;
+        Receiver rcvr;
+
+        schedule_op(exec_context *c, Receiver r)
+            : detail::io_op{}, context(c), rcvr(std::move(r))
+        {
+            complete = &schedule_op::completed;
+        }
+
+        schedule_op(schedule_op&&) = delete;
+
+        void start() & noexcept;
+
+        static void completed(detail::io_op *op, DWORD error, DWORD) noexcept
+        {
+            auto *self = static_cast<schedule_op*>(op);
+            if (error != 0)
+                stdexec::set_error(std::move(self->rcvr), detail::win32_error(error));
+            else
+                stdexec::set_value(std::move(self->rcvr));
+        }
+    };
+
+    struct schedule_sender
+    {
+        using sender_concept = stdexec::sender_t;
+        using completion_signatures = stdexec::completion_signatures<
+            stdexec::set_value_t(), stdexec::set_error_t(std::error_code)>;
+
+        exec_context *context;
+
+        template <typename Receiver>
+        schedule_op<Receiver> connect(Receiver rcvr) const
+        {
+            return schedule_op<Receiver>(context, std::move(rcvr));
+        }
+
+        env get_env() const noexcept
+        {
+            return env{ context };
+        }
+    };
+
+    explicit exec_scheduler(exec_context *context) noexcept
+        : context_(context)
+    {
+    }
+
+    /** @brief Returns a sender completing on the reactor thread. */
+    schedule_sender schedule() const noexcept
+    {
+        return schedule_sender{ context_ };
+    }
+
+    bool operator==(const exec_scheduler&) const noexcept = default;
+
+private:
+    exec_context *context_;
+};
+
+/**
+ * @brief Reactor for serial senders, an I/O completion port drained by run().
+ *
+ * @ingroup exec_functions
+ */
+class exec_context
+{
+public:
+    /** @throws std::system_error if the completion port cannot be created. */
+    exec_context()
+        : iocp_(CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1))
+    {
+        if (iocp_ == NULL)
+            throw std::system_error(detail::win32_error(GetLastError()), "CreateIoCompletionPort");
+    }
+
+    exec_context(const exec_context&) = delete;
+    exec_context &operator=(const exec_context&) = delete;
+
+    ~exec_context()
+    {
+        CloseHandle(iocp_);
+    }
+
+    /** @brief Returns the scheduler of the reactor thread. */
+    exec_scheduler get_scheduler() noexcept
+    {
+        return exec_scheduler(this);
+    }
+
+    /**
+     * @brief Runs completions on the calling thread, which becomes the reactor thread, until finish() is called.
+     *
+     * Every operation started on the context must have completed before run() returns for the last time.
+     */
+    void run() noexcept
+    {
+        for (;;)
+        {
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            OVERLAPPED *overlapped = NULL;
+            BOOL ok = GetQueuedCompletionStatus(iocp_, &bytes, &key, &overlapped, INFINITE);
+
+            if (overlapped == NULL)
+            {
+                if (key == FINISH_KEY || !ok)
+                    return;
+                continue;
+            }
+
+            auto *op = reinterpret_cast<detail::io_op*>(overlapped);
+            op->complete(op, ok ? op->failed : GetLastError(), bytes);
+        }
+    }
+
+    /** @brief Makes run() return once the completions queued before this call are processed. */
+    void finish() noexcept
+    {
+        PostQueuedCompletionStatus(iocp_, 0, FINISH_KEY, NULL);
+    }
+
+    /** @brief Queues op's completion on the reactor thread. */
+    bool post(detail::io_op *op, DWORD bytes = 0) noexcept
+    {
+        return PostQueuedCompletionStatus(iocp_, bytes, 0, &op->overlapped) != FALSE;
+    }
+
+    /** @brief The completion port. */
+    HANDLE native_handle() const noexcept
+    {
+        return iocp_;
+    }
+
+private:
+    static constexpr ULONG_PTR FINISH_KEY = 1;
+
+    HANDLE iocp_;
+};
+
+template <typename Receiver>
+void exec_scheduler::schedule_op<Receiver>::start() & noexcept
+{
+    if (!context->post(this))
+        stdexec::set_error(std::move(rcvr), detail::win32_error(GetLastError()));
+}
+
+namespace detail {
+
+/* stop handling and completion shared by the port operations; Derived provides completed() */
+template <typename Derived, typename Receiver>
+class port_op : public io_op
+{
+public:
+    using operation_state_concept = stdexec::operation_state_t;
+
+    port_op(exec_port *port, Receiver rcvr);
+    port_op(port_op&&) = delete;
+
+protected:
+    using token_type = stdexec::stop_token_of_t<stdexec::env_of_t<Receiver>>;
+
+    struct on_stop
+    {
+        port_op *self;
+
+        void operator()() noexcept
+        {
+            self->stopping_.store(true, std::memory_order_release);
+            CancelIoEx(self->handle(), &self->overlapped);
+        }
+    };
+
+    /* registers for stop requests; false if the operation has already completed as stopped */
+    bool begin() noexcept
+    {
+        if constexpr (!stdexec::unstoppable_token<token_type>)
+        {
+            auto token = stdexec::get_stop_token(stdexec::get_env(rcvr_));
+            if (token.stop_requested())
+            {
+                stdexec::set_stopped(std::move(rcvr_));
+                return false;
+            }
+            callback_.emplace(token, on_stop{ this });
+        }
+        return true;
+    }
+
+    /* starts an overlapped transfer whose packet comes back to Derived::completed */
+    void issue(bool write, void *buf, DWORD len) noexcept
+    {
+        std::memset(&overlapped, 0, sizeof(overlapped));
+        failed = 0;
+
+        BOOL done = write ? WriteFile(handle(), buf, len, NULL, &overlapped)
+                          : ReadFile(handle(), buf, len, NULL, &overlapped);
+
+        if (!done && GetLastError() != ERROR_IO_PENDING)
+        {
+            failed = GetLastError();
+            post();
+            return;
+        }
+
+        /* a stop request that raced with starting the transfer found nothing to cancel */
+        if (stopping_.load(std::memory_order_acquire))
+            CancelIoEx(handle(), &overlapped);
+    }
+
+    /* completes through the reactor instead of inside start() */
+    void post(DWORD bytes = 0) noexcept;
+
+    void finish_value(std::size_t n) noexcept
+    {
+        callback_.reset();
+        stdexec::set_value(std::move(rcvr_), n);
+    }
+
+    void finish_error(std::error_code error) noexcept
+    {
+        callback_.reset();
+        stdexec::set_error(std::move(rcvr_), error);
+    }
+
+    void finish_error(DWORD error) noexcept
+    {
+        if (error == ERROR_OPERATION_ABORTED && stopping_.load(std::memory_order_acquire))
+        {
+            callback_.reset();
+            stdexec::set_stopped(std::move(rcvr_));
+            return;
+        }
+        finish_error(win32_error(error));
+    }
+
+    HANDLE handle() const noexcept;
+    serial_port_t &serial() const noexcept;
+
+    exec_port *port_;
+
+private:
+    static void dispatch(io_op *op, DWORD error, DWORD bytes) noexcept
+    {
+        static_cast<Derived*>(op)->completed(error, bytes);
+    }
+
+    Receiver rcvr_;
+    std::atomic<bool> stopping_{ false };
+    std::optional<stdexec::stop_callback_for_t<token_type, on_stop>> callback_;
+};
+
+} // namespace detail
+
+/**
+ * @brief Serial port attached to an exec_context, producing senders for its operations.
+ *
+ * The adapter does not own the port; it must be destroyed before the port is closed and outlive
+ * every operation started from it. While it exists, reads on the port complete as soon as at least
+ * one byte is available, also for the blocking C API, and the previous timeouts are restored by
+ * the destructor. Reads never time out on their own; bound them with a stop request, e.g. from a
+ * timer racing the read in exec::when_any. At most one read (read_some, read_until) and one write
+ * may be in flight at a time.
+ *
+ * @ingroup exec_functions
+ *
+ * ### Example
+ * Below is an example that queries two instruments at once from the reactor thread.
+ * @code
+ * serial_port_t meterPort, loadPort;
+ * int main(){
+ *  if(serialPortOpen(&meterPort, "COM3", 115200, 50, 100) != SERIAL_ERR_OK ||
+ *     serialPortOpen(&loadPort, "COM4", 115200, 50, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  serialport::exec_context context;
+ *  serialport::exec_port meter(context, meterPort), load(context, loadPort);
+ *  std::thread reactor([&]{ context.run(); });
+ *
+ *  char volts[64], amps[64];
+ *  auto query = stdexec::when_all(
+ *      meter.transact("MEAS:VOLT?\n", 11, volts, sizeof(volts), '\n'),
+ *      load.transact("MEAS:CURR?\n", 11, amps, sizeof(amps), '\n'))
+ *    | stdexec::then([&](std::size_t v, std::size_t a){
+ *          printf("%.*s %.*s", (int)v, volts, (int)a, amps);
+ *      });
+ *  stdexec::sync_wait(std::move(query));
+ *
+ *  context.finish();
+ *  reactor.join();
+ *  return 0;
+ * }
+ * @endcode
+ */
+class exec_port
+{
+    template <typename Derived, typename Receiver>
+    friend class detail::port_op;
+
+public:
+    /** @brief Value completion scheduler of every sender, the reactor thread. */
+    using env = exec_scheduler::env;
+
+    /**
+     * @brief Attaches an opened port to a context.
+     *
+     * @throws std::system_error if the handle cannot be attached.
+     */
+    exec_port(exec_context &context, serial_port_t &port)
+        : context_(&context), port_(&port), handle_(NULL)
+    {
+        /* the duplicate shares the port's file object; closing it leaves the port open */
+        if (!DuplicateHandle(GetCurrentProcess(), port.handle, GetCurrentProcess(), &handle_,
+                             0, FALSE, DUPLICATE_SAME_ACCESS))
+            throw std::system_error(detail::win32_error(GetLastError()), "DuplicateHandle");
+
+        if (CreateIoCompletionPort(handle_, context.native_handle(), 0, 0) == NULL)
+        {
+            DWORD error = GetLastError();
+            CloseHandle(handle_);
+            throw std::system_error(detail::win32_error(error), "CreateIoCompletionPort");
+        }
+
+        /*
+         * a read completing with no data would be a wasted wake-up, so wait for at least one byte;
+         * the destructor puts back whatever the port was set up with
+         */
+        if (serialPortSetPollTimeouts(&port, MAXDWORD - 1, &savedTimeouts_) != SERIAL_ERR_OK)
+        {
+            DWORD error = GetLastError();
+            CloseHandle(handle_);
+            throw std::system_error(detail::win32_error(error), "SetCommTimeouts");
+        }
+    }
+
+    exec_port(const exec_port&) = delete;
+    exec_port &operator=(const exec_port&) = delete;
+
+    /** @brief Restores the port's timeouts. */
+    ~exec_port()
+    {
+        CloseHandle(handle_);
+        serialPortRestoreTimeouts(port_, &savedTimeouts_);
+    }
+
+    /** @brief Returns the wrapped port. */
+    serial_port_t &port() noexcept
+    {
+        return *port_;
+    }
+
+    /** @brief Returns the context the port is attached to. */
+    exec_context &context() noexcept
+    {
+        return *context_;
+    }
+
+    template <typename Receiver>
+    class read_some_op : public detail::port_op<read_some_op<Receiver>, Receiver>
+    {
+        using base = detail::port_op<read_some_op<Receiver>, Receiver>;
+        friend base;
+
+    public:
+        read_some_op(exec_port *port, Receiver rcvr, void *buf, std::size_t size)
+            : base(port, std::move(rcvr)), buf_(buf), size_(size)
+        {
+        }
+
+        void start() & noexcept
+        {
+            if (!this->begin())
+                return;
+
+            /* leftovers of the line mode are handed out first */
+            serial_port_t &serial = this->serial();
+            if (serial.rxPendingLen != 0)
+            {
+                uint32_t n = serial.rxPendingLen < size_ ? serial.rxPendingLen : static_cast<uint32_t>(size_);
+                std::memcpy(buf_, serial.rxPending, n);
+                std::memmove(serial.rxPending, serial.rxPending + n, serial.rxPendingLen - n);
+                serial.rxPendingLen -= n;
+                this->post(n);
+                return;
+            }
+
+            this->issue(false, buf_, static_cast<DWORD>(size_));
+        }
+
+    private:
+        void completed(DWORD error, DWORD bytes) noexcept
+        {
+            if (error != 0)
+                this->finish_error(error);
+            else if (bytes == 0)
+                this->issue(false, buf_, static_cast<DWORD>(size_));
+            else
+                this->finish_value(bytes);
+        }
+
+        void *buf_;
+        std::size_t size_;
+    };
+
+    template <typename Receiver>
+    class write_op : public detail::port_op<write_op<Receiver>, Receiver>
+    {
+        using base = detail::port_op<write_op<Receiver>, Receiver>;
+        friend base;
+
+    public:
+        write_op(exec_port *port, Receiver rcvr, const void *buf, std::size_t size)
+            : base(port, std::move(rcvr)), buf_(static_cast<const uint8_t*>(buf)), size_(size), done_(0)
+        {
+        }
+
+        void start() & noexcept
+        {
+            if (this->begin())
+                this->issue(true, const_cast<uint8_t*>(buf_), static_cast<DWORD>(size_));
+        }
+
+    private:
+        void completed(DWORD error, DWORD bytes) noexcept
+        {
+            done_ += bytes;
+
+            if (error != 0)
+                this->finish_error(error);
+            else if (done_ == size_)
+                this->finish_value(done_);
+            else if (bytes == 0)
+                this->finish_error(static_cast<DWORD>(ERROR_TIMEOUT));
+            else
+                this->issue(true, const_cast<uint8_t*>(buf_ + done_), static_cast<DWORD>(size_ - done_));
+        }
+
+        const uint8_t *buf_;
+        std::size_t size_;
+        std::size_t done_;
+    };
+
+    template <typename Receiver>
+    class read_until_op : public detail::port_op<read_until_op<Receiver>, Receiver>
+    {
+        using base = detail::port_op<read_until_op<Receiver>, Receiver>;
+        friend base;
+
+    public:
+        read_until_op(exec_port *port, Receiver rcvr, void *buf, std::size_t size, uint8_t delimiter)
+            : base(port, std::move(rcvr)), buf_(static_cast<uint8_t*>(buf)), size_(size),
+              delimiter_(delimiter), scanned_(0), length_(0), ready_(false)
+        {
+        }
+
+        void start() & noexcept
+        {
+            if (!this->begin())
+                return;
+
+            /* a line already buffered still completes on the reactor thread */
+            if (take_line())
+            {
+                ready_ = true;
+                this->post();
+                return;
+            }
+
+            read_more();
+        }
+
+    private:
+        void completed(DWORD error, DWORD bytes) noexcept
+        {
+            serial_port_t &serial = this->serial();
+
+            if (ready_)
+                return finish();
+
+            if (error != 0)
+                return this->finish_error(error);
+
+            serial.rxPendingLen += bytes;
+
+            if (take_line())
+                return finish();
+
+            read_more();
+        }
+
+        /* extracts a complete line from the port's pending buffer, the same way serialPortReadUntil does */
+        bool take_line() noexcept
+        {
+            serial_port_t &serial = this->serial();
+            auto *end = static_cast<uint8_t*>(std::memchr(serial.rxPending + scanned_, delimiter_,
+                                                          serial.rxPendingLen - scanned_));
+            if (end == NULL)
+            {
+                scanned_ = serial.rxPendingLen;
+
+                /* a full buffer without a delimiter is garbage, resynchronise */
+                if (serial.rxPendingLen == SERIAL_RX_PENDING_SIZE)
+                {
+                    serial.rxPendingLen = 0;
+                    overflow_ = true;
+                    return true;
+                }
+                return false;
+            }
+
+            uint32_t lineLen = static_cast<uint32_t>(end - serial.rxPending) + 1;
+
+            /* the line does not fit; drop it so the next read starts on a fresh line */
+            overflow_ = lineLen > size_;
+            if (!overflow_)
+                std::memcpy(buf_, serial.rxPending, lineLen);
+
+            std::memmove(serial.rxPending, serial.rxPending + lineLen, serial.rxPendingLen - lineLen);
+            serial.rxPendingLen -= lineLen;
+            length_ = lineLen;
+            return true;
+        }
+
+        void read_more() noexcept
+        {
+            serial_port_t &serial = this->serial();
+            this->issue(false, serial.rxPending + serial.rxPendingLen,
+                        static_cast<DWORD>(SERIAL_RX_PENDING_SIZE - serial.rxPendingLen));
+        }
+
+        void finish() noexcept
+        {
+            if (overflow_)
+                this->finish_error(std::make_error_code(std::errc::message_size));
+            else
+                this->finish_value(length_);
+        }
+
+        uint8_t *buf_;
+        std::size_t size_;
+        uint8_t delimiter_;
+        uint32_t scanned_;
+        std::size_t length_;
+        bool ready_;
+        bool overflow_ = false;
+    };
+
+    template <template <typename> class Op, typename... Args>
+    struct io_sender
+    {
+        using sender_concept = stdexec::sender_t;
+        using completion_signatures = stdexec::completion_signatures<
+            stdexec::set_value_t(std::size_t), stdexec::set_error_t(std::error_code), stdexec::set_stopped_t()>;
+
+        exec_port *port;
+        std::tuple<Args...> args;
+
+        template <typename Receiver>
+        Op<Receiver> connect(Receiver rcvr) const
+        {
+            return std::apply([&](auto... a) { return Op<Receiver>(port, std::move(rcvr), a...); }, args);
+        }
+
+        env get_env() const noexcept
+        {
+            return env{ port->context_ };
+        }
+    };
+
+    /**
+     * @brief Sender reading at least one byte into buf.
+     *
+     * Bytes left over by a line read are handed out first. Completes with the number of bytes read.
+     */
+    auto read_some(void *buf, std::size_t size) noexcept
+    {
+        return io_sender<read_some_op, void*, std::size_t>{ this, { buf, size } };
+    }
+
+    /**
+     * @brief Sender writing all of buf.
+     *
+     * Completes with size, or with ERROR_TIMEOUT if the port's write timeout expires first.
+     */
+    auto write(const void *buf, std::size_t size) noexcept
+    {
+        return io_sender<write_op, const void*, std::size_t>{ this, { buf, size } };
+    }
+
+    /**
+     * @brief Sender reading one delimiter terminated line into buf, like serialPortReadUntil.
+     *
+     * Completes with the line length including the delimiter. A line longer than size, or
+     * SERIAL_RX_PENDING_SIZE bytes without a delimiter, is dropped and completes with
+     * std::errc::message_size.
+     */
+    auto read_until(void *buf, std::size_t size, uint8_t delimiter) noexcept
+    {
+        return io_sender<read_until_op, void*, std::size_t, uint8_t>{ this, { buf, size, delimiter } };
+    }
+
+    /**
+     * @brief Sender writing a request and then reading the delimiter terminated reply.
+     *
+     * Completes with the reply length. The read's operation state lives inside the transact
+     * operation, so the pair does not allocate either.
+     */
+    auto transact(const void *request, std::size_t requestSize, void *reply, std::size_t replySize, uint8_t delimiter) noexcept
+    {
+        return stdexec::let_value(write(request, requestSize), [this, reply, replySize, delimiter](std::size_t) {
+            return read_until(reply, replySize, delimiter);
+        });
+    }
+
+private:
+    exec_context *context_;
+    serial_port_t *port_;
+    HANDLE handle_;
+    COMMTIMEOUTS savedTimeouts_;
+};
+
+namespace detail {
+
+template <typename Derived, typename Receiver>
+port_op<Derived, Receiver>::port_op(exec_port *port, Receiver rcvr)
+    : io_op{}, port_(port), rcvr_(std::move(rcvr))
+{
+    complete = &port_op::dispatch;
+}
+
+template <typename Derived, typename Receiver>
+void port_op<Derived, Receiver>::post(DWORD bytes) noexcept
+{
+    if (!port_->context_->post(this, bytes))
+        finish_error(GetLastError());
+}
+
+template <typename Derived, typename Receiver>
+HANDLE port_op<Derived, Receiver>::handle() const noexcept
+{
+    return port_->handle_;
+}
+
+template <typename Derived, typename Receiver>
+serial_port_t &port_op<Derived, Receiver>::serial() const noexcept
+{
+    return *port_->port_;
+}
+
+} // namespace detail
+
+} // namespace serialport
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file serialPortPmr.hpp
+ * @brief std::pmr::memory_resource support for the library.
+ *
+ * serialport::memory_resource_allocator turns a std::pmr::memory_resource into the C allocator
+ * of serialAlloc.h, and serialport::scoped_memory_resource installs one for a scope, so the queues,
+ * pattern tables, aggregation windows and images of the C modules come from the same monotonic
+ * arena or locked pool as the application's own pmr containers. The C++ adapters need nothing
+ * extra: serialport::asio_port allocates through the completion handler's associated allocator,
+ * so binding a std::pmr::polymorphic_allocator with asio::bind_allocator routes its operations to
+ * the resource, and the senders of serialPortExec.hpp do not allocate at all.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SERIALPORTPMR_HPP
+#define SERIALPORTPMR_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "serialAlloc.h"
+
+/**
+ * @defgroup pmr_functions Memory Resources
+ * @ingroup functions
+ * @brief Backing the library with a std::pmr::memory_resource.
+ */
+
+namespace serialport {
+
+/**
+ * @brief Returns a C allocator forwarding to a memory resource.
+ *
+ * Allocation failures are reported to the C modules as NULL instead of std::bad_alloc.
+ *
+ * @param[in] resource Resource that outlives every block allocated through the result.
+ *
+ * @ingroup pmr_functions
+ */
+inline serial_allocator_t memory_resource_allocator(std::pmr::memory_resource *resource) noexcept
+{
+    serial_allocator_t allocator;
+
+    allocator.allocate = [](void *context, std::size_t size, std::size_t alignment) noexcept -> void* {
+        try
+        {
+            return static_cast<std::pmr::memory_resource*>(context)->allocate(size, alignment);
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    };
+    allocator.deallocate = [](void *context, void *ptr, std::size_t size, std::size_t alignment) noexcept {
+        static_cast<std::pmr::memory_resource*>(context)->deallocate(ptr, size, alignment);
+    };
+    allocator.context = resource;
+
+    return allocator;
+}
+
+/**
+ * @brief Installs a memory resource as the library's allocator for the lifetime of the object.
+ *
+ * The previous allocator is restored on destruction; every object of the library created in the
+ * scope must be released before that.
+ *
+ * @ingroup pmr_functions
+ *
+ * ### Example
+ * Below is an example that serves the library from a fixed arena, so it can never fall back to the heap.
+ * @code
+ * static std::byte arena[8 << 20];
+ *
+ * int main(){
+ *  std::pmr::monotonic_buffer_resource pool(arena, sizeof(arena), std::pmr::null_memory_resource());
+ *  serialport::scoped_memory_resource scope(&pool);
+ *  // every allocation of the library comes from arena; exhausting it fails instead of using the heap
+ *  ...
+ * }
+ * @endcode
+ */
+class scoped_memory_resource
+{
+public:
+    explicit scoped_memory_resource(std::pmr::memory_resource *resource) noexcept
+        : previous_(*serialGetAllocator())
+    {
+        serial_allocator_t allocator = memory_resource_allocator(resource);
+        serialSetAllocator(&allocator);
+    }
+
+    scoped_memory_resource(const scoped_memory_resource&) = delete;
+    scoped_memory_resource &operator=(const scoped_memory_resource&) = delete;
+
+    ~scoped_memory_resource()
+    {
+        serialSetAllocator(&previous_);
+    }
+
+private:
+    serial_allocator_t previous_;
+};
+
+} // namespace serialport
+
+#endif
@@ -0,0 +1,339 @@
+/**
+ * @file serialPortRanges.hpp
+ * @brief C++20 ranges view over the frames received on a serial port.
+ *
+ * serialport::frames(port, framer) is a lazy input view: each increment decodes the next frame
+ * from the bytes already read, and only calls serialPortReadSome when those are used up. Frames
+ * are std::span views into the framer's own buffer, so nothing is copied or allocated and the
+ * view composes with std::views::filter, transform, take and the other range adaptors without
+ * intermediate containers. Framers are provided for SLIP, HDLC and delimiter terminated lines;
+ * any type with the same reset / feed members can be used.
+ *
+ * Needs C++20.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SERIALPORTRANGES_HPP
+#define SERIALPORTRANGES_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <ranges>
+#include <span>
+
+extern "C" {
+#include "serialPort.h"
+#include "slip.h"
+#include "hdlc.h"
+}
+
+/**
+ * @defgroup ranges_functions Frame Ranges
+ * @ingroup functions
+ * @brief C++20 range access to received frames.
+ */
+
+namespace serialport {
+
+/** @brief A received frame, valid until the view is advanced. */
+using frame = std::span<const uint8_t>;
+
+/**
+ * @brief Decoder turning a byte stream into frames for serialport::frames.
+ *
+ * reset() prepares an empty decoder. feed() consumes received bytes up to and including the
+ * end of at most one frame, returns how many it consumed and sets complete to the frame when
+ * one is finished.
+ *
+ * @ingroup ranges_functions
+ */
+template <typename F>
+concept framer = std::movable<F> && requires(F f, const uint8_t *data, std::size_t len, frame &complete) {
+    f.reset();
+    { f.feed(data, len, complete) } -> std::same_as<std::size_t>;
+};
+
+/**
+ * @brief SLIP framer; empty and oversized packets are dropped.
+ *
+ * @ingroup ranges_functions
+ */
+template <std::size_t Capacity = 2048>
+class slip_framer
+{
+public:
+    void reset() noexcept
+    {
+        slipDecoderInit(&decoder_, buf_, Capacity);
+    }
+
+    std::size_t feed(const uint8_t *data, std::size_t len, frame &complete) noexcept
+    {
+        std::size_t used = slipDecode(&decoder_, data, len);
+        if (decoder_.complete)
+            complete = frame(decoder_.buf, decoder_.len);
+        return used;
+    }
+
+private:
+    slip_decoder_t decoder_{};
+    uint8_t buf_[Capacity];
+};
+
+/**
+ * @brief HDLC framer; frames with a bad FCS and oversized frames are dropped, the FCS is not part of the frame.
+ *
+ * @ingroup ranges_functions
+ */
+template <std::size_t Capacity = 2048>
+class hdlc_framer
+{
+public:
+    void reset() noexcept
+    {
+        hdlcDecoderInit(&decoder_, buf_, Capacity + 2);
+    }
+
+    std::size_t feed(const uint8_t *data, std::size_t len, frame &complete) noexcept
+    {
+        std::size_t used = hdlcDecode(&decoder_, data, len);
+        if (decoder_.complete)
+            complete = frame(decoder_.buf, decoder_.len);
+        return used;
+    }
+
+    /** @brief Frames dropped so far. */
+    uint32_t errors() const noexcept
+    {
+        return decoder_.errors;
+    }
+
+private:
+    hdlc_decoder_t decoder_{};
+    uint8_t buf_[Capacity + 2];
+};
+
+/**
+ * @brief Delimiter terminated lines, including the delimiter, as serialPortReadUntil returns them.
+ *
+ * Lines longer than Capacity are dropped.
+ *
+ * @ingroup ranges_functions
+ */
+template <std::size_t Capacity = SERIAL_RX_PENDING_SIZE>
+class line_framer
+{
+public:
+    explicit line_framer(uint8_t delimiter = '\n') noexcept
+        : delimiter_(delimiter)
+    {
+    }
+
+    void reset() noexcept
+    {
+        len_ = 0;
+        overflow_ = false;
+        complete_ = false;
+    }
+
+    std::size_t feed(const uint8_t *data, std::size_t len, frame &complete) noexcept
+    {
+        /* the previous line has been handed out, start a new one */
+        if (complete_)
+            reset();
+
+        auto *end = static_cast<const uint8_t*>(std::memchr(data, delimiter_, len));
+        std::size_t used = end != nullptr ? static_cast<std::size_t>(end - data) + 1 : len;
+
+        if (!overflow_ && len_ + used <= Capacity)
+        {
+            std::memcpy(buf_ + len_, data, used);
+            len_ += used;
+        }
+        else
+            overflow_ = true;
+
+        if (end != nullptr)
+        {
+            if (overflow_)
+                reset();
+            else
+            {
+                complete_ = true;
+                complete = frame(buf_, len_);
+            }
+        }
+
+        return used;
+    }
+
+private:
+    uint8_t delimiter_;
+    bool overflow_ = false;
+    bool complete_ = false;
+    std::size_t len_ = 0;
+    uint8_t buf_[Capacity];
+};
+
+/**
+ * @brief Input view of the frames received on a port; see serialport::frames.
+ *
+ * @ingroup ranges_functions
+ */
+template <framer Framer, std::size_t ChunkSize = 4096>
+class frame_view : public std::ranges::view_interface<frame_view<Framer, ChunkSize>>
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_concept = std::input_iterator_tag;
+        using value_type = frame;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        explicit iterator(frame_view *view) noexcept
+            : view_(view)
+        {
+        }
+
+        frame operator*() const noexcept
+        {
+            return view_->current_;
+        }
+
+        iterator &operator++()
+        {
+            view_->next();
+            return *this;
+        }
+
+        void operator++(int)
+        {
+            ++*this;
+        }
+
+        friend bool operator==(const iterator &it, std::default_sentinel_t) noexcept
+        {
+            return it.at_end();
+        }
+
+    private:
+        bool at_end() const noexcept
+        {
+            return view_->done_;
+        }
+
+        frame_view *view_ = nullptr;
+    };
+
+    frame_view() = default;
+
+    frame_view(serial_port_t &port, Framer framer, bool endOnIdle)
+        : port_(&port), framer_(std::move(framer)), endOnIdle_(endOnIdle)
+    {
+    }
+
+    /** @brief Starts decoding and blocks until the first frame; an input view can be iterated once. */
+    iterator begin()
+    {
+        framer_.reset();
+        pos_ = len_ = 0;
+        done_ = false;
+        next();
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const noexcept
+    {
+        return std::default_sentinel;
+    }
+
+private:
+    void next()
+    {
+        for (;;)
+        {
+            frame complete;
+
+            while (pos_ < len_)
+            {
+                pos_ += framer_.feed(chunk_ + pos_, len_ - pos_, complete);
+                if (complete.data() != nullptr)
+                {
+                    current_ = complete;
+                    return;
+                }
+            }
+
+            /* the decoded bytes are used up, only now touch the port */
+            uint64_t got = 0;
+            if (serialPortReadSome(port_, chunk_, ChunkSize, &got) != SERIAL_ERR_OK || (got == 0 && endOnIdle_))
+            {
+                done_ = true;
+                return;
+            }
+
+            pos_ = 0;
+            len_ = static_cast<std::size_t>(got);
+        }
+    }
+
+    serial_port_t *port_ = nullptr;
+    Framer framer_{};
+    bool endOnIdle_ = false;
+    bool done_ = true;
+    frame current_;
+    std::size_t pos_ = 0;
+    std::size_t len_ = 0;
+    uint8_t chunk_[ChunkSize];
+};
+
+/**
+ * @brief Returns a lazy view of the frames received on a port.
+ *
+ * Iterating blocks in serialPortReadSome only when every byte read so far has been decoded.
+ * Each frame is a span into the framer and stays valid until the iterator is advanced; copy it
+ * to keep it. The view holds its buffers inline, so keep it on the stack or in an object rather
+ * than moving it around while iterating. The range ends when a read fails, or with endOnIdle when
+ * the port's read timeout passes without any data; otherwise it is endless and bounded with
+ * std::views::take or a break.
+ *
+ * @param[in] port Opened port, read by nobody else while the view is iterated.
+ * @param[in] framer Decoder, e.g. slip_framer<>, hdlc_framer<> or line_framer<>.
+ * @param[in] endOnIdle End the range on a read timeout instead of waiting for more.
+ *
+ * @ingroup ranges_functions
+ *
+ * ### Example
+ * Below is an example that prints the first ten telemetry frames of type 0x21.
+ * @code
+ * serial_port_t myPort;
+ * int main(){
+ *  if(serialPortOpen(&myPort, "COM3", 921600, 100, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  auto telemetry = serialport::frames(myPort, serialport::hdlc_framer<>())
+ *      | std::views::filter([](serialport::frame f){ return !f.empty() && f[0] == 0x21; })
+ *      | std::views::take(10);
+ *  for(serialport::frame f : telemetry)
+ *      printf("%zu bytes\n", f.size());
+ *  return 0;
+ * }
+ * @endcode
+ */
+template <framer Framer>
+frame_view<Framer> frames(serial_port_t &port, Framer framer, bool endOnIdle = false)
+{
+    return frame_view<Framer>(port, std::move(framer), endOnIdle);
+}
+
+} // namespace serialport
+
+#endif
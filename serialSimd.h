@@ -0,0 +1,54 @@
+/**
+ * @file serialSimd.h
+ * @brief SSE2 detection and scanning helpers shared by the codecs, internal to the library.
+ *
+ * Defines SERIAL_SSE2 when the compiler targets SSE2, which every x64 compiler does and 32 bit
+ * builds only when asked to, and then provides the few helpers the byte scanning loops of the
+ * codecs have in common.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SERIALSIMD_H
+#define SERIALSIMD_H
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SERIAL_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef SERIAL_SSE2
+
+/** @brief Index of the lowest set bit of a non-zero mask. */
+static __inline uint32_t simdLowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+/** @brief Mask of the 16 bytes at p, bit i set where p[i] is a or b. */
+static __inline uint32_t simdMatch2(const uint8_t *p, uint8_t a, uint8_t b)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)a)),
+                               _mm_cmpeq_epi8(v, _mm_set1_epi8((char)b)));
+    return (uint32_t)_mm_movemask_epi8(hit);
+}
+
+#endif
+
+#endif
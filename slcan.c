@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "slcan.h"
+#include "hexCodec.h"
+
+
+/* frames formatted per port write in slcanWriteFrames */
+#define SLCAN_TX_BATCH          64
+
+
+/* parses a fixed width hex field, returns -1 on a bad digit */
+static int parseHexField(const char *text, int digits, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (int i = 0; i < digits; i++)
+    {
+        int nibble = hexDigitValue(text[i]);
+        if (nibble < 0)
+            return -1;
+        result = (result << 4) | (uint32_t)nibble;
+    }
+
+    *value = result;
+    return 0;
+}
+
+
+static void formatHexField(uint32_t value, int digits, char *out)
+{
+    static const char digitChars[] = "0123456789ABCDEF";
+
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        out[i] = digitChars[value & 0x0F];
+        value >>= 4;
+    }
+}
+
+
+int slcanParseFrame(const char *line, size_t len, can_frame_t *frame)
+{
+    uint32_t value;
+    int idDigits;
+
+    /* a BEL error reply has no CR of its own and ends up in front of the next line */
+    while (len > 0 && *line == '\a')
+    {
+        line++;
+        len--;
+    }
+
+    if (len > 0 && line[len - 1] == '\r')
+        len--;
+
+    if (len < 1)
+        return -1;
+
+    switch (line[0])
+    {
+        case 't': frame->flags = 0; idDigits = 3; break;
+        case 'T': frame->flags = CAN_FLAG_EXTENDED; idDigits = 8; break;
+        case 'r': frame->flags = CAN_FLAG_RTR; idDigits = 3; break;
+        case 'R': frame->flags = CAN_FLAG_EXTENDED | CAN_FLAG_RTR; idDigits = 8; break;
+        default: return -1;
+    }
+
+    /* type, identifier and DLC */
+    if (len < (size_t)(1 + idDigits + 1))
+        return -1;
+
+    if (parseHexField(line + 1, idDigits, &frame->id) != 0)
+        return -1;
+
+    if (frame->id > ((frame->flags & CAN_FLAG_EXTENDED) ? 0x1FFFFFFFu : 0x7FFu))
+        return -1;
+
+    if (parseHexField(line + 1 + idDigits, 1, &value) != 0 || value > 8)
+        return -1;
+    frame->dlc = (uint8_t)value;
+
+    const char *rest = line + 2 + idDigits;
+    size_t restLen = len - 2 - idDigits;
+
+    if (!(frame->flags & CAN_FLAG_RTR))
+    {
+        if (restLen < 2u * frame->dlc || hexDecode(rest, frame->dlc, frame->data) != 0)
+            return -1;
+        rest += 2 * frame->dlc;
+        restLen -= 2 * frame->dlc;
+    }
+
+    /* adapters with timestamps enabled append 4 hex digits */
+    frame->timestamp = 0;
+    if (restLen == 4)
+    {
+        if (parseHexField(rest, 4, &value) != 0)
+            return -1;
+        frame->timestamp = (uint16_t)value;
+        frame->flags |= CAN_FLAG_TIMESTAMP;
+    }
+    else if (restLen != 0)
+        return -1;
+
+    return 0;
+}
+
+
+size_t slcanFormatFrame(const can_frame_t *frame, char *out)
+{
+    int extended = (frame->flags & CAN_FLAG_EXTENDED) != 0;
+    int rtr = (frame->flags & CAN_FLAG_RTR) != 0;
+    int idDigits = extended ? 8 : 3;
+    uint8_t dlc = frame->dlc > 8 ? 8 : frame->dlc;
+    char *p = out;
+
+    *p++ = rtr ? (extended ? 'R' : 'r') : (extended ? 'T' : 't');
+    formatHexField(frame->id, idDigits, p);
+    p += idDigits;
+    *p++ = (char)('0' + dlc);
+
+    if (!rtr)
+    {
+        hexEncode(frame->data, dlc, p, 1);
+        p += 2 * dlc;
+    }
+
+    *p++ = '\r';
+
+    return (size_t)(p - out);
+}
+
+
+serial_port_err_t slcanInit(slcan_t *slcan, serial_port_t *port)
+{
+    if (port == NULL || !port->isOpen)
+        return SERIAL_ERR_UNKNOWN;
+
+    slcan->port = port;
+    slcan->rxLen = 0;
+    slcan->framesReceived = 0;
+    slcan->framesInvalid = 0;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t slcanOpenChannel(slcan_t *slcan, slcan_bitrate_t bitrate, int listenOnly)
+{
+    /* close first, the adapter refuses to change the bit rate on an open channel */
+    char command[] = "C\rS0\rO\r";
+
+    command[3] = (char)('0' + bitrate);
+    if (listenOnly)
+        command[5] = 'L';
+
+    serial_port_err_t err = serialPortWrite(slcan->port, (uint8_t*)command, sizeof(command) - 1);
+
+    slcan->rxLen = 0;
+
+    return err;
+}
+
+
+serial_port_err_t slcanCloseChannel(slcan_t *slcan)
+{
+    uint8_t command[] = "C\r";
+
+    return serialPortWrite(slcan->port, command, sizeof(command) - 1);
+}
+
+
+/* parses complete lines from the receive buffer, returns the number of frames stored */
+static size_t parseBuffered(slcan_t *slcan, can_frame_t *frames, size_t max)
+{
+    size_t count = 0;
+    uint32_t pos = 0;
+
+    while (count < max)
+    {
+        uint8_t *end = memchr(slcan->rx + pos, '\r', slcan->rxLen - pos);
+        if (end == NULL)
+            break;
+
+        size_t lineLen = (size_t)(end - (slcan->rx + pos)) + 1;
+        const char *line = (const char*)slcan->rx + pos;
+        pos += (uint32_t)lineLen;
+
+        /* only lines carrying a frame type are counted, the rest are replies */
+        char type = line[lineLen > 1 && line[0] == '\a' ? 1 : 0];
+        if (type != 't' && type != 'T' && type != 'r' && type != 'R')
+            continue;
+
+        if (slcanParseFrame(line, lineLen, &frames[count]) == 0)
+        {
+            count++;
+            slcan->framesReceived++;
+        }
+        else
+            slcan->framesInvalid++;
+    }
+
+    /* keep the unparsed tail for the next call */
+    memmove(slcan->rx, slcan->rx + pos, slcan->rxLen - pos);
+    slcan->rxLen -= pos;
+
+    return count;
+}
+
+
+serial_port_err_t slcanReadFrames(slcan_t *slcan, can_frame_t *frames, size_t max, size_t *count)
+{
+    uint64_t got;
+
+    /* frames left over from the previous batch are served without touching the port */
+    *count = parseBuffered(slcan, frames, max);
+    if (*count == max)
+        return SERIAL_ERR_OK;
+
+    /* a buffer full of garbage without a single CR can never be parsed, drop it */
+    if (slcan->rxLen == SLCAN_RX_BUF_SIZE)
+        slcan->rxLen = 0;
+
+    /* block for at least one byte, then take everything the driver has queued */
+    int available = bytesAvailable(slcan->port);
+    uint64_t want = available > 0 ? (uint64_t)available : 1;
+    uint64_t space = SLCAN_RX_BUF_SIZE - slcan->rxLen;
+
+    if (want > space)
+        want = space;
+
+    if (serialPortReadSome(slcan->port, slcan->rx + slcan->rxLen, want, &got) != SERIAL_ERR_OK)
+        return SERIAL_ERR_READ_UNKNOWN;
+
+    slcan->rxLen += (uint32_t)got;
+
+    /* after a blocking single byte read the rest of the burst is usually queued */
+    available = bytesAvailable(slcan->port);
+    space = SLCAN_RX_BUF_SIZE - slcan->rxLen;
+    if (got > 0 && available > 0 && space > 0)
+    {
+        want = (uint64_t)available < space ? (uint64_t)available : space;
+        if (serialPortReadSome(slcan->port, slcan->rx + slcan->rxLen, want, &got) != SERIAL_ERR_OK)
+            return SERIAL_ERR_READ_UNKNOWN;
+        slcan->rxLen += (uint32_t)got;
+    }
+
+    *count += parseBuffered(slcan, frames + *count, max - *count);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t slcanWriteFrames(slcan_t *slcan, const can_frame_t *frames, size_t count)
+{
+    char batch[SLCAN_TX_BATCH * SLCAN_MAX_LINE];
+
+    while (count > 0)
+    {
+        size_t len = 0;
+        size_t n = count < SLCAN_TX_BATCH ? count : SLCAN_TX_BATCH;
+
+        for (size_t i = 0; i < n; i++)
+            len += slcanFormatFrame(&frames[i], batch + len);
+
+        serial_port_err_t err = serialPortWrite(slcan->port, (uint8_t*)batch, len);
+        if (err != SERIAL_ERR_OK)
+            return err;
+
+        frames += n;
+        count -= n;
+    }
+
+    return SERIAL_ERR_OK;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file slcan.h
+ * @brief SLCAN (Lawicel CAN-over-serial) adapter engine.
+ * 
+ * Parses and generates the ASCII 't', 'T', 'r' and 'R' frames spoken by USB-serial CAN adapters.
+ * Received data is pulled from the port in bulk and parsed in place into caller supplied frame
+ * arrays, so a whole burst of frames is handled per read without any allocation.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SLCAN_H
+#define SLCAN_H
+
+#include "serialPort.h"
+
+/**
+ * @defgroup slcan_functions SLCAN
+ * @ingroup functions
+ * @brief CAN frames over SLCAN serial adapters.
+ */
+
+/** @brief Longest SLCAN frame line: 'T', 8 id digits, dlc, 16 data digits, 4 timestamp digits and CR. */
+#define SLCAN_MAX_LINE          31
+
+/** @brief Size of the receive buffer holding partially received lines. */
+#define SLCAN_RX_BUF_SIZE       4096
+
+#define CAN_FLAG_EXTENDED       0x01    /**< 29 bit identifier. */
+#define CAN_FLAG_RTR            0x02    /**< Remote transmission request, no data. */
+#define CAN_FLAG_TIMESTAMP      0x04    /**< The adapter supplied a timestamp. */
+
+/**
+ * @struct can_frame_t
+ * @brief A classic CAN frame.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t id;            /**< 11 or 29 bit identifier. */
+    uint8_t dlc;            /**< Data length code, 0 - 8. */
+    uint8_t flags;          /**< CAN_FLAG_* bits. */
+    uint16_t timestamp;     /**< Adapter timestamp in milliseconds (0 - 59999), valid with CAN_FLAG_TIMESTAMP. */
+    uint8_t data[8];        /**< Frame payload. */
+} can_frame_t;
+
+/**
+ * @enum slcan_bitrate_t
+ * @brief Standard SLCAN bit rates, selected with the 'S' command.
+ * 
+ * @ingroup enums
+ */
+typedef enum {
+    SLCAN_BITRATE_10K,      /**< S0 */
+    SLCAN_BITRATE_20K,      /**< S1 */
+    SLCAN_BITRATE_50K,      /**< S2 */
+    SLCAN_BITRATE_100K,     /**< S3 */
+    SLCAN_BITRATE_125K,     /**< S4 */
+    SLCAN_BITRATE_250K,     /**< S5 */
+    SLCAN_BITRATE_500K,     /**< S6 */
+    SLCAN_BITRATE_800K,     /**< S7 */
+    SLCAN_BITRATE_1M        /**< S8 */
+} slcan_bitrate_t;
+
+/**
+ * @struct slcan_t
+ * @brief State of an SLCAN adapter bound to a serial port.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;                /**< Port the adapter is connected to. */
+    uint8_t rx[SLCAN_RX_BUF_SIZE];      /**< Received bytes not parsed yet. */
+    uint32_t rxLen;                     /**< Number of valid bytes in rx. */
+    uint64_t framesReceived;            /**< Frames parsed successfully. */
+    uint64_t framesInvalid;             /**< Frame lines that failed to parse. */
+} slcan_t;
+
+/**
+ * @brief Binds an SLCAN engine to an opened serial port.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup slcan_functions
+ */
+serial_port_err_t slcanInit(slcan_t *slcan, serial_port_t *port);
+
+/**
+ * @brief Sets the bit rate and opens the CAN channel.
+ * 
+ * @param[in] slcan Pointer to the SLCAN engine.
+ * @param[in] bitrate CAN bit rate.
+ * @param[in] listenOnly Non-zero to open in listen only mode ('L'), zero for normal mode ('O').
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise an appropriate error code.
+ *
+ * @ingroup slcan_functions
+ * 
+ * ### Example
+ * Below is an example that sniffs a 1 Mbit bus and prints frames in batches.
+ * @code
+ * serial_port_t myPort;
+ * slcan_t slcan;
+ * can_frame_t frames[256];
+ * size_t count;
+ * int main(){
+ *  if(serialPortOpen(&myPort, "COM7", 3000000, 100, 100) != SERIAL_ERR_OK)
+ *      return -1;
+ *  slcanInit(&slcan, &myPort);
+ *  if(slcanOpenChannel(&slcan, SLCAN_BITRATE_1M, 1) != SERIAL_ERR_OK)
+ *      return -1;
+ *  while(1){
+ *      if(slcanReadFrames(&slcan, frames, 256, &count) == SERIAL_ERR_OK)
+ *          for(size_t i = 0; i < count; i++)
+ *              printf("%08X [%d]\n", frames[i].id, frames[i].dlc);
+ *  }
+ * }
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t slcanOpenChannel(slcan_t *slcan, slcan_bitrate_t bitrate, int listenOnly);
+
+/**
+ * @brief Closes the CAN channel ('C').
+ * 
+ * @ingroup slcan_functions
+ */
+serial_port_err_t slcanCloseChannel(slcan_t *slcan);
+
+/**
+ * @brief Parses one SLCAN frame line.
+ * 
+ * @param[in] line Line starting with 't', 'T', 'r' or 'R'; the terminating CR is optional.
+ * @param[in] len Length of line.
+ * @param[out] frame Parsed frame.
+ * 
+ * @return 0 if successful, or -1 if the line is not a valid frame.
+ *
+ * @ingroup slcan_functions
+ */
+int slcanParseFrame(const char *line, size_t len, can_frame_t *frame);
+
+/**
+ * @brief Formats a frame as an SLCAN line.
+ * 
+ * @param[in] frame Frame to format.
+ * @param[out] out Buffer of at least SLCAN_MAX_LINE bytes.
+ * 
+ * @return Length of the line including the terminating CR.
+ *
+ * @ingroup slcan_functions
+ */
+size_t slcanFormatFrame(const can_frame_t *frame, char *out);
+
+/**
+ * @brief Receives a batch of CAN frames.
+ * 
+ * Blocks up to the port's read timeout for the first byte, then parses every complete
+ * frame already received, up to max frames. Lines that are not frames (command
+ * acknowledgements, status replies) are skipped.
+ * 
+ * @param[in] slcan Pointer to the SLCAN engine.
+ * @param[out] frames Array receiving the frames.
+ * @param[in] max Capacity of frames.
+ * @param[out] count Number of frames stored.
+ * 
+ * @return SERIAL_ERR_OK if successful (count may be zero on timeout), otherwise SERIAL_ERR_READ_UNKNOWN.
+ *
+ * @ingroup slcan_functions
+ */
+serial_port_err_t slcanReadFrames(slcan_t *slcan, can_frame_t *frames, size_t max, size_t *count);
+
+/**
+ * @brief Transmits CAN frames, formatted and written 64 frames per port write.
+ *
+ * Stops at the first failed write; frames of earlier writes have been sent by then.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise the error of serialPortWrite.
+ * 
+ * @ingroup slcan_functions
+ */
+serial_port_err_t slcanWriteFrames(slcan_t *slcan, const can_frame_t *frames, size_t count);
+
+#endif
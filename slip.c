@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "slip.h"
+#include "serialSimd.h"
+
+
+size_t slipEncode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    uint8_t *out = dst;
+
+    *out++ = SLIP_END;
+
+    while (len > 0)
+    {
+#ifdef SERIAL_SSE2
+        /* plain runs are copied 16 bytes at a time; the store may run ahead of out, the worst case size leaves room */
+        if (len >= 16)
+        {
+            uint32_t mask = simdMatch2(src, SLIP_END, SLIP_ESC);
+            uint32_t n = mask == 0 ? 16 : simdLowestBit(mask);
+
+            _mm_storeu_si128((__m128i*)out, _mm_loadu_si128((const __m128i*)src));
+            out += n;
+            src += n;
+            len -= n;
+            if (mask == 0)
+                continue;
+        }
+#endif
+        uint8_t c = *src++;
+        len--;
+
+        if (c == SLIP_END)
+        {
+            *out++ = SLIP_ESC;
+            *out++ = SLIP_ESC_END;
+        }
+        else if (c == SLIP_ESC)
+        {
+            *out++ = SLIP_ESC;
+            *out++ = SLIP_ESC_ESC;
+        }
+        else
+            *out++ = c;
+    }
+
+    *out++ = SLIP_END;
+
+    return (size_t)(out - dst);
+}
+
+
+void slipDecoderInit(slip_decoder_t *decoder, uint8_t *buf, size_t capacity)
+{
+    decoder->buf = buf;
+    decoder->capacity = capacity;
+    decoder->len = 0;
+    decoder->escaped = 0;
+    decoder->overflow = 0;
+    decoder->complete = 0;
+}
+
+
+size_t slipDecode(slip_decoder_t *decoder, const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+
+    /* the previous call handed out a packet, start the next one */
+    if (decoder->complete)
+    {
+        decoder->complete = 0;
+        decoder->len = 0;
+    }
+
+    while (pos < len)
+    {
+#ifdef SERIAL_SSE2
+        /* outside an escape, runs of plain bytes go straight into the packet buffer */
+        if (!decoder->escaped && !decoder->overflow && len - pos >= 16 && decoder->capacity - decoder->len >= 16)
+        {
+            uint32_t mask = simdMatch2(data + pos, SLIP_END, SLIP_ESC);
+            uint32_t n = mask == 0 ? 16 : simdLowestBit(mask);
+
+            _mm_storeu_si128((__m128i*)(decoder->buf + decoder->len), _mm_loadu_si128((const __m128i*)(data + pos)));
+            decoder->len += n;
+            pos += n;
+            if (mask == 0)
+                continue;
+        }
+#endif
+        uint8_t c = data[pos++];
+
+        if (c == SLIP_END)
+        {
+            int keep = decoder->len > 0 && !decoder->overflow;
+
+            decoder->escaped = 0;
+            decoder->overflow = 0;
+
+            if (keep)
+            {
+                decoder->complete = 1;
+                return pos;
+            }
+
+            decoder->len = 0;
+            continue;
+        }
+
+        if (decoder->escaped)
+        {
+            decoder->escaped = 0;
+            if (c == SLIP_ESC_END)
+                c = SLIP_END;
+            else if (c == SLIP_ESC_ESC)
+                c = SLIP_ESC;
+        }
+        else if (c == SLIP_ESC)
+        {
+            decoder->escaped = 1;
+            continue;
+        }
+
+        if (decoder->len == decoder->capacity)
+        {
+            decoder->overflow = 1;
+            continue;
+        }
+
+        decoder->buf[decoder->len++] = c;
+    }
+
+    return pos;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file slip.h
+ * @brief SLIP (RFC 1055) framing.
+ * 
+ * Packets are delimited by END bytes; END and ESC inside the packet are replaced by two byte
+ * escape sequences. The decoder is incremental and can be fed received data in any chunk size.
+ * Runs of bytes that need no escaping are copied 16 at a time with SSE2 in both directions.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SLIP_H
+#define SLIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup slip_functions SLIP
+ * @ingroup functions
+ * @brief SLIP packet framing.
+ */
+
+#define SLIP_END                0xC0
+#define SLIP_ESC                0xDB
+#define SLIP_ESC_END            0xDC
+#define SLIP_ESC_ESC            0xDD
+
+/** @brief Worst case size of an encoded packet. */
+#define SLIP_ENCODED_MAX(len)   (2 * (len) + 2)
+
+/**
+ * @struct slip_decoder_t
+ * @brief Incremental SLIP decoder writing into a caller supplied buffer.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t *buf;               /**< Packet buffer. */
+    size_t capacity;            /**< Size of buf. */
+    size_t len;                 /**< Bytes of the current packet in buf. */
+    uint8_t escaped;            /**< The previous byte was ESC. */
+    uint8_t overflow;           /**< The current packet did not fit and will be dropped. */
+    uint8_t complete;           /**< buf holds a complete packet. */
+} slip_decoder_t;
+
+/**
+ * @brief Encodes a packet, including the leading and trailing END bytes.
+ * 
+ * @param[in] src Packet to encode.
+ * @param[in] len Length of src.
+ * @param[out] dst Buffer of at least SLIP_ENCODED_MAX(len) bytes.
+ * 
+ * @return Length of the encoded packet.
+ *
+ * @ingroup slip_functions
+ */
+size_t slipEncode(const uint8_t *src, size_t len, uint8_t *dst);
+
+/**
+ * @brief Initialises a decoder.
+ * 
+ * @ingroup slip_functions
+ */
+void slipDecoderInit(slip_decoder_t *decoder, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Feeds received bytes until a packet completes.
+ * 
+ * When a packet completes, decoding stops after its END byte, decoder->complete is set and
+ * the packet is in decoder->buf. The next call starts a new packet. Empty and oversized
+ * packets are dropped.
+ * 
+ * @param[in] decoder Pointer to the decoder.
+ * @param[in] data Received bytes.
+ * @param[in] len Number of bytes.
+ * 
+ * @return Number of bytes consumed.
+ *
+ * @ingroup slip_functions
+ * 
+ * ### Example
+ * @code
+ * size_t pos = 0;
+ * while (pos < received) {
+ *     pos += slipDecode(&decoder, chunk + pos, received - pos);
+ *     if (decoder.complete)
+ *         handlePacket(decoder.buf, decoder.len);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+size_t slipDecode(slip_decoder_t *decoder, const uint8_t *data, size_t len);
+
+#endif
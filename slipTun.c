@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slipTun.h"
+#include "serialAlloc.h"
+
+
+/* entry points of wintun.dll, in the order of tun->api */
+typedef void *(WINAPI *wintun_create_adapter_t)(LPCWSTR name, LPCWSTR tunnelType, const GUID *requestedGuid);
+typedef void (WINAPI *wintun_close_adapter_t)(void *adapter);
+typedef void *(WINAPI *wintun_start_session_t)(void *adapter, DWORD capacity);
+typedef void (WINAPI *wintun_end_session_t)(void *session);
+typedef HANDLE (WINAPI *wintun_get_read_wait_event_t)(void *session);
+typedef BYTE *(WINAPI *wintun_receive_packet_t)(void *session, DWORD *packetSize);
+typedef void (WINAPI *wintun_release_receive_packet_t)(void *session, const BYTE *packet);
+typedef BYTE *(WINAPI *wintun_allocate_send_packet_t)(void *session, DWORD packetSize);
+typedef void (WINAPI *wintun_send_packet_t)(void *session, const BYTE *packet);
+
+enum {
+    WINTUN_CREATE_ADAPTER,
+    WINTUN_CLOSE_ADAPTER,
+    WINTUN_START_SESSION,
+    WINTUN_END_SESSION,
+    WINTUN_GET_READ_WAIT_EVENT,
+    WINTUN_RECEIVE_PACKET,
+    WINTUN_RELEASE_RECEIVE_PACKET,
+    WINTUN_ALLOCATE_SEND_PACKET,
+    WINTUN_SEND_PACKET,
+};
+
+static const char *const wintunNames[] = {
+    "WintunCreateAdapter",
+    "WintunCloseAdapter",
+    "WintunStartSession",
+    "WintunEndSession",
+    "WintunGetReadWaitEvent",
+    "WintunReceivePacket",
+    "WintunReleaseReceivePacket",
+    "WintunAllocateSendPacket",
+    "WintunSendPacket",
+};
+
+#define WINTUN(tun, index, type)    ((type)(void*)(tun)->api[index])
+
+
+static void flushBatch(sliptun_t *tun, uint8_t *batch, size_t *used, uint32_t *packets)
+{
+    if (*used == 0)
+        return;
+
+    InterlockedIncrement64(&tun->writes);
+
+    /* a write that failed or timed out part-way loses every packet of the batch */
+    if (serialPortWrite(tun->port, batch, *used) == SERIAL_ERR_OK)
+    {
+        InterlockedExchangeAdd64(&tun->packetsOut, (LONG64)*packets);
+        InterlockedExchangeAdd64(&tun->bytesOut, (LONG64)*used);
+    }
+    else
+        InterlockedExchangeAdd64(&tun->dropped, (LONG64)*packets);
+
+    *used = 0;
+    *packets = 0;
+}
+
+
+static DWORD WINAPI TunTransmit(LPVOID lpParam)
+{
+    sliptun_t *tun = (sliptun_t*)lpParam;
+    wintun_receive_packet_t receivePacket = WINTUN(tun, WINTUN_RECEIVE_PACKET, wintun_receive_packet_t);
+    wintun_release_receive_packet_t releasePacket = WINTUN(tun, WINTUN_RELEASE_RECEIVE_PACKET, wintun_release_receive_packet_t);
+
+    /* room for one more worst case frame past the batch limit */
+    uint8_t *batch = serialAlloc(SLIPTUN_BATCH + HDLC_ENCODED_MAX(SLIPTUN_MTU));
+    size_t used = 0;
+    uint32_t packets = 0;
+
+    if (batch == NULL)
+        return 0;
+
+    while (ReadAcquire(&tun->running))
+    {
+        DWORD size;
+        BYTE *packet = receivePacket(tun->session, &size);
+
+        if (packet == NULL)
+        {
+            if (GetLastError() != ERROR_NO_MORE_ITEMS)
+                break;
+
+            /* the ring is drained: send the batch, or sleep until the stack routes something in */
+            if (used > 0)
+                flushBatch(tun, batch, &used, &packets);
+            else
+                WaitForSingleObject(tun->readWait, SLIPTUN_POLL_MS);
+            continue;
+        }
+
+        if (size > SLIPTUN_MTU)
+            InterlockedIncrement64(&tun->dropped);
+        else
+        {
+            if (tun->framing == SLIPTUN_HDLC)
+                used += hdlcEncode(packet, size, batch + used);
+            else
+                used += slipEncode(packet, size, batch + used);
+            packets++;
+        }
+
+        releasePacket(tun->session, packet);
+
+        if (used >= SLIPTUN_BATCH)
+            flushBatch(tun, batch, &used, &packets);
+    }
+
+    flushBatch(tun, batch, &used, &packets);
+    serialFree(batch, SLIPTUN_BATCH + HDLC_ENCODED_MAX(SLIPTUN_MTU));
+    return 0;
+}
+
+
+static void deliver(sliptun_t *tun, const uint8_t *packet, size_t len)
+{
+    wintun_allocate_send_packet_t allocatePacket = WINTUN(tun, WINTUN_ALLOCATE_SEND_PACKET, wintun_allocate_send_packet_t);
+    wintun_send_packet_t sendPacket = WINTUN(tun, WINTUN_SEND_PACKET, wintun_send_packet_t);
+
+    /* line noise decodes to short or non IP frames, keep those away from the stack */
+    if (len < 20 || len > SLIPTUN_MTU || ((packet[0] >> 4) != 4 && (packet[0] >> 4) != 6))
+    {
+        InterlockedIncrement64(&tun->badFrames);
+        return;
+    }
+
+    BYTE *slot = allocatePacket(tun->session, (DWORD)len);
+    if (slot == NULL)
+    {
+        InterlockedIncrement64(&tun->dropped);
+        return;
+    }
+
+    memcpy(slot, packet, len);
+    sendPacket(tun->session, slot);
+    InterlockedIncrement64(&tun->packetsIn);
+}
+
+
+static DWORD WINAPI TunReceive(LPVOID lpParam)
+{
+    sliptun_t *tun = (sliptun_t*)lpParam;
+    uint8_t *chunk = serialAlloc(SLIPTUN_READ_CHUNK);
+    uint8_t packet[SLIPTUN_MTU + 2];
+    slip_decoder_t slip;
+    hdlc_decoder_t hdlc;
+    uint32_t hdlcErrors = 0;
+
+    if (chunk == NULL)
+        return 0;
+
+    slipDecoderInit(&slip, packet, SLIPTUN_MTU);
+    hdlcDecoderInit(&hdlc, packet, sizeof(packet));
+
+    while (ReadAcquire(&tun->running))
+    {
+        uint64_t got = 0;
+
+        if (serialPortReadSome(tun->port, chunk, SLIPTUN_READ_CHUNK, &got) != SERIAL_ERR_OK)
+            break;
+
+        InterlockedExchangeAdd64(&tun->bytesIn, (LONG64)got);
+
+        for (size_t pos = 0; pos < got; )
+        {
+            if (tun->framing == SLIPTUN_HDLC)
+            {
+                pos += hdlcDecode(&hdlc, chunk + pos, got - pos);
+                if (hdlc.complete)
+                    deliver(tun, hdlc.buf, hdlc.len);
+            }
+            else
+            {
+                pos += slipDecode(&slip, chunk + pos, got - pos);
+                if (slip.complete)
+                    deliver(tun, slip.buf, slip.len);
+            }
+        }
+
+        if (hdlc.errors != hdlcErrors)
+        {
+            InterlockedExchangeAdd64(&tun->badFrames, hdlc.errors - hdlcErrors);
+            hdlcErrors = hdlc.errors;
+        }
+    }
+
+    serialFree(chunk, SLIPTUN_READ_CHUNK);
+    return 0;
+}
+
+
+serial_port_err_t slipTunOpen(sliptun_t *tun, serial_port_t *port, const char *adapterName, sliptun_framing_t framing)
+{
+    WCHAR name[128];
+
+    memset(tun, 0, sizeof(*tun));
+    tun->framing = framing;
+
+    /* the receiver polls so it notices slipTunClose, which puts back whatever the port was set up with */
+    if (serialPortSetPollTimeouts(port, SLIPTUN_POLL_MS, &tun->savedTimeouts) != SERIAL_ERR_OK)
+        return SERIAL_ERR_UNKNOWN;
+    tun->port = port;
+
+    /* writes get the wire time of every byte plus the port's own timeout */
+    COMMTIMEOUTS timeouts;
+    BOOL ok = GetCommTimeouts(port->handle, &timeouts);
+    if (ok)
+    {
+        timeouts.WriteTotalTimeoutMultiplier = port->baud > 0 ? (DWORD)ceil(serialPortCharacterBits(port) * 1000.0 / port->baud) : 1;
+        timeouts.WriteTotalTimeoutConstant = port->writeTimeout;
+        ok = SetCommTimeouts(port->handle, &timeouts);
+    }
+    if (!ok)
+    {
+        slipTunClose(tun);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    tun->wintun = LoadLibraryA("wintun.dll");
+    if (tun->wintun == NULL)
+    {
+        slipTunClose(tun);
+        return SERIAL_ERR_OPEN;
+    }
+
+    for (int i = 0; i < (int)(sizeof(wintunNames) / sizeof(wintunNames[0])); i++)
+    {
+        tun->api[i] = GetProcAddress(tun->wintun, wintunNames[i]);
+        if (tun->api[i] == NULL)
+        {
+            slipTunClose(tun);
+            return SERIAL_ERR_OPEN;
+        }
+    }
+
+    if (MultiByteToWideChar(CP_UTF8, 0, adapterName, -1, name, (int)(sizeof(name) / sizeof(name[0]))) == 0)
+    {
+        slipTunClose(tun);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    tun->adapter = WINTUN(tun, WINTUN_CREATE_ADAPTER, wintun_create_adapter_t)(name, L"serialPort", NULL);
+    if (tun->adapter != NULL)
+        tun->session = WINTUN(tun, WINTUN_START_SESSION, wintun_start_session_t)(tun->adapter, SLIPTUN_RING_CAPACITY);
+    if (tun->session == NULL)
+    {
+        slipTunClose(tun);
+        return SERIAL_ERR_OPEN;
+    }
+    tun->readWait = WINTUN(tun, WINTUN_GET_READ_WAIT_EVENT, wintun_get_read_wait_event_t)(tun->session);
+
+    InterlockedExchange(&tun->running, 1);
+    tun->txThread = CreateThread(NULL, 0, TunTransmit, tun, 0, NULL);
+    tun->rxThread = CreateThread(NULL, 0, TunReceive, tun, 0, NULL);
+    if (tun->txThread == NULL || tun->rxThread == NULL)
+    {
+        slipTunClose(tun);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void slipTunClose(sliptun_t *tun)
+{
+    InterlockedExchange(&tun->running, 0);
+
+    if (tun->txThread != NULL)
+    {
+        WaitForSingleObject(tun->txThread, INFINITE);
+        CloseHandle(tun->txThread);
+        tun->txThread = NULL;
+    }
+
+    if (tun->rxThread != NULL)
+    {
+        WaitForSingleObject(tun->rxThread, INFINITE);
+        CloseHandle(tun->rxThread);
+        tun->rxThread = NULL;
+    }
+
+    if (tun->session != NULL)
+    {
+        WINTUN(tun, WINTUN_END_SESSION, wintun_end_session_t)(tun->session);
+        tun->session = NULL;
+    }
+
+    if (tun->adapter != NULL)
+    {
+        WINTUN(tun, WINTUN_CLOSE_ADAPTER, wintun_close_adapter_t)(tun->adapter);
+        tun->adapter = NULL;
+    }
+
+    if (tun->wintun != NULL)
+    {
+        FreeLibrary(tun->wintun);
+        tun->wintun = NULL;
+    }
+
+    if (tun->port != NULL)
+    {
+        serialPortRestoreTimeouts(tun->port, &tun->savedTimeouts);
+        tun->port = NULL;
+    }
+}
+
+
+void slipTunGetStats(sliptun_t *tun, sliptun_stats_t *stats)
+{
+    stats->packetsOut = (uint64_t)ReadAcquire64(&tun->packetsOut);
+    stats->bytesOut = (uint64_t)ReadAcquire64(&tun->bytesOut);
+    stats->writes = (uint64_t)ReadAcquire64(&tun->writes);
+    stats->packetsIn = (uint64_t)ReadAcquire64(&tun->packetsIn);
+    stats->bytesIn = (uint64_t)ReadAcquire64(&tun->bytesIn);
+    stats->badFrames = (uint64_t)ReadAcquire64(&tun->badFrames);
+    stats->dropped = (uint64_t)ReadAcquire64(&tun->dropped);
+}
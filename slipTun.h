@@ -0,0 +1,147 @@
+/**
+ * @file slipTun.h
+ * @brief IP network interface over a serial port (SLIP or HDLC framing on a Wintun adapter).
+ *
+ * A layer 3 Wintun adapter is created and every IP packet the system routes into it is framed
+ * with SLIP or HDLC and sent on the port; packets received on the port are deframed and handed
+ * back to the network stack. Standard tools (ping, ssh, iperf) then reach a device that only has
+ * a UART. wintun.dll is loaded at run time, so nothing is linked against it.
+ *
+ * The transmit thread drains every packet waiting in the adapter's ring, encodes them back to back
+ * into one buffer and writes them with a single call, so the link stays busy at high baud rates
+ * instead of paying a write per packet. The receive thread reads as soon as bytes arrive and
+ * deframes with the SIMD paths of the SLIP and HDLC decoders.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SLIPTUN_H
+#define SLIPTUN_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+#include "slip.h"
+#include "hdlc.h"
+
+/**
+ * @defgroup sliptun_functions SLIP / HDLC Tunnel
+ * @ingroup functions
+ * @brief IP over serial through a virtual network adapter.
+ */
+
+#define SLIPTUN_MTU             1500                /**< Largest packet sent or accepted. */
+#define SLIPTUN_RING_CAPACITY   0x400000            /**< Wintun session ring size, a power of two. */
+#define SLIPTUN_BATCH           16384               /**< Encoded bytes collected before a write is forced. */
+#define SLIPTUN_READ_CHUNK      16384               /**< Largest read from the port. */
+#define SLIPTUN_POLL_MS         10                  /**< Longest a thread waits before checking for stop. */
+
+/**
+ * @enum sliptun_framing_t
+ * @brief Framing used on the serial link.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    SLIPTUN_SLIP,           /**< RFC 1055 SLIP, no error detection. */
+    SLIPTUN_HDLC,           /**< RFC 1662 octet stuffed frames with FCS-16; corrupted frames are dropped. */
+} sliptun_framing_t;
+
+/**
+ * @struct sliptun_stats_t
+ * @brief Counters of a tunnel.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint64_t packetsOut;        /**< Packets sent on the port. */
+    uint64_t bytesOut;          /**< Encoded bytes written to the port. */
+    uint64_t writes;            /**< Write calls; packetsOut / writes is the batching factor. */
+    uint64_t packetsIn;         /**< Packets delivered to the network stack. */
+    uint64_t bytesIn;           /**< Bytes read from the port. */
+    uint64_t badFrames;         /**< Received frames dropped for a bad FCS, size or IP version. */
+    uint64_t dropped;           /**< Packets lost because the adapter's ring was full, the packet exceeded the MTU or its write failed. */
+} sliptun_stats_t;
+
+/**
+ * @struct sliptun_t
+ * @brief A tunnel between a Wintun adapter and a serial port.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;            /**< Opened port carrying the link. */
+    sliptun_framing_t framing;      /**< Framing on the link. */
+    HMODULE wintun;                 /**< wintun.dll. */
+    void *adapter;                  /**< Wintun adapter handle. */
+    void *session;                  /**< Wintun session handle. */
+    HANDLE readWait;                /**< Signalled by Wintun when packets are waiting to be sent. */
+    HANDLE txThread;                /**< Adapter to port thread. */
+    HANDLE rxThread;                /**< Port to adapter thread. */
+    volatile LONG running;          /**< Cleared by slipTunClose. */
+    FARPROC api[9];                 /**< Wintun entry points. */
+    COMMTIMEOUTS savedTimeouts;     /**< Timeouts of the port before slipTunOpen. */
+    volatile LONG64 packetsOut;     /**< See sliptun_stats_t. */
+    volatile LONG64 bytesOut;       /**< See sliptun_stats_t. */
+    volatile LONG64 writes;         /**< See sliptun_stats_t. */
+    volatile LONG64 packetsIn;      /**< See sliptun_stats_t. */
+    volatile LONG64 bytesIn;        /**< See sliptun_stats_t. */
+    volatile LONG64 badFrames;      /**< See sliptun_stats_t. */
+    volatile LONG64 dropped;        /**< See sliptun_stats_t. */
+} sliptun_t;
+
+/**
+ * @brief Creates the adapter and starts moving packets between it and the port.
+ *
+ * Needs wintun.dll next to the executable or on the search path, and administrator rights to
+ * create the adapter. The adapter comes up without an address; assign one as for any interface.
+ *
+ * @param[out] tun Pointer to the tunnel.
+ * @param[in] port Opened port, not used by anyone else while the tunnel runs.
+ * @param[in] adapterName Name of the network adapter, e.g. "serial0".
+ * @param[in] framing Framing on the link; both ends must agree.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_OPEN if wintun.dll cannot be loaded or the
+ *         adapter cannot be created, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup sliptun_functions
+ *
+ * ### Example
+ * Below is an example that puts a device running a SLIP stack on 10.0.5.2 behind COM7.
+ * @code
+ * serial_port_t link;
+ * sliptun_t tun;
+ * int main(){
+ *  if(serialPortOpen(&link, "COM7", 3000000, 50, 1000) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(slipTunOpen(&tun, &link, "serial0", SLIPTUN_SLIP) != SERIAL_ERR_OK)
+ *      return -1;
+ *  system("netsh interface ip set address name=serial0 static 10.0.5.1 255.255.255.0");
+ *  system("ping 10.0.5.2");
+ *  slipTunClose(&tun);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t slipTunOpen(sliptun_t *tun, serial_port_t *port, const char *adapterName, sliptun_framing_t framing);
+
+/**
+ * @brief Stops the threads, removes the adapter, unloads wintun.dll and restores the port timeouts.
+ *
+ * @ingroup sliptun_functions
+ */
+void slipTunClose(sliptun_t *tun);
+
+/**
+ * @brief Reads the counters of a tunnel.
+ *
+ * @ingroup sliptun_functions
+ */
+void slipTunGetStats(sliptun_t *tun, sliptun_stats_t *stats);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "spscQueue.h"
+#include "serialAlloc.h"
+
+
+/* every record starts with an 8 byte header so payloads stay 8 byte aligned */
+#define SPSC_HEADER     8
+#define SPSC_WRAP       0xFFFFFFFFu
+
+#define SPSC_ALIGN(n)   (((n) + 7u) & ~7u)
+
+
+serial_port_err_t spscQueueInit(spsc_queue_t *queue, uint32_t capacity)
+{
+    uint32_t size = 64;
+
+    memset(queue, 0, sizeof(*queue));
+
+    while (size < capacity && size < 0x40000000u)
+        size <<= 1;
+
+    queue->ring = serialAlloc(size);
+    queue->capacity = size;
+    queue->notEmpty = CreateEventA(NULL, FALSE, FALSE, NULL);
+    queue->notFull = CreateEventA(NULL, FALSE, FALSE, NULL);
+
+    if (queue->ring == NULL || queue->notEmpty == NULL || queue->notFull == NULL)
+    {
+        spscQueueFree(queue);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void spscQueueFree(spsc_queue_t *queue)
+{
+    serialFree(queue->ring, queue->capacity);
+    if (queue->notEmpty != NULL)
+        CloseHandle(queue->notEmpty);
+    if (queue->notFull != NULL)
+        CloseHandle(queue->notFull);
+
+    queue->ring = NULL;
+    queue->notEmpty = NULL;
+    queue->notFull = NULL;
+}
+
+
+void *spscQueueReserve(spsc_queue_t *queue, uint32_t len)
+{
+    uint32_t need = SPSC_HEADER + SPSC_ALIGN(len);
+    uint32_t writePos = (uint32_t)queue->writePos;
+    uint32_t offset = writePos & (queue->capacity - 1);
+    uint32_t tail = queue->capacity - offset;
+    uint32_t skip = tail < need ? tail : 0;
+
+    /* anything larger than half the ring could wait forever for a contiguous gap */
+    if (need > queue->capacity / 2)
+        return NULL;
+
+    /* only look at the consumer's cache line when the cached view says full */
+    if (queue->capacity - (writePos - queue->cachedReadPos) < skip + need)
+    {
+        queue->cachedReadPos = (uint32_t)ReadAcquire(&queue->readPos);
+        if (queue->capacity - (writePos - queue->cachedReadPos) < skip + need)
+            return NULL;
+    }
+
+    /* a record never straddles the end, the rest of the ring is marked as skipped */
+    if (skip > 0)
+    {
+        *(uint32_t*)(queue->ring + offset) = SPSC_WRAP;
+        offset = 0;
+    }
+
+    queue->reserveOffset = offset;
+    queue->reserveSkip = skip;
+
+    return queue->ring + offset + SPSC_HEADER;
+}
+
+
+void *spscQueueReserveWait(spsc_queue_t *queue, uint32_t len, DWORD timeoutMs)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    void *slot;
+
+    while ((slot = spscQueueReserve(queue, len)) == NULL)
+    {
+        if (SPSC_HEADER + SPSC_ALIGN(len) > queue->capacity / 2)
+            return NULL;
+
+        /* announce the sleep first, then look again so a release in between is not missed */
+        InterlockedExchange(&queue->producerWaiting, 1);
+        slot = spscQueueReserve(queue, len);
+        if (slot == NULL)
+        {
+            ULONGLONG now = GetTickCount64();
+            if (timeoutMs != INFINITE && now >= deadline)
+            {
+                InterlockedExchange(&queue->producerWaiting, 0);
+                return NULL;
+            }
+            WaitForSingleObject(queue->notFull, timeoutMs == INFINITE ? INFINITE : (DWORD)(deadline - now));
+        }
+        InterlockedExchange(&queue->producerWaiting, 0);
+
+        if (slot != NULL)
+            break;
+    }
+
+    return slot;
+}
+
+
+void spscQueueCommit(spsc_queue_t *queue, uint32_t len)
+{
+    *(uint32_t*)(queue->ring + queue->reserveOffset) = len;
+
+    /* pushed first so the depth seen by the consumer never goes negative */
+    InterlockedIncrement(&queue->pushed);
+    InterlockedExchange(&queue->writePos, (LONG)((uint32_t)queue->writePos + queue->reserveSkip + SPSC_HEADER + SPSC_ALIGN(len)));
+
+    if (ReadAcquire(&queue->consumerWaiting))
+        SetEvent(queue->notEmpty);
+}
+
+
+const void *spscQueuePeek(spsc_queue_t *queue, uint32_t *len)
+{
+    uint32_t readPos = (uint32_t)queue->readPos;
+
+    if (readPos == queue->cachedWritePos)
+    {
+        queue->cachedWritePos = (uint32_t)ReadAcquire(&queue->writePos);
+        if (readPos == queue->cachedWritePos)
+            return NULL;
+    }
+
+    uint32_t offset = readPos & (queue->capacity - 1);
+    uint32_t skip = 0;
+    uint32_t recordLen = *(const uint32_t*)(queue->ring + offset);
+
+    if (recordLen == SPSC_WRAP)
+    {
+        skip = queue->capacity - offset;
+        offset = 0;
+        recordLen = *(const uint32_t*)queue->ring;
+    }
+
+    queue->peekSize = skip + SPSC_HEADER + SPSC_ALIGN(recordLen);
+    *len = recordLen;
+
+    return queue->ring + offset + SPSC_HEADER;
+}
+
+
+const void *spscQueuePeekWait(spsc_queue_t *queue, uint32_t *len, DWORD timeoutMs)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    const void *record;
+
+    while ((record = spscQueuePeek(queue, len)) == NULL)
+    {
+        InterlockedExchange(&queue->consumerWaiting, 1);
+        record = spscQueuePeek(queue, len);
+        if (record == NULL)
+        {
+            ULONGLONG now = GetTickCount64();
+            if (timeoutMs != INFINITE && now >= deadline)
+            {
+                InterlockedExchange(&queue->consumerWaiting, 0);
+                return NULL;
+            }
+            WaitForSingleObject(queue->notEmpty, timeoutMs == INFINITE ? INFINITE : (DWORD)(deadline - now));
+        }
+        InterlockedExchange(&queue->consumerWaiting, 0);
+
+        if (record != NULL)
+            break;
+    }
+
+    return record;
+}
+
+
+void spscQueueRelease(spsc_queue_t *queue)
+{
+    InterlockedIncrement(&queue->popped);
+    InterlockedExchange(&queue->readPos, (LONG)((uint32_t)queue->readPos + queue->peekSize));
+
+    if (ReadAcquire(&queue->producerWaiting))
+        SetEvent(queue->notFull);
+}
+
+
+uint32_t spscQueueDepth(const spsc_queue_t *queue)
+{
+    return (uint32_t)ReadAcquire(&queue->pushed) - (uint32_t)ReadAcquire(&queue->popped);
+}
+
+
+uint32_t spscQueueBytes(const spsc_queue_t *queue)
+{
+    return (uint32_t)ReadAcquire(&queue->writePos) - (uint32_t)ReadAcquire(&queue->readPos);
+}
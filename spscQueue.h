@@ -0,0 +1,160 @@
+/**
+ * @file spscQueue.h
+ * @brief Bounded lock-free single producer / single consumer queue of variable length records.
+ *
+ * Records are stored back to back in one power of two byte ring, so passing data between two
+ * threads needs neither allocation nor locks: the producer reserves space, fills it in place and
+ * commits it; the consumer peeks at the oldest record, uses it in place and releases it. The two
+ * sides only share the read and write positions, which live on separate cache lines. Waiting is
+ * done on events that are only signalled when the other side is actually asleep.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+
+/**
+ * @defgroup spsc_functions SPSC Queue
+ * @ingroup functions
+ * @brief Lock-free hand-over of records between two threads.
+ */
+
+#define SPSC_CACHE_LINE     64
+
+/**
+ * @struct spsc_queue_t
+ * @brief A bounded record queue between exactly one producer and one consumer thread.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t *ring;              /**< Record storage. */
+    uint32_t capacity;          /**< Size of ring, a power of two. */
+    HANDLE notEmpty;            /**< Signalled when a sleeping consumer has data. */
+    HANDLE notFull;             /**< Signalled when a sleeping producer has space. */
+
+    uint8_t pad0[SPSC_CACHE_LINE];
+
+    volatile LONG writePos;             /**< Producer position, free running. */
+    volatile LONG pushed;               /**< Records committed. */
+    volatile LONG producerWaiting;      /**< Producer sleeps on notFull. */
+    uint32_t cachedReadPos;             /**< Producer's last view of readPos. */
+    uint32_t reserveOffset;             /**< Ring offset of the reserved record's header. */
+    uint32_t reserveSkip;               /**< Bytes skipped at the ring end by the reserved record. */
+    uint8_t pad1[SPSC_CACHE_LINE];
+
+    volatile LONG readPos;              /**< Consumer position, free running. */
+    volatile LONG popped;               /**< Records released. */
+    volatile LONG consumerWaiting;      /**< Consumer sleeps on notEmpty. */
+    uint32_t cachedWritePos;            /**< Consumer's last view of writePos. */
+    uint32_t peekSize;                  /**< Ring bytes taken by the peeked record. */
+    uint8_t pad2[SPSC_CACHE_LINE];
+} spsc_queue_t;
+
+/**
+ * @brief Allocates a queue.
+ *
+ * @param[out] queue Pointer to the queue.
+ * @param[in] capacity Ring size in bytes, rounded up to a power of two.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup spsc_functions
+ *
+ * ### Example
+ * @code
+ * // producer thread
+ * uint8_t *slot = spscQueueReserveWait(&queue, len, INFINITE);
+ * memcpy(slot, frame, len);
+ * spscQueueCommit(&queue, len);
+ *
+ * // consumer thread
+ * uint32_t len;
+ * const uint8_t *frame = spscQueuePeekWait(&queue, &len, INFINITE);
+ * handleFrame(frame, len);
+ * spscQueueRelease(&queue);
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t spscQueueInit(spsc_queue_t *queue, uint32_t capacity);
+
+/**
+ * @brief Releases a queue.
+ *
+ * @ingroup spsc_functions
+ */
+void spscQueueFree(spsc_queue_t *queue);
+
+/**
+ * @brief Reserves contiguous space for a record of len bytes (producer side).
+ *
+ * @return Pointer to the space, or NULL if the queue is too full or len can never fit.
+ *
+ * @ingroup spsc_functions
+ */
+void *spscQueueReserve(spsc_queue_t *queue, uint32_t len);
+
+/**
+ * @brief As spscQueueReserve but sleeps up to timeoutMs for space.
+ *
+ * @ingroup spsc_functions
+ */
+void *spscQueueReserveWait(spsc_queue_t *queue, uint32_t len, DWORD timeoutMs);
+
+/**
+ * @brief Publishes the record filled in after the last reserve (producer side).
+ *
+ * @param[in] queue Pointer to the queue.
+ * @param[in] len Final record length, at most the reserved length.
+ *
+ * @ingroup spsc_functions
+ */
+void spscQueueCommit(spsc_queue_t *queue, uint32_t len);
+
+/**
+ * @brief Returns the oldest record without removing it (consumer side).
+ *
+ * @return Pointer to the record, or NULL if the queue is empty.
+ *
+ * @ingroup spsc_functions
+ */
+const void *spscQueuePeek(spsc_queue_t *queue, uint32_t *len);
+
+/**
+ * @brief As spscQueuePeek but sleeps up to timeoutMs for a record.
+ *
+ * @ingroup spsc_functions
+ */
+const void *spscQueuePeekWait(spsc_queue_t *queue, uint32_t *len, DWORD timeoutMs);
+
+/**
+ * @brief Removes the record returned by the last peek (consumer side).
+ *
+ * @ingroup spsc_functions
+ */
+void spscQueueRelease(spsc_queue_t *queue);
+
+/**
+ * @brief Number of records in the queue.
+ *
+ * @ingroup spsc_functions
+ */
+uint32_t spscQueueDepth(const spsc_queue_t *queue);
+
+/**
+ * @brief Number of ring bytes in use, including record headers.
+ *
+ * @ingroup spsc_functions
+ */
+uint32_t spscQueueBytes(const spsc_queue_t *queue);
+
+#endif
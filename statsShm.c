@@ -0,0 +1,270 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "statsShm.h"
+#include "serialAlloc.h"
+
+
+/* readers in other processes rely on this layout, it only changes together with STATS_SHM_VERSION */
+typedef char stats_shm_record_size_check[sizeof(stats_shm_record_t) == STATS_SHM_RECORD_SIZE ? 1 : -1];
+typedef char stats_shm_header_size_check[sizeof(stats_shm_header_t) == 64 ? 1 : -1];
+
+
+serial_port_err_t statsShmOpen(stats_shm_t *shm, const char *name, uint32_t capacity)
+{
+    memset(shm, 0, sizeof(*shm));
+
+    if (capacity == 0)
+        return SERIAL_ERR_UNKNOWN;
+
+    shm->ports = serialCalloc(capacity, sizeof(serial_port_t*));
+    if (shm->ports == NULL)
+        return SERIAL_ERR_UNKNOWN;
+    shm->capacity = capacity;
+
+    uint64_t size = sizeof(stats_shm_header_t) + (uint64_t)capacity * STATS_SHM_RECORD_SIZE;
+
+    shm->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, name);
+    if (shm->mapping == NULL)
+    {
+        statsShmClose(shm);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    /* another publisher owns the name; its live page must not be cleared, and may be smaller than ours */
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        statsShmClose(shm);
+        return SERIAL_ERR_OPEN;
+    }
+
+    shm->header = (stats_shm_header_t*)MapViewOfFile(shm->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (shm->header == NULL)
+    {
+        statsShmClose(shm);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    shm->records = (stats_shm_record_t*)(shm->header + 1);
+    memset(shm->header, 0, (size_t)size);
+    shm->header->version = STATS_SHM_VERSION;
+    shm->header->headerSize = sizeof(stats_shm_header_t);
+    shm->header->recordSize = STATS_SHM_RECORD_SIZE;
+    shm->header->capacity = capacity;
+    shm->header->processId = GetCurrentProcessId();
+
+    /* readers check the magic first, so it goes in once the rest of the header is valid */
+    InterlockedExchange((volatile LONG*)&shm->header->magic, STATS_SHM_MAGIC);
+
+    return SERIAL_ERR_OK;
+}
+
+
+void statsShmClose(stats_shm_t *shm)
+{
+    serialFree(shm->ports, shm->capacity * sizeof(serial_port_t*));
+    if (shm->header != NULL)
+        UnmapViewOfFile(shm->header);
+    if (shm->mapping != NULL)
+        CloseHandle(shm->mapping);
+
+    shm->header = NULL;
+    shm->mapping = NULL;
+    shm->records = NULL;
+    shm->ports = NULL;
+    shm->capacity = 0;
+}
+
+
+serial_port_err_t statsShmAddPort(stats_shm_t *shm, serial_port_t *port)
+{
+    uint32_t index = (uint32_t)shm->header->count;
+
+    if (port == NULL || index == shm->header->capacity)
+        return SERIAL_ERR_UNKNOWN;
+
+    stats_shm_record_t *record = &shm->records[index];
+
+    record->index = index;
+    strncpy(record->name, port->name != NULL ? port->name : "", STATS_SHM_NAME_LEN - 1);
+    shm->ports[index] = port;
+
+    /* the publisher and the readers only look at records below count */
+    InterlockedIncrement(&shm->header->count);
+
+    return SERIAL_ERR_OK;
+}
+
+
+void statsShmPublish(stats_shm_t *shm)
+{
+    uint32_t count = (uint32_t)ReadAcquire(&shm->header->count);
+    uint64_t now = GetTickCount64();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const serial_port_t *port = shm->ports[i];
+        stats_shm_record_t *record = &shm->records[i];
+
+        /* the interlocked increments are full barriers around the plain stores in between */
+        InterlockedIncrement(&record->sequence);
+
+        record->baud = port->baud;
+        record->updatedTick = now;
+        record->lastRxTick = (uint64_t)ReadAcquire64(&port->lastRxTick);
+        record->rxBytes = (uint64_t)ReadAcquire64(&port->rxBytes);
+        record->txBytes = (uint64_t)ReadAcquire64(&port->txBytes);
+        record->readErrors = (uint64_t)ReadAcquire64(&port->readErrors);
+        record->writeErrors = (uint64_t)ReadAcquire64(&port->writeErrors);
+        record->lineErrors = (uint64_t)ReadAcquire64(&port->lineErrors);
+        for (uint32_t b = 0; b < SERIAL_LATENCY_BUCKETS; b++)
+            record->txLatency[b] = (uint64_t)ReadAcquire64(&port->txLatency[b]);
+        record->txLatencyUs = (uint64_t)ReadAcquire64(&port->txLatencyUs);
+        record->isOpen = port->isOpen;
+        record->dataBits = port->dataBits;
+        record->parity = port->parity;
+        record->stopBits = port->stopBits;
+
+        InterlockedIncrement(&record->sequence);
+    }
+
+    InterlockedExchange64(&shm->header->updatedTick, (LONG64)now);
+    InterlockedIncrement64(&shm->header->generation);
+}
+
+
+static DWORD WINAPI StatsShmThread(LPVOID lpParam)
+{
+    stats_shm_t *shm = (stats_shm_t*)lpParam;
+
+    while (ReadAcquire(&shm->running))
+    {
+        statsShmPublish(shm);
+        Sleep(shm->intervalMs);
+    }
+
+    /* leave the final counters behind for readers that look after the stop */
+    statsShmPublish(shm);
+
+    return 0;
+}
+
+
+serial_port_err_t statsShmStart(stats_shm_t *shm, uint32_t intervalMs)
+{
+    if (shm->header == NULL || shm->thread != NULL || intervalMs == 0)
+        return SERIAL_ERR_UNKNOWN;
+
+    shm->intervalMs = intervalMs;
+    shm->header->intervalMs = intervalMs;
+    InterlockedExchange(&shm->running, 1);
+
+    shm->thread = CreateThread(NULL, 0, StatsShmThread, shm, 0, NULL);
+    if (shm->thread == NULL)
+    {
+        InterlockedExchange(&shm->running, 0);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void statsShmStop(stats_shm_t *shm)
+{
+    InterlockedExchange(&shm->running, 0);
+
+    if (shm->thread != NULL)
+    {
+        WaitForSingleObject(shm->thread, INFINITE);
+        CloseHandle(shm->thread);
+        shm->thread = NULL;
+    }
+}
+
+
+serial_port_err_t statsShmAttach(stats_shm_view_t *view, const char *name)
+{
+    memset(view, 0, sizeof(*view));
+
+    view->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (view->mapping == NULL)
+        return SERIAL_ERR_OPEN;
+
+    view->header = (const stats_shm_header_t*)MapViewOfFile(view->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view->header == NULL)
+    {
+        statsShmDetach(view);
+        return SERIAL_ERR_OPEN;
+    }
+
+    if (ReadAcquire((const volatile LONG*)&view->header->magic) != STATS_SHM_MAGIC ||
+        view->header->version != STATS_SHM_VERSION ||
+        view->header->recordSize != STATS_SHM_RECORD_SIZE)
+    {
+        statsShmDetach(view);
+        return SERIAL_ERR_UNKNOWN;
+    }
+
+    view->records = (const stats_shm_record_t*)((const uint8_t*)view->header + view->header->headerSize);
+
+    return SERIAL_ERR_OK;
+}
+
+
+void statsShmDetach(stats_shm_view_t *view)
+{
+    if (view->header != NULL)
+        UnmapViewOfFile(view->header);
+    if (view->mapping != NULL)
+        CloseHandle(view->mapping);
+
+    view->header = NULL;
+    view->mapping = NULL;
+    view->records = NULL;
+}
+
+
+int statsShmSnapshot(const stats_shm_view_t *view, uint32_t index, stats_shm_record_t *record)
+{
+    if (index >= (uint32_t)ReadAcquire(&view->header->count) || index >= view->header->capacity)
+        return FALSE;
+
+    const stats_shm_record_t *source = &view->records[index];
+
+    for (int attempt = 0; attempt < STATS_SHM_RETRIES; attempt++)
+    {
+        LONG begin = ReadAcquire(&source->sequence);
+
+        if ((begin & 1) == 0)
+        {
+            memcpy(record, (const void*)source, sizeof(*record));
+
+            /* the copy must be complete before the sequence is looked at again */
+            MemoryBarrier();
+            if (ReadAcquire(&source->sequence) == begin)
+                return TRUE;
+        }
+
+        YieldProcessor();
+    }
+
+    return FALSE;
+}
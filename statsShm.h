@@ -0,0 +1,227 @@
+/**
+ * @file statsShm.h
+ * @brief Port statistics published in a shared memory page for external monitors.
+ *
+ * A publisher thread copies the counters of the registered ports into a named file mapping at a
+ * fixed interval, one fixed-size record per port behind a versioned header. Every record is
+ * guarded by a sequence lock: the publisher makes the sequence odd, writes the record and makes
+ * it even again, and a reader copies the record and keeps the copy only if the sequence was even
+ * and unchanged around it. Monitors such as tools/serialstat map the page read-only and take
+ * consistent snapshots without any system call, lock or message into the serial process, whose
+ * I/O threads never touch the page at all.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef STATSSHM_H
+#define STATSSHM_H
+
+#include <windows.h>
+#include <stdint.h>
+#include "serialPort.h"
+
+/**
+ * @defgroup statsshm_functions Shared Memory Statistics
+ * @ingroup functions
+ * @brief Publishing port counters to other processes.
+ */
+
+#define STATS_SHM_MAGIC         0x54415453  /**< "STAT" */
+#define STATS_SHM_VERSION       1           /**< Layout version, raised whenever the header or record changes. */
+#define STATS_SHM_RECORD_SIZE   256         /**< Size of every record. */
+#define STATS_SHM_NAME_LEN      48          /**< Room for the port name, including the terminator. */
+#define STATS_SHM_DEFAULT_NAME  "Local\\serialStats"
+#define STATS_SHM_RETRIES       64          /**< Attempts of statsShmSnapshot before giving up on a busy record. */
+
+/**
+ * @struct stats_shm_header_t
+ * @brief Start of the shared page, followed by capacity records.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t magic;                 /**< STATS_SHM_MAGIC, written last when the page is created. */
+    uint32_t version;               /**< STATS_SHM_VERSION of the publisher. */
+    uint32_t headerSize;            /**< sizeof(stats_shm_header_t), where the records start. */
+    uint32_t recordSize;            /**< STATS_SHM_RECORD_SIZE. */
+    uint32_t capacity;              /**< Records in the page. */
+    volatile LONG count;            /**< Records in use. */
+    uint32_t processId;             /**< Publishing process. */
+    uint32_t intervalMs;            /**< Publishing interval. */
+    volatile LONG64 generation;     /**< Publishing passes so far. */
+    volatile LONG64 updatedTick;    /**< GetTickCount64 time of the last pass, shared by all processes. */
+    uint8_t reserved[16];           /**< Zero. */
+} stats_shm_header_t;
+
+/**
+ * @struct stats_shm_record_t
+ * @brief Counters of one port, see serial_port_t for their meaning.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    volatile LONG sequence;         /**< Odd while the publisher writes the record. */
+    uint32_t index;                 /**< Position of the record. */
+    char name[STATS_SHM_NAME_LEN];  /**< Port name, truncated. */
+    uint64_t baud;                  /**< Baud rate. */
+    uint64_t updatedTick;           /**< GetTickCount64 time of the copy. */
+    uint64_t lastRxTick;            /**< GetTickCount64 time of the last received data. */
+    uint64_t rxBytes;               /**< Bytes received. */
+    uint64_t txBytes;               /**< Bytes transmitted. */
+    uint64_t readErrors;            /**< Reads that failed. */
+    uint64_t writeErrors;           /**< Writes that failed. */
+    uint64_t lineErrors;            /**< Framing, parity and overrun errors. */
+    uint64_t txLatency[SERIAL_LATENCY_BUCKETS];  /**< Writes by time to completion, see serialLatencyBoundsUs. */
+    uint64_t txLatencyUs;           /**< Sum of the write completion times. */
+    uint8_t isOpen;                 /**< The port is open. */
+    uint8_t dataBits;               /**< Data bits per character. */
+    uint8_t parity;                 /**< Parity setting. */
+    uint8_t stopBits;               /**< Stop bits setting. */
+    uint8_t reserved[12];           /**< Zero, pads the record to STATS_SHM_RECORD_SIZE. */
+} stats_shm_record_t;
+
+/**
+ * @struct stats_shm_t
+ * @brief Publishing side of a statistics page.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    HANDLE mapping;                 /**< Named file mapping. */
+    stats_shm_header_t *header;     /**< Start of the mapping. */
+    stats_shm_record_t *records;    /**< Records after the header. */
+    serial_port_t **ports;          /**< Port of every record in use. */
+    uint32_t capacity;              /**< Entries in ports. */
+    uint32_t intervalMs;            /**< Publishing interval of the thread. */
+    HANDLE thread;                  /**< Publisher thread. */
+    volatile LONG running;          /**< Cleared by statsShmStop. */
+} stats_shm_t;
+
+/**
+ * @struct stats_shm_view_t
+ * @brief Reading side of a statistics page, in any process.
+ *
+ * @ingroup structs
+ */
+typedef struct {
+    HANDLE mapping;                         /**< Opened file mapping. */
+    const stats_shm_header_t *header;       /**< Start of the read-only view. */
+    const stats_shm_record_t *records;      /**< Records after the header. */
+} stats_shm_view_t;
+
+/**
+ * @brief Creates the named statistics page.
+ *
+ * @param[out] shm Pointer to the publisher.
+ * @param[in] name Name of the mapping, e.g. STATS_SHM_DEFAULT_NAME.
+ * @param[in] capacity Most ports that can be added.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_OPEN if a page of that name already exists,
+ *         otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup statsshm_functions
+ *
+ * ### Example
+ * Below is an example that publishes two ports every 250 ms; run `serialstat` next to it to watch them.
+ * @code
+ * serial_port_t gps, imu;
+ * stats_shm_t stats;
+ * int main(){
+ *  // open the ports
+ *  ...
+ *  if(statsShmOpen(&stats, STATS_SHM_DEFAULT_NAME, 64) != SERIAL_ERR_OK)
+ *      return -1;
+ *  statsShmAddPort(&stats, &gps);
+ *  statsShmAddPort(&stats, &imu);
+ *  statsShmStart(&stats, 250);
+ *  ...
+ *  statsShmStop(&stats);
+ *  statsShmClose(&stats);
+ *  return 0;
+ * }
+ * @endcode
+ *
+ *
+ */
+serial_port_err_t statsShmOpen(stats_shm_t *shm, const char *name, uint32_t capacity);
+
+/**
+ * @brief Closes the page; the publisher thread must be stopped.
+ *
+ * @ingroup statsshm_functions
+ */
+void statsShmClose(stats_shm_t *shm);
+
+/**
+ * @brief Gives a port the next record; may be called while the publisher runs.
+ *
+ * Ports are added from one thread at a time. Records are never reused, a closed port keeps its record with isOpen cleared.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN when the page is full.
+ *
+ * @ingroup statsshm_functions
+ */
+serial_port_err_t statsShmAddPort(stats_shm_t *shm, serial_port_t *port);
+
+/**
+ * @brief Copies the counters of every port into the page once.
+ *
+ * Called by the publisher thread; only one thread may publish at a time.
+ *
+ * @ingroup statsshm_functions
+ */
+void statsShmPublish(stats_shm_t *shm);
+
+/**
+ * @brief Starts a thread calling statsShmPublish every intervalMs.
+ *
+ * @return SERIAL_ERR_OK if successful, otherwise SERIAL_ERR_UNKNOWN.
+ *
+ * @ingroup statsshm_functions
+ */
+serial_port_err_t statsShmStart(stats_shm_t *shm, uint32_t intervalMs);
+
+/**
+ * @brief Stops and joins the publisher thread.
+ *
+ * @ingroup statsshm_functions
+ */
+void statsShmStop(stats_shm_t *shm);
+
+/**
+ * @brief Maps an existing statistics page read-only.
+ *
+ * @param[out] view Pointer to the view.
+ * @param[in] name Name the publisher used.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_OPEN if there is no such page, otherwise
+ *         SERIAL_ERR_UNKNOWN for a page of another layout version.
+ *
+ * @ingroup statsshm_functions
+ */
+serial_port_err_t statsShmAttach(stats_shm_view_t *view, const char *name);
+
+/**
+ * @brief Unmaps a view.
+ *
+ * @ingroup statsshm_functions
+ */
+void statsShmDetach(stats_shm_view_t *view);
+
+/**
+ * @brief Takes a consistent copy of one record.
+ *
+ * @param[in] view Attached view.
+ * @param[in] index Record, below header->count.
+ * @param[out] record Copy.
+ *
+ * @return TRUE if successful, FALSE if the record stayed busy for STATS_SHM_RETRIES attempts or does not exist.
+ *
+ * @ingroup statsshm_functions
+ */
+int statsShmSnapshot(const stats_shm_view_t *view, uint32_t index, stats_shm_record_t *record);
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "stm32Boot.h"
+
+
+#define CMD_GET                 0x00
+#define CMD_GET_ID              0x02
+#define CMD_READ_MEMORY         0x11
+#define CMD_GO                  0x21
+#define CMD_WRITE_MEMORY        0x31
+#define CMD_ERASE               0x43
+#define CMD_EXTENDED_ERASE      0x44
+#define SYNC_BYTE               0x7F
+
+/* a prepared Write Memory data phase: N-1, data padded to a word multiple, checksum */
+typedef struct {
+    uint32_t address;
+    uint32_t len;
+    uint8_t frame[1 + STM32_MAX_BLOCK + 1];
+    uint32_t frameLen;
+} stm32_block_t;
+
+
+static serial_port_err_t readExact(stm32_boot_t *boot, uint8_t *buf, uint32_t len, uint32_t timeoutMs)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+
+    while (len > 0)
+    {
+        uint64_t got;
+        serial_port_err_t err = serialPortReadSome(boot->port, buf, len, &got);
+        if (err != SERIAL_ERR_OK)
+            return err;
+
+        buf += got;
+        len -= (uint32_t)got;
+
+        if (len > 0 && got == 0 && GetTickCount64() >= deadline)
+            return SERIAL_ERR_READ_TIMEOUT;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+static serial_port_err_t waitAck(stm32_boot_t *boot, uint32_t timeoutMs)
+{
+    uint8_t reply;
+
+    serial_port_err_t err = readExact(boot, &reply, 1, timeoutMs);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    if (reply == STM32_ACK)
+        return SERIAL_ERR_OK;
+
+    return reply == STM32_NACK ? SERIAL_ERR_NACK : SERIAL_ERR_FRAME;
+}
+
+
+/* every command goes out together with its complement */
+static serial_port_err_t sendCommand(stm32_boot_t *boot, uint8_t command)
+{
+    uint8_t frame[2] = { command, (uint8_t)~command };
+
+    serial_port_err_t err = serialPortWrite(boot->port, frame, sizeof(frame));
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    return waitAck(boot, boot->ackTimeout);
+}
+
+
+static serial_port_err_t sendAddress(stm32_boot_t *boot, uint32_t address)
+{
+    uint8_t frame[5];
+
+    /* big endian address followed by the XOR of its bytes */
+    frame[0] = (uint8_t)(address >> 24);
+    frame[1] = (uint8_t)(address >> 16);
+    frame[2] = (uint8_t)(address >> 8);
+    frame[3] = (uint8_t)address;
+    frame[4] = frame[0] ^ frame[1] ^ frame[2] ^ frame[3];
+
+    serial_port_err_t err = serialPortWrite(boot->port, frame, sizeof(frame));
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    return waitAck(boot, boot->ackTimeout);
+}
+
+
+static int hasCommand(const stm32_boot_t *boot, uint8_t command)
+{
+    return memchr(boot->commands, command, boot->commandCount) != NULL;
+}
+
+
+serial_port_err_t stm32Connect(stm32_boot_t *boot, serial_port_t *port)
+{
+    uint8_t reply[32];
+    serial_port_err_t err = SERIAL_ERR_READ_TIMEOUT;
+
+    memset(boot, 0, sizeof(*boot));
+    boot->port = port;
+    boot->ackTimeout = 1000;
+    boot->eraseTimeout = 60000;
+
+    /* the bootloader only speaks 8 data bits with even parity */
+    if (setFrameFormat(port, 8, EVENPARITY, ONESTOPBIT) != SERIAL_ERR_OK)
+        return SERIAL_ERR_UNKNOWN;
+
+    PurgeComm(port->handle, PURGE_RXCLEAR | PURGE_TXCLEAR);
+    port->rxPendingLen = 0;
+
+    /* 0x7F lets the bootloader measure the baud rate; a NACK means it is already synchronised */
+    for (int attempt = 0; attempt < 5 && err != SERIAL_ERR_OK; attempt++)
+    {
+        uint8_t sync = SYNC_BYTE;
+
+        if (serialPortWrite(port, &sync, 1) != SERIAL_ERR_OK)
+            return SERIAL_ERR_WRITE_UNKNOWN;
+
+        err = waitAck(boot, 200);
+        if (err == SERIAL_ERR_NACK)
+            err = SERIAL_ERR_OK;
+    }
+
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    /* Get: N, version, N command codes, ACK */
+    if ((err = sendCommand(boot, CMD_GET)) != SERIAL_ERR_OK ||
+        (err = readExact(boot, reply, 1, boot->ackTimeout)) != SERIAL_ERR_OK)
+        return err;
+
+    uint8_t count = reply[0];
+    if (count + 1u > sizeof(reply) - 1 ||
+        (err = readExact(boot, reply + 1, count + 1u, boot->ackTimeout)) != SERIAL_ERR_OK ||
+        (err = waitAck(boot, boot->ackTimeout)) != SERIAL_ERR_OK)
+        return err == SERIAL_ERR_OK ? SERIAL_ERR_FRAME : err;
+
+    boot->version = reply[1];
+    boot->commandCount = count < sizeof(boot->commands) ? count : sizeof(boot->commands);
+    memcpy(boot->commands, reply + 2, boot->commandCount);
+
+    /* Get ID: N, N + 1 bytes of product id, ACK */
+    if ((err = sendCommand(boot, CMD_GET_ID)) != SERIAL_ERR_OK ||
+        (err = readExact(boot, reply, 1, boot->ackTimeout)) != SERIAL_ERR_OK)
+        return err;
+
+    count = reply[0];
+    if (count + 1u > sizeof(reply) - 1 ||
+        (err = readExact(boot, reply + 1, count + 1u, boot->ackTimeout)) != SERIAL_ERR_OK ||
+        (err = waitAck(boot, boot->ackTimeout)) != SERIAL_ERR_OK)
+        return err == SERIAL_ERR_OK ? SERIAL_ERR_FRAME : err;
+
+    boot->productId = (uint16_t)((reply[1] << 8) | reply[2]);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t stm32MassErase(stm32_boot_t *boot)
+{
+    serial_port_err_t err;
+
+    if (hasCommand(boot, CMD_EXTENDED_ERASE))
+    {
+        uint8_t frame[3] = { 0xFF, 0xFF, 0x00 };
+
+        if ((err = sendCommand(boot, CMD_EXTENDED_ERASE)) != SERIAL_ERR_OK ||
+            (err = serialPortWrite(boot->port, frame, sizeof(frame))) != SERIAL_ERR_OK)
+            return err;
+    }
+    else
+    {
+        uint8_t frame[2] = { 0xFF, 0x00 };
+
+        if ((err = sendCommand(boot, CMD_ERASE)) != SERIAL_ERR_OK ||
+            (err = serialPortWrite(boot->port, frame, sizeof(frame))) != SERIAL_ERR_OK)
+            return err;
+    }
+
+    return waitAck(boot, boot->eraseTimeout);
+}
+
+
+serial_port_err_t stm32ErasePages(stm32_boot_t *boot, const uint16_t *pages, uint16_t count)
+{
+    uint8_t frame[2 + 2 * 256 + 1];
+    uint32_t len = 0;
+    uint8_t checksum = 0;
+    serial_port_err_t err;
+
+    if (count == 0)
+        return SERIAL_ERR_OK;
+
+    if (hasCommand(boot, CMD_EXTENDED_ERASE))
+    {
+        /* 16 bit N - 1 and page numbers, big endian */
+        if (count > 256)
+            return SERIAL_ERR_BUFFER_OVERFLOW;
+
+        frame[len++] = (uint8_t)((count - 1) >> 8);
+        frame[len++] = (uint8_t)(count - 1);
+        for (uint16_t i = 0; i < count; i++)
+        {
+            frame[len++] = (uint8_t)(pages[i] >> 8);
+            frame[len++] = (uint8_t)pages[i];
+        }
+
+        err = sendCommand(boot, CMD_EXTENDED_ERASE);
+    }
+    else
+    {
+        /* the legacy command takes 8 bit page numbers */
+        if (count > 255)
+            return SERIAL_ERR_BUFFER_OVERFLOW;
+
+        frame[len++] = (uint8_t)(count - 1);
+        for (uint16_t i = 0; i < count; i++)
+            frame[len++] = (uint8_t)pages[i];
+
+        err = sendCommand(boot, CMD_ERASE);
+    }
+
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    for (uint32_t i = 0; i < len; i++)
+        checksum ^= frame[i];
+    frame[len++] = checksum;
+
+    if ((err = serialPortWrite(boot->port, frame, len)) != SERIAL_ERR_OK)
+        return err;
+
+    return waitAck(boot, boot->eraseTimeout);
+}
+
+
+static void prepareBlock(stm32_block_t *block, const uint8_t *data, uint32_t len)
+{
+    /* flash is programmed in words, pad with the erased value */
+    uint32_t padded = (len + 3) & ~3u;
+    uint8_t checksum;
+
+    block->len = len;
+    block->frame[0] = (uint8_t)(padded - 1);
+    if (data != block->frame + 1)
+        memcpy(block->frame + 1, data, len);
+    memset(block->frame + 1 + len, 0xFF, padded - len);
+
+    checksum = block->frame[0];
+    for (uint32_t i = 0; i < padded; i++)
+        checksum ^= block->frame[1 + i];
+
+    block->frame[1 + padded] = checksum;
+    block->frameLen = padded + 2;
+}
+
+
+/* sends the command, address and data of a block but leaves its final ACK unread */
+static serial_port_err_t startBlock(stm32_boot_t *boot, const stm32_block_t *block)
+{
+    serial_port_err_t err;
+
+    if ((err = sendCommand(boot, CMD_WRITE_MEMORY)) != SERIAL_ERR_OK ||
+        (err = sendAddress(boot, block->address)) != SERIAL_ERR_OK)
+        return err;
+
+    return serialPortWrite(boot->port, (uint8_t*)block->frame, block->frameLen);
+}
+
+
+serial_port_err_t stm32WriteMemory(stm32_boot_t *boot, uint32_t address, const uint8_t *data, uint32_t len)
+{
+    stm32_block_t block;
+
+    if (len == 0 || len > STM32_MAX_BLOCK)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    block.address = address;
+    prepareBlock(&block, data, len);
+
+    serial_port_err_t err = startBlock(boot, &block);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    return waitAck(boot, boot->ackTimeout);
+}
+
+
+serial_port_err_t stm32ReadMemory(stm32_boot_t *boot, uint32_t address, uint8_t *data, uint32_t len)
+{
+    uint8_t count[2];
+    serial_port_err_t err;
+
+    if (len == 0 || len > STM32_MAX_BLOCK)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    count[0] = (uint8_t)(len - 1);
+    count[1] = (uint8_t)~count[0];
+
+    if ((err = sendCommand(boot, CMD_READ_MEMORY)) != SERIAL_ERR_OK ||
+        (err = sendAddress(boot, address)) != SERIAL_ERR_OK ||
+        (err = serialPortWrite(boot->port, count, sizeof(count))) != SERIAL_ERR_OK ||
+        (err = waitAck(boot, boot->ackTimeout)) != SERIAL_ERR_OK)
+        return err;
+
+    return readExact(boot, data, len, boot->ackTimeout);
+}
+
+
+serial_port_err_t stm32Go(stm32_boot_t *boot, uint32_t address)
+{
+    serial_port_err_t err = sendCommand(boot, CMD_GO);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    return sendAddress(boot, address);
+}
+
+
+/* pulls and prepares the next block, len 0 marks the end of the image */
+static serial_port_err_t fetchBlock(const stm32_source_t *source, stm32_block_t *block)
+{
+    int len = source->next(source->context, &block->address, block->frame + 1, STM32_MAX_BLOCK);
+
+    if (len < 0)
+        return SERIAL_ERR_FRAME;
+
+    block->len = 0;
+    if (len > 0)
+        prepareBlock(block, block->frame + 1, (uint32_t)len);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t stm32Flash(stm32_boot_t *boot, const stm32_source_t *source, stm32_progress_t progress, void *context)
+{
+    stm32_block_t blocks[2];
+    int current = 0;
+    ULONGLONG start = GetTickCount64();
+    serial_port_err_t err;
+
+    boot->bytesWritten = 0;
+    boot->elapsedMs = 0;
+    boot->bytesPerSecond = 0;
+
+    if ((err = fetchBlock(source, &blocks[current])) != SERIAL_ERR_OK)
+        return err;
+
+    while (blocks[current].len > 0)
+    {
+        stm32_block_t *block = &blocks[current];
+        stm32_block_t *next = &blocks[current ^ 1];
+
+        if ((err = startBlock(boot, block)) != SERIAL_ERR_OK)
+            return err;
+
+        /* the device is busy programming; read and checksum the next block meanwhile */
+        serial_port_err_t fetchErr = fetchBlock(source, next);
+
+        if ((err = waitAck(boot, boot->ackTimeout)) != SERIAL_ERR_OK)
+            return err;
+        if (fetchErr != SERIAL_ERR_OK)
+            return fetchErr;
+
+        boot->bytesWritten += block->len;
+        if (progress != NULL)
+            progress(block->address, boot->bytesWritten, context);
+
+        current ^= 1;
+    }
+
+    boot->elapsedMs = GetTickCount64() - start;
+    if (boot->elapsedMs > 0)
+        boot->bytesPerSecond = boot->bytesWritten * 1000 / boot->elapsedMs;
+
+    return SERIAL_ERR_OK;
+}
+
+
+static int nextBinary(void *context, uint32_t *address, uint8_t *data, uint32_t maxLen)
+{
+    stm32_file_source_t *state = (stm32_file_source_t*)context;
+    size_t got = fread(data, 1, maxLen, state->file);
+
+    if (got == 0)
+        return ferror(state->file) ? -1 : 0;
+
+    *address = state->address;
+    state->address += (uint32_t)got;
+
+    return (int)got;
+}
+
+
+void stm32SourceBinary(stm32_source_t *source, stm32_file_source_t *state, FILE *file, uint32_t baseAddress)
+{
+    memset(state, 0, sizeof(*state));
+    state->file = file;
+    state->address = baseAddress;
+    source->next = nextBinary;
+    source->context = state;
+}
+
+
+/* the reader already coalesces records into contiguous runs */
+static int nextHex(void *context, uint32_t *address, uint8_t *data, uint32_t maxLen)
+{
+    return hexReaderRead((hex_reader_t*)context, address, data, maxLen);
+}
+
+
+void stm32SourceHex(stm32_source_t *source, hex_reader_t *reader)
+{
+    source->next = nextHex;
+    source->context = reader;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file stm32Boot.h
+ * @brief STM32 system memory bootloader (AN3155 USART protocol) flasher.
+ * 
+ * Implements auto-baud synchronisation, Get / Get ID, mass and sector erase, memory read, go and
+ * a pipelined memory write: while the device programs the current block and before its ACK is
+ * read, the next block is pulled from the image source and its checksum computed. Images are
+ * streamed block by block from a source callback, so neither binary nor HEX / S-record files are
+ * ever loaded as a whole.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef STM32BOOT_H
+#define STM32BOOT_H
+
+#include <stdio.h>
+#include "serialPort.h"
+#include "hexRecord.h"
+
+/**
+ * @defgroup stm32_functions STM32 Bootloader
+ * @ingroup functions
+ * @brief Flashing STM32 devices through the USART bootloader.
+ */
+
+#define STM32_ACK               0x79
+#define STM32_NACK              0x1F
+#define STM32_MAX_BLOCK         256     /**< Largest Write Memory / Read Memory transfer. */
+#define STM32_FLASH_BASE        0x08000000
+
+/**
+ * @brief Pulls the next contiguous block of the image.
+ * 
+ * @param[in] context Source state.
+ * @param[out] address Target address of the block.
+ * @param[out] data Buffer for the block.
+ * @param[in] maxLen Capacity of data.
+ * 
+ * @return Number of bytes stored, 0 at the end of the image, or -1 on a malformed image.
+ */
+typedef int (*stm32_source_next_t)(void *context, uint32_t *address, uint8_t *data, uint32_t maxLen);
+
+/**
+ * @struct stm32_source_t
+ * @brief A streaming image source.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    stm32_source_next_t next;   /**< Block producer. */
+    void *context;              /**< State passed to next. */
+} stm32_source_t;
+
+/**
+ * @struct stm32_file_source_t
+ * @brief State of the binary file source.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    FILE *file;                 /**< Open image file. */
+    uint32_t address;           /**< Next address. */
+} stm32_file_source_t;
+
+/** @brief Progress callback, called after each written block. */
+typedef void (*stm32_progress_t)(uint32_t address, uint64_t bytesDone, void *context);
+
+/**
+ * @struct stm32_boot_t
+ * @brief Connection to an STM32 bootloader.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;        /**< Port connected to the device's bootloader USART. */
+    uint8_t version;            /**< Bootloader protocol version. */
+    uint8_t commands[16];       /**< Supported command codes reported by Get. */
+    uint8_t commandCount;       /**< Number of entries in commands. */
+    uint16_t productId;         /**< Product id reported by Get ID. */
+    uint32_t ackTimeout;        /**< Timeout for ordinary ACKs in milliseconds. */
+    uint32_t eraseTimeout;      /**< Timeout for erase ACKs in milliseconds. */
+    uint64_t bytesWritten;      /**< Bytes programmed by the last stm32Flash. */
+    uint64_t elapsedMs;         /**< Duration of the last stm32Flash. */
+    uint64_t bytesPerSecond;    /**< Effective flashing throughput of the last stm32Flash. */
+} stm32_boot_t;
+
+/**
+ * @brief Switches the port to 8E1, synchronises with the bootloader and reads its capabilities.
+ * 
+ * @param[out] boot Pointer to the bootloader connection.
+ * @param[in] port Opened serial port; the device must already be in system memory boot mode.
+ * 
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_READ_TIMEOUT if the device does not answer,
+ *         otherwise an appropriate error code.
+ *
+ * @ingroup stm32_functions
+ * 
+ * ### Example
+ * Below is an example that mass erases a device and flashes an Intel HEX image.
+ * @code
+ * serial_port_t myPort;
+ * stm32_boot_t boot;
+ * hex_reader_t image;
+ * stm32_source_t source;
+ * int main(){
+ *  if(hexReaderOpen(&image, "firmware.hex", HEX_FORMAT_AUTO) != SERIAL_ERR_OK ||
+ *     serialPortOpen(&myPort, "COM3", 115200, 50, 1000) != SERIAL_ERR_OK)
+ *      return -1;
+ *  if(stm32Connect(&boot, &myPort) != SERIAL_ERR_OK || stm32MassErase(&boot) != SERIAL_ERR_OK)
+ *      return -1;
+ *  stm32SourceHex(&source, &image);
+ *  if(stm32Flash(&boot, &source, NULL, NULL) != SERIAL_ERR_OK)
+ *      return -1;
+ *  printf("%llu bytes at %llu B/s\n", boot.bytesWritten, boot.bytesPerSecond);
+ *  return stm32Go(&boot, STM32_FLASH_BASE);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t stm32Connect(stm32_boot_t *boot, serial_port_t *port);
+
+/**
+ * @brief Erases the whole flash, using Extended Erase when the bootloader supports it.
+ * 
+ * @ingroup stm32_functions
+ */
+serial_port_err_t stm32MassErase(stm32_boot_t *boot);
+
+/**
+ * @brief Erases a list of flash pages / sectors.
+ * 
+ * @ingroup stm32_functions
+ */
+serial_port_err_t stm32ErasePages(stm32_boot_t *boot, const uint16_t *pages, uint16_t count);
+
+/**
+ * @brief Writes one block of at most STM32_MAX_BLOCK bytes.
+ * 
+ * @ingroup stm32_functions
+ */
+serial_port_err_t stm32WriteMemory(stm32_boot_t *boot, uint32_t address, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Reads one block of at most STM32_MAX_BLOCK bytes.
+ * 
+ * @ingroup stm32_functions
+ */
+serial_port_err_t stm32ReadMemory(stm32_boot_t *boot, uint32_t address, uint8_t *data, uint32_t len);
+
+/**
+ * @brief Starts the user application at an address.
+ * 
+ * @ingroup stm32_functions
+ */
+serial_port_err_t stm32Go(stm32_boot_t *boot, uint32_t address);
+
+/**
+ * @brief Streams an image from a source into flash with pipelined block writes.
+ * 
+ * On return bytesWritten, elapsedMs and bytesPerSecond hold the effective throughput.
+ * 
+ * @param[in] boot Pointer to the bootloader connection.
+ * @param[in] source Image source.
+ * @param[in] progress Optional progress callback, may be NULL.
+ * @param[in] context User pointer passed to progress.
+ * 
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_FRAME for a malformed image, otherwise the
+ *         protocol error of the failing block.
+ *
+ * @ingroup stm32_functions
+ */
+serial_port_err_t stm32Flash(stm32_boot_t *boot, const stm32_source_t *source, stm32_progress_t progress, void *context);
+
+/**
+ * @brief Creates a source streaming a raw binary file to consecutive addresses.
+ * 
+ * @ingroup stm32_functions
+ */
+void stm32SourceBinary(stm32_source_t *source, stm32_file_source_t *state, FILE *file, uint32_t baseAddress);
+
+/**
+ * @brief Creates a source streaming an Intel HEX or S-record image from a hex record reader.
+ * 
+ * @ingroup stm32_functions
+ */
+void stm32SourceHex(stm32_source_t *source, hex_reader_t *reader);
+
+#endif
@@ -0,0 +1,242 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * aggregate: statistics of known sample windows in every sample type, windows split across
+ * records, header and partial frame handling, percentile estimates, and histogram clamping of
+ * out of range, infinite and NaN samples
+ *
+ * build: cl /I.. testAggregate.c ..\aggregate.c ..\pipeline.c ..\spscQueue.c ..\serialPort.c ..\serialAlloc.c ws2_32.lib
+ */
+
+#include <math.h>
+#include <string.h>
+#include "testCheck.h"
+#include "aggregate.h"
+
+
+#define MAX_RECORDS     16
+
+typedef struct {
+    agg_record_t records[MAX_RECORDS];
+    uint32_t count;
+} collector_t;
+
+
+static void collect(const agg_record_t *record, uint32_t size, void *context)
+{
+    collector_t *c = (collector_t*)context;
+
+    CHECK(size == aggregateRecordSize(record->channelCount));
+    if (c->count < MAX_RECORDS)
+        c->records[c->count++] = *record;
+}
+
+
+static int closeTo(float value, float expect, float tolerance)
+{
+    return fabsf(value - expect) <= tolerance;
+}
+
+
+static void config(void)
+{
+    aggregate_t agg;
+    agg_config_t cfg = { AGG_SAMPLE_INT16, 1, 0, 1.0f, 0.0f, 10, 0.0f, 1.0f, { 50 }, 1 };
+
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_OK);
+    aggregateFree(&agg);
+
+    cfg.channels = 0;
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_UNKNOWN);
+    cfg.channels = AGG_MAX_CHANNELS + 1;
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_UNKNOWN);
+    cfg.channels = 1;
+    cfg.window = 0;
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_UNKNOWN);
+    cfg.window = 10;
+    cfg.histogramMax = cfg.histogramMin;
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_UNKNOWN);
+    cfg.histogramMax = 1.0f;
+    cfg.percentileCount = AGG_MAX_PERCENTILES + 1;
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_UNKNOWN);
+}
+
+
+/* two int16 channels behind a 4 byte header: a ramp 0 - 999 and its negation, scaled by 0.5 */
+static void int16Windows(void)
+{
+    aggregate_t agg;
+    collector_t c;
+    agg_config_t cfg = { AGG_SAMPLE_INT16, 2, 4, 0.5f, 10.0f, 1000, -600.0f, 600.0f, { 0, 50, 100 }, 3 };
+    static uint8_t record[4 + 4 * 1000];
+
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_OK);
+    memset(&c, 0, sizeof(c));
+
+    for (int i = 0; i < 1000; i++)
+    {
+        int16_t up = (int16_t)i, down = (int16_t)-i;
+        memcpy(record + 4 + 4 * i, &up, 2);
+        memcpy(record + 6 + 4 * i, &down, 2);
+    }
+
+    /* the window is split over three records of uneven size */
+    size_t cut1 = 4 + 4 * 1, cut2 = 4 + 4 * 700;
+    static uint8_t part[4 + 4 * 1000];
+    memcpy(part + 4, record + 4, cut1 - 4);
+    CHECK(aggregateFeed(&agg, part, cut1, collect, &c) == 0);
+    memcpy(part + 4, record + cut1, cut2 - cut1);
+    CHECK(aggregateFeed(&agg, part, 4 + (cut2 - cut1), collect, &c) == 0);
+    memcpy(part + 4, record + cut2, sizeof(record) - cut2);
+    CHECK(aggregateFeed(&agg, part, 4 + (sizeof(record) - cut2), collect, &c) == 1);
+
+    CHECK(c.count == 1);
+    const agg_record_t *r = &c.records[0];
+    CHECK(r->window == 0 && r->frames == 1000 && r->channelCount == 2);
+
+    /* values 10 .. 509.5 and 10 .. -489.5 */
+    CHECK(closeTo(r->channels[0].mean, 259.75f, 0.01f));
+    CHECK(r->channels[0].min == 10.0f && r->channels[0].max == 509.5f);
+    CHECK(closeTo(r->channels[1].mean, -239.75f, 0.01f));
+    CHECK(r->channels[1].min == -489.5f && r->channels[1].max == 10.0f);
+
+    double squares = 0;
+    for (int i = 0; i < 1000; i++)
+        squares += (0.5 * i + 10) * (0.5 * i + 10);
+    CHECK(closeTo(r->channels[0].rms, (float)sqrt(squares / 1000), 0.01f));
+
+    /* percentiles are exact at the ends and within a bin in between */
+    float bin = (cfg.histogramMax - cfg.histogramMin) / AGG_HISTOGRAM_BINS;
+    CHECK(closeTo(r->channels[0].percentiles[0], 10.0f, bin));
+    CHECK(closeTo(r->channels[0].percentiles[1], 259.75f, bin));
+    CHECK(r->channels[0].percentiles[2] == 509.5f);
+    CHECK(r->channels[0].percentiles[3] == 0);
+    CHECK(closeTo(r->channels[1].percentiles[1], -239.75f, bin));
+
+    /* a partial frame is ignored and counted, and so is a record shorter than its header */
+    CHECK(aggregateFeed(&agg, record, 4 + 4 * 3 + 2, collect, &c) == 0);
+    CHECK(agg.frames == 3 && agg.partialFrames == 1);
+    CHECK(aggregateFeed(&agg, record, 3, collect, &c) == 0);
+    CHECK(agg.frames == 3 && agg.partialFrames == 2);
+    CHECK(agg.framesIn == 1003 && agg.recordsOut == 1);
+
+    aggregateFree(&agg);
+}
+
+
+/* single channel int32 and float32 streams, long enough for the SIMD paths and their tails */
+static void singleChannel(agg_sample_t type)
+{
+    aggregate_t agg;
+    collector_t c;
+    agg_config_t cfg = { type, 1, 0, 0.0f, 0.0f, 101, 0.0f, 101.0f, { 50 }, 1 };
+    static uint8_t data[4 * 303];
+
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_OK);
+    CHECK(agg.config.scale == 1.0f);
+    memset(&c, 0, sizeof(c));
+
+    for (int i = 0; i < 303; i++)
+    {
+        int32_t v = i % 101;
+        float f = (float)v;
+        memcpy(data + 4 * i, type == AGG_SAMPLE_INT32 ? (const void*)&v : (const void*)&f, 4);
+    }
+
+    CHECK(aggregateFeed(&agg, data, sizeof(data), collect, &c) == 3);
+    CHECK(c.count == 3);
+    for (uint32_t w = 0; w < c.count; w++)
+    {
+        const agg_channel_t *ch = &c.records[w].channels[0];
+
+        CHECK(c.records[w].window == w && c.records[w].frames == 101);
+        CHECK(closeTo(ch->mean, 50.0f, 0.001f));
+        CHECK(ch->min == 0.0f && ch->max == 100.0f);
+        CHECK(closeTo(ch->percentiles[0], 50.0f, 101.0f / AGG_HISTOGRAM_BINS));
+    }
+
+    aggregateFree(&agg);
+}
+
+
+/* samples outside the sketch range land in the end bins, NaN in the first */
+static void clamping(void)
+{
+    aggregate_t agg;
+    collector_t c;
+    agg_config_t cfg = { AGG_SAMPLE_FLOAT32, 1, 0, 1.0f, 0.0f, 1000, -1.0f, 1.0f, { 50 }, 1 };
+    float samples[11];
+    uint32_t nan = 0x7FC00000;
+
+    samples[0] = -5.0f;
+    samples[1] = 5.0f;
+    samples[2] = -INFINITY;
+    samples[3] = INFINITY;
+    samples[4] = 1e30f;
+    samples[5] = -1e30f;
+    memcpy(&samples[6], &nan, 4);
+    samples[7] = 1.0f;
+    samples[8] = -1.0f;
+    samples[9] = 0.0f;
+    samples[10] = 2e9f;
+
+    CHECK(aggregateInit(&agg, &cfg) == SERIAL_ERR_OK);
+    memset(&c, 0, sizeof(c));
+
+    /* 11 samples cover both the four wide SIMD loop and the scalar tail */
+    CHECK(aggregateFeed(&agg, (const uint8_t*)samples, sizeof(samples), collect, &c) == 0);
+    CHECK(aggregateFeed(&agg, (const uint8_t*)samples, 3 * 4, collect, &c) == 0);
+
+    uint64_t total = 0;
+    for (uint32_t b = 0; b < AGG_HISTOGRAM_BINS; b++)
+        total += agg.histogram[b];
+    CHECK(total == 14);
+
+    /* -5, -inf, -1e30, NaN, -1 and again -5, -inf in the first bin; 5, inf, 1e30, 1, 2e9 and 5 in the last */
+    CHECK(agg.histogram[0] == 7);
+    CHECK(agg.histogram[AGG_HISTOGRAM_BINS - 1] == 6);
+    CHECK(agg.histogram[AGG_HISTOGRAM_BINS / 2] == 1);
+
+    aggregateFree(&agg);
+
+    /* everything above the range: the estimate is clamped to the true extremes */
+    agg_config_t high = { AGG_SAMPLE_FLOAT32, 1, 0, 1.0f, 0.0f, 4, -1.0f, 1.0f, { 10, 90 }, 2 };
+    float above[4] = { 100.0f, 200.0f, 300.0f, 400.0f };
+
+    CHECK(aggregateInit(&agg, &high) == SERIAL_ERR_OK);
+    memset(&c, 0, sizeof(c));
+    CHECK(aggregateFeed(&agg, (const uint8_t*)above, sizeof(above), collect, &c) == 1);
+    CHECK(c.count == 1 && c.records[0].channels[0].percentiles[0] == 100.0f);
+    CHECK(c.count == 1 && c.records[0].channels[0].percentiles[1] == 100.0f);
+    aggregateFree(&agg);
+}
+
+
+int main(void)
+{
+    config();
+    int16Windows();
+    singleChannel(AGG_SAMPLE_INT32);
+    singleChannel(AGG_SAMPLE_FLOAT32);
+    clamping();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,40 @@
+/**
+ * @file testCheck.h
+ * @brief Minimal check macro shared by the hardware-free tests.
+ *
+ * A failed check prints its location and expression and is counted; a test program returns
+ * TEST_RESULT() from main, which is non-zero when any check failed.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef TESTCHECK_H
+#define TESTCHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+static int testFailures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            testFailures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT()   (printf("%s\n", testFailures == 0 ? "ok" : "FAILED"), testFailures != 0)
+
+/* small deterministic generator so failures reproduce */
+static uint32_t testSeed = 0x12345678;
+
+static __inline uint32_t testRandom(void)
+{
+    testSeed = testSeed * 1103515245u + 12345u;
+    return testSeed >> 8;
+}
+
+#endif
@@ -0,0 +1,257 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * SLIP and HDLC framing: encoders against a byte at a time reference, the FCS-16 check value,
+ * streams of packets full of special bytes decoded in random sized chunks, and dropped frames
+ *
+ * build: cl /I.. testFraming.c ..\slip.c ..\hdlc.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "testCheck.h"
+#include "slip.h"
+#include "hdlc.h"
+
+
+#define PACKETS     300
+#define PACKET_MAX  1500
+
+
+static uint8_t packets[PACKETS][PACKET_MAX];
+static size_t packetLen[PACKETS];
+static uint8_t stream[PACKETS * HDLC_ENCODED_MAX(PACKET_MAX) + PACKETS];
+
+
+/* random packets where about one byte in ten is a SLIP or HDLC special byte */
+static void makePackets(void)
+{
+    static const uint8_t special[] = { SLIP_END, SLIP_ESC, HDLC_FLAG, HDLC_ESC, SLIP_ESC_END, SLIP_ESC_ESC };
+
+    for (int p = 0; p < PACKETS; p++)
+    {
+        packetLen[p] = 1 + testRandom() % PACKET_MAX;
+        for (size_t i = 0; i < packetLen[p]; i++)
+            packets[p][i] = testRandom() % 10 == 0 ? special[testRandom() % sizeof(special)] : (uint8_t)testRandom();
+    }
+}
+
+
+static size_t referenceSlip(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t n = 0;
+
+    dst[n++] = SLIP_END;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (src[i] == SLIP_END || src[i] == SLIP_ESC)
+        {
+            dst[n++] = SLIP_ESC;
+            dst[n++] = src[i] == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC;
+        }
+        else
+            dst[n++] = src[i];
+    }
+    dst[n++] = SLIP_END;
+
+    return n;
+}
+
+
+static size_t hdlcPut(uint8_t *dst, uint8_t c)
+{
+    if (c == HDLC_FLAG || c == HDLC_ESC)
+    {
+        dst[0] = HDLC_ESC;
+        dst[1] = (uint8_t)(c ^ HDLC_ESC_XOR);
+        return 2;
+    }
+
+    dst[0] = c;
+    return 1;
+}
+
+
+static size_t referenceHdlc(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    uint16_t fcs = (uint16_t)~hdlcFcs(HDLC_FCS_INIT, src, len);
+    size_t n = 0;
+
+    dst[n++] = HDLC_FLAG;
+    for (size_t i = 0; i < len; i++)
+        n += hdlcPut(dst + n, src[i]);
+    n += hdlcPut(dst + n, (uint8_t)fcs);
+    n += hdlcPut(dst + n, (uint8_t)(fcs >> 8));
+    dst[n++] = HDLC_FLAG;
+
+    return n;
+}
+
+
+static void slip(void)
+{
+    static uint8_t encoded[SLIP_ENCODED_MAX(PACKET_MAX)], expect[SLIP_ENCODED_MAX(PACKET_MAX)];
+    uint8_t buf[PACKET_MAX];
+    slip_decoder_t decoder;
+    size_t len = 0;
+
+    static const uint8_t known[] = { 0x01, 0xC0, 0xDB, 0x02 };
+    static const uint8_t knownEncoded[] = { 0xC0, 0x01, 0xDB, 0xDC, 0xDB, 0xDD, 0x02, 0xC0 };
+    CHECK(slipEncode(known, sizeof(known), encoded) == sizeof(knownEncoded));
+    CHECK(memcmp(encoded, knownEncoded, sizeof(knownEncoded)) == 0);
+
+    for (int p = 0; p < PACKETS; p++)
+    {
+        size_t n = slipEncode(packets[p], packetLen[p], encoded);
+        CHECK(n <= SLIP_ENCODED_MAX(packetLen[p]));
+        CHECK(n == referenceSlip(packets[p], packetLen[p], expect) && memcmp(encoded, expect, n) == 0);
+
+        memcpy(stream + len, encoded, n);
+        len += n;
+
+        /* empty packets between the real ones are skipped */
+        if (p % 5 == 0)
+            stream[len++] = SLIP_END;
+    }
+
+    /* random chunks, then one byte at a time so chunks also end inside escapes */
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int got = 0, bad = 0;
+
+        slipDecoderInit(&decoder, buf, sizeof(buf));
+        for (size_t pos = 0; pos < len;)
+        {
+            size_t chunk = pass == 0 ? 1 + testRandom() % 700 : 1;
+            if (chunk > len - pos)
+                chunk = len - pos;
+
+            for (size_t used = 0; used < chunk;)
+            {
+                used += slipDecode(&decoder, stream + pos + used, chunk - used);
+                if (decoder.complete)
+                {
+                    if (got >= PACKETS || decoder.len != packetLen[got] || memcmp(buf, packets[got], decoder.len) != 0)
+                        bad++;
+                    got++;
+                }
+            }
+            pos += chunk;
+        }
+
+        CHECK(got == PACKETS && bad == 0);
+    }
+
+    /* a packet too large for the buffer is dropped, the next one still arrives */
+    len = slipEncode(packets[0], 200, stream);
+    len += slipEncode((const uint8_t*)"next", 4, stream + len);
+    slipDecoderInit(&decoder, buf, 100);
+    size_t used = slipDecode(&decoder, stream, len);
+    CHECK(decoder.complete && decoder.len == 4 && memcmp(buf, "next", 4) == 0);
+    CHECK(used == len);
+}
+
+
+static void hdlc(void)
+{
+    static uint8_t encoded[HDLC_ENCODED_MAX(PACKET_MAX)], expect[HDLC_ENCODED_MAX(PACKET_MAX)];
+    uint8_t buf[PACKET_MAX + 2];
+    hdlc_decoder_t decoder;
+    size_t len = 0;
+
+    /* FCS-16 check value of RFC 1662, and the constant left over a frame with its own FCS */
+    uint16_t check = (uint16_t)~hdlcFcs(HDLC_FCS_INIT, (const uint8_t*)"123456789", 9);
+    CHECK(check == 0x906E);
+    CHECK(hdlcFcs(hdlcFcs(HDLC_FCS_INIT, (const uint8_t*)"1234", 4), (const uint8_t*)"56789", 5) ==
+          hdlcFcs(HDLC_FCS_INIT, (const uint8_t*)"123456789", 9));
+    uint8_t withFcs[11];
+    memcpy(withFcs, "123456789", 9);
+    withFcs[9] = 0x6E;
+    withFcs[10] = 0x90;
+    CHECK(hdlcFcs(HDLC_FCS_INIT, withFcs, 11) == HDLC_FCS_GOOD);
+
+    for (int p = 0; p < PACKETS; p++)
+    {
+        size_t n = hdlcEncode(packets[p], packetLen[p], encoded);
+        CHECK(n <= HDLC_ENCODED_MAX(packetLen[p]));
+        CHECK(n == referenceHdlc(packets[p], packetLen[p], expect) && memcmp(encoded, expect, n) == 0);
+
+        memcpy(stream + len, encoded, n);
+        len += n;
+        if (p % 7 == 0)
+            stream[len++] = HDLC_FLAG;
+    }
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int got = 0, bad = 0;
+
+        hdlcDecoderInit(&decoder, buf, sizeof(buf));
+        for (size_t pos = 0; pos < len;)
+        {
+            size_t chunk = pass == 0 ? 1 + testRandom() % 700 : 1;
+            if (chunk > len - pos)
+                chunk = len - pos;
+
+            for (size_t used = 0; used < chunk;)
+            {
+                used += hdlcDecode(&decoder, stream + pos + used, chunk - used);
+                if (decoder.complete)
+                {
+                    if (got >= PACKETS || decoder.len != packetLen[got] || memcmp(buf, packets[got], decoder.len) != 0)
+                        bad++;
+                    got++;
+                }
+            }
+            pos += chunk;
+        }
+
+        CHECK(got == PACKETS && bad == 0);
+        CHECK(decoder.errors == 0);
+    }
+
+    /* a flipped bit fails the FCS: the frame is dropped and counted, the next one arrives */
+    len = hdlcEncode((const uint8_t*)"first frame", 11, stream);
+    stream[5] ^= 0x01;
+    len += hdlcEncode((const uint8_t*)"second", 6, stream + len);
+    hdlcDecoderInit(&decoder, buf, sizeof(buf));
+    hdlcDecode(&decoder, stream, len);
+    CHECK(decoder.complete && decoder.len == 6 && memcmp(buf, "second", 6) == 0);
+    CHECK(decoder.errors == 1);
+
+    /* so does a frame too large for the buffer */
+    len = hdlcEncode(packets[0], 200, stream);
+    len += hdlcEncode((const uint8_t*)"next", 4, stream + len);
+    hdlcDecoderInit(&decoder, buf, 100);
+    hdlcDecode(&decoder, stream, len);
+    CHECK(decoder.complete && decoder.len == 4 && memcmp(buf, "next", 4) == 0);
+    CHECK(decoder.errors == 1);
+}
+
+
+int main(void)
+{
+    makePackets();
+    slip();
+    hdlc();
+
+    return TEST_RESULT();
+}
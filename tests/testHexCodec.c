@@ -0,0 +1,273 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * hexCodec and hexRecord: encode / decode round trips at every length around the SIMD block
+ * size, bad digits, and Intel HEX and S-record images read from memory with address records,
+ * coalescing, gaps, start addresses and damaged records
+ *
+ * build: cl /I.. testHexCodec.c ..\hexCodec.c ..\hexRecord.c
+ */
+
+#include <string.h>
+#include "testCheck.h"
+#include "hexCodec.h"
+#include "hexRecord.h"
+
+
+/* appends one Intel HEX record with a correct checksum */
+static size_t intelLine(char *out, uint8_t type, uint16_t address, const uint8_t *data, uint8_t len)
+{
+    uint8_t record[4 + 255 + 1];
+    uint8_t sum = 0;
+
+    record[0] = len;
+    record[1] = (uint8_t)(address >> 8);
+    record[2] = (uint8_t)address;
+    record[3] = type;
+    if (len > 0)
+        memcpy(record + 4, data, len);
+
+    for (int i = 0; i < 4 + len; i++)
+        sum = (uint8_t)(sum + record[i]);
+    record[4 + len] = (uint8_t)(0 - sum);
+
+    out[0] = ':';
+    hexEncode(record, 5u + len, out + 1, 1);
+    out[11 + 2 * len] = '\r';
+    out[12 + 2 * len] = '\n';
+
+    return 13u + 2 * len;
+}
+
+
+/* appends one S-record with a 4 byte address and a correct checksum */
+static size_t srecLine(char *out, char type, uint32_t address, const uint8_t *data, uint8_t len)
+{
+    uint8_t record[1 + 4 + 255 + 1];
+    uint8_t sum = 0;
+
+    record[0] = (uint8_t)(len + 5);
+    record[1] = (uint8_t)(address >> 24);
+    record[2] = (uint8_t)(address >> 16);
+    record[3] = (uint8_t)(address >> 8);
+    record[4] = (uint8_t)address;
+    if (len > 0)
+        memcpy(record + 5, data, len);
+
+    for (int i = 0; i < 5 + len; i++)
+        sum = (uint8_t)(sum + record[i]);
+    record[5 + len] = (uint8_t)~sum;
+
+    out[0] = 'S';
+    out[1] = type;
+    hexEncode(record, 6u + len, out + 2, 0);
+    out[14 + 2 * len] = '\n';
+
+    return 15u + 2 * len;
+}
+
+
+static void codec(void)
+{
+    static const uint8_t known[] = { 0x01, 0xAB, 0x00, 0xFF, 0x7F, 0x80, 0xC3 };
+    uint8_t data[300], back[300];
+    char text[600];
+
+    hexEncode(known, sizeof(known), text, 1);
+    CHECK(memcmp(text, "01AB00FF7F80C3", 14) == 0);
+    hexEncode(known, sizeof(known), text, 0);
+    CHECK(memcmp(text, "01ab00ff7f80c3", 14) == 0);
+
+    CHECK(hexDecode("01aB00Ff7F80c3", 7, back) == 0);
+    CHECK(memcmp(back, known, sizeof(known)) == 0);
+
+    CHECK(hexDigitValue('0') == 0 && hexDigitValue('9') == 9);
+    CHECK(hexDigitValue('a') == 10 && hexDigitValue('F') == 15);
+    CHECK(hexDigitValue('g') == -1 && hexDigitValue(':') == -1 && hexDigitValue('@') == -1);
+
+    /* every length up to past two SIMD blocks, upper and lower case */
+    for (size_t len = 0; len < sizeof(data); len++)
+    {
+        for (size_t i = 0; i < len; i++)
+            data[i] = (uint8_t)testRandom();
+
+        hexEncode(data, len, text, (int)(len & 1));
+        memset(back, 0, sizeof(back));
+        CHECK(hexDecode(text, len, back) == 0);
+        CHECK(memcmp(back, data, len) == 0);
+    }
+
+    /* a bad digit anywhere fails the decode */
+    for (size_t len = 1; len < 80; len++)
+    {
+        for (size_t i = 0; i < len; i++)
+            data[i] = (uint8_t)testRandom();
+        hexEncode(data, len, text, 1);
+
+        size_t at = testRandom() % (2 * len);
+        static const char bad[] = { 'g', 'G', ' ', '/', ':', '@', '`', '\0', (char)0xB0 };
+        text[at] = bad[testRandom() % sizeof(bad)];
+        CHECK(hexDecode(text, len, back) == -1);
+    }
+}
+
+
+static void intel(void)
+{
+    static char text[8192];
+    hex_reader_t reader;
+    hex_segment_t segment;
+    uint8_t data[64], image[512];
+    uint32_t address;
+    size_t len = 0;
+
+    for (size_t i = 0; i < sizeof(image); i++)
+        image[i] = (uint8_t)testRandom();
+
+    /* 0x08000000 - 0x080000FF in 16 byte records, then 0x08001000 - 0x080010FF after a gap */
+    len += intelLine(text + len, 0x04, 0, (const uint8_t*)"\x08\x00", 2);
+    for (int i = 0; i < 16; i++)
+        len += intelLine(text + len, 0x00, (uint16_t)(i * 16), image + i * 16, 16);
+    for (int i = 0; i < 16; i++)
+        len += intelLine(text + len, 0x00, (uint16_t)(0x1000 + i * 16), image + 256 + i * 16, 16);
+    len += intelLine(text + len, 0x05, 0, (const uint8_t*)"\x08\x00\x01\x21", 4);
+    len += intelLine(text + len, 0x01, 0, NULL, 0);
+
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_AUTO);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK);
+    CHECK(segment.address == 0x08000000 && segment.len == 256);
+    CHECK(segment.len == 256 && memcmp(segment.data, image, 256) == 0);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK);
+    CHECK(segment.address == 0x08001000 && segment.len == 256);
+    CHECK(segment.len == 256 && memcmp(segment.data, image + 256, 256) == 0);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK && segment.len == 0);
+    CHECK(reader.format == HEX_FORMAT_INTEL);
+    CHECK(reader.startAddress == 0x08000121);
+    CHECK(reader.records == 32 && reader.dataBytes == 512);
+    hexReaderClose(&reader);
+
+    /* runs end where the buffer is full */
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_INTEL);
+    CHECK(hexReaderRead(&reader, &address, data, 40) == 40 && address == 0x08000000);
+    CHECK(memcmp(data, image, 40) == 0);
+    CHECK(hexReaderRead(&reader, &address, data, 40) == 40 && address == 0x08000028);
+    CHECK(memcmp(data, image + 40, 40) == 0);
+    hexReaderClose(&reader);
+
+    /* extended segment address, base << 4 */
+    len = intelLine(text, 0x02, 0, (const uint8_t*)"\x12\x34", 2);
+    len += intelLine(text + len, 0x00, 0x0010, image, 8);
+    len += intelLine(text + len, 0x01, 0, NULL, 0);
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_AUTO);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK);
+    CHECK(segment.address == 0x12350 && segment.len == 8);
+    hexReaderClose(&reader);
+
+    /* the classic example record */
+    static const char example[] = ":10010000214601360121470136007EFE09D2190140\n:00000001FF\n";
+    hexReaderInitMemory(&reader, example, sizeof(example) - 1, HEX_FORMAT_AUTO);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK);
+    CHECK(segment.address == 0x0100 && segment.len == 16);
+    CHECK(segment.len == 16 && memcmp(segment.data, "\x21\x46\x01\x36\x01\x21\x47\x01\x36\x00\x7E\xFE\x09\xD2\x19\x01", 16) == 0);
+    hexReaderClose(&reader);
+
+    /* a damaged checksum after good data: the data comes first, the error on the next call */
+    len = intelLine(text, 0x00, 0x0000, image, 16);
+    size_t second = len;
+    len += intelLine(text + len, 0x00, 0x0010, image + 16, 16);
+    len += intelLine(text + len, 0x01, 0, NULL, 0);
+    text[second + 9] = text[second + 9] == '0' ? '1' : '0';
+
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_AUTO);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK && segment.len == 16);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_CHECKSUM);
+    CHECK(reader.error == SERIAL_ERR_CHECKSUM);
+    hexReaderClose(&reader);
+
+    /* a character that is not a hex digit */
+    len = intelLine(text, 0x00, 0x0000, image, 16);
+    text[5] = 'x';
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_AUTO);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_FRAME);
+    hexReaderClose(&reader);
+
+    /* an S-record where Intel HEX was asked for */
+    hexReaderInitMemory(&reader, "S00600004844521B\n", 17, HEX_FORMAT_INTEL);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_FRAME);
+    hexReaderClose(&reader);
+}
+
+
+static void srec(void)
+{
+    static char text[8192];
+    hex_reader_t reader;
+    hex_segment_t segment;
+    uint8_t image[300];
+    size_t len = 0;
+
+    for (size_t i = 0; i < sizeof(image); i++)
+        image[i] = (uint8_t)testRandom();
+
+    /* header, 300 bytes at 0x20000000 in records of 32, a record count and the start address */
+    static const char header[] = "S00600004844521B\n";
+    memcpy(text, header, sizeof(header) - 1);
+    len = sizeof(header) - 1;
+    for (int i = 0; i < 300; i += 32)
+        len += srecLine(text + len, '3', 0x20000000u + (uint32_t)i, image + i, (uint8_t)(300 - i < 32 ? 300 - i : 32));
+    static const char count[] = "S5030A00F2\n";
+    memcpy(text + len, count, sizeof(count) - 1);
+    len += sizeof(count) - 1;
+    len += srecLine(text + len, '7', 0x20000101u, NULL, 0);
+
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_AUTO);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK);
+    CHECK(segment.address == 0x20000000 && segment.len == 300);
+    CHECK(segment.len == 300 && memcmp(segment.data, image, 300) == 0);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_OK && segment.len == 0);
+    CHECK(reader.format == HEX_FORMAT_SREC);
+    CHECK(reader.startAddress == 0x20000101);
+    CHECK(reader.records == 10 && reader.dataBytes == 300);
+    hexReaderClose(&reader);
+
+    /* a damaged checksum on the only record */
+    len = srecLine(text, '3', 0x1000, image, 16);
+    text[len - 2] = text[len - 2] == '0' ? '1' : '0';
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_SREC);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_CHECKSUM);
+    hexReaderClose(&reader);
+
+    /* S4 is reserved */
+    len = srecLine(text, '4', 0x1000, image, 16);
+    hexReaderInitMemory(&reader, text, len, HEX_FORMAT_SREC);
+    CHECK(hexReaderNext(&reader, &segment) == SERIAL_ERR_FRAME);
+    hexReaderClose(&reader);
+}
+
+
+int main(void)
+{
+    codec();
+    intel();
+    srec();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,251 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * miniDeflate: Adler-32 against known values, and zlib streams of empty, random, repetitive and
+ * text-like data decoded again by a small fixed Huffman inflater written for this test
+ *
+ * build: cl /I.. testMiniDeflate.c ..\miniDeflate.c ..\serialAlloc.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "testCheck.h"
+#include "miniDeflate.h"
+
+
+typedef struct {
+    const uint8_t *src;
+    size_t len;
+    size_t pos;         /* bit position */
+    int error;
+} bit_reader_t;
+
+
+static uint32_t getBits(bit_reader_t *r, int count)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < count; i++, r->pos++)
+    {
+        if (r->pos / 8 >= r->len)
+        {
+            r->error = 1;
+            return 0;
+        }
+        value |= (uint32_t)((r->src[r->pos / 8] >> (r->pos % 8)) & 1) << i;
+    }
+
+    return value;
+}
+
+
+/* Huffman codes are packed starting with their most significant bit */
+static uint32_t getCode(bit_reader_t *r, int count)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < count; i++)
+        value = (value << 1) | getBits(r, 1);
+
+    return value;
+}
+
+
+/* fixed literal/length code of RFC 1951 section 3.2.6 */
+static int fixedSymbol(bit_reader_t *r)
+{
+    uint32_t code = getCode(r, 7);
+
+    if (code <= 0x17)
+        return 256 + (int)code;
+
+    code = (code << 1) | getCode(r, 1);
+    if (code >= 0x30 && code <= 0xBF)
+        return (int)code - 0x30;
+    if (code >= 0xC0 && code <= 0xC7)
+        return 280 + (int)code - 0xC0;
+
+    code = (code << 1) | getCode(r, 1);
+    return 144 + (int)code - 0x190;
+}
+
+
+/* inflates a zlib stream of fixed Huffman blocks, returns the output length or -1 */
+static long inflateFixed(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity)
+{
+    static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+                                             59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+                                             5, 5, 5, 5, 0 };
+    static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+                                           769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+                                           11, 11, 12, 12, 13, 13 };
+    bit_reader_t r = { src, len, 16, 0 };
+    size_t out = 0;
+    int final;
+
+    if (len < 6 || (src[0] & 0x0F) != 8 || ((src[0] << 8) | src[1]) % 31 != 0)
+        return -1;
+
+    do
+    {
+        final = (int)getBits(&r, 1);
+        if (getBits(&r, 2) != 1)
+            return -1;
+
+        for (;;)
+        {
+            int symbol = fixedSymbol(&r);
+
+            if (r.error || symbol > 285)
+                return -1;
+            if (symbol < 256)
+            {
+                if (out == capacity)
+                    return -1;
+                dst[out++] = (uint8_t)symbol;
+                continue;
+            }
+            if (symbol == 256)
+                break;
+
+            size_t length = lengthBase[symbol - 257] + getBits(&r, lengthExtra[symbol - 257]);
+            uint32_t d = getCode(&r, 5);
+            if (d > 29)
+                return -1;
+            size_t distance = distBase[d] + getBits(&r, distExtra[d]);
+
+            if (r.error || distance > out || distance > 32768 || length > capacity - out)
+                return -1;
+            for (size_t i = 0; i < length; i++, out++)
+                dst[out] = dst[out - distance];
+        }
+    } while (!final);
+
+    /* the Adler-32 trailer follows on the next byte boundary, big endian */
+    size_t trailer = (r.pos + 7) / 8;
+    if (trailer + 4 != len)
+        return -1;
+
+    uint32_t adler = ((uint32_t)src[trailer] << 24) | ((uint32_t)src[trailer + 1] << 16) |
+                     ((uint32_t)src[trailer + 2] << 8) | src[trailer + 3];
+    if (adler != miniDeflateAdler32(1, dst, out))
+        return -1;
+
+    return (long)out;
+}
+
+
+static uint32_t slowAdler32(const uint8_t *data, size_t len)
+{
+    uint32_t a = 1, b = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+
+static void roundTrip(const uint8_t *data, size_t len, size_t expectAtMost)
+{
+    size_t bound = miniDeflateBound(len);
+    uint8_t *packed = malloc(bound);
+    uint8_t *back = malloc(len + 1);
+
+    CHECK(packed != NULL && back != NULL);
+    if (packed == NULL || back == NULL)
+    {
+        free(packed);
+        free(back);
+        return;
+    }
+
+    size_t packedLen = miniDeflateCompress(data, len, packed, bound);
+    CHECK(packedLen > 0 && packedLen <= bound);
+    CHECK(packedLen <= expectAtMost);
+    CHECK(packed[0] == 0x78 && packed[1] == 0x01);
+    CHECK(inflateFixed(packed, packedLen, back, len + 1) == (long)len);
+    CHECK(memcmp(back, data, len) == 0);
+
+    /* too small a destination fails instead of overrunning */
+    CHECK(miniDeflateCompress(data, len, packed, packedLen - 1) == 0);
+
+    free(packed);
+    free(back);
+}
+
+
+int main(void)
+{
+    enum { BIG = 300000 };
+    uint8_t *data = malloc(BIG);
+
+    CHECK(data != NULL);
+    if (data == NULL)
+        return TEST_RESULT();
+
+    /* Adler-32 */
+    CHECK(miniDeflateAdler32(1, (const uint8_t*)"Wikipedia", 9) == 0x11E60398);
+    CHECK(miniDeflateAdler32(1, NULL, 0) == 1);
+    memset(data, 0xFF, BIG);
+    CHECK(miniDeflateAdler32(1, data, BIG) == slowAdler32(data, BIG));
+    for (size_t i = 0; i < BIG; i++)
+        data[i] = (uint8_t)testRandom();
+    CHECK(miniDeflateAdler32(1, data, BIG) == slowAdler32(data, BIG));
+    CHECK(miniDeflateAdler32(miniDeflateAdler32(1, data, 12345), data + 12345, BIG - 12345) == slowAdler32(data, BIG));
+
+    /* empty and tiny inputs */
+    roundTrip(data, 0, 8);
+    roundTrip((const uint8_t*)"a", 1, 9);
+    roundTrip((const uint8_t*)"abcabcabcabcabcabcabcabc", 24, 16);
+
+    /* incompressible data stays within the bound */
+    roundTrip(data, BIG, miniDeflateBound(BIG));
+
+    /* zeros shrink to little more than one length code per 258 bytes */
+    memset(data, 0, BIG);
+    roundTrip(data, BIG, BIG / 100);
+
+    /* text-like data with repeats near and beyond the 32K window */
+    static const char *const words[] = { "flash ", "erase ", "sector ", "0x08000000 ", "ok\r\n", "write ", "verify " };
+    for (size_t pos = 0; pos < BIG;)
+    {
+        const char *word = words[testRandom() % 7];
+        for (size_t i = 0; word[i] != '\0' && pos < BIG; i++)
+            data[pos++] = (uint8_t)word[i];
+    }
+    roundTrip(data, BIG, BIG / 3);
+
+    /* a block repeated at a distance just past the window */
+    for (size_t i = 0; i < 40000; i++)
+        data[i] = (uint8_t)testRandom();
+    memcpy(data + 32769, data, 40000 - 32769);
+    roundTrip(data, 40000, miniDeflateBound(40000));
+
+    free(data);
+
+    return TEST_RESULT();
+}
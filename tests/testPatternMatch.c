@@ -0,0 +1,203 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * patternMatch: overlapping patterns, matches split across chunks, case folding, timestamps, and
+ * random pattern sets checked against a naive search with and without the start byte prefilter
+ *
+ * build: cl /I.. testPatternMatch.c ..\patternMatch.c ..\pipeline.c ..\spscQueue.c ..\serialPort.c ..\serialAlloc.c ws2_32.lib
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "testCheck.h"
+#include "patternMatch.h"
+
+
+#define MAX_EVENTS  64
+
+typedef struct {
+    match_event_t events[MAX_EVENTS];
+    uint32_t count;
+    uint64_t total;
+    uint64_t digest;
+} collector_t;
+
+
+static void collect(const match_event_t *event, void *context)
+{
+    collector_t *c = (collector_t*)context;
+
+    if (c->count < MAX_EVENTS)
+        c->events[c->count++] = *event;
+    c->total++;
+    c->digest += event->offset * 31 + event->patternId;
+}
+
+
+static int foldByte(int c, int caseInsensitive)
+{
+    return caseInsensitive && c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+
+static void known(void)
+{
+    static const char *const words[] = { "he", "she", "his", "hers" };
+    match_set_t set;
+    match_stream_t stream;
+    collector_t c;
+
+    patternMatchInit(&set, 0);
+    CHECK(patternMatchAdd(&set, (const uint8_t*)"", 0, 9) == SERIAL_ERR_UNKNOWN);
+    for (uint32_t i = 0; i < 4; i++)
+        CHECK(patternMatchAdd(&set, (const uint8_t*)words[i], (uint32_t)strlen(words[i]), i + 1) == SERIAL_ERR_OK);
+    CHECK(patternMatchCompile(&set) == SERIAL_ERR_OK);
+    CHECK(patternMatchAdd(&set, (const uint8_t*)"late", 4, 5) == SERIAL_ERR_UNKNOWN);
+
+    /* "ushers": she at 1, he at 2, hers at 2 */
+    memset(&c, 0, sizeof(c));
+    patternMatchStreamInit(&stream, &set, collect, &c);
+    CHECK(patternMatchFeed(&stream, (const uint8_t*)"ushers", 6, 7) == 3);
+    CHECK(c.count == 3);
+
+    int she = 0, he = 0, hers = 0;
+    for (uint32_t i = 0; i < c.count; i++)
+    {
+        const match_event_t *e = &c.events[i];
+        CHECK(e->timestamp == 7);
+        if (e->patternId == 2 && e->offset == 1 && e->length == 3)
+            she++;
+        else if (e->patternId == 1 && e->offset == 2 && e->length == 2)
+            he++;
+        else if (e->patternId == 4 && e->offset == 2 && e->length == 4)
+            hers++;
+    }
+    CHECK(she == 1 && he == 1 && hers == 1);
+
+    /* matching is exact without case folding */
+    CHECK(patternMatchFeed(&stream, (const uint8_t*)"SHE HIS", 7, 8) == 0);
+    patternMatchFree(&set);
+
+    /* one byte at a time across chunks, reported with the timestamp of the last byte */
+    patternMatchInit(&set, 1);
+    CHECK(patternMatchAdd(&set, (const uint8_t*)"Kernel Panic", 12, 42) == SERIAL_ERR_OK);
+    CHECK(patternMatchCompile(&set) == SERIAL_ERR_OK);
+
+    static const char console[] = "boot ok\r\nKERNEL panic - not syncing\r\nkernel PANIC";
+    memset(&c, 0, sizeof(c));
+    patternMatchStreamInit(&stream, &set, collect, &c);
+    for (size_t i = 0; i < sizeof(console) - 1; i++)
+        patternMatchFeed(&stream, (const uint8_t*)console + i, 1, 1000 + i);
+
+    CHECK(c.count == 2);
+    CHECK(c.events[0].patternId == 42 && c.events[0].offset == 9 && c.events[0].timestamp == 1000 + 20);
+    CHECK(c.events[1].offset == 37 && c.events[1].timestamp == 1000 + 48);
+    CHECK(stream.offset == sizeof(console) - 1 && stream.matches == 2);
+    patternMatchFree(&set);
+}
+
+
+/* random patterns over a small alphabet against a naive search, fed in random sized chunks */
+static void randomSets(uint32_t patterns, int alphabet, int caseInsensitive, int prefilter)
+{
+    enum { TEXT = 20000, MAXLEN = 6 };
+    uint8_t pattern[256][MAXLEN];
+    uint32_t length[256];
+    uint8_t *text = malloc(TEXT);
+    match_set_t set;
+    match_stream_t stream;
+    collector_t c;
+    uint64_t want = 0, wantDigest = 0;
+
+    CHECK(text != NULL);
+    if (text == NULL)
+        return;
+
+    patternMatchInit(&set, caseInsensitive);
+    for (uint32_t p = 0; p < patterns; p++)
+    {
+        length[p] = 1 + testRandom() % MAXLEN;
+        for (uint32_t j = 0; j < length[p]; j++)
+            pattern[p][j] = (uint8_t)('a' + testRandom() % alphabet - (caseInsensitive && testRandom() % 2 ? 32 : 0));
+        CHECK(patternMatchAdd(&set, pattern[p], length[p], p) == SERIAL_ERR_OK);
+    }
+    CHECK(patternMatchCompile(&set) == SERIAL_ERR_OK);
+    CHECK((set.startByteCount != 0) == prefilter);
+
+    for (size_t i = 0; i < TEXT; i++)
+    {
+        if (testRandom() % 4 == 0)
+            text[i] = (uint8_t)('a' + testRandom() % alphabet - (testRandom() % 2 ? 32 : 0));
+        else
+            text[i] = ' ';
+    }
+
+    for (size_t i = 0; i < TEXT; i++)
+    {
+        for (uint32_t p = 0; p < patterns; p++)
+        {
+            uint32_t j = 0;
+
+            if (i + length[p] > TEXT)
+                continue;
+            while (j < length[p] && foldByte(text[i + j], caseInsensitive) == foldByte(pattern[p][j], caseInsensitive))
+                j++;
+            if (j == length[p])
+            {
+                want++;
+                wantDigest += (uint64_t)i * 31 + p;
+            }
+        }
+    }
+
+    memset(&c, 0, sizeof(c));
+    patternMatchStreamInit(&stream, &set, collect, &c);
+    for (size_t pos = 0; pos < TEXT;)
+    {
+        size_t chunk = 1 + testRandom() % 70;
+        if (chunk > TEXT - pos)
+            chunk = TEXT - pos;
+        patternMatchFeed(&stream, text + pos, chunk, 0);
+        pos += chunk;
+    }
+
+    CHECK(c.total == want);
+    CHECK(c.digest == wantDigest);
+    CHECK(stream.matches == want);
+
+    patternMatchFree(&set);
+    free(text);
+}
+
+
+int main(void)
+{
+    known();
+
+    /* few start bytes use the SIMD prefilter, many do not */
+    randomSets(3, 26, 0, 1);
+    randomSets(3, 26, 1, 1);
+    randomSets(1, 26, 0, 1);
+    randomSets(50, 4, 0, 1);
+    randomSets(200, 26, 1, 0);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,250 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * spscQueue: capacity rounding, full and oversized reserves, records wrapping at the ring end and
+ * at the end of the 32 bit positions, short commits and a producer thread against the consumer
+ *
+ * build: cl /I.. testSpscQueue.c ..\spscQueue.c ..\serialAlloc.c
+ */
+
+#include <string.h>
+#include "testCheck.h"
+#include "spscQueue.h"
+
+
+#define THREAD_RECORDS  200000
+
+typedef struct {
+    uint32_t seq;
+    uint32_t len;
+} expected_t;
+
+
+static void fillRecord(uint8_t *slot, uint32_t seq, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+        slot[i] = (uint8_t)(seq * 7 + i);
+}
+
+
+static int recordMatches(const uint8_t *record, uint32_t seq, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (record[i] != (uint8_t)(seq * 7 + i))
+            return 0;
+    }
+    return 1;
+}
+
+
+/* random length records through a small ring, the consumer only running when the producer is stuck */
+static void mixedRecords(uint32_t startPos)
+{
+    spsc_queue_t queue;
+    expected_t fifo[64];
+    uint32_t head = 0, tail = 0, seq = 0, wraps = 0, bad = 0;
+
+    CHECK(spscQueueInit(&queue, 256) == SERIAL_ERR_OK);
+
+    /* positions are free running, start them just short of the 32 bit wrap */
+    queue.writePos = (LONG)startPos;
+    queue.readPos = (LONG)startPos;
+    queue.cachedReadPos = startPos;
+    queue.cachedWritePos = startPos;
+
+    for (int i = 0; i < 20000; i++)
+    {
+        uint32_t len = testRandom() % 121;
+        uint8_t *slot;
+
+        while ((slot = spscQueueReserve(&queue, len)) == NULL)
+        {
+            uint32_t got;
+            const uint8_t *record = spscQueuePeek(&queue, &got);
+
+            CHECK(record != NULL);
+            if (record == NULL)
+                return;
+            if (got != fifo[tail % 64].len || !recordMatches(record, fifo[tail % 64].seq, got))
+                bad++;
+            spscQueueRelease(&queue);
+            tail++;
+        }
+
+        if (queue.reserveSkip != 0)
+            wraps++;
+
+        fillRecord(slot, seq, len);
+        spscQueueCommit(&queue, len);
+        fifo[head % 64].seq = seq++;
+        fifo[head % 64].len = len;
+        head++;
+
+        CHECK(spscQueueDepth(&queue) == head - tail);
+    }
+
+    while (head != tail)
+    {
+        uint32_t got;
+        const uint8_t *record = spscQueuePeek(&queue, &got);
+
+        CHECK(record != NULL);
+        if (record == NULL)
+            return;
+        if (got != fifo[tail % 64].len || !recordMatches(record, fifo[tail % 64].seq, got))
+            bad++;
+        spscQueueRelease(&queue);
+        tail++;
+    }
+
+    CHECK(bad == 0);
+    CHECK(wraps > 0);
+    CHECK(spscQueueDepth(&queue) == 0);
+    CHECK(spscQueueBytes(&queue) == 0);
+    CHECK(spscQueuePeek(&queue, &head) == NULL);
+
+    spscQueueFree(&queue);
+}
+
+
+static DWORD WINAPI producerThread(LPVOID lpParam)
+{
+    spsc_queue_t *queue = (spsc_queue_t*)lpParam;
+    uint32_t seed = 1;
+
+    for (uint32_t seq = 0; seq < THREAD_RECORDS; seq++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t len = 4 + (seed >> 16) % 300;
+        uint8_t *slot = spscQueueReserveWait(queue, len, INFINITE);
+
+        memcpy(slot, &seq, 4);
+        fillRecord(slot + 4, seq, len - 4);
+        spscQueueCommit(queue, len);
+    }
+
+    return 0;
+}
+
+
+static void threaded(void)
+{
+    spsc_queue_t queue;
+    uint32_t seed = 1, bad = 0;
+
+    CHECK(spscQueueInit(&queue, 4096) == SERIAL_ERR_OK);
+
+    HANDLE thread = CreateThread(NULL, 0, producerThread, &queue, 0, NULL);
+    CHECK(thread != NULL);
+    if (thread == NULL)
+        return;
+
+    for (uint32_t seq = 0; seq < THREAD_RECORDS; seq++)
+    {
+        uint32_t len, got;
+
+        seed = seed * 1103515245u + 12345u;
+        len = 4 + (seed >> 16) % 300;
+
+        const uint8_t *record = spscQueuePeekWait(&queue, &got, INFINITE);
+        if (got != len || memcmp(record, &seq, 4) != 0 || !recordMatches(record + 4, seq, len - 4))
+            bad++;
+        spscQueueRelease(&queue);
+    }
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    CHECK(bad == 0);
+    CHECK(spscQueueDepth(&queue) == 0);
+
+    spscQueueFree(&queue);
+}
+
+
+int main(void)
+{
+    spsc_queue_t queue;
+    uint32_t len;
+
+    /* capacity is rounded up to a power of two of at least 64 */
+    CHECK(spscQueueInit(&queue, 0) == SERIAL_ERR_OK);
+    CHECK(queue.capacity == 64);
+    spscQueueFree(&queue);
+
+    CHECK(spscQueueInit(&queue, 200) == SERIAL_ERR_OK);
+    CHECK(queue.capacity == 256);
+    CHECK(spscQueuePeek(&queue, &len) == NULL);
+
+    /* records with their 8 byte header are limited to half the ring */
+    CHECK(spscQueueReserve(&queue, 121) == NULL);
+    CHECK(spscQueueReserve(&queue, 120) != NULL);
+
+    /* 24 byte records take 32 bytes, eight fill the ring */
+    int count = 0;
+    uint8_t *slot;
+    while ((slot = spscQueueReserve(&queue, 24)) != NULL)
+    {
+        fillRecord(slot, (uint32_t)count, 24);
+        spscQueueCommit(&queue, 24);
+        count++;
+    }
+    CHECK(count == 8);
+    CHECK(spscQueueDepth(&queue) == 8);
+    CHECK(spscQueueBytes(&queue) == 256);
+
+    /* releasing one makes room for one */
+    const uint8_t *record = spscQueuePeek(&queue, &len);
+    CHECK(record != NULL && len == 24 && recordMatches(record, 0, 24));
+    spscQueueRelease(&queue);
+    CHECK(spscQueueReserve(&queue, 24) != NULL);
+    spscQueueCommit(&queue, 24);
+    CHECK(spscQueueReserve(&queue, 0) == NULL);
+
+    for (int i = 1; i <= 8; i++)
+    {
+        record = spscQueuePeek(&queue, &len);
+        CHECK(record != NULL && len == 24);
+        if (record != NULL && i < 8)
+            CHECK(recordMatches(record, (uint32_t)i, 24));
+        spscQueueRelease(&queue);
+    }
+    CHECK(spscQueueDepth(&queue) == 0);
+
+    /* a commit may be shorter than the reserve */
+    slot = spscQueueReserve(&queue, 100);
+    CHECK(slot != NULL);
+    fillRecord(slot, 5, 10);
+    spscQueueCommit(&queue, 10);
+    record = spscQueuePeek(&queue, &len);
+    CHECK(record != NULL && len == 10 && recordMatches(record, 5, 10));
+    spscQueueRelease(&queue);
+    CHECK(spscQueueBytes(&queue) == 0);
+
+    spscQueueFree(&queue);
+
+    mixedRecords(0);
+    mixedRecords(0xFFFFF000u);
+    threaded();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,187 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * traceFormat: hexdump lines against a printf reference at every length and across offset carries,
+ * escaping and trace lines against known text, and parsing everything back
+ *
+ * build: cl /I.. testTraceFormat.c ..\traceFormat.c ..\hexCodec.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "testCheck.h"
+#include "traceFormat.h"
+
+
+/* hexdump -C layout written the slow way */
+static size_t referenceHexdump(const uint8_t *data, size_t len, uint64_t baseOffset, char *dst)
+{
+    size_t n = 0;
+
+    for (size_t line = 0; line < len; line += 16)
+    {
+        n += (size_t)sprintf(dst + n, "%08x  ", (uint32_t)(baseOffset + line));
+        for (size_t i = 0; i < 16; i++)
+        {
+            if (line + i < len)
+                n += (size_t)sprintf(dst + n, "%02x ", data[line + i]);
+            else
+                n += (size_t)sprintf(dst + n, "   ");
+            if (i == 7)
+                dst[n++] = ' ';
+        }
+        dst[n++] = ' ';
+        dst[n++] = '|';
+        for (size_t i = 0; i < 16 && line + i < len; i++)
+            dst[n++] = data[line + i] >= 0x20 && data[line + i] < 0x7F ? (char)data[line + i] : '.';
+        dst[n++] = '|';
+        dst[n++] = '\n';
+    }
+
+    return n;
+}
+
+
+static void hexdump(void)
+{
+    static const uint64_t offsets[] = { 0, 0x10, 0xFFF8, 0x99999990, 0xFFFFFFF8, 0x1FFFFFFF0ull, 0x123456789ABCDEF0ull };
+    static uint8_t data[1000];
+    static char text[TRACE_HEXDUMP_SIZE(1000)], expect[TRACE_HEXDUMP_SIZE(1000) + 1];
+    uint8_t back[1000];
+    size_t written;
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)testRandom();
+
+    static const char hello[] = "00000000  48 65 6c 6c 6f 0d 0a                              |Hello..|\n";
+    CHECK(traceHexdump((const uint8_t*)"Hello\r\n", 7, 0, text, sizeof(text)) == sizeof(hello) - 1);
+    CHECK(memcmp(text, hello, sizeof(hello) - 1) == 0);
+
+    for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+    {
+        for (size_t len = 0; len <= 200; len++)
+        {
+            size_t n = traceHexdump(data, len, offsets[o], text, TRACE_HEXDUMP_SIZE(len));
+            size_t m = referenceHexdump(data, len, offsets[o], expect);
+
+            CHECK(n == m && memcmp(text, expect, m) == 0);
+            CHECK(traceParseHexdump(text, n, back, len, &written) == SERIAL_ERR_OK);
+            CHECK(written == len && memcmp(back, data, len) == 0);
+        }
+    }
+
+    /* long enough for the offset to count through several digits */
+    size_t n = traceHexdump(data, sizeof(data), 0xFFFFFE00, text, sizeof(text));
+    CHECK(n == referenceHexdump(data, sizeof(data), 0xFFFFFE00, expect) && memcmp(text, expect, n) == 0);
+
+    /* too small a destination or too small a parse buffer */
+    CHECK(traceHexdump(data, 17, 0, text, TRACE_HEXDUMP_SIZE(17) - 1) == 0);
+    n = traceHexdump(data, 32, 0, text, sizeof(text));
+    CHECK(traceParseHexdump(text, n, back, 31, &written) == SERIAL_ERR_BUFFER_OVERFLOW);
+
+    /* damaged hex pairs */
+    text[12] = 'z';
+    CHECK(traceParseHexdump(text, n, back, sizeof(back), &written) == SERIAL_ERR_FRAME);
+}
+
+
+static void escape(void)
+{
+    static const char input[] = "Hello\r\n\x01\xff\"\\ world\t";
+    static const char expect[] = "Hello\\r\\n\\x01\\xff\\\"\\\\ world\\t";
+    char text[TRACE_ESCAPE_SIZE(300)];
+    uint8_t data[300], back[300];
+    size_t written;
+
+    size_t n = traceEscape((const uint8_t*)input, sizeof(input) - 1, text, sizeof(text));
+    CHECK(n == sizeof(expect) - 1 && memcmp(text, expect, n) == 0);
+    CHECK(traceEscape((const uint8_t*)input, sizeof(input) - 1, text, TRACE_ESCAPE_SIZE(sizeof(input) - 1) - 1) == 0);
+
+    /* the extra escapes accepted on input */
+    static const char extra[] = "\\0\\a\\b\\f\\v\\'\\x7F";
+    CHECK(traceUnescape(extra, sizeof(extra) - 1, back, sizeof(back), &written) == SERIAL_ERR_OK);
+    CHECK(written == 7 && memcmp(back, "\0\a\b\f\v'\x7F", 7) == 0);
+
+    CHECK(traceUnescape("\\q", 2, back, sizeof(back), &written) == SERIAL_ERR_FRAME);
+    CHECK(traceUnescape("\\x4", 3, back, sizeof(back), &written) == SERIAL_ERR_FRAME);
+    CHECK(traceUnescape("abc\\", 4, back, sizeof(back), &written) == SERIAL_ERR_FRAME);
+    CHECK(traceUnescape("abcd", 4, back, 3, &written) == SERIAL_ERR_BUFFER_OVERFLOW);
+
+    for (int round = 0; round < 500; round++)
+    {
+        size_t len = testRandom() % sizeof(data);
+
+        /* mostly printable with runs of control and high bytes, as on a console */
+        for (size_t i = 0; i < len; i++)
+            data[i] = (uint8_t)(testRandom() % 3 ? ' ' + testRandom() % 95 : testRandom());
+
+        n = traceEscape(data, len, text, sizeof(text));
+        CHECK(len == 0 || n > 0);
+        CHECK(traceUnescape(text, n, back, sizeof(back), &written) == SERIAL_ERR_OK);
+        CHECK(written == len && memcmp(back, data, len) == 0);
+    }
+}
+
+
+static void lines(void)
+{
+    static char text[TRACE_LINE_SIZE(300)];
+    uint8_t data[300], back[300];
+    uint64_t timestamp;
+    char tag[9];
+    size_t written;
+
+    static const char escaped[] = "12.000345 RX \"OK\\r\\n\"\n";
+    size_t n = traceFormatLine(12000345, "RX", (const uint8_t*)"OK\r\n", 4, TRACE_MODE_ESCAPED, text, sizeof(text));
+    CHECK(n == sizeof(escaped) - 1 && memcmp(text, escaped, n) == 0);
+
+    static const char hex[] = "0.000005 TX 48 65 6c 6c 6f\n";
+    n = traceFormatLine(5, "TX", (const uint8_t*)"Hello", 5, TRACE_MODE_HEX, text, sizeof(text));
+    CHECK(n == sizeof(hex) - 1 && memcmp(text, hex, n) == 0);
+
+    CHECK(traceFormatLine(5, "TX", (const uint8_t*)"Hello", 5, TRACE_MODE_HEX, text, TRACE_LINE_SIZE(5) - 1) == 0);
+
+    for (int round = 0; round < 500; round++)
+    {
+        size_t len = testRandom() % sizeof(data);
+        uint64_t when = (uint64_t)testRandom() * 1000003u;
+        trace_mode_t mode = round % 2 ? TRACE_MODE_HEX : TRACE_MODE_ESCAPED;
+
+        for (size_t i = 0; i < len; i++)
+            data[i] = (uint8_t)(testRandom() % 3 ? ' ' + testRandom() % 95 : testRandom());
+
+        n = traceFormatLine(when, "COM12", data, len, mode, text, sizeof(text));
+        CHECK(n > 0 && text[n - 1] == '\n');
+        CHECK(traceParseLine(text, n, &timestamp, tag, back, sizeof(back), &written) == SERIAL_ERR_OK);
+        CHECK(timestamp == when && strcmp(tag, "COM12") == 0);
+        CHECK(written == len && memcmp(back, data, len) == 0);
+    }
+}
+
+
+int main(void)
+{
+    hexdump();
+    escape();
+    lines();
+
+    return TEST_RESULT();
+}
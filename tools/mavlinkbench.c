@@ -0,0 +1,240 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * throughput of the MAVLink router between in-memory endpoints, no ports needed
+ *
+ *   mavlinkbench [-l links] [-s seconds]
+ *
+ * link 0 is an autopilot (1/1) streaming telemetry, every other link a ground station (255 - i / 190)
+ * sending heartbeats and COMMAND_LONGs addressed to the autopilot. The tool supplies its own
+ * bytesAvailable, serialPortReadSome and serialPortWrite over memory buffers instead of linking
+ * serialPort.c, so the numbers are those of parsing, CRC checking, route learning and fan-out.
+ *
+ * build: cl /O2 /I.. mavlinkbench.c ..\mavlink.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mavlink.h"
+
+
+#define STREAM_BYTES    (4u << 20)      /* telemetry generated for the autopilot link, replayed in a loop */
+#define GCS_BYTES       (256u << 10)    /* traffic generated for every ground station link */
+
+/* a few common messages of the common dialect, sorted by msgid */
+static const mavlink_msg_entry_t dialect[] = {
+    { 0, 50, 9, 9, 0, 0, 0 },           /* HEARTBEAT */
+    { 1, 124, 31, 43, 0, 0, 0 },        /* SYS_STATUS */
+    { 24, 24, 30, 52, 0, 0, 0 },        /* GPS_RAW_INT */
+    { 30, 39, 28, 28, 0, 0, 0 },        /* ATTITUDE */
+    { 33, 104, 28, 28, 0, 0, 0 },       /* GLOBAL_POSITION_INT */
+    { 76, 152, 33, 33, MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_SYSTEM | MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_COMPONENT, 30, 31 },    /* COMMAND_LONG */
+};
+#define DIALECT_LEN     (sizeof(dialect) / sizeof(dialect[0]))
+
+typedef struct {
+    uint8_t *data;          /* bytes the link "receives", replayed from the start once consumed */
+    size_t len;
+    size_t pos;
+    uint64_t received;      /* bytes handed to the router */
+    uint64_t written;       /* bytes the router wrote to the link */
+    uint8_t sink[MAVLINK_MAX_FRAME];
+} endpoint_t;
+
+static serial_port_t ports[MAVLINK_ROUTER_MAX_LINKS];
+static endpoint_t endpoints[MAVLINK_ROUTER_MAX_LINKS];
+static uint32_t seed = 0x12345678;
+
+
+/* ---- in-memory replacements of the port functions the router uses ---- */
+
+int bytesAvailable(serial_port_t *hSerial)
+{
+    endpoint_t *e = &endpoints[hSerial - ports];
+
+    if (e->pos == e->len)
+        e->pos = 0;
+
+    return (int)(e->len - e->pos);
+}
+
+
+serial_port_err_t serialPortReadSome(serial_port_t *port, uint8_t *buf, uint64_t size, uint64_t *got)
+{
+    endpoint_t *e = &endpoints[port - ports];
+    size_t n = e->len - e->pos < size ? e->len - e->pos : (size_t)size;
+
+    memcpy(buf, e->data + e->pos, n);
+    e->pos += n;
+    e->received += n;
+    *got = n;
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t serialPortWrite(serial_port_t *port, uint8_t *buf, uint64_t size)
+{
+    endpoint_t *e = &endpoints[port - ports];
+
+    /* stands in for the copy into the driver */
+    memcpy(e->sink, buf, (size_t)size);
+    e->written += size;
+
+    return SERIAL_ERR_OK;
+}
+
+
+/* ---- traffic ---- */
+
+static uint8_t nextRandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (uint8_t)(seed >> 16);
+}
+
+
+/* appends a MAVLink 2 frame with a random payload; the last byte is kept non-zero so nothing is trimmed */
+static size_t putFrame(uint8_t *out, const mavlink_msg_entry_t *entry, uint8_t seq, uint8_t sysid, uint8_t compid,
+                       uint8_t targetSystem, uint8_t targetComponent)
+{
+    uint8_t len = entry->maxLen;
+
+    out[0] = MAVLINK_STX_V2;
+    out[1] = len;
+    out[2] = 0;
+    out[3] = 0;
+    out[4] = seq;
+    out[5] = sysid;
+    out[6] = compid;
+    out[7] = (uint8_t)entry->msgid;
+    out[8] = (uint8_t)(entry->msgid >> 8);
+    out[9] = (uint8_t)(entry->msgid >> 16);
+
+    for (uint8_t i = 0; i < len; i++)
+        out[10 + i] = nextRandom();
+    out[10 + len - 1] |= 1;
+
+    if (entry->flags & MAVLINK_MSG_ENTRY_FLAGS_HAS_TARGET_SYSTEM)
+    {
+        out[10 + entry->targetSystemOfs] = targetSystem;
+        out[10 + entry->targetComponentOfs] = targetComponent;
+    }
+
+    uint16_t crc = mavlinkCrcAccumulate(0xFFFF, out + 1, 9u + len);
+    crc = mavlinkCrcAccumulate(crc, &entry->crcExtra, 1);
+    out[10 + len] = (uint8_t)crc;
+    out[11 + len] = (uint8_t)(crc >> 8);
+
+    return 12u + len;
+}
+
+
+/* fills a buffer with whole frames cycling through the given messages */
+static void fillStream(endpoint_t *e, size_t capacity, const uint32_t *msgids, int count, uint8_t sysid, uint8_t compid)
+{
+    uint64_t frames = 0;
+    uint8_t seq = 0;
+
+    e->data = malloc(capacity);
+    e->len = 0;
+    if (e->data == NULL)
+        exit(1);
+
+    while (e->len + MAVLINK_MAX_FRAME <= capacity)
+    {
+        const mavlink_msg_entry_t *entry = mavlinkFindEntry(dialect, DIALECT_LEN, msgids[frames % (uint64_t)count]);
+        e->len += putFrame(e->data + e->len, entry, seq++, sysid, compid, 1, 1);
+        frames++;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const uint32_t telemetry[] = { 0, 1, 24, 30, 30, 30, 33, 33 };
+    static const uint32_t ground[] = { 0, 76, 76, 76 };
+    static mavlink_router_t router;
+    int links = 4;
+    double seconds = 3;
+    LARGE_INTEGER frequency, start, now;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            links = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [-l links] [-s seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (links < 2 || links > MAVLINK_ROUTER_MAX_LINKS)
+        links = 4;
+
+    mavlinkRouterInit(&router, NULL, NULL);
+
+    for (int i = 0; i < links; i++)
+    {
+        if (i == 0)
+            fillStream(&endpoints[i], STREAM_BYTES, telemetry, 8, 1, 1);
+        else
+            fillStream(&endpoints[i], GCS_BYTES, ground, 4, (uint8_t)(255 - i), 190);
+
+        mavlinkRouterAddLink(&router, &ports[i], dialect, DIALECT_LEN);
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    uint64_t messages = 0, polls = 0;
+    double elapsed;
+    do
+    {
+        for (int k = 0; k < 64; k++, polls++)
+            messages += mavlinkRouterPoll(&router);
+
+        QueryPerformanceCounter(&now);
+        elapsed = (double)(now.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+    } while (elapsed < seconds);
+
+    uint64_t received = 0, written = 0, forwarded = 0, errors = 0;
+    for (int i = 0; i < links; i++)
+    {
+        received += endpoints[i].received;
+        written += endpoints[i].written;
+        forwarded += router.links[i].forwarded;
+        errors += router.links[i].parser.crcErrors + router.links[i].parser.unknownMessages;
+    }
+
+    printf("%d links, %.1f s, %llu polls\n", links, elapsed, (unsigned long long)polls);
+    printf("in   %12.0f msg/s  %8.1f MB/s\n", messages / elapsed, received / elapsed / 1e6);
+    printf("out  %12.0f msg/s  %8.1f MB/s\n", forwarded / elapsed, written / elapsed / 1e6);
+    printf("%.1f ns per received message, %llu frames dropped\n", elapsed * 1e9 / (double)messages, (unsigned long long)errors);
+
+    for (int i = 0; i < links; i++)
+        free(endpoints[i].data);
+
+    return errors != 0;
+}
@@ -0,0 +1,204 @@
+
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * top-like view of the ports a process publishes with statsShm.h; it only reads the shared page
+ *
+ *   serialstat [-n mapping name] [-i refresh ms] [-1]
+ *
+ * build: cl /I.. serialstat.c ..\statsShm.c ..\serialAlloc.c ..\serialPort.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "statsShm.h"
+
+
+/* upper bound of the bucket holding the given fraction of the writes, 0 without writes */
+static uint32_t latencyPercentileUs(const stats_shm_record_t *record, double fraction, int *unbounded)
+{
+    uint64_t total = 0, seen = 0;
+
+    for (uint32_t b = 0; b < SERIAL_LATENCY_BUCKETS; b++)
+        total += record->txLatency[b];
+
+    *unbounded = FALSE;
+    if (total == 0)
+        return 0;
+
+    for (uint32_t b = 0; b < SERIAL_LATENCY_BUCKETS - 1; b++)
+    {
+        seen += record->txLatency[b];
+        if ((double)seen >= fraction * (double)total)
+            return serialLatencyBoundsUs[b];
+    }
+
+    *unbounded = TRUE;
+    return serialLatencyBoundsUs[SERIAL_LATENCY_BUCKETS - 2];
+}
+
+
+static void printRate(double bytesPerSecond)
+{
+    if (bytesPerSecond >= 1e6)
+        printf(" %8.2fM", bytesPerSecond / 1e6);
+    else if (bytesPerSecond >= 1e3)
+        printf(" %8.2fk", bytesPerSecond / 1e3);
+    else
+        printf(" %9.0f", bytesPerSecond);
+}
+
+
+static void printRecord(const stats_shm_record_t *record, const stats_shm_record_t *previous)
+{
+    uint64_t writes = 0;
+    int unbounded;
+
+    for (uint32_t b = 0; b < SERIAL_LATENCY_BUCKETS; b++)
+        writes += record->txLatency[b];
+
+    printf("%-16.16s %8llu", record->name, (unsigned long long)record->baud);
+
+    /* rates over the interval between the two copies, by the publisher's own clock */
+    if (previous != NULL && record->updatedTick > previous->updatedTick)
+    {
+        double seconds = (double)(record->updatedTick - previous->updatedTick) / 1000.0;
+        printRate((double)(record->rxBytes - previous->rxBytes) / seconds);
+        printRate((double)(record->txBytes - previous->txBytes) / seconds);
+    }
+    else
+        printf(" %9s %9s", "-", "-");
+
+    printf(" %12llu %12llu %5llu/%llu/%llu",
+           (unsigned long long)record->rxBytes, (unsigned long long)record->txBytes,
+           (unsigned long long)record->readErrors, (unsigned long long)record->writeErrors,
+           (unsigned long long)record->lineErrors);
+
+    if (!record->isOpen)
+        printf(" %8s", "closed");
+    else
+        printf(" %7.1fs", record->updatedTick > record->lastRxTick ? (double)(record->updatedTick - record->lastRxTick) / 1000.0 : 0.0);
+
+    if (writes != 0)
+    {
+        uint32_t p99 = latencyPercentileUs(record, 0.99, &unbounded);
+        printf(" %8.2fms %s%7.2fms", (double)record->txLatencyUs / (double)writes / 1000.0, unbounded ? ">" : "<", p99 / 1000.0);
+    }
+    else
+        printf(" %10s %9s", "-", "-");
+
+    printf("\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *name = STATS_SHM_DEFAULT_NAME;
+    DWORD refreshMs = 1000;
+    int once = FALSE;
+    stats_shm_view_t view;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            name = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            refreshMs = (DWORD)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-1") == 0)
+            once = TRUE;
+        else
+        {
+            fprintf(stderr, "usage: %s [-n mapping name] [-i refresh ms] [-1]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    serial_port_err_t err = statsShmAttach(&view, name);
+    if (err != SERIAL_ERR_OK)
+    {
+        fprintf(stderr, err == SERIAL_ERR_OPEN ? "no statistics page named %s\n" : "%s has an unknown layout version\n", name);
+        return 1;
+    }
+
+    uint32_t capacity = view.header->capacity;
+    /* rates are taken between the two latest distinct copies, whatever the refresh and publishing intervals */
+    stats_shm_record_t snapshot;
+    stats_shm_record_t *latest = calloc(capacity, sizeof(stats_shm_record_t));
+    stats_shm_record_t *base = calloc(capacity, sizeof(stats_shm_record_t));
+    uint8_t *seen = calloc(capacity, 1);
+    if (latest == NULL || base == NULL || seen == NULL)
+        return 1;
+
+    /* same virtual terminal setup as serialPortOpen, for clearing the screen */
+    DWORD consoleMode;
+    GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &consoleMode);
+    SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+    for (;;)
+    {
+        uint32_t count = (uint32_t)ReadAcquire(&view.header->count);
+        uint64_t age = GetTickCount64() - (uint64_t)ReadAcquire64(&view.header->updatedTick);
+
+        if (!once)
+            printf("\x1b[H\x1b[2J");
+
+        printf("%s  pid %lu  %lu ports  every %lu ms  generation %llu%s\n\n", name,
+               (unsigned long)view.header->processId, (unsigned long)count, (unsigned long)view.header->intervalMs,
+               (unsigned long long)ReadAcquire64(&view.header->generation),
+               view.header->intervalMs != 0 && age > 3ull * view.header->intervalMs + 1000 ? "  (publisher stopped)" : "");
+        printf("%-16s %8s %9s %9s %12s %12s %11s %8s %10s %9s\n",
+               "PORT", "BAUD", "RX B/s", "TX B/s", "RX TOTAL", "TX TOTAL", "ERR R/W/L", "SILENT", "WR MEAN", "WR P99");
+
+        for (uint32_t i = 0; i < count && i < capacity; i++)
+        {
+            if (!statsShmSnapshot(&view, i, &snapshot))
+            {
+                printf("%-16.16s (busy)\n", view.records[i].name);
+                continue;
+            }
+
+            if (seen[i] == 0)
+            {
+                latest[i] = snapshot;
+                seen[i] = 1;
+            }
+            else if (snapshot.updatedTick > latest[i].updatedTick)
+            {
+                base[i] = latest[i];
+                latest[i] = snapshot;
+                seen[i] = 2;
+            }
+
+            printRecord(&latest[i], seen[i] == 2 ? &base[i] : NULL);
+        }
+
+        fflush(stdout);
+        if (once)
+            break;
+        Sleep(refreshMs);
+    }
+
+    statsShmDetach(&view);
+    free(latest);
+    free(base);
+    free(seen);
+
+    return 0;
+}
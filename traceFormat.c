@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "traceFormat.h"
+#include "hexCodec.h"
+#include "serialSimd.h"
+
+
+static const char hexDigits[] = "0123456789abcdef";
+
+/* "000102...ff", two digits of every byte value */
+#define HEX_ROW(h)  h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+static const char hexPairs[] = HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3") HEX_ROW("4") HEX_ROW("5")
+                               HEX_ROW("6") HEX_ROW("7") HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b")
+                               HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+
+#ifdef SERIAL_SSE2
+/* squeezes four [h l ' ' 0] lanes into 12 contiguous bytes followed by 4 zero bytes */
+static __m128i packTriplets(__m128i lanes)
+{
+    const __m128i low24 = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+    const __m128i next24 = _mm_set_epi32(0x0000FFFF, (int)0xFF000000, 0x0000FFFF, (int)0xFF000000);
+    const __m128i low64 = _mm_set_epi32(0, 0, -1, -1);
+
+    /* 6 bytes per 64 bit half, then the upper half moved down over the 2 byte gap */
+    __m128i halves = _mm_or_si128(_mm_and_si128(lanes, low24), _mm_and_si128(_mm_srli_epi64(lanes, 8), next24));
+
+    return _mm_or_si128(_mm_and_si128(halves, low64), _mm_srli_si128(_mm_andnot_si128(low64, halves), 2));
+}
+
+
+/* writes "hl " for each of 16 bytes, the second 8 shifted right by gap; 4 bytes past the end are clobbered */
+static void hexTriplets16(const uint8_t *src, char *dst, size_t gap)
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+    const __m128i space = _mm_set1_epi16(' ');
+
+    __m128i v = _mm_loadu_si128((const __m128i*)src);
+    __m128i lo = _mm_and_si128(v, mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+
+    /* n + '0', plus the gap to 'a' for nibbles above 9 */
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+
+    __m128i pairs0 = _mm_unpacklo_epi8(hi, lo);
+    __m128i pairs1 = _mm_unpackhi_epi8(hi, lo);
+
+    /* each store's 4 trailing zero bytes are overwritten by the next one */
+    _mm_storeu_si128((__m128i*)dst, packTriplets(_mm_unpacklo_epi16(pairs0, space)));
+    _mm_storeu_si128((__m128i*)(dst + 12), packTriplets(_mm_unpackhi_epi16(pairs0, space)));
+    _mm_storeu_si128((__m128i*)(dst + 24 + gap), packTriplets(_mm_unpacklo_epi16(pairs1, space)));
+    _mm_storeu_si128((__m128i*)(dst + 36 + gap), packTriplets(_mm_unpackhi_epi16(pairs1, space)));
+}
+
+
+/* printable ASCII kept, everything else replaced by '.' */
+static void printable16(const uint8_t *src, char *dst)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)src);
+
+    /* signed compares also reject 0x80 - 0xFF, which are negative */
+    __m128i keep = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+
+    _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_and_si128(keep, v), _mm_andnot_si128(keep, _mm_set1_epi8('.'))));
+}
+#endif
+
+
+static char printableChar(uint8_t c)
+{
+    return (c >= 0x20 && c < 0x7F) ? (char)c : '.';
+}
+
+
+/* the 8 offset digits of a hexdump line, the first one in the lowest byte so a memcpy writes them in order */
+static uint64_t offsetDigits(uint32_t offset)
+{
+    char digits[8];
+    uint64_t value;
+
+    for (int i = 3; i >= 0; i--)
+    {
+        memcpy(digits + 2 * i, hexPairs + 2 * (offset & 0xFF), 2);
+        offset >>= 8;
+    }
+
+    memcpy(&value, digits, 8);
+    return value;
+}
+
+
+/* the next line starts 16 further on, which mostly just steps the second to last digit */
+static uint64_t nextOffsetDigits(uint64_t digits, uint64_t offset)
+{
+    uint8_t second = (uint8_t)(digits >> 48);
+
+    if (second != '9' && second != 'f')
+        return digits + (1ull << 48);
+
+    return offsetDigits((uint32_t)offset);
+}
+
+
+/* hex pair of byte k sits at column 10 + 3k, one further right in the second half */
+static size_t hexColumn(size_t k)
+{
+    return 10 + 3 * k + (k >= 8);
+}
+
+
+size_t traceHexdump(const uint8_t *data, size_t len, uint64_t baseOffset, char *dst, size_t capacity)
+{
+    char *out = dst;
+    size_t line = 0;
+
+    if (capacity < TRACE_HEXDUMP_SIZE(len))
+        return 0;
+
+    /* kept in a register from line to line, formatting it afresh every line costs as much as the hex */
+    uint64_t offset = offsetDigits((uint32_t)baseOffset);
+
+#ifdef SERIAL_SSE2
+    for (; len - line >= 16; line += 16)
+    {
+        memcpy(out, &offset, 8);
+        memcpy(out + 8, "  ", 2);
+
+        /* the hex stores clobber the separators after them, so those go in afterwards */
+        hexTriplets16(data + line, out + 10, 1);
+        out[34] = ' ';
+        memcpy(out + 59, " |", 2);
+        printable16(data + line, out + 61);
+        memcpy(out + 77, "|\n", 2);
+
+        out += TRACE_HEXDUMP_LINE;
+        offset = nextOffsetDigits(offset, baseOffset + line + 16);
+    }
+#endif
+
+    for (; line < len; line += 16)
+    {
+        size_t n = len - line < 16 ? len - line : 16;
+
+        memcpy(out, &offset, 8);
+        memcpy(out + 8, "  ", 2);
+        memset(out + 10, ' ', 50);
+        for (size_t k = 0; k < n; k++)
+        {
+            out[hexColumn(k)] = hexDigits[data[line + k] >> 4];
+            out[hexColumn(k) + 1] = hexDigits[data[line + k] & 0xF];
+            out[61 + k] = printableChar(data[line + k]);
+        }
+
+        out[60] = '|';
+        out[61 + n] = '|';
+        out[62 + n] = '\n';
+        out += 63 + n;
+        offset = nextOffsetDigits(offset, baseOffset + line + 16);
+    }
+
+    return (size_t)(out - dst);
+}
+
+
+/* bytes written as themselves inside a C string */
+static int isPlain(uint8_t c)
+{
+    return c >= 0x20 && c < 0x7F && c != '\\' && c != '"';
+}
+
+
+size_t traceEscape(const uint8_t *data, size_t len, char *dst, size_t capacity)
+{
+    char *out = dst;
+    size_t i = 0;
+
+    if (capacity < TRACE_ESCAPE_SIZE(len))
+        return 0;
+
+    while (i < len)
+    {
+#ifdef SERIAL_SSE2
+        /* most log text has nothing to escape, copy it 16 bytes at a time */
+        if (i + 16 <= len)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            __m128i plain = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+            __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+
+            if (_mm_movemask_epi8(_mm_andnot_si128(special, plain)) == 0xFFFF)
+            {
+                _mm_storeu_si128((__m128i*)out, v);
+                out += 16;
+                i += 16;
+                continue;
+            }
+        }
+#endif
+
+        uint8_t c = data[i++];
+
+        if (isPlain(c))
+        {
+            *out++ = (char)c;
+            continue;
+        }
+
+        *out++ = '\\';
+        switch (c)
+        {
+            case '\n': *out++ = 'n'; break;
+            case '\r': *out++ = 'r'; break;
+            case '\t': *out++ = 't'; break;
+            case '\\': *out++ = '\\'; break;
+            case '"':  *out++ = '"'; break;
+            default:
+                *out++ = 'x';
+                *out++ = hexDigits[c >> 4];
+                *out++ = hexDigits[c & 0xF];
+                break;
+        }
+    }
+
+    return (size_t)(out - dst);
+}
+
+
+/* hex pairs separated by single spaces, without a trailing space */
+static size_t hexSpaced(const uint8_t *data, size_t len, char *dst)
+{
+    char *out = dst;
+    size_t i = 0;
+
+#ifdef SERIAL_SSE2
+    for (; i + 16 <= len; i += 16)
+    {
+        hexTriplets16(data + i, out, 0);
+        out += 48;
+    }
+#endif
+
+    for (; i < len; i++)
+    {
+        *out++ = hexDigits[data[i] >> 4];
+        *out++ = hexDigits[data[i] & 0xF];
+        *out++ = ' ';
+    }
+
+    return len > 0 ? (size_t)(out - dst) - 1 : 0;
+}
+
+
+size_t traceFormatLine(uint64_t timestampUs, const char *tag, const uint8_t *data, size_t len, trace_mode_t mode,
+                       char *dst, size_t capacity)
+{
+    char digits[20];
+    char *out = dst;
+    uint64_t seconds = timestampUs / 1000000;
+    uint32_t micros = (uint32_t)(timestampUs % 1000000);
+    size_t n = 0;
+
+    if (capacity < TRACE_LINE_SIZE(len))
+        return 0;
+
+    do
+    {
+        digits[n++] = (char)('0' + seconds % 10);
+        seconds /= 10;
+    } while (seconds > 0);
+
+    while (n > 0)
+        *out++ = digits[--n];
+
+    *out++ = '.';
+    for (int i = 5; i >= 0; i--)
+    {
+        out[i] = (char)('0' + micros % 10);
+        micros /= 10;
+    }
+    out += 6;
+
+    *out++ = ' ';
+    for (int i = 0; i < 8 && tag[i] != '\0'; i++)
+        *out++ = tag[i];
+    *out++ = ' ';
+
+    if (mode == TRACE_MODE_ESCAPED)
+    {
+        *out++ = '"';
+        out += traceEscape(data, len, out, TRACE_ESCAPE_SIZE(len));
+        *out++ = '"';
+    }
+    else
+        out += hexSpaced(data, len, out);
+
+    *out++ = '\n';
+
+    return (size_t)(out - dst);
+}
+
+
+/* ---- parsing ---- */
+
+serial_port_err_t traceParseHexdump(const char *text, size_t len, uint8_t *dst, size_t capacity, size_t *written)
+{
+    const char *end = text + len;
+    size_t count = 0;
+
+    *written = 0;
+
+    while (text < end)
+    {
+        const char *lineEnd = memchr(text, '\n', (size_t)(end - text));
+        if (lineEnd == NULL)
+            lineEnd = end;
+
+        /* the offset column, then pairs up to the ASCII column, which may itself look like hex */
+        const char *p = text;
+        while (p < lineEnd && hexDigitValue(*p) >= 0)
+            p++;
+
+        while (p < lineEnd && *p != '|')
+        {
+            if (*p == ' ' || *p == '\r')
+            {
+                p++;
+                continue;
+            }
+
+            if (lineEnd - p < 2)
+                return SERIAL_ERR_FRAME;
+            if (count == capacity)
+                return SERIAL_ERR_BUFFER_OVERFLOW;
+            if (hexDecode(p, 1, dst + count) != 0)
+                return SERIAL_ERR_FRAME;
+
+            count++;
+            p += 2;
+        }
+
+        text = lineEnd < end ? lineEnd + 1 : end;
+    }
+
+    *written = count;
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t traceUnescape(const char *text, size_t len, uint8_t *dst, size_t capacity, size_t *written)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+    *written = 0;
+
+    while (i < len)
+    {
+        if (count == capacity)
+            return SERIAL_ERR_BUFFER_OVERFLOW;
+
+        /* runs without escapes are copied in one go */
+        const char *escape = memchr(text + i, '\\', len - i);
+        size_t run = (escape != NULL ? (size_t)(escape - text) : len) - i;
+
+        if (run > 0)
+        {
+            if (run > capacity - count)
+                return SERIAL_ERR_BUFFER_OVERFLOW;
+            memcpy(dst + count, text + i, run);
+            count += run;
+            i += run;
+            continue;
+        }
+
+        if (i + 1 >= len)
+            return SERIAL_ERR_FRAME;
+
+        char c = text[i + 1];
+        i += 2;
+
+        switch (c)
+        {
+            case 'n':  dst[count++] = '\n'; break;
+            case 'r':  dst[count++] = '\r'; break;
+            case 't':  dst[count++] = '\t'; break;
+            case '0':  dst[count++] = '\0'; break;
+            case 'a':  dst[count++] = '\a'; break;
+            case 'b':  dst[count++] = '\b'; break;
+            case 'f':  dst[count++] = '\f'; break;
+            case 'v':  dst[count++] = '\v'; break;
+            case '\\': dst[count++] = '\\'; break;
+            case '"':  dst[count++] = '"'; break;
+            case '\'': dst[count++] = '\''; break;
+            case 'x':
+                if (i + 2 > len || hexDecode(text + i, 1, dst + count) != 0)
+                    return SERIAL_ERR_FRAME;
+                count++;
+                i += 2;
+                break;
+            default:
+                return SERIAL_ERR_FRAME;
+        }
+    }
+
+    *written = count;
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t traceParseLine(const char *line, size_t len, uint64_t *timestampUs, char tag[9],
+                                 uint8_t *dst, size_t capacity, size_t *written)
+{
+    const char *p = line;
+    const char *end = line + len;
+    uint64_t seconds = 0;
+    uint32_t micros = 0;
+    int tagLen = 0;
+
+    *written = 0;
+
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r'))
+        end--;
+
+    /* seconds '.' six digits */
+    if (p == end || *p < '0' || *p > '9')
+        return SERIAL_ERR_FRAME;
+    while (p < end && *p >= '0' && *p <= '9')
+        seconds = seconds * 10 + (uint64_t)(*p++ - '0');
+
+    if (end - p < 8 || *p++ != '.')
+        return SERIAL_ERR_FRAME;
+    for (int i = 0; i < 6; i++, p++)
+    {
+        if (*p < '0' || *p > '9')
+            return SERIAL_ERR_FRAME;
+        micros = micros * 10 + (uint32_t)(*p - '0');
+    }
+
+    if (*p++ != ' ')
+        return SERIAL_ERR_FRAME;
+
+    while (p < end && *p != ' ' && tagLen < 8)
+        tag[tagLen++] = *p++;
+    tag[tagLen] = '\0';
+
+    if (p == end || *p++ != ' ')
+        return SERIAL_ERR_FRAME;
+
+    *timestampUs = seconds * 1000000 + micros;
+
+    if (p < end && *p == '"')
+    {
+        if (end - p < 2 || end[-1] != '"')
+            return SERIAL_ERR_FRAME;
+        return traceUnescape(p + 1, (size_t)(end - p) - 2, dst, capacity, written);
+    }
+
+    /* hex payload: pairs separated by spaces, the hexdump parser without an offset column */
+    size_t count = 0;
+    while (p < end)
+    {
+        if (*p == ' ')
+        {
+            p++;
+            continue;
+        }
+
+        if (end - p < 2)
+            return SERIAL_ERR_FRAME;
+        if (count == capacity)
+            return SERIAL_ERR_BUFFER_OVERFLOW;
+        if (hexDecode(p, 1, dst + count) != 0)
+            return SERIAL_ERR_FRAME;
+
+        count++;
+        p += 2;
+    }
+
+    *written = count;
+    return SERIAL_ERR_OK;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file traceFormat.h
+ * @brief Fast rendering of received data as hexdump, C-escaped and timestamped trace text.
+ *
+ * Formatting with printf per byte costs more CPU than the serial I/O it logs. These routines
+ * convert 16 bytes per step with SSE2 (nibbles to hex digits, printable masks for the ASCII
+ * column, a plain-text fast path for escaping) straight into caller supplied buffers, and can
+ * parse every format they produce back into bytes for replay.
+ *
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef TRACEFORMAT_H
+#define TRACEFORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "serialPort.h"
+
+/**
+ * @defgroup trace_functions Trace Formatting
+ * @ingroup functions
+ * @brief Hexdump, escaping and trace line conversion.
+ */
+
+#define TRACE_HEXDUMP_LINE          79  /**< Characters of one full hexdump line including the newline. */
+
+/** @brief Buffer size needed by traceHexdump for len bytes. */
+#define TRACE_HEXDUMP_SIZE(len)     ((((len) + 15) / 16) * TRACE_HEXDUMP_LINE)
+
+/** @brief Buffer size needed by traceEscape for len bytes. */
+#define TRACE_ESCAPE_SIZE(len)      ((len) * 4)
+
+/** @brief Buffer size needed by traceFormatLine for len bytes and a tag of at most 8 characters. */
+#define TRACE_LINE_SIZE(len)        (48 + (len) * 4)
+
+/**
+ * @enum trace_mode_t
+ * @brief Payload rendering of a trace line.
+ *
+ * @ingroup enums
+ */
+typedef enum {
+    TRACE_MODE_HEX,         /**< Space separated hex pairs. */
+    TRACE_MODE_ESCAPED,     /**< Double quoted C-escaped text. */
+} trace_mode_t;
+
+/**
+ * @brief Renders data as `hexdump -C` style lines.
+ *
+ * @param[in] data Bytes to render.
+ * @param[in] len Number of bytes.
+ * @param[in] baseOffset Offset printed for data[0]; the low 32 bits are shown.
+ * @param[out] dst Destination, at least TRACE_HEXDUMP_SIZE(len) characters. No NUL is written.
+ * @param[in] capacity Size of dst.
+ *
+ * @return Characters written, or 0 if dst is too small.
+ *
+ * @ingroup trace_functions
+ *
+ * ### Example
+ * @code
+ * char text[TRACE_HEXDUMP_SIZE(sizeof(buffer))];
+ * size_t n = traceHexdump(buffer, sizeof(buffer), 0, text, sizeof(text));
+ * fwrite(text, 1, n, stdout);
+ * // 00000000  48 65 6c 6c 6f 0d 0a                              |Hello..|
+ * @endcode
+ *
+ *
+ */
+size_t traceHexdump(const uint8_t *data, size_t len, uint64_t baseOffset, char *dst, size_t capacity);
+
+/**
+ * @brief Renders data as C string contents without the surrounding quotes.
+ *
+ * \\n, \\r, \\t, \\\\ and \\" are written by name, other unprintable bytes as \\xHH with exactly two digits.
+ *
+ * @return Characters written, or 0 if dst is smaller than TRACE_ESCAPE_SIZE(len).
+ *
+ * @ingroup trace_functions
+ */
+size_t traceEscape(const uint8_t *data, size_t len, char *dst, size_t capacity);
+
+/**
+ * @brief Renders one timestamped trace line, e.g. `12.000345 RX "OK\r\n"` followed by a newline.
+ *
+ * @param[in] timestampUs Timestamp in microseconds, printed as seconds with six decimals.
+ * @param[in] tag Direction or port tag of at most 8 characters without spaces, e.g. "RX".
+ * @param[in] data Payload.
+ * @param[in] len Payload length.
+ * @param[in] mode Payload rendering.
+ * @param[out] dst Destination, at least TRACE_LINE_SIZE(len) characters.
+ * @param[in] capacity Size of dst.
+ *
+ * @return Characters written, or 0 if dst is too small.
+ *
+ * @ingroup trace_functions
+ */
+size_t traceFormatLine(uint64_t timestampUs, const char *tag, const uint8_t *data, size_t len, trace_mode_t mode,
+                       char *dst, size_t capacity);
+
+/**
+ * @brief Parses hexdump text produced by traceHexdump back into bytes.
+ *
+ * @param[in] text Hexdump lines.
+ * @param[in] len Characters in text.
+ * @param[out] dst Destination for the bytes.
+ * @param[in] capacity Size of dst.
+ * @param[out] written Bytes stored.
+ *
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_FRAME for malformed text, SERIAL_ERR_BUFFER_OVERFLOW
+ *         if dst is too small.
+ *
+ * @ingroup trace_functions
+ */
+serial_port_err_t traceParseHexdump(const char *text, size_t len, uint8_t *dst, size_t capacity, size_t *written);
+
+/**
+ * @brief Parses C-escaped text back into bytes; also accepts \\0, \\a, \\b, \\f, \\v and \\'.
+ *
+ * @return As traceParseHexdump.
+ *
+ * @ingroup trace_functions
+ */
+serial_port_err_t traceUnescape(const char *text, size_t len, uint8_t *dst, size_t capacity, size_t *written);
+
+/**
+ * @brief Parses one line produced by traceFormatLine in either mode.
+ *
+ * @param[in] line The line, with or without its newline.
+ * @param[in] len Characters in line.
+ * @param[out] timestampUs Timestamp in microseconds.
+ * @param[out] tag Receives the NUL terminated tag, 9 characters.
+ * @param[out] dst Destination for the payload.
+ * @param[in] capacity Size of dst.
+ * @param[out] written Payload bytes stored.
+ *
+ * @return As traceParseHexdump.
+ *
+ * @ingroup trace_functions
+ */
+serial_port_err_t traceParseLine(const char *line, size_t len, uint64_t *timestampUs, char tag[9],
+                                 uint8_t *dst, size_t capacity, size_t *written);
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2023 Avijit Das <avijitdasxp@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "ubx.h"
+#include "hexCodec.h"
+
+
+/* demultiplexer states */
+#define STATE_IDLE          0
+#define STATE_UBX_SYNC      1
+#define STATE_UBX_HEADER    2
+#define STATE_UBX_BODY      3
+#define STATE_NMEA          4
+
+#define UBX_HEADER_LEN      6
+
+
+void ubxInit(ubx_t *ubx, serial_port_t *port, ubx_handler_t onUbx, nmea_handler_t onNmea, void *context)
+{
+    memset(ubx, 0, sizeof(*ubx));
+    ubx->port = port;
+    ubx->onUbx = onUbx;
+    ubx->onNmea = onNmea;
+    ubx->context = context;
+    ubx->state = STATE_IDLE;
+}
+
+
+static void fletcher(ubx_t *ubx, const uint8_t *data, size_t len)
+{
+    uint8_t a = ubx->ckA;
+    uint8_t b = ubx->ckB;
+
+    while (len--)
+    {
+        a += *data++;
+        b += a;
+    }
+
+    ubx->ckA = a;
+    ubx->ckB = b;
+}
+
+
+/* gives up CFG messages whose ACK is overdue; entries are oldest first, so the expired ones lead */
+static void expireAcks(ubx_t *ubx)
+{
+    ULONGLONG now = GetTickCount64();
+    uint8_t expired = 0;
+
+    while (expired < ubx->pendingCount && ubx->pending[expired].deadline <= now)
+        expired++;
+
+    if (expired == 0)
+        return;
+
+    memmove(&ubx->pending[0], &ubx->pending[expired], (ubx->pendingCount - expired) * sizeof(ubx_pending_ack_t));
+    ubx->pendingCount -= expired;
+    ubx->ackTimeouts += expired;
+    ubx->timedOut = 1;
+}
+
+
+/* resolves the oldest pending CFG message matching an ACK-ACK / ACK-NAK */
+static void trackAck(ubx_t *ubx, const ubx_msg_t *msg)
+{
+    if (msg->len < sizeof(ubx_ack_t))
+        return;
+
+    const ubx_ack_t *ack = (const ubx_ack_t*)msg->payload;
+
+    for (uint8_t i = 0; i < ubx->pendingCount; i++)
+    {
+        if (ubx->pending[i].cls != ack->clsID || ubx->pending[i].id != ack->msgID)
+            continue;
+
+        memmove(&ubx->pending[i], &ubx->pending[i + 1], (ubx->pendingCount - i - 1u) * sizeof(ubx_pending_ack_t));
+        ubx->pendingCount--;
+
+        if (msg->id == UBX_ID_ACK_ACK)
+            ubx->acked++;
+        else
+        {
+            ubx->nacked++;
+            ubx->rejected = 1;
+        }
+        return;
+    }
+}
+
+
+static size_t finishUbx(ubx_t *ubx)
+{
+    uint16_t len = (uint16_t)(ubx->frameLen - UBX_HEADER_LEN - 2);
+
+    ubx->state = STATE_IDLE;
+
+    if (ubx->frame[UBX_HEADER_LEN + len] != ubx->ckA || ubx->frame[UBX_HEADER_LEN + len + 1] != ubx->ckB)
+    {
+        ubx->checksumErrors++;
+        return 0;
+    }
+
+    ubx_msg_t msg;
+    msg.cls = ubx->frame[2];
+    msg.id = ubx->frame[3];
+    msg.len = len;
+    msg.payload = ubx->frame + UBX_HEADER_LEN;
+
+    if (msg.cls == UBX_CLASS_ACK)
+        trackAck(ubx, &msg);
+
+    ubx->ubxMessages++;
+    if (ubx->onUbx != NULL)
+        ubx->onUbx(&msg, ubx->context);
+
+    return 1;
+}
+
+
+static size_t finishNmea(ubx_t *ubx)
+{
+    const char *sentence = (const char*)ubx->frame;
+    size_t len = ubx->frameLen;
+    uint8_t sum = 0;
+
+    ubx->state = STATE_IDLE;
+
+    /* $<body>*HH\r\n */
+    if (len < 6 || sentence[len - 2] != '\r' || sentence[len - 5] != '*')
+    {
+        ubx->checksumErrors++;
+        return 0;
+    }
+
+    uint8_t expected;
+    if (hexDecode(sentence + len - 4, 1, &expected) != 0)
+    {
+        ubx->checksumErrors++;
+        return 0;
+    }
+
+    for (size_t i = 1; i < len - 5; i++)
+        sum ^= (uint8_t)sentence[i];
+
+    if (sum != expected)
+    {
+        ubx->checksumErrors++;
+        return 0;
+    }
+
+    ubx->nmeaSentences++;
+    if (ubx->onNmea != NULL)
+        ubx->onNmea(sentence, len, ubx->context);
+
+    return 1;
+}
+
+
+size_t ubxFeed(ubx_t *ubx, const uint8_t *data, size_t len)
+{
+    size_t delivered = 0;
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        switch (ubx->state)
+        {
+            case STATE_IDLE:
+            {
+                while (pos < len && data[pos] != UBX_SYNC_1 && data[pos] != '$')
+                    pos++;
+                if (pos == len)
+                    break;
+
+                ubx->frame[0] = data[pos];
+                ubx->frameLen = 1;
+                ubx->state = data[pos] == '$' ? STATE_NMEA : STATE_UBX_SYNC;
+                pos++;
+                break;
+            }
+
+            case STATE_UBX_SYNC:
+            {
+                /* a lone 0xB5 is noise; look at this byte again from idle */
+                if (data[pos] != UBX_SYNC_2)
+                {
+                    ubx->state = STATE_IDLE;
+                    break;
+                }
+
+                ubx->frame[1] = UBX_SYNC_2;
+                ubx->frameLen = 2;
+                ubx->expected = UBX_HEADER_LEN;
+                ubx->ckA = 0;
+                ubx->ckB = 0;
+                ubx->state = STATE_UBX_HEADER;
+                pos++;
+                break;
+            }
+
+            case STATE_UBX_HEADER:
+            case STATE_UBX_BODY:
+            {
+                size_t n = (size_t)(ubx->expected - ubx->frameLen);
+                if (n > len - pos)
+                    n = len - pos;
+
+                uint16_t from = ubx->frameLen;
+                memcpy(ubx->frame + from, data + pos, n);
+                ubx->frameLen = (uint16_t)(from + n);
+                pos += n;
+
+                /* the checksum covers class, id, length and payload */
+                uint16_t ckEnd = ubx->state == STATE_UBX_HEADER ? ubx->frameLen : (uint16_t)(ubx->expected - 2);
+                if (from < ckEnd)
+                    fletcher(ubx, ubx->frame + from, (ubx->frameLen < ckEnd ? ubx->frameLen : ckEnd) - from);
+
+                if (ubx->frameLen < ubx->expected)
+                    break;
+
+                if (ubx->state == STATE_UBX_BODY)
+                {
+                    delivered += finishUbx(ubx);
+                    break;
+                }
+
+                uint16_t payloadLen = ubx->frame[4] | ((uint16_t)ubx->frame[5] << 8);
+                if (payloadLen > UBX_MAX_PAYLOAD)
+                {
+                    ubx->overflows++;
+                    ubx->state = STATE_IDLE;
+                    break;
+                }
+
+                ubx->expected = (uint16_t)(UBX_HEADER_LEN + payloadLen + 2);
+                ubx->state = STATE_UBX_BODY;
+                break;
+            }
+
+            case STATE_NMEA:
+            {
+                uint8_t c = data[pos];
+
+                /* binary data inside a sentence means it was cut short by a UBX message */
+                if (c >= 0x80 || (c < 0x20 && c != '\r' && c != '\n'))
+                {
+                    ubx->checksumErrors++;
+                    ubx->state = STATE_IDLE;
+                    break;
+                }
+
+                if (ubx->frameLen == NMEA_MAX_SENTENCE)
+                {
+                    ubx->overflows++;
+                    ubx->state = STATE_IDLE;
+                    break;
+                }
+
+                ubx->frame[ubx->frameLen++] = c;
+                pos++;
+
+                if (c == '\n')
+                    delivered += finishNmea(ubx);
+                break;
+            }
+        }
+    }
+
+    return delivered;
+}
+
+
+serial_port_err_t ubxPoll(ubx_t *ubx)
+{
+    uint8_t chunk[4096];
+    uint64_t got;
+
+    int available = bytesAvailable(ubx->port);
+    uint64_t want = available > 0 ? (uint64_t)available : 1;
+    if (want > sizeof(chunk))
+        want = sizeof(chunk);
+
+    serial_port_err_t err = serialPortReadSome(ubx->port, chunk, want, &got);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    ubxFeed(ubx, chunk, (size_t)got);
+
+    return SERIAL_ERR_OK;
+}
+
+
+serial_port_err_t ubxSend(ubx_t *ubx, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    uint8_t frame[UBX_HEADER_LEN + sizeof(((ubx_valset_t*)0)->payload) + 2];
+    uint8_t a = 0;
+    uint8_t b = 0;
+
+    if (len > sizeof(frame) - UBX_HEADER_LEN - 2)
+        return SERIAL_ERR_BUFFER_OVERFLOW;
+
+    /* lost ACKs must not fill the table for good */
+    if (cls == UBX_CLASS_CFG)
+    {
+        expireAcks(ubx);
+        if (ubx->pendingCount == UBX_MAX_PENDING_ACKS)
+            return SERIAL_ERR_BUFFER_OVERFLOW;
+    }
+
+    frame[0] = UBX_SYNC_1;
+    frame[1] = UBX_SYNC_2;
+    frame[2] = cls;
+    frame[3] = id;
+    frame[4] = (uint8_t)(len & 0xFF);
+    frame[5] = (uint8_t)(len >> 8);
+    memcpy(frame + UBX_HEADER_LEN, payload, len);
+
+    for (uint16_t i = 2; i < UBX_HEADER_LEN + len; i++)
+    {
+        a += frame[i];
+        b += a;
+    }
+    frame[UBX_HEADER_LEN + len] = a;
+    frame[UBX_HEADER_LEN + len + 1] = b;
+
+    serial_port_err_t err = serialPortWrite(ubx->port, frame, UBX_HEADER_LEN + len + 2u);
+    if (err != SERIAL_ERR_OK)
+        return err;
+
+    /* every CFG message is answered with ACK-ACK or ACK-NAK */
+    if (cls == UBX_CLASS_CFG)
+    {
+        ubx->pending[ubx->pendingCount].cls = cls;
+        ubx->pending[ubx->pendingCount].id = id;
+        ubx->pending[ubx->pendingCount].deadline = GetTickCount64() + UBX_ACK_TIMEOUT_MS;
+        ubx->pendingCount++;
+    }
+
+    return SERIAL_ERR_OK;
+}
+
+
+void ubxValsetBegin(ubx_valset_t *valset, uint8_t layers)
+{
+    /* version 0, layers, two reserved bytes */
+    valset->payload[0] = 0;
+    valset->payload[1] = layers;
+    valset->payload[2] = 0;
+    valset->payload[3] = 0;
+    valset->len = 4;
+    valset->items = 0;
+}
+
+
+int ubxValsetAdd(ubx_valset_t *valset, uint32_t key, uint64_t value)
+{
+    static const uint8_t sizes[8] = {0, 1, 1, 2, 4, 8, 0, 0};
+    uint8_t size = sizes[(key >> 28) & 0x07];
+
+    if (size == 0 || valset->items == UBX_VALSET_MAX_ITEMS)
+        return -1;
+
+    uint8_t *p = valset->payload + valset->len;
+
+    /* keys and values are little endian */
+    for (int i = 0; i < 4; i++)
+        *p++ = (uint8_t)(key >> (8 * i));
+    for (int i = 0; i < size; i++)
+        *p++ = (uint8_t)(value >> (8 * i));
+
+    valset->len = (uint16_t)(p - valset->payload);
+    valset->items++;
+
+    return 0;
+}
+
+
+serial_port_err_t ubxSendValset(ubx_t *ubx, const ubx_valset_t *valset)
+{
+    return ubxSend(ubx, UBX_CLASS_CFG, UBX_ID_CFG_VALSET, valset->payload, valset->len);
+}
+
+
+serial_port_err_t ubxWaitAcks(ubx_t *ubx, uint32_t timeoutMs)
+{
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    serial_port_err_t err = SERIAL_ERR_OK;
+
+    while (1)
+    {
+        expireAcks(ubx);
+        if (ubx->pendingCount == 0)
+            break;
+
+        if (GetTickCount64() >= deadline)
+        {
+            err = SERIAL_ERR_READ_TIMEOUT;
+            break;
+        }
+
+        err = ubxPoll(ubx);
+        if (err != SERIAL_ERR_OK)
+            break;
+    }
+
+    if (err == SERIAL_ERR_OK && ubx->rejected)
+        err = SERIAL_ERR_NACK;
+    else if (err == SERIAL_ERR_OK && ubx->timedOut)
+        err = SERIAL_ERR_READ_TIMEOUT;
+
+    ubx->rejected = 0;
+    ubx->timedOut = 0;
+
+    return err;
+}
+
+
+const ubx_nav_pvt_t *ubxNavPvt(const ubx_msg_t *msg)
+{
+    if (msg->cls != UBX_CLASS_NAV || msg->id != UBX_ID_NAV_PVT || msg->len < sizeof(ubx_nav_pvt_t))
+        return NULL;
+
+    return (const ubx_nav_pvt_t*)msg->payload;
+}
@@ -0,0 +1,310 @@
+/**
+ * @file ubx.h
+ * @brief u-blox UBX / NMEA demultiplexer, zero-copy message views and batched configuration.
+ * 
+ * u-blox receivers interleave UBX binary messages (0xB5 0x62, Fletcher-8 checksum) and NMEA
+ * sentences on the same port. The demultiplexer separates the two on the receive path and hands
+ * out views into its frame buffer; typed accessors cast a view to the packed payload layout
+ * without copying. Configuration is written with CFG-VALSET messages holding up to 64 key/value
+ * pairs each, and their ACK-ACK / ACK-NAK replies are tracked by the demultiplexer.
+ * 
+ * @author iiriis
+ * @date 2023 - 2024
+ * @copyright
+ * This program is licensed under the GNU General Public License v3.0.
+ */
+
+#ifndef UBX_H
+#define UBX_H
+
+#include "serialPort.h"
+
+/**
+ * @defgroup ubx_functions u-blox UBX
+ * @ingroup functions
+ * @brief UBX / NMEA receive path and receiver configuration.
+ */
+
+#define UBX_SYNC_1              0xB5
+#define UBX_SYNC_2              0x62
+#define UBX_MAX_PAYLOAD         2048    /**< Longer messages are dropped and counted as overflows. */
+#define NMEA_MAX_SENTENCE       256     /**< Longest NMEA sentence accepted, including CRLF. */
+#define UBX_MAX_PENDING_ACKS    16      /**< CFG messages that may await their ACK at the same time. */
+#define UBX_ACK_TIMEOUT_MS      1000    /**< A CFG message not acknowledged within this time is given up. */
+#define UBX_VALSET_MAX_ITEMS    64      /**< Key/value pairs per CFG-VALSET message. */
+
+#define UBX_CLASS_NAV           0x01
+#define UBX_CLASS_ACK           0x05
+#define UBX_CLASS_CFG           0x06
+#define UBX_ID_NAV_PVT          0x07
+#define UBX_ID_ACK_NAK          0x00
+#define UBX_ID_ACK_ACK          0x01
+#define UBX_ID_CFG_VALSET       0x8A
+
+#define UBX_LAYER_RAM           0x01    /**< CFG-VALSET layer: RAM. */
+#define UBX_LAYER_BBR           0x02    /**< CFG-VALSET layer: battery backed RAM. */
+#define UBX_LAYER_FLASH         0x04    /**< CFG-VALSET layer: flash. */
+
+/**
+ * @struct ubx_msg_t
+ * @brief View of a received UBX message. Only valid inside the handler.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t cls;                /**< Message class. */
+    uint8_t id;                 /**< Message id. */
+    uint16_t len;               /**< Payload length. */
+    const uint8_t *payload;     /**< Payload, points into the demultiplexer. */
+} ubx_msg_t;
+
+#pragma pack(push, 1)
+/**
+ * @struct ubx_nav_pvt_t
+ * @brief UBX-NAV-PVT payload (navigation position velocity time solution).
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint32_t iTOW;              /**< GPS time of week, ms. */
+    uint16_t year;              /**< UTC year. */
+    uint8_t month;              /**< UTC month, 1 - 12. */
+    uint8_t day;                /**< UTC day, 1 - 31. */
+    uint8_t hour;               /**< UTC hour. */
+    uint8_t min;                /**< UTC minute. */
+    uint8_t sec;                /**< UTC second. */
+    uint8_t valid;              /**< Validity flags. */
+    uint32_t tAcc;              /**< Time accuracy, ns. */
+    int32_t nano;               /**< Fraction of second, ns. */
+    uint8_t fixType;            /**< 0 no fix, 2 2D, 3 3D, ... */
+    uint8_t flags;              /**< Fix status flags. */
+    uint8_t flags2;             /**< Additional flags. */
+    uint8_t numSV;              /**< Satellites used. */
+    int32_t lon;                /**< Longitude, 1e-7 deg. */
+    int32_t lat;                /**< Latitude, 1e-7 deg. */
+    int32_t height;             /**< Height above ellipsoid, mm. */
+    int32_t hMSL;               /**< Height above mean sea level, mm. */
+    uint32_t hAcc;              /**< Horizontal accuracy, mm. */
+    uint32_t vAcc;              /**< Vertical accuracy, mm. */
+    int32_t velN;               /**< North velocity, mm/s. */
+    int32_t velE;               /**< East velocity, mm/s. */
+    int32_t velD;               /**< Down velocity, mm/s. */
+    int32_t gSpeed;             /**< Ground speed, mm/s. */
+    int32_t headMot;            /**< Heading of motion, 1e-5 deg. */
+    uint32_t sAcc;              /**< Speed accuracy, mm/s. */
+    uint32_t headAcc;           /**< Heading accuracy, 1e-5 deg. */
+    uint16_t pDOP;              /**< Position DOP, 0.01. */
+    uint8_t flags3;             /**< Additional flags. */
+    uint8_t reserved0[5];       /**< Reserved. */
+    int32_t headVeh;            /**< Heading of vehicle, 1e-5 deg. */
+    int16_t magDec;             /**< Magnetic declination, 1e-2 deg. */
+    uint16_t magAcc;            /**< Declination accuracy, 1e-2 deg. */
+} ubx_nav_pvt_t;
+
+/**
+ * @struct ubx_ack_t
+ * @brief UBX-ACK-ACK / UBX-ACK-NAK payload.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t clsID;              /**< Class of the acknowledged message. */
+    uint8_t msgID;              /**< Id of the acknowledged message. */
+} ubx_ack_t;
+#pragma pack(pop)
+
+/** @brief Called for every valid UBX message. */
+typedef void (*ubx_handler_t)(const ubx_msg_t *msg, void *context);
+
+/** @brief Called for every valid NMEA sentence, including the leading '$' and the trailing CRLF. */
+typedef void (*nmea_handler_t)(const char *sentence, size_t len, void *context);
+
+/**
+ * @struct ubx_pending_ack_t
+ * @brief A CFG message awaiting its acknowledgement.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t cls;                /**< Class of the sent message. */
+    uint8_t id;                 /**< Id of the sent message. */
+    ULONGLONG deadline;         /**< GetTickCount64 time after which the ACK is given up. */
+} ubx_pending_ack_t;
+
+/**
+ * @struct ubx_t
+ * @brief UBX / NMEA demultiplexer bound to a receiver.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    serial_port_t *port;        /**< Port of the receiver, may be NULL when only ubxFeed is used. */
+    ubx_handler_t onUbx;        /**< UBX handler, may be NULL. */
+    nmea_handler_t onNmea;      /**< NMEA handler, may be NULL. */
+    void *context;              /**< User pointer passed to the handlers. */
+
+    uint8_t state;              /**< Internal parser state. */
+    uint8_t frame[6 + UBX_MAX_PAYLOAD + 2]; /**< UBX frame or NMEA sentence being assembled. */
+    uint16_t frameLen;          /**< Bytes collected in frame. */
+    uint16_t expected;          /**< Bytes needed for the current header or frame. */
+    uint8_t ckA;                /**< Running Fletcher checksum, first byte. */
+    uint8_t ckB;                /**< Running Fletcher checksum, second byte. */
+
+    ubx_pending_ack_t pending[UBX_MAX_PENDING_ACKS]; /**< Sent CFG messages awaiting ACK, oldest first. */
+    uint8_t pendingCount;       /**< Number of entries in pending. */
+    uint32_t acked;             /**< CFG messages acknowledged. */
+    uint32_t nacked;            /**< CFG messages rejected. */
+    uint32_t ackTimeouts;       /**< CFG messages given up without an acknowledgement. */
+    uint8_t rejected;           /**< A CFG message was rejected since the last ubxWaitAcks. */
+    uint8_t timedOut;           /**< A CFG message was given up since the last ubxWaitAcks. */
+
+    uint64_t ubxMessages;       /**< Valid UBX messages. */
+    uint64_t nmeaSentences;     /**< Valid NMEA sentences. */
+    uint64_t checksumErrors;    /**< UBX or NMEA checksum failures. */
+    uint64_t overflows;         /**< Messages longer than the frame buffer. */
+} ubx_t;
+
+/**
+ * @struct ubx_valset_t
+ * @brief A CFG-VALSET message being assembled.
+ * 
+ * @ingroup structs
+ */
+typedef struct {
+    uint8_t payload[4 + UBX_VALSET_MAX_ITEMS * 12]; /**< Header followed by key/value pairs. */
+    uint16_t len;               /**< Bytes used in payload. */
+    uint8_t items;              /**< Number of key/value pairs. */
+} ubx_valset_t;
+
+/**
+ * @brief Initialises a demultiplexer.
+ * 
+ * @param[out] ubx Pointer to the demultiplexer.
+ * @param[in] port Port of the receiver, or NULL to feed data with ubxFeed only.
+ * @param[in] onUbx Handler for UBX messages, may be NULL.
+ * @param[in] onNmea Handler for NMEA sentences, may be NULL.
+ * @param[in] context User pointer passed to the handlers.
+ *
+ * @ingroup ubx_functions
+ * 
+ * ### Example
+ * Below is an example that prints the position from NAV-PVT and forwards NMEA to the console.
+ * @code
+ * void onUbx(const ubx_msg_t *msg, void *context) {
+ *     const ubx_nav_pvt_t *pvt = ubxNavPvt(msg);
+ *     if (pvt != NULL)
+ *         printf("%.7f %.7f\n", pvt->lat * 1e-7, pvt->lon * 1e-7);
+ * }
+ * 
+ * void onNmea(const char *sentence, size_t len, void *context) {
+ *     printf("%.*s", (int)len, sentence);
+ * }
+ * 
+ * serial_port_t myPort;
+ * ubx_t gnss;
+ * int main() {
+ *     if (serialPortOpen(&myPort, "COM5", 460800, 100, 100) != SERIAL_ERR_OK)
+ *         return -1;
+ *     ubxInit(&gnss, &myPort, onUbx, onNmea, NULL);
+ *     while (1)
+ *         ubxPoll(&gnss);
+ * }
+ * @endcode
+ * 
+ * 
+ */
+void ubxInit(ubx_t *ubx, serial_port_t *port, ubx_handler_t onUbx, nmea_handler_t onNmea, void *context);
+
+/**
+ * @brief Feeds received bytes into the demultiplexer.
+ * 
+ * @return Number of UBX messages and NMEA sentences delivered.
+ *
+ * @ingroup ubx_functions
+ */
+size_t ubxFeed(ubx_t *ubx, const uint8_t *data, size_t len);
+
+/**
+ * @brief Reads the data received so far (blocking up to the read timeout for the first byte) and feeds it.
+ * 
+ * @return SERIAL_ERR_OK if successful, otherwise the read error.
+ *
+ * @ingroup ubx_functions
+ */
+serial_port_err_t ubxPoll(ubx_t *ubx);
+
+/**
+ * @brief Sends a UBX message.
+ * 
+ * CFG class messages are registered for acknowledgement tracking; those not acknowledged within
+ * UBX_ACK_TIMEOUT_MS are given up, counted in ackTimeouts and reported by the next ubxWaitAcks.
+ * 
+ * @return SERIAL_ERR_OK if successful, SERIAL_ERR_BUFFER_OVERFLOW if too many ACKs are pending,
+ *         otherwise the write error.
+ *
+ * @ingroup ubx_functions
+ */
+serial_port_err_t ubxSend(ubx_t *ubx, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len);
+
+/**
+ * @brief Starts a CFG-VALSET message.
+ * 
+ * @param[out] valset Message to initialise.
+ * @param[in] layers UBX_LAYER_* bits selecting where the values are stored.
+ *
+ * @ingroup ubx_functions
+ */
+void ubxValsetBegin(ubx_valset_t *valset, uint8_t layers);
+
+/**
+ * @brief Appends a configuration item; the value size is taken from the key id.
+ * 
+ * @return 0 if successful, or -1 if the message is full or the key has an invalid size field.
+ *
+ * @ingroup ubx_functions
+ */
+int ubxValsetAdd(ubx_valset_t *valset, uint32_t key, uint64_t value);
+
+/**
+ * @brief Sends an assembled CFG-VALSET message and registers it for ACK tracking.
+ * 
+ * @ingroup ubx_functions
+ * 
+ * ### Example
+ * Below is an example that sets the measurement rate to 40 ms (25 Hz) and enables NAV-PVT on UART1,
+ * without waiting between messages, then waits for all acknowledgements.
+ * @code
+ * ubx_valset_t valset;
+ * ubxValsetBegin(&valset, UBX_LAYER_RAM);
+ * ubxValsetAdd(&valset, 0x30210001, 40);      // CFG-RATE-MEAS
+ * ubxValsetAdd(&valset, 0x20910007, 1);       // CFG-MSGOUT-UBX_NAV_PVT_UART1
+ * ubxSendValset(&gnss, &valset);
+ * if (ubxWaitAcks(&gnss, 1000) != SERIAL_ERR_OK)
+ *     printf("configuration rejected\n");
+ * @endcode
+ * 
+ * 
+ */
+serial_port_err_t ubxSendValset(ubx_t *ubx, const ubx_valset_t *valset);
+
+/**
+ * @brief Receives until every pending CFG message has been acknowledged or the timeout expires.
+ * 
+ * @return SERIAL_ERR_OK if all were acknowledged, SERIAL_ERR_NACK if any was rejected since the
+ *         last call, SERIAL_ERR_READ_TIMEOUT if acknowledgements are still missing or any was
+ *         given up since the last call.
+ *
+ * @ingroup ubx_functions
+ */
+serial_port_err_t ubxWaitAcks(ubx_t *ubx, uint32_t timeoutMs);
+
+/**
+ * @brief Typed view of a NAV-PVT message.
+ * 
+ * @return The payload as ubx_nav_pvt_t, or NULL if msg is not a NAV-PVT message.
+ *
+ * @ingroup ubx_functions
+ */
+const ubx_nav_pvt_t *ubxNavPvt(const ubx_msg_t *msg);
+
+#endif